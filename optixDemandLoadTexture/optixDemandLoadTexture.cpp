@@ -51,6 +51,7 @@
 #include "common.h"
 #include <sutil/Arcball.h>
 #include <sutil/sutil.h>
+#include <sutil/FrameProfiler.h>
 
 #include <algorithm>
 #include <sstream>
@@ -368,16 +369,19 @@ void glutRun()
 void glutDisplay()
 {
     updateCamera();
-    context->launch( 0, width, height );
+    {
+        sutil::FrameTimer timer( sutil::FRAME_STAGE_LAUNCH );
+        context->launch( 0, width, height );
+    }
 
     sutil::displayBufferGL( getOutputBuffer() );
 
     {
         static unsigned frame_count = 0;
-        sutil::displayFps( frame_count++ );
+        sutil::displayFrameStats( frame_count++ );
     }
 
-    glutSwapBuffers();
+    sutil::swapBuffers();
 }
 
 
@@ -49,6 +49,7 @@
 
 #include "optixDenoiser.h"
 #include <sutil.h>
+#include <FrameProfiler.h>
 #include <Arcball.h>
 
 #include <algorithm>
@@ -662,13 +663,17 @@ void glutDisplay()
     Variable(denoiserStage->queryVariable("blend"))->setFloat(denoiseBlend);
 
     bool isEarlyFrame = (frame_number <= numNonDenoisedFrames);
-    if (isEarlyFrame)
     {
-        commandListWithoutDenoiser->execute();
-    }
-    else
-    {
-        commandListWithDenoiser->execute();
+        // The command lists launch and run the tonemap/denoiser stages in one call
+        sutil::FrameTimer timer( sutil::FRAME_STAGE_POSTPROCESS );
+        if (isEarlyFrame)
+        {
+            commandListWithoutDenoiser->execute();
+        }
+        else
+        {
+            commandListWithDenoiser->execute();
+        }
     }
 
     switch (showBuffer)
@@ -745,7 +750,7 @@ void glutDisplay()
 
     {
         static unsigned frame_count = 0;
-        sutil::displayFps( frame_count++ );
+        sutil::displayFrameStats( frame_count++ );
     }
 
     sutil::displayText(bufferInfo.c_str(), 140, 10);
@@ -755,7 +760,7 @@ void glutDisplay()
 
     frame_number++;
 
-    glutSwapBuffers();
+    sutil::swapBuffers();
 }
 
 
@@ -52,6 +52,8 @@
 #include <optixu/optixu_aabb_namespace.h>
 
 #include <sutil.h>
+#include <ChromeTrace.h>
+#include <FrameProfiler.h>
 #include "common.h"
 #include "random.h"
 #include <Arcball.h>
@@ -258,6 +260,7 @@ void RebuildLayout::triggerGeometryMove()
 
 void RebuildLayout::updateGeometry()
 {
+  sutil::TraceZone zone( "updateGeometry" );
   double t0 = sutil::currentTime();
   
   bool meshes_have_moved = false;
@@ -293,6 +296,7 @@ void RebuildLayout::updateGeometry()
       std::cerr << "Geometry transform time: "
                 << std::fixed << std::setw( 7 ) << std::setprecision( 2 ) << ( t1-t0 )*1000.0 << "ms" << std::endl;
     }
+    sutil::TraceZone rebuild_zone( "Accel rebuild" );
     t0 = sutil::currentTime();
     m_top_object->getAcceleration()->markDirty();
     m_top_object->getContext()->launch( 0, 0, 0 );
@@ -440,6 +444,7 @@ void SeparateAccelsLayout::triggerGeometryMove()
 
 void SeparateAccelsLayout::updateGeometry()
 {
+  sutil::TraceZone zone( "updateGeometry" );
   double t0 = sutil::currentTime();
   
   bool meshes_have_moved = false;
@@ -466,6 +471,7 @@ void SeparateAccelsLayout::updateGeometry()
       std::cerr << "Geometry transform time: "
                 << std::fixed << std::setw( 7 ) << std::setprecision( 2 ) << ( t1-t0 )*1000.0 << "ms" << std::endl;
     }
+    sutil::TraceZone rebuild_zone( "Accel rebuild" );
     t0 = sutil::currentTime();
     m_top_object->getAcceleration()->markDirty();
     m_top_object->getContext()->launch( 0, 0, 0 );
@@ -678,16 +684,19 @@ void glutDisplay()
 
     layout->updateGeometry();
 
-    context->launch( 0, width, height );
+    {
+        sutil::FrameTimer timer( sutil::FRAME_STAGE_LAUNCH );
+        context->launch( 0, width, height );
+    }
 
     sutil::displayBufferGL( getOutputBuffer() );
 
     {
       static unsigned frame_count = 0;
-      sutil::displayFps( frame_count++ );
+      sutil::displayFrameStats( frame_count++ );
     }
 
-    glutSwapBuffers();
+    sutil::swapBuffers();
 }
 
 
@@ -800,6 +809,7 @@ void printUsageAndExit( const std::string& argv0 )
         "  -x | --multi-accel        Turn on multi-acceleration mode (default)\n"
         "  -r | --single-accel       Turn on single-acceleration mode\n"
         "  -t | --print-timing       Print acceleration structure update/rebuild times\n"
+        "       --trace <file>       Write a Chrome trace of setup and accel updates to <file>\n"
         "App Keystrokes:\n"
         "  q      Quit\n" 
         "  s      Save image to '" << SAMPLE_NAME << ".ppm'\n"
@@ -858,6 +868,15 @@ int main( int argc, char** argv )
         {
             print_timing = true;
         }
+        else if( arg == "--trace" )
+        {
+            if( i == argc-1 )
+            {
+                std::cerr << "Option '" << arg << "' requires additional argument.\n";
+                printUsageAndExit( argv[0] );
+            }
+            sutil::beginTrace( argv[++i] );
+        }
         else
         {
             std::cerr << "Unknown option '" << arg << "'\n";
@@ -889,20 +908,32 @@ int main( int argc, char** argv )
             layout = new SeparateAccelsLayout( builder, print_timing );
         }
 
-        createContext();
-        layout->createGeometry( context, mesh_file, 200 );
+        {
+            sutil::TraceZone zone( "createContext" );
+            createContext();
+        }
+        {
+            sutil::TraceZone zone( "createGeometry", mesh_file );
+            layout->createGeometry( context, mesh_file, 200 );
+        }
         const optix::Aabb aabb = layout->getSceneBBox();
 
         setupCamera( aabb );
         setupLights( aabb );
 
         std::cerr << "Validating ... ";
-        context->validate();
+        {
+            sutil::TraceZone zone( "validate" );
+            context->validate();
+        }
         std::cerr << "done" << std::endl;;
 
         std::cerr << "Preprocessing scene ... ";
         const double t0 = sutil::currentTime();
-        context->launch( 0, 0, 0 );
+        {
+            sutil::TraceZone zone( "Preprocessing launch" );
+            context->launch( 0, 0, 0 );
+        }
         const double t1 = sutil::currentTime();
         std::cerr << "done (" << t1-t0 << "sec )" << std::endl;
 
@@ -49,6 +49,7 @@
 #include <optixu/optixu_math_stream_namespace.h>
 
 #include <sutil.h>
+#include <FrameProfiler.h>
 #include "common.h"
 #include <Arcball.h>
 #include <OptiXMesh.h>
@@ -372,16 +373,19 @@ void updateCamera()
 void displayGlut()
 {
     updateCamera();
-    context->launch( 0, width, height );
+    {
+        sutil::FrameTimer timer( sutil::FRAME_STAGE_LAUNCH );
+        context->launch( 0, width, height );
+    }
 
     sutil::displayBufferGL( getOutputBuffer() );
 
     {
         static unsigned frame_count = 0;
-        sutil::displayFps( frame_count++ );
+        sutil::displayFrameStats( frame_count++ );
     }
 
-    glutSwapBuffers();
+    sutil::swapBuffers();
 }
 
 
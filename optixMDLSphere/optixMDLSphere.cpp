@@ -51,6 +51,7 @@
 #include <algorithm>
 #include <optixu/optixpp_namespace.h>
 #include <sutil.h>
+#include <FrameProfiler.h>
 #include <Arcball.h>
 #include <HDRLoader.h>
 
@@ -466,16 +467,19 @@ void initializeGlut( int* argc, char** argv )
 void displayGlut()
 {
     updateCamera();
-    context->launch( 0, width, height );
+    {
+        sutil::FrameTimer timer( sutil::FRAME_STAGE_LAUNCH );
+        context->launch( 0, width, height );
+    }
 
     sutil::displayBufferGL( getOutputBuffer() );
 
     {
         static unsigned frame_count = 0;
-        sutil::displayFps( frame_count++ );
+        sutil::displayFrameStats( frame_count++ );
     }
 
-    glutSwapBuffers();
+    sutil::swapBuffers();
 }
 
 
@@ -48,6 +48,8 @@
 #include <optixu/optixu_math_stream_namespace.h>
 
 #include <sutil.h>
+#include <ChromeTrace.h>
+#include <FrameProfiler.h>
 #include "common.h"
 #include <Arcball.h>
 #include <OptiXMesh.h>
@@ -166,6 +168,7 @@ void registerExitHandler()
 
 void createContext( int usage_report_level, UsageReportLogger* logger )
 {
+    sutil::TraceZone zone( "createContext" );
     // Set up context
     context = Context::create();
     context->setRayTypeCount( 2 );
@@ -198,6 +201,7 @@ void createContext( int usage_report_level, UsageReportLogger* logger )
 
 void loadMesh( const std::string& filename )
 {
+    sutil::TraceZone zone( "loadMesh", filename );
     OptiXMesh mesh;
     mesh.context = context;
     mesh.use_tri_api = use_tri_api;
@@ -216,6 +220,7 @@ void loadMesh( const std::string& filename )
   
 void setupCamera()
 {
+    sutil::TraceZone zone( "setupCamera" );
     const float max_dim = fmaxf(aabb.extent(0), aabb.extent(1)); // max of x, y components
 
     camera_eye    = aabb.center() + make_float3( 0.0f, 0.0f, max_dim*1.5f ); 
@@ -228,6 +233,7 @@ void setupCamera()
 
 void setupLights()
 {
+    sutil::TraceZone zone( "setupLights" );
     const float max_dim = fmaxf(aabb.extent(0), aabb.extent(1)); // max of x, y components
 
     BasicLight lights[] = {
@@ -336,16 +342,19 @@ void glutRun()
 void glutDisplay()
 {
     updateCamera();
-    context->launch( 0, width, height );
+    {
+        sutil::FrameTimer timer( sutil::FRAME_STAGE_LAUNCH );
+        context->launch( 0, width, height );
+    }
 
     sutil::displayBufferGL( getOutputBuffer() );
 
     {
       static unsigned frame_count = 0;
-      sutil::displayFps( frame_count++ );
+      sutil::displayFrameStats( frame_count++ );
     }
 
-    glutSwapBuffers();
+    sutil::swapBuffers();
 }
 
 
@@ -529,7 +538,10 @@ int main( int argc, char** argv )
         setupCamera();
         setupLights();
 
-        context->validate();
+        {
+            sutil::TraceZone zone( "validate" );
+            context->validate();
+        }
 
         if ( out_file.empty() )
         {
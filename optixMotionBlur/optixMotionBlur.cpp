@@ -49,6 +49,7 @@
 #include <optixu/optixu_quaternion_namespace.h>
 
 #include <sutil.h>
+#include <FrameProfiler.h>
 #include "common.h"
 #include <Arcball.h>
 #include <OptiXMesh.h>
@@ -712,20 +713,26 @@ void glutDisplay()
     }
     
     context["frame"]->setUint( accumulation_frame++ );
-    context->launch( 0, width, height );
+    {
+        sutil::FrameTimer timer( sutil::FRAME_STAGE_LAUNCH );
+        context->launch( 0, width, height );
+    }
 
     // colormap
     if ( do_timeview )
+    {
+      sutil::FrameTimer timer( sutil::FRAME_STAGE_POSTPROCESS );
       context->launch( 1, width, height );
+    }
 
     sutil::displayBufferGL( getOutputBuffer() );
 
     {
       static unsigned frame_count = 0;
-      sutil::displayFps( frame_count++ );
+      sutil::displayFrameStats( frame_count++ );
     }
 
-    glutSwapBuffers();
+    sutil::swapBuffers();
 }
 
 
@@ -49,6 +49,8 @@
 
 #include "optixPathTracer.h"
 #include <sutil.h>
+#include <ChromeTrace.h>
+#include <FrameProfiler.h>
 #include <Arcball.h>
 
 #include <algorithm>
@@ -187,6 +189,7 @@ GeometryInstance createParallelogram(
 
 void createContext()
 {
+    sutil::TraceZone zone( "createContext" );
     context = Context::create();
     context->setRayTypeCount( 2 );
     context->setEntryPointCount( 1 );
@@ -213,6 +216,7 @@ void createContext()
 
 void loadGeometry()
 {
+    sutil::TraceZone zone( "loadGeometry" );
     // Light buffer
     ParallelogramLight light;
     light.corner   = make_float3( 343.0f, 548.6f, 227.0f);
@@ -349,6 +353,7 @@ void loadGeometry()
   
 void setupCamera()
 {
+    sutil::TraceZone zone( "setupCamera" );
     camera_eye    = make_float3( 278.0f, 273.0f, -900.0f );
     camera_lookat = make_float3( 278.0f, 273.0f,    0.0f );
     camera_up     = make_float3(   0.0f,   1.0f,    0.0f );
@@ -448,16 +453,19 @@ void glutRun()
 void glutDisplay()
 {
     updateCamera();
-    context->launch( 0, width, height );
+    {
+        sutil::FrameTimer timer( sutil::FRAME_STAGE_LAUNCH );
+        context->launch( 0, width, height );
+    }
 
     sutil::displayBufferGL( getOutputBuffer() );
 
     {
       static unsigned frame_count = 0;
-      sutil::displayFps( frame_count++ );
+      sutil::displayFrameStats( frame_count++ );
     }
 
-    glutSwapBuffers();
+    sutil::swapBuffers();
 }
 
 
@@ -632,7 +640,10 @@ int main( int argc, char** argv )
         setupCamera();
         loadGeometry();
 
-        context->validate();
+        {
+            sutil::TraceZone zone( "validate" );
+            context->validate();
+        }
 
         if ( out_file.empty() )
         {
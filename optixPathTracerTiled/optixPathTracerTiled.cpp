@@ -53,6 +53,7 @@
 
 #include "optixPathTracerTiled.h"
 #include <sutil.h>
+#include <FrameProfiler.h>
 #include <Arcball.h>
 
 #include <algorithm>
@@ -640,16 +641,19 @@ void glutDisplay()
 {
     updateCamera();
 
-    workManager.render();
+    {
+        sutil::FrameTimer timer( sutil::FRAME_STAGE_LAUNCH );
+        workManager.render();
+    }
 
     sutil::displayBufferGL( getOutputBuffer() );
 
     {
       static unsigned frame_count = 0;
-      sutil::displayFps( frame_count++ );
+      sutil::displayFrameStats( frame_count++ );
     }
 
-    glutSwapBuffers();
+    sutil::swapBuffers();
 }
 
 
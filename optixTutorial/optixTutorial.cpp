@@ -63,6 +63,7 @@
 #include <optixu/optixu_math_stream_namespace.h>
 
 #include <sutil.h>
+#include <FrameProfiler.h>
 #include "common.h"
 #include "random.h"
 #include <Arcball.h>
@@ -549,17 +550,20 @@ void glutDisplay()
 {
     updateCamera();
 
-    context->launch( 0, width, height );
+    {
+        sutil::FrameTimer timer( sutil::FRAME_STAGE_LAUNCH );
+        context->launch( 0, width, height );
+    }
 
     Buffer buffer = getOutputBuffer();
     sutil::displayBufferGL( getOutputBuffer() );
 
     {
         static unsigned frame_count = 0;
-        sutil::displayFps( frame_count++ );
+        sutil::displayFrameStats( frame_count++ );
     }
 
-    glutSwapBuffers();
+    sutil::swapBuffers();
 }
 
 
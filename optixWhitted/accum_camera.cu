@@ -30,7 +30,9 @@
 #include <optixu/optixu_math_namespace.h>
 #include <common.h>
 #include "helpers.h"
+#include "iterative.h"
 #include "random.h"
+#include "rayDifferentials.h"
 
 using namespace optix;
 
@@ -39,6 +41,9 @@ struct PerRayData_radiance
   float3 result;
   float  importance;
   int    depth;
+  float  distance;  // hit distance of this ray, negative on a miss
+  RayDifferential differential;
+  int    cache_index;  // shadow_cache slot of the pixel, -1 for secondary rays
 };
 
 rtDeclareVariable(float3,        eye, , );
@@ -52,40 +57,279 @@ rtBuffer<float4, 2>              accum_buffer;
 rtDeclareVariable(rtObject,      top_object, , );
 rtDeclareVariable(unsigned int,  frame, , );
 rtDeclareVariable(uint2,         launch_index, rtLaunchIndex, );
+rtDeclareVariable(int,           iterative_shading, , );
+rtDeclareVariable(int,           russian_roulette_depth, , );
+rtBuffer<uint2>                  shadow_cache;
+rtDeclareVariable(int,           shadow_cache_frame, , );
 
 
-RT_PROGRAM void pinhole_camera()
+// Iterative ray tree: closest hit programs return one throughput-weighted
+// continuation ray at a time, with Russian roulette standing in for the
+// importance cutoff of the recursive materials.
+static __device__ __inline__ float3 trace_iterative( optix::Ray ray, RayDifferential differential,
+                                                     int cache_index, unsigned int seed, float& distance )
 {
+  float3 radiance   = make_float3(0.0f);
+  float3 throughput = make_float3(1.0f);
 
-  size_t2 screen = output_buffer.size();
-  unsigned int seed = tea<16>(screen.x*launch_index.y+launch_index.x, frame);
+  PerRayData_radiance_iterative prd;
+  prd.seed = seed;
+  for( int depth = 0; ; ++depth ) {
+    prd.result       = make_float3(0.0f);
+    prd.importance   = luminance( throughput );
+    prd.depth        = depth;
+    prd.distance     = -1.0f;
+    prd.continue_ray = 0;
+    prd.differential = differential;
+    prd.cache_index  = depth == 0 ? cache_index : -1;
 
-  // Subpixel jitter: send the ray through a different position inside the pixel each time,
-  // to provide antialiasing.
-  float2 subpixel_jitter = frame == 0 ? make_float2(0.0f, 0.0f) : make_float2(rnd( seed ) - 0.5f, rnd( seed ) - 0.5f);
+    rtTrace(top_object, ray, prd);
+
+    if( depth == 0 )
+      distance = prd.distance;
+    radiance += throughput * prd.result;
+    if( !prd.continue_ray )
+      break;
+
+    throughput *= prd.weight;
+    differential = prd.differential;
+    if( depth >= russian_roulette_depth ) {
+      const float p = fminf( fmaxf( throughput ), 0.95f );
+      if( rnd( prd.seed ) >= p )
+        break;
+      throughput /= p;
+    }
+
+    ray = optix::make_Ray( prd.origin, prd.direction, RADIANCE_RAY_TYPE, scene_epsilon, RT_DEFAULT_MAX );
+  }
+
+  return radiance;
+}
 
-  float2 d = (make_float2(launch_index) + subpixel_jitter) / make_float2(screen) * 2.f - 1.f;
+
+static __device__ __inline__ float3 trace_camera_ray( uint2 pixel, size_t2 screen, float2 subpixel_jitter,
+                                                      float3& ray_direction, float& distance )
+{
+  float2 d = (make_float2(pixel) + subpixel_jitter) / make_float2(screen) * 2.f - 1.f;
   float3 ray_origin = eye;
-  float3 ray_direction = normalize(d.x*U + d.y*V + W);
+  ray_direction = normalize(d.x*U + d.y*V + W);
   
   optix::Ray ray(ray_origin, ray_direction, RADIANCE_RAY_TYPE, scene_epsilon );
 
+  // One pixel step moves d by 2/screen
+  const RayDifferential differential = cameraRayDifferential( d.x*U + d.y*V + W,
+                                                              U * (2.f / screen.x), V * (2.f / screen.y) );
+
+  // Shadow visibility cache slot; a new fill starts from an empty entry
+  int cache_index = -1;
+  if( shadow_cache_frame >= 0 ) {
+    cache_index = screen.x*pixel.y+pixel.x;
+    if( shadow_cache_frame == 0 )
+      shadow_cache[cache_index] = make_uint2( 0u, 0u );
+  }
+
+  if( iterative_shading ) {
+    // Separate stream from the jitter seed, but still a function of pixel and frame
+    unsigned int seed = tea<16>(frame, screen.x*pixel.y+pixel.x);
+    return trace_iterative( ray, differential, cache_index, seed, distance );
+  }
+
   PerRayData_radiance prd;
   prd.importance = 1.f;
   prd.depth = 0;
+  prd.differential = differential;
+  prd.cache_index = cache_index;
 
   rtTrace(top_object, ray, prd);
 
+  distance = prd.distance;
+  return prd.result;
+}
+
+static __device__ __inline__ float2 camera_jitter( uint2 pixel, size_t2 screen )
+{
+  unsigned int seed = tea<16>(screen.x*pixel.y+pixel.x, frame);
+
+  // Subpixel jitter: send the ray through a different position inside the pixel each time,
+  // to provide antialiasing.
+  return frame == 0 ? make_float2(0.0f, 0.0f) : make_float2(rnd( seed ) - 0.5f, rnd( seed ) - 0.5f);
+}
+
+static __device__ __inline__ float3 trace_camera_ray( uint2 pixel, size_t2 screen )
+{
+  float3 ray_direction;
+  float  distance;
+  return trace_camera_ray( pixel, screen, camera_jitter( pixel, screen ), ray_direction, distance );
+}
+
+
+RT_PROGRAM void pinhole_camera()
+{
+
+  size_t2 screen = output_buffer.size();
+  float3 result = trace_camera_ray( launch_index, screen );
+
   float4 acc_val = accum_buffer[launch_index];
   if( frame > 0 ) {
-    acc_val = lerp( acc_val, make_float4( prd.result, 0.f), 1.0f / static_cast<float>( frame+1 ) );
+    acc_val = lerp( acc_val, make_float4( result, 0.f), 1.0f / static_cast<float>( frame+1 ) );
   } else {
-    acc_val = make_float4(prd.result, 0.f);
+    acc_val = make_float4(result, 0.f);
   }
   output_buffer[launch_index] = make_color( make_float3( acc_val ) );
   accum_buffer[launch_index] = acc_val;
 }
 
+
+//
+// Adaptive sampling.  variance_buffer holds per-pixel running luminance
+// statistics (mean, M2, unused, sample count) that the host reads to build
+// pixel_mask_buffer.  Masked-out pixels keep their accumulated value.
+//
+rtBuffer<float4, 2>              variance_buffer;
+rtBuffer<unsigned char, 2>       pixel_mask_buffer;
+rtBuffer<uint2>                  active_tile_buffer;
+rtDeclareVariable(unsigned int,  adaptive_tile_size, , );
+
+static __device__ __inline__ void adaptive_sample( uint2 pixel, size_t2 screen )
+{
+  if( !pixel_mask_buffer[pixel] )
+    return;
+
+  float3 result = trace_camera_ray( pixel, screen );
+  float  lum    = luminance( result );
+
+  float4 acc_val = accum_buffer[pixel];
+  float4 stats   = variance_buffer[pixel];
+  if( frame > 0 ) {
+    // Welford update.  Pixels may have skipped frames, so weight by the
+    // pixel's own sample count rather than frame.
+    const float n = stats.w + 1.0f;
+    acc_val = lerp( acc_val, make_float4( result, 0.f), 1.0f / n );
+    const float delta = lum - stats.x;
+    stats.x += delta / n;
+    stats.y += delta * ( lum - stats.x );
+    stats.w  = n;
+  } else {
+    acc_val = make_float4(result, 0.f);
+    stats   = make_float4(lum, 0.f, 0.f, 1.f);
+  }
+  output_buffer[pixel]   = make_color( make_float3( acc_val ) );
+  accum_buffer[pixel]    = acc_val;
+  variance_buffer[pixel] = stats;
+}
+
+// Full-screen launch; converged pixels return immediately.
+RT_PROGRAM void pinhole_camera_adaptive()
+{
+  adaptive_sample( launch_index, output_buffer.size() );
+}
+
+// Compacted launch of adaptive_tile_size x (adaptive_tile_size * N) threads,
+// one square block per entry of active_tile_buffer (tile origins in pixels).
+RT_PROGRAM void pinhole_camera_adaptive_tiles()
+{
+  size_t2 screen = output_buffer.size();
+  const uint2 tile  = active_tile_buffer[launch_index.y / adaptive_tile_size];
+  const uint2 pixel = make_uint2( tile.x + launch_index.x, tile.y + launch_index.y % adaptive_tile_size );
+  if( pixel.x >= screen.x || pixel.y >= screen.y )
+    return;
+
+  adaptive_sample( pixel, screen );
+}
+
+//
+// Temporal reprojection.  accum_buffer.w holds the per-pixel sample count and
+// position_buffer the unjittered first hit (xyz, w = 1) or the ray direction
+// for background pixels (w = 0).  When the camera moves the host swaps both
+// with their history_ counterparts and launches reproject_camera, which warps
+// the history into the new view.
+//
+rtBuffer<float4, 2>              history_accum_buffer;
+rtBuffer<float4, 2>              position_buffer;
+rtBuffer<float4, 2>              history_position_buffer;
+rtDeclareVariable(float3,        prev_eye, , );
+rtDeclareVariable(float3,        prev_U, , );
+rtDeclareVariable(float3,        prev_V, , );
+rtDeclareVariable(float3,        prev_W, , );
+rtDeclareVariable(float,         max_history, , );
+rtDeclareVariable(float,         reprojection_tolerance, , );
+
+static __device__ __inline__ float4 first_hit_position( const float3& ray_direction, float distance )
+{
+  return distance >= 0.0f ? make_float4( eye + distance * ray_direction, 1.0f ) : make_float4( ray_direction, 0.0f );
+}
+
+// Accumulation with per-pixel sample counts, used instead of pinhole_camera
+// when reprojection is enabled.
+RT_PROGRAM void pinhole_camera_reproject()
+{
+  size_t2 screen = output_buffer.size();
+
+  float3 ray_direction;
+  float  distance;
+  float3 result = trace_camera_ray( launch_index, screen, camera_jitter( launch_index, screen ), ray_direction, distance );
+
+  float4 acc_val = accum_buffer[launch_index];
+  if( frame > 0 ) {
+    const float n = acc_val.w + 1.0f;
+    acc_val = make_float4( lerp( make_float3( acc_val ), result, 1.0f / n ), n );
+  } else {
+    acc_val = make_float4(result, 1.f);
+    position_buffer[launch_index] = first_hit_position( ray_direction, distance );
+  }
+  output_buffer[launch_index] = make_color( make_float3( acc_val ) );
+  accum_buffer[launch_index] = acc_val;
+}
+
+RT_PROGRAM void reproject_camera()
+{
+  size_t2 screen = output_buffer.size();
+
+  // One unjittered sample through the new camera gives both the first hit
+  // and a fresh radiance sample.
+  float3 ray_direction;
+  float  distance;
+  float3 result = trace_camera_ray( launch_index, screen, make_float2(0.0f, 0.0f), ray_direction, distance );
+  const float4 position = first_hit_position( ray_direction, distance );
+
+  float4 acc_val = make_float4(result, 1.f);
+
+  // Project the hit point (or the direction, for background) into the
+  // previous camera.  U, V and W are orthogonal, so the screen coordinates
+  // are plain projections onto each axis.
+  const float3 v = position.w > 0.0f ? make_float3( position ) - prev_eye : ray_direction;
+  const float  w = dot( v, prev_W ) / dot( prev_W, prev_W );
+  if( w > 0.0f ) {
+    const float2 d = make_float2( dot( v, prev_U ) / dot( prev_U, prev_U ),
+                                  dot( v, prev_V ) / dot( prev_V, prev_V ) ) / w;
+    const float2 p = ( d + 1.f ) * 0.5f * make_float2(screen) + 0.5f;
+    if( p.x >= 0.0f && p.y >= 0.0f && p.x < screen.x && p.y < screen.y ) {
+      const uint2  prev_pixel = make_uint2( static_cast<unsigned int>( p.x ), static_cast<unsigned int>( p.y ) );
+      const float4 prev_position = history_position_buffer[prev_pixel];
+
+      // Disocclusion: the previous first hit must be the same surface point,
+      // or background in both views.
+      bool valid;
+      if( position.w > 0.0f )
+        valid = prev_position.w > 0.0f &&
+                length( make_float3( prev_position ) - make_float3( position ) ) <= reprojection_tolerance * distance;
+      else
+        valid = prev_position.w == 0.0f;
+
+      if( valid ) {
+        // Clamp the history weight so stale view-dependent shading fades out
+        const float4 history = history_accum_buffer[prev_pixel];
+        const float  n = fminf( history.w, max_history ) + 1.0f;
+        acc_val = make_float4( lerp( make_float3( history ), result, 1.0f / n ), n );
+      }
+    }
+  }
+
+  output_buffer[launch_index]   = make_color( make_float3( acc_val ) );
+  accum_buffer[launch_index]    = acc_val;
+  position_buffer[launch_index] = position;
+}
+
 RT_PROGRAM void exception()
 {
   const unsigned int code = rtGetExceptionCode();
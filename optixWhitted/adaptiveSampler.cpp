@@ -0,0 +1,197 @@
+/* 
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "adaptiveSampler.h"
+
+#include <sutil.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace optix;
+
+
+AdaptiveSampler::AdaptiveSampler( Context context, unsigned width, unsigned height, Mode mode,
+                                  float threshold, unsigned min_samples, unsigned update_interval )
+  : m_context( context ),
+    m_width( width ),
+    m_height( height ),
+    m_mode( mode ),
+    m_threshold( threshold ),
+    m_min_samples( std::max( min_samples, 2u ) ),
+    m_update_interval( std::max( update_interval, 1u ) ),
+    m_active_pixels( 0 )
+{
+  // Read back by the host, so not GPU_LOCAL
+  m_variance_buffer = m_context->createBuffer( RT_BUFFER_INPUT_OUTPUT, RT_FORMAT_FLOAT4, width, height );
+  m_context["variance_buffer"]->set( m_variance_buffer );
+
+  m_mask_buffer = m_context->createBuffer( RT_BUFFER_INPUT, RT_FORMAT_UNSIGNED_BYTE, width, height );
+  m_context["pixel_mask_buffer"]->set( m_mask_buffer );
+
+  m_tile_buffer = m_context->createBuffer( RT_BUFFER_INPUT, RT_FORMAT_UNSIGNED_INT2, 1 );
+  m_context["active_tile_buffer"]->set( m_tile_buffer );
+  m_context["adaptive_tile_size"]->setUint( TILE_SIZE );
+
+  reset();
+}
+
+
+const char* AdaptiveSampler::rayGenProgramName( Mode mode )
+{
+  return mode == MODE_TILES ? "pinhole_camera_adaptive_tiles" : "pinhole_camera_adaptive";
+}
+
+
+void AdaptiveSampler::resize( unsigned width, unsigned height )
+{
+  m_width = width;
+  m_height = height;
+  sutil::resizeBuffer( m_variance_buffer, width, height );
+  m_mask_buffer->setSize( width, height );
+  reset();
+}
+
+
+void AdaptiveSampler::launch( unsigned frame )
+{
+  if( frame == 0 )
+    reset();
+  else if( frame >= m_min_samples && ( frame - m_min_samples ) % m_update_interval == 0 )
+    updateMask();
+
+  if( m_active_pixels == 0 )
+  {
+    std::fill( m_tile_mask.begin(), m_tile_mask.end(), 0 );
+    return;
+  }
+
+  if( m_mode == MODE_TILES )
+    m_context->launch( 0, TILE_SIZE, TILE_SIZE * static_cast<unsigned>( m_active_tiles.size() ) );
+  else
+    m_context->launch( 0, m_width, m_height );
+}
+
+
+float AdaptiveSampler::activeFraction() const
+{
+  return static_cast<float>( m_active_pixels ) / static_cast<float>( m_width * m_height );
+}
+
+
+float AdaptiveSampler::launchedFraction() const
+{
+  if( m_active_pixels == 0 )
+    return 0.0f;
+  if( m_mode == MODE_MASK )
+    return 1.0f;
+  const float launched = static_cast<float>( m_active_tiles.size() * TILE_SIZE * TILE_SIZE );
+  return std::min( 1.0f, launched / static_cast<float>( m_width * m_height ) );
+}
+
+
+void AdaptiveSampler::reset()
+{
+  m_mask.assign( m_width * m_height, 1 );
+  m_active_pixels = m_mask.size();
+  uploadMask();
+}
+
+
+void AdaptiveSampler::updateMask()
+{
+  const float4* stats = static_cast<const float4*>( m_variance_buffer->map( 0, RT_BUFFER_MAP_READ ) );
+
+  m_active_pixels = 0;
+  for( size_t i = 0; i < m_mask.size(); ++i )
+  {
+    if( !m_mask[i] )
+      continue;
+
+    // Relative standard error of the mean: sqrt( M2 / (n (n-1)) ) / mean
+    const float n = stats[i].w;
+    bool converged = false;
+    if( n >= m_min_samples )
+    {
+      const float std_error = sqrtf( stats[i].y / ( n * ( n - 1.0f ) ) );
+      converged = std_error <= m_threshold * std::max( stats[i].x, 1.e-3f );
+    }
+    m_mask[i] = converged ? 0 : 1;
+    m_active_pixels += m_mask[i];
+  }
+
+  m_variance_buffer->unmap();
+  uploadMask();
+}
+
+
+void AdaptiveSampler::uploadMask()
+{
+  memcpy( m_mask_buffer->map( 0, RT_BUFFER_MAP_WRITE_DISCARD ), &m_mask[0], m_mask.size() );
+  m_mask_buffer->unmap();
+
+  // Find the tiles that still contain at least one active pixel
+  m_tile_mask.assign( tilesX() * tilesY(), 0 );
+  m_active_tiles.clear();
+  for( unsigned ty = 0; ty < m_height; ty += TILE_SIZE )
+  {
+    for( unsigned tx = 0; tx < m_width; tx += TILE_SIZE )
+    {
+      bool active = false;
+      for( unsigned y = ty; y < std::min( ty + TILE_SIZE, m_height ) && !active; ++y )
+      {
+        const unsigned char* row = &m_mask[y * m_width];
+        for( unsigned x = tx; x < std::min( tx + TILE_SIZE, m_width ); ++x )
+        {
+          if( row[x] )
+          {
+            active = true;
+            break;
+          }
+        }
+      }
+      if( !active )
+        continue;
+      m_tile_mask[( ty / TILE_SIZE ) * tilesX() + tx / TILE_SIZE] = 1;
+      if( m_mode == MODE_TILES )
+        m_active_tiles.push_back( make_uint2( tx, ty ) );
+    }
+  }
+
+  if( m_mode != MODE_TILES )
+    return;
+
+  m_tile_buffer->setSize( std::max<size_t>( m_active_tiles.size(), 1 ) );
+  if( !m_active_tiles.empty() )
+  {
+    memcpy( m_tile_buffer->map( 0, RT_BUFFER_MAP_WRITE_DISCARD ), &m_active_tiles[0],
+            m_active_tiles.size() * sizeof( uint2 ) );
+    m_tile_buffer->unmap();
+  }
+}
@@ -0,0 +1,103 @@
+/* 
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//-----------------------------------------------------------------------------
+//
+// adaptiveSampler: host side of the adaptive pinhole camera programs in
+// accum_camera.cu.  Owns variance_buffer, pixel_mask_buffer and
+// active_tile_buffer, periodically turns the per-pixel luminance statistics
+// into a convergence mask and launches only the pixels that still need work.
+//
+//-----------------------------------------------------------------------------
+
+#pragma once
+
+#include <optixu/optixpp_namespace.h>
+
+#include <vector>
+
+class AdaptiveSampler
+{
+public:
+  enum Mode
+  {
+    MODE_MASK,   // full-screen launch, converged pixels return early
+    MODE_TILES   // compacted launch over tiles that still have active pixels
+  };
+
+  static const unsigned TILE_SIZE = 16;
+
+  // threshold is the relative standard error of the mean luminance below
+  // which a pixel is considered converged.
+  AdaptiveSampler( optix::Context context, unsigned width, unsigned height, Mode mode,
+                   float threshold, unsigned min_samples = 8, unsigned update_interval = 4 );
+
+  // Name of the ray generation program in accum_camera.cu for mode.
+  static const char* rayGenProgramName( Mode mode );
+
+  void resize( unsigned width, unsigned height );
+
+  // Launches entry point 0 for accumulation frame 'frame'.  Frame 0 resets
+  // the mask; later frames refresh it every update_interval frames.
+  void launch( unsigned frame );
+
+  // Fraction of pixels that were not converged at the last mask update.
+  float activeFraction() const;
+
+  // Fraction of the screen covered by the last launch.  Equal to 1 in
+  // MODE_MASK until everything has converged.
+  float launchedFraction() const;
+
+  // One byte per TILE_SIZE square of the output buffer, row-major from
+  // row 0, nonzero where the last launch wrote pixels.  Converged pixels
+  // keep their value, so only these tiles need to be redisplayed.
+  const unsigned char* dirtyTiles() const { return &m_tile_mask[0]; }
+  unsigned tilesX() const { return ( m_width + TILE_SIZE - 1 ) / TILE_SIZE; }
+  unsigned tilesY() const { return ( m_height + TILE_SIZE - 1 ) / TILE_SIZE; }
+
+private:
+  void reset();
+  void updateMask();
+  void uploadMask();
+
+  optix::Context     m_context;
+  optix::Buffer      m_variance_buffer;
+  optix::Buffer      m_mask_buffer;
+  optix::Buffer      m_tile_buffer;
+  unsigned           m_width;
+  unsigned           m_height;
+  Mode               m_mode;
+  float              m_threshold;
+  unsigned           m_min_samples;
+  unsigned           m_update_interval;
+
+  std::vector<unsigned char>  m_mask;
+  std::vector<unsigned char>  m_tile_mask;
+  std::vector<optix::uint2>   m_active_tiles;
+  size_t                      m_active_pixels;
+};
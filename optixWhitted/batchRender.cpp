@@ -0,0 +1,212 @@
+/* 
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "batchRender.h"
+
+#include <sutil.h>
+
+#include <fstream>
+#include <sstream>
+
+using namespace optix;
+
+namespace batch
+{
+
+std::vector<CameraKey> loadCameraPath( const std::string& filename )
+{
+  std::ifstream in( filename.c_str() );
+  if( !in.is_open() )
+    throw Exception( "Could not open camera path file '" + filename + "'" );
+
+  std::vector<CameraKey> keys;
+  std::string line;
+  int line_number = 0;
+  while( std::getline( in, line ) )
+  {
+    ++line_number;
+    const size_t first = line.find_first_not_of( " \t\r" );
+    if( first == std::string::npos || line[first] == '#' )
+      continue;
+
+    std::istringstream fields( line );
+    CameraKey key;
+    fields >> key.eye.x    >> key.eye.y    >> key.eye.z
+           >> key.lookat.x >> key.lookat.y >> key.lookat.z
+           >> key.up.x     >> key.up.y     >> key.up.z;
+    if( fields.fail() )
+    {
+      std::ostringstream msg;
+      msg << "Malformed camera in '" << filename << "' at line " << line_number;
+      throw Exception( msg.str() );
+    }
+    keys.push_back( key );
+  }
+
+  if( keys.empty() )
+    throw Exception( "Camera path file '" + filename + "' has no cameras" );
+  return keys;
+}
+
+
+void writeTimings( const std::string& filename, const std::vector<FrameTiming>& timings,
+                   unsigned width, unsigned height, unsigned samples_per_frame )
+{
+  std::ofstream out( filename.c_str() );
+  if( !out.is_open() )
+    throw Exception( "Could not open timing file '" + filename + "'" );
+
+  const bool json = filename.size() >= 5 && filename.compare( filename.size() - 5, 5, ".json" ) == 0;
+  if( json )
+  {
+    out << "{\n"
+        << "  \"width\": " << width << ",\n"
+        << "  \"height\": " << height << ",\n"
+        << "  \"samples_per_frame\": " << samples_per_frame << ",\n"
+        << "  \"frames\": [\n";
+    for( size_t i = 0; i < timings.size(); ++i )
+    {
+      const FrameTiming& t = timings[i];
+      out << "    { \"frame\": " << t.frame
+          << ", \"launch_ms\": " << t.launch_ms
+          << ", \"accum_ms\": " << t.accum_ms
+          << ", \"readback_ms\": " << t.readback_ms
+          << ", \"write_ms\": " << t.write_ms
+          << ", \"active_fraction\": " << t.active_fraction
+          << " }" << ( i + 1 < timings.size() ? "," : "" ) << "\n";
+    }
+    out << "  ]\n}\n";
+  }
+  else
+  {
+    out << "frame,width,height,samples_per_frame,launch_ms,accum_ms,readback_ms,write_ms,active_fraction\n";
+    for( size_t i = 0; i < timings.size(); ++i )
+    {
+      const FrameTiming& t = timings[i];
+      out << t.frame << "," << width << "," << height << "," << samples_per_frame << ","
+          << t.launch_ms << "," << t.accum_ms << "," << t.readback_ms << "," << t.write_ms << "," << t.active_fraction << "\n";
+    }
+  }
+}
+
+
+//------------------------------------------------------------------------------
+//
+// AsyncImageWriter
+//
+//------------------------------------------------------------------------------
+
+AsyncImageWriter::AsyncImageWriter( size_t max_pending )
+  : m_max_pending( max_pending > 0 ? max_pending : 1 ),
+    m_in_flight( 0 ),
+    m_done( false )
+{
+  m_thread = std::thread( &AsyncImageWriter::run, this );
+}
+
+
+AsyncImageWriter::~AsyncImageWriter()
+{
+  {
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_done = true;
+  }
+  m_cond.notify_all();
+  m_thread.join();
+}
+
+
+void AsyncImageWriter::push( const std::string& filename, std::vector<uchar4>& pixels,
+                             unsigned width, unsigned height, size_t index )
+{
+  std::unique_lock<std::mutex> lock( m_mutex );
+  m_cond.wait( lock, [this]() { return m_jobs.size() < m_max_pending; } );
+
+  m_jobs.push_back( Job() );
+  Job& job = m_jobs.back();
+  job.filename = filename;
+  job.pixels.swap( pixels );
+  job.width = width;
+  job.height = height;
+  job.index = index;
+  if( m_write_ms.size() <= index )
+    m_write_ms.resize( index + 1, 0.0 );
+
+  lock.unlock();
+  m_cond.notify_all();
+}
+
+
+void AsyncImageWriter::flush()
+{
+  std::unique_lock<std::mutex> lock( m_mutex );
+  m_cond.wait( lock, [this]() { return m_jobs.empty() && m_in_flight == 0; } );
+}
+
+
+void AsyncImageWriter::run()
+{
+  for( ;; )
+  {
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock( m_mutex );
+      m_cond.wait( lock, [this]() { return m_done || !m_jobs.empty(); } );
+      if( m_jobs.empty() )
+        return;  // m_done and drained
+      job.filename = m_jobs.front().filename;
+      job.pixels.swap( m_jobs.front().pixels );
+      job.width = m_jobs.front().width;
+      job.height = m_jobs.front().height;
+      job.index = m_jobs.front().index;
+      m_jobs.pop_front();
+      ++m_in_flight;
+    }
+    m_cond.notify_all();
+
+    const double t0 = sutil::currentTime();
+    try
+    {
+      sutil::displayBufferPPM( job.filename.c_str(), &job.pixels[0], job.width, job.height );
+    }
+    catch( const std::exception& e )
+    {
+      sutil::reportErrorMessage( e.what() );
+    }
+    const double t1 = sutil::currentTime();
+
+    {
+      std::lock_guard<std::mutex> lock( m_mutex );
+      m_write_ms[job.index] = ( t1 - t0 ) * 1000.0;
+      --m_in_flight;
+    }
+    m_cond.notify_all();
+  }
+}
+
+} // namespace batch
@@ -0,0 +1,123 @@
+/* 
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//-----------------------------------------------------------------------------
+//
+// batchRender: helpers for the headless batch mode of optixWhitted.  Camera
+// path loading, an asynchronous PPM writer and per-frame timing reports.
+//
+//-----------------------------------------------------------------------------
+
+#pragma once
+
+#include <optixu/optixu_math_namespace.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace batch
+{
+
+struct CameraKey
+{
+  optix::float3 eye;
+  optix::float3 lookat;
+  optix::float3 up;
+};
+
+// Reads one camera per line as "eye.xyz lookat.xyz up.xyz".  Blank lines and
+// lines starting with '#' are skipped.  Throws optix::Exception on error.
+std::vector<CameraKey> loadCameraPath( const std::string& filename );
+
+
+struct FrameTiming
+{
+  unsigned frame;
+  double   launch_ms;        // first launch of the frame, including any rebuilds
+  double   accum_ms;         // remaining samples_per_frame-1 accumulation launches
+  double   readback_ms;      // output buffer map and copy
+  double   write_ms;         // image encode and write on the writer thread
+  double   active_fraction;  // mean fraction of pixels sampled per launch
+};
+
+// Writes JSON if filename ends in ".json", CSV otherwise.
+void writeTimings( const std::string& filename, const std::vector<FrameTiming>& timings,
+                   unsigned width, unsigned height, unsigned samples_per_frame );
+
+
+//------------------------------------------------------------------------------
+//
+// AsyncImageWriter: writes BGRA images with sutil::displayBufferPPM on a
+// background thread so that the next frame can be launched while the previous
+// one is written.  push() blocks while max_pending images are queued.
+//
+//------------------------------------------------------------------------------
+
+class AsyncImageWriter
+{
+public:
+  explicit AsyncImageWriter( size_t max_pending = 4 );
+  ~AsyncImageWriter();
+
+  // Takes ownership of pixels.  index selects the slot in writeTimes().
+  void push( const std::string& filename, std::vector<optix::uchar4>& pixels,
+             unsigned width, unsigned height, size_t index );
+
+  // Blocks until every queued image has been written.
+  void flush();
+
+  // Per-image write time in milliseconds.  Only valid after flush().
+  const std::vector<double>& writeTimes() const { return m_write_ms; }
+
+private:
+  struct Job
+  {
+    std::string                 filename;
+    std::vector<optix::uchar4>  pixels;
+    unsigned                    width;
+    unsigned                    height;
+    size_t                      index;
+  };
+
+  void run();
+
+  size_t                  m_max_pending;
+  std::deque<Job>         m_jobs;
+  size_t                  m_in_flight;
+  bool                    m_done;
+  std::vector<double>     m_write_ms;
+  std::mutex              m_mutex;
+  std::condition_variable m_cond;
+  std::thread             m_thread;
+};
+
+} // namespace batch
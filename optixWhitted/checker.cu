@@ -29,21 +29,10 @@
 #include <optix.h>
 #include <optixu/optixu_math_namespace.h>
 #include "phong.h" 
+#include "materials.h"
 
 using namespace optix;
 
-rtDeclareVariable(float3,       Kd1, , );
-rtDeclareVariable(float3,       Kd2, , );
-rtDeclareVariable(float3,       Ka1, , );
-rtDeclareVariable(float3,       Ka2, , );
-rtDeclareVariable(float3,       Ks1, , );
-rtDeclareVariable(float3,       Ks2, , );
-rtDeclareVariable(float3,       Kr1, , );
-rtDeclareVariable(float3,       Kr2, , );
-rtDeclareVariable(float,        phong_exp1, , );
-rtDeclareVariable(float,        phong_exp2, , );
-rtDeclareVariable(float3,       inv_checker_size, , );  // Inverse checker height, width and depth in texture space
-
 rtDeclareVariable(float3, texcoord, attribute texcoord, ); 
 rtDeclareVariable(float3, geometric_normal, attribute geometric_normal, ); 
 rtDeclareVariable(float3, shading_normal, attribute shading_normal, ); 
@@ -55,12 +44,14 @@ RT_PROGRAM void any_hit_shadow()
 }
 
 
-RT_PROGRAM void closest_hit_radiance()
+static __device__ void checkerParams( float3& Kd, float3& Ka, float3& Ks, float3& Kr, float& phong_exp,
+                                      float3& ffnormal )
 {
-  float3 Kd, Ka, Ks, Kr;
-  float  phong_exp;
+  // The table holds the first check at the material id and the second one
+  // right after it
+  int m = materialId();
 
-  float3 t  = texcoord * inv_checker_size;
+  float3 t  = texcoord * material_checker_scale[m];
   t.x = floorf(t.x);
   t.y = floorf(t.y);
   t.z = floorf(t.z);
@@ -69,14 +60,29 @@ RT_PROGRAM void closest_hit_radiance()
                       static_cast<int>( t.y ) +
                       static_cast<int>( t.z ) ) & 1;
 
-  if ( which_check ) {
-    Kd = Kd1; Ka = Ka1; Ks = Ks1; Kr = Kr1; phong_exp = phong_exp1;
-  } else {
-    Kd = Kd2; Ka = Ka2; Ks = Ks2; Kr = Kr2; phong_exp = phong_exp2;
-  }
+  if ( !which_check )
+    ++m;
+  Kd = material_Kd[m]; Ka = material_Ka[m]; Ks = material_Ks[m]; Kr = material_Kr[m]; phong_exp = material_phong_exp[m];
 
   float3 world_shading_normal   = normalize(rtTransformNormal(RT_OBJECT_TO_WORLD, shading_normal));
   float3 world_geometric_normal = normalize(rtTransformNormal(RT_OBJECT_TO_WORLD, geometric_normal));
-  float3 ffnormal  = faceforward( world_shading_normal, -ray.direction, world_geometric_normal );
+  ffnormal  = faceforward( world_shading_normal, -ray.direction, world_geometric_normal );
+}
+
+
+RT_PROGRAM void closest_hit_radiance()
+{
+  float3 Kd, Ka, Ks, Kr, ffnormal;
+  float  phong_exp;
+  checkerParams( Kd, Ka, Ks, Kr, phong_exp, ffnormal );
   phongShade( Kd, Ka, Ks, Kr, phong_exp, ffnormal );
 }
+
+
+RT_PROGRAM void closest_hit_radiance_iterative()
+{
+  float3 Kd, Ka, Ks, Kr, ffnormal;
+  float  phong_exp;
+  checkerParams( Kd, Ka, Ks, Kr, phong_exp, ffnormal );
+  phongShadeIterative( Kd, Ka, Ks, Kr, phong_exp, ffnormal );
+}
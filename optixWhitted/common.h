@@ -32,6 +32,12 @@
 #define RADIANCE_RAY_TYPE 0
 #define SHADOW_RAY_TYPE 1
 
+// Lights with a bit in the shadow visibility cache (see shadowCache.h)
+#define SHADOW_CACHE_LIGHTS 32
+
+// Upper bound on exact_lights (see phong.h)
+#define MAX_EXACT_LIGHTS 8
+
 #include <optixu/optixu_vector_types.h>
 
 struct BasicLight
@@ -45,4 +51,17 @@ struct BasicLight
   int    padding;      // make this structure 32 bytes -- powers of two are your friend!
 };
 
+// Node of the light hierarchy built by lightTree.cpp.  Children of an inner
+// node are stored next to each other; leaves hold exactly one light.
+struct LightTreeNode
+{
+#if defined(__cplusplus)
+  typedef optix::float3 float3;
+#endif
+  float3 bbox_min;
+  float  power;        // summed luminance of the lights below this node
+  float3 bbox_max;
+  int    child;        // index of the first child, or -(light index)-1 for a leaf
+};
+
 
@@ -27,6 +27,7 @@
  */
 
 #include <optix_world.h>
+#include "rayDifferentials.h"
 
 rtDeclareVariable(float3, bg_color, , );
 rtTextureSampler<float4, 2> envmap;
@@ -37,6 +38,9 @@ struct PerRayData_radiance
   float3 result;
   float importance;
   int depth;
+  float distance;
+  RayDifferential differential;
+  int cache_index;  // shadow_cache slot of a camera ray's pixel, -1 otherwise
 };
 
 rtDeclareVariable(PerRayData_radiance, prd_radiance, rtPayload, );
@@ -49,5 +53,6 @@ RT_PROGRAM void miss()
 	float v = 0.5f * (1.0f + sin(phi));
 
 	prd_radiance.result = make_float3(tex2D(envmap, u, v));
+	prd_radiance.distance = -1.0f;
 	//prd_radiance.result = bg_color;
 }
@@ -0,0 +1,1111 @@
+/* 
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <optix.h>
+
+#include "cpuRenderer.h"
+#include "random.h"
+#include "stb_image.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <iostream>
+#include <thread>
+
+using namespace optix;
+
+namespace cpu
+{
+
+namespace
+{
+
+const unsigned TILE_SIZE = 16;
+const int      LEAF_SIZE = 2;
+
+bool potentialIntersection( const Ray& ray, float t )
+{
+  return t > ray.tmin && t < ray.tmax;
+}
+
+float3 exp( const float3& x )
+{
+  return make_float3( expf( x.x ), expf( x.y ), expf( x.z ) );
+}
+
+uchar4 make_color( const float3& c )
+{
+  return make_uchar4( static_cast<unsigned char>( clamp( c.z, 0.0f, 1.0f )*255.99f ),  /* B */
+                      static_cast<unsigned char>( clamp( c.y, 0.0f, 1.0f )*255.99f ),  /* G */
+                      static_cast<unsigned char>( clamp( c.x, 0.0f, 1.0f )*255.99f ),  /* R */
+                      255u );                                                        /* A */
+}
+
+
+//------------------------------------------------------------------------------
+//
+// Intersectors.  Each one is a line-by-line port of the corresponding
+// intersection program; rtPotentialIntersection() becomes a (tmin, tmax) test
+// and rtReportIntersection() always accepts.
+//
+//------------------------------------------------------------------------------
+
+bool intersectSphere( const Primitive& p, const Ray& ray, Hit& hit )
+{
+  float3 center = make_float3( p.sphere );
+  float3 O = ray.origin - center;
+  float  l = 1 / length( ray.direction );
+  float3 D = ray.direction * l;
+  float radius = p.sphere.w;
+
+  float b = dot( O, D );
+  float c = dot( O, O )-radius*radius;
+  float disc = b*b-c;
+  if( disc > 0.0f )
+  {
+    float sdisc = sqrtf( disc );
+    float root1 = ( -b - sdisc );
+
+    bool do_refine = fabsf( root1 ) > 10.f * radius;
+    float root11 = 0.0f;
+
+    if( do_refine )
+    {
+      // refine root1
+      float3 O1 = O + root1 * D;
+      b = dot( O1, D );
+      c = dot( O1, O1 ) - radius*radius;
+      disc = b*b - c;
+
+      if( disc > 0.0f )
+      {
+        sdisc = sqrtf( disc );
+        root11 = ( -b - sdisc );
+      }
+    }
+
+    if( potentialIntersection( ray, ( root1 + root11 ) * l ) )
+    {
+      hit.t = ( root1 + root11 ) * l;
+      hit.shading_normal = hit.geometric_normal = ( O + ( root1 + root11 )*D )/radius;
+      return true;
+    }
+
+    float root2 = ( -b + sdisc ) + ( do_refine ? root1 : 0 );
+    if( potentialIntersection( ray, root2 * l ) )
+    {
+      hit.t = root2 * l;
+      hit.shading_normal = hit.geometric_normal = ( O + root2*D )/radius;
+      return true;
+    }
+  }
+  return false;
+}
+
+
+bool intersectTexturedSphere( const Primitive& p, const Ray& ray, Hit& hit )
+{
+  float3 center = make_float3( p.sphere );
+  float3 O = ray.origin - center;
+  float  l = 1 / length( ray.direction );
+  float3 D = ray.direction * l;
+  float radius = p.sphere.w;
+
+  float b = dot( O, D );
+  float c = dot( O, O ) - radius * radius;
+  float disc = b * b - c;
+  if( disc <= 0.0f )
+    return false;
+
+  float sdisc = sqrtf( disc );
+  float root = ( -b - sdisc );
+  if( !potentialIntersection( ray, root * l ) )
+  {
+    root = ( -b + sdisc );
+    if( !potentialIntersection( ray, root * l ) )
+      return false;
+  }
+
+  hit.t = root * l;
+  hit.shading_normal = hit.geometric_normal = ( O + root * D ) / radius;
+
+  float3 polar;
+  polar.x = dot( p.matrix_row[0], hit.geometric_normal );
+  polar.y = dot( p.matrix_row[1], hit.geometric_normal );
+  polar.z = dot( p.matrix_row[2], hit.geometric_normal );
+  polar = cart_to_pol( polar );
+
+  hit.texcoord = make_float3( polar.x * 0.5f * M_1_PIf, ( polar.y + M_PI_2f ) * M_1_PIf, polar.z / radius );
+  return true;
+}
+
+
+bool intersectSphereShell( const Primitive& p, const Ray& ray, float scene_epsilon, Hit& hit )
+{
+  float3 O = ray.origin - p.center;
+  float  l = 1 / length( ray.direction );
+  float3 D = ray.direction * l;
+
+  float b = dot( O, D );
+  float O_dot_O = dot( O, O );
+  float sqr_radius2 = p.radius2*p.radius2;
+
+  // Which sphere was hit and whether the offset points flip, per case of
+  // sphere_shell.cu
+  float t = 0.0f;
+  float radius = 0.0f;
+  bool  flip = false;
+
+  // check if we are outside of outer sphere
+  if( O_dot_O > sqr_radius2 + scene_epsilon )
+  {
+    float c = O_dot_O - sqr_radius2;
+    float root = b*b-c;
+    if( root <= 0.0f )
+      return false;
+    t = -b - sqrtf( root );
+    if( !potentialIntersection( ray, t * l ) )
+      return false;
+    radius = p.radius2;
+  }
+  // else we are inside of the outer sphere
+  else
+  {
+    float c = O_dot_O - p.radius1*p.radius1;
+    float root = b*b-c;
+    if( root > 0.0f )
+    {
+      t = -b - sqrtf( root );
+      // do we hit inner sphere from between spheres?
+      if( potentialIntersection( ray, t * l ) )
+      {
+        radius = -p.radius1;
+        flip = true;
+      }
+      else
+      {
+        t = -b + sqrtf( root );
+        // do we hit inner sphere from within both spheres?
+        if( potentialIntersection( ray, t * l ) )
+        {
+          radius = -p.radius1;
+        }
+        else
+        {
+          c = O_dot_O - sqr_radius2;
+          root = b*b-c;
+          t = -b + sqrtf( root );
+          // do we hit outer sphere from between spheres?
+          if( !potentialIntersection( ray, t * l ) )
+            return false;
+          radius = p.radius2;
+          flip = true;
+        }
+      }
+    }
+    else
+    {
+      c = O_dot_O - sqr_radius2;
+      root = b*b-c;
+      t = -b + sqrtf( root );
+      // do we hit outer sphere from between spheres?
+      if( !potentialIntersection( ray, t * l ) )
+        return false;
+      radius = p.radius2;
+      flip = true;
+    }
+  }
+
+  hit.t = t * l;
+  hit.shading_normal = hit.geometric_normal = ( O + t*D ) / radius;
+  float3 hit_p  = ray.origin + t*D;
+  float3 offset = normalize( hit.shading_normal )*scene_epsilon;
+  hit.front_hit_point = flip ? hit_p - offset : hit_p + offset;
+  hit.back_hit_point  = flip ? hit_p + offset : hit_p - offset;
+  return true;
+}
+
+
+float3 boxnormal( float t, float3 t0, float3 t1 )
+{
+  float3 neg = make_float3( t==t0.x?1:0, t==t0.y?1:0, t==t0.z?1:0 );
+  float3 pos = make_float3( t==t1.x?1:0, t==t1.y?1:0, t==t1.z?1:0 );
+  return pos-neg;
+}
+
+bool intersectBox( const Primitive& p, const Ray& ray, Hit& hit )
+{
+  float3 t0 = ( p.boxmin - ray.origin )/ray.direction;
+  float3 t1 = ( p.boxmax - ray.origin )/ray.direction;
+  float3 near = fminf( t0, t1 );
+  float3 far = fmaxf( t0, t1 );
+  float tmin = fmaxf( near );
+  float tmax = fminf( far );
+
+  if( tmin > tmax )
+    return false;
+
+  float t;
+  if( potentialIntersection( ray, tmin ) )
+    t = tmin;
+  else if( potentialIntersection( ray, tmax ) )
+    t = tmax;
+  else
+    return false;
+
+  hit.t = t;
+  hit.texcoord = make_float3( 0.0f );
+  hit.shading_normal = hit.geometric_normal = boxnormal( t, t0, t1 );
+  return true;
+}
+
+
+bool intersectParallelogram( const Primitive& p, const Ray& ray, Hit& hit )
+{
+  float3 n = make_float3( p.plane );
+  float dt = dot( ray.direction, n );
+  float t = ( p.plane.w - dot( n, ray.origin ) )/dt;
+  if( !potentialIntersection( ray, t ) )
+    return false;
+
+  float3 vi = ray.origin + ray.direction * t - p.anchor;
+  float a1 = dot( p.v1, vi );
+  if( a1 < 0 || a1 > 1 )
+    return false;
+  float a2 = dot( p.v2, vi );
+  if( a2 < 0 || a2 > 1 )
+    return false;
+
+  hit.t = t;
+  hit.shading_normal = hit.geometric_normal = n;
+  hit.texcoord = make_float3( a1, a2, 0 );
+  return true;
+}
+
+
+bool intersectTriangle( const Primitive& p, const Ray& ray, Hit& hit )
+{
+  const float3 e1 = p.vertices[1] - p.vertices[0];
+  const float3 e2 = p.vertices[2] - p.vertices[0];
+  const float3 pvec = cross( ray.direction, e2 );
+  const float det = dot( e1, pvec );
+  if( det == 0.0f )
+    return false;
+
+  const float inv_det = 1.0f / det;
+  const float3 tvec = ray.origin - p.vertices[0];
+  const float b1 = dot( tvec, pvec ) * inv_det;
+  if( b1 < 0.0f || b1 > 1.0f )
+    return false;
+
+  const float3 qvec = cross( tvec, e1 );
+  const float b2 = dot( ray.direction, qvec ) * inv_det;
+  if( b2 < 0.0f || b1 + b2 > 1.0f )
+    return false;
+
+  const float t = dot( e2, qvec ) * inv_det;
+  if( !potentialIntersection( ray, t ) )
+    return false;
+
+  // triangle_attributes from optixGeometryTriangles.cu
+  const float b0 = 1.0f - b1 - b2;
+  hit.t = t;
+  hit.geometric_normal = normalize( cross( e1, e2 ) );
+  hit.shading_normal = p.normals[1]*b1 + p.normals[2]*b2 + p.normals[0]*b0;
+  hit.texcoord = make_float3( p.texcoords[1]*b1 + p.texcoords[2]*b2 + p.texcoords[0]*b0 );
+  return true;
+}
+
+
+bool intersectPrimitive( const Primitive& p, const Ray& ray, float scene_epsilon, Hit& hit )
+{
+  switch( p.type )
+  {
+  case PRIMITIVE_SPHERE:          return intersectSphere( p, ray, hit );
+  case PRIMITIVE_SPHERE_TEXCOORD: return intersectTexturedSphere( p, ray, hit );
+  case PRIMITIVE_SPHERE_SHELL:    return intersectSphereShell( p, ray, scene_epsilon, hit );
+  case PRIMITIVE_BOX:             return intersectBox( p, ray, hit );
+  case PRIMITIVE_PARALLELOGRAM:   return intersectParallelogram( p, ray, hit );
+  case PRIMITIVE_TRIANGLE:        return intersectTriangle( p, ray, hit );
+  }
+  return false;
+}
+
+
+Aabb primitiveBounds( const Primitive& p )
+{
+  Aabb aabb;
+  switch( p.type )
+  {
+  case PRIMITIVE_SPHERE:
+  case PRIMITIVE_SPHERE_TEXCOORD:
+    aabb.set( make_float3( p.sphere ) - make_float3( p.sphere.w ),
+              make_float3( p.sphere ) + make_float3( p.sphere.w ) );
+    break;
+  case PRIMITIVE_SPHERE_SHELL:
+  {
+    float3 rad = make_float3( std::max( p.radius1, p.radius2 ) );
+    aabb.set( p.center - rad, p.center + rad );
+    break;
+  }
+  case PRIMITIVE_BOX:
+    aabb.set( p.boxmin, p.boxmax );
+    break;
+  case PRIMITIVE_PARALLELOGRAM:
+  {
+    // v1 and v2 are scaled by 1./length^2.  Rescale back to normal for the bounds computation.
+    const float3 tv1 = p.v1 / dot( p.v1, p.v1 );
+    const float3 tv2 = p.v2 / dot( p.v2, p.v2 );
+    aabb.set( p.anchor, p.anchor + tv1 );
+    aabb.include( p.anchor + tv2 );
+    aabb.include( p.anchor + tv1 + tv2 );
+    break;
+  }
+  case PRIMITIVE_TRIANGLE:
+    aabb.set( p.vertices[0], p.vertices[1] );
+    aabb.include( p.vertices[2] );
+    break;
+  }
+  return aabb;
+}
+
+
+bool intersectAabb( const Aabb& aabb, const Ray& ray, const float3& inv_dir )
+{
+  float3 t0 = ( aabb.m_min - ray.origin ) * inv_dir;
+  float3 t1 = ( aabb.m_max - ray.origin ) * inv_dir;
+  float tnear = std::max( fmaxf( fminf( t0, t1 ) ), ray.tmin );
+  float tfar  = std::min( fminf( fmaxf( t0, t1 ) ), ray.tmax );
+  return tnear <= tfar;
+}
+
+} // namespace
+
+
+//------------------------------------------------------------------------------
+//
+// Texture
+//
+//------------------------------------------------------------------------------
+
+bool Texture::load( const std::string& filename )
+{
+  int nx, ny, components;
+  unsigned char* data = stbi_load( filename.c_str(), &nx, &ny, &components, 0 );
+  if( !data )
+  {
+    std::cerr << "Texture failed to load at path: " << filename << std::endl;
+    width = height = 1;
+    texels.assign( 1, make_float4( 0.0f ) );
+    return false;
+  }
+
+  width  = nx;
+  height = ny;
+  texels.resize( width * height );
+  for( int i = 0; i < width * height; ++i )
+  {
+    // Same channel expansion as glTexImage2D with GL_RED, GL_RGB or GL_RGBA
+    const unsigned char* src = data + i*components;
+    float4 texel = make_float4( 0.0f, 0.0f, 0.0f, 1.0f );
+    texel.x = src[0] / 255.0f;
+    if( components > 1 ) texel.y = src[1] / 255.0f;
+    if( components > 2 ) texel.z = src[2] / 255.0f;
+    if( components > 3 ) texel.w = src[3] / 255.0f;
+    texels[i] = texel;
+  }
+  stbi_image_free( data );
+  return true;
+}
+
+
+float4 Texture::fetch( float u, float v ) const
+{
+  if( texels.empty() )
+    return make_float4( 0.0f );
+
+  const int x = std::min( std::max( static_cast<int>( floorf( u ) ), 0 ), width - 1 );
+  const int y = std::min( std::max( static_cast<int>( floorf( v ) ), 0 ), height - 1 );
+  return texels[y * width + x];
+}
+
+
+float4 Texture::sample( float u, float v ) const
+{
+  if( texels.empty() )
+    return make_float4( 0.0f );
+
+  const float x = u * width - 0.5f;
+  const float y = v * height - 0.5f;
+  const float fx = floorf( x );
+  const float fy = floorf( y );
+  const float ax = x - fx;
+  const float ay = y - fy;
+
+  // Repeat wrapping, also for negative coordinates
+  const int x0 = ( ( static_cast<int>( fx ) % width ) + width ) % width;
+  const int y0 = ( ( static_cast<int>( fy ) % height ) + height ) % height;
+  const int x1 = ( x0 + 1 ) % width;
+  const int y1 = ( y0 + 1 ) % height;
+
+  const float4 bottom = lerp( texels[y0 * width + x0], texels[y0 * width + x1], ax );
+  const float4 top    = lerp( texels[y1 * width + x0], texels[y1 * width + x1], ax );
+  return lerp( bottom, top, ay );
+}
+
+
+Texture Texture::downsample() const
+{
+  Texture dst;
+  dst.width  = std::max( width / 2, 1 );
+  dst.height = std::max( height / 2, 1 );
+  dst.texels.resize( dst.width * dst.height );
+  for( int y = 0; y < dst.height; ++y )
+  {
+    const int y0 = std::min( 2 * y, height - 1 );
+    const int y1 = std::min( 2 * y + 1, height - 1 );
+    for( int x = 0; x < dst.width; ++x )
+    {
+      const int x0 = std::min( 2 * x, width - 1 );
+      const int x1 = std::min( 2 * x + 1, width - 1 );
+      dst.texels[y * dst.width + x] = 0.25f * ( texels[y0 * width + x0] + texels[y0 * width + x1] +
+                                                texels[y1 * width + x0] + texels[y1 * width + x1] );
+    }
+  }
+  return dst;
+}
+
+
+void MipTexture::build( const Texture& level0 )
+{
+  levels.assign( 1, level0 );
+  while( levels.back().width > 1 || levels.back().height > 1 )
+    levels.push_back( levels.back().downsample() );
+}
+
+
+float4 MipTexture::sampleLod( float u, float v, float lod ) const
+{
+  if( levels.empty() )
+    return make_float4( 0.0f );
+
+  const float last = static_cast<float>( levels.size() - 1 );
+  lod = fminf( fmaxf( lod, 0.0f ), last );
+  const int   level = static_cast<int>( lod );
+  const float blend = lod - level;
+  if( blend == 0.0f )
+    return levels[level].sample( u, v );
+  return lerp( levels[level].sample( u, v ), levels[level+1].sample( u, v ), blend );
+}
+
+
+//------------------------------------------------------------------------------
+//
+// Scene
+//
+//------------------------------------------------------------------------------
+
+Scene::Scene()
+  : Kd_map_density( 0.0f ),
+    ambient_light_color( make_float3( 0.0f ) ),
+    scene_epsilon( 1.e-4f ),
+    max_depth( 10 )
+{
+}
+
+
+int Scene::addMaterial( const Material& material )
+{
+  m_materials.push_back( material );
+  return static_cast<int>( m_materials.size() ) - 1;
+}
+
+
+void Scene::addSphere( const float4& sphere, int material )
+{
+  Primitive p = Primitive();
+  p.type = PRIMITIVE_SPHERE;
+  p.material = material;
+  p.sphere = sphere;
+  m_primitives.push_back( p );
+}
+
+
+void Scene::addTexturedSphere( const float4& sphere, const float3& row0,
+                               const float3& row1, const float3& row2, int material )
+{
+  Primitive p = Primitive();
+  p.type = PRIMITIVE_SPHERE_TEXCOORD;
+  p.material = material;
+  p.sphere = sphere;
+  p.matrix_row[0] = row0;
+  p.matrix_row[1] = row1;
+  p.matrix_row[2] = row2;
+  m_primitives.push_back( p );
+}
+
+
+void Scene::addSphereShell( const float3& center, float radius1, float radius2, int material )
+{
+  Primitive p = Primitive();
+  p.type = PRIMITIVE_SPHERE_SHELL;
+  p.material = material;
+  p.center = center;
+  p.radius1 = radius1;
+  p.radius2 = radius2;
+  m_primitives.push_back( p );
+}
+
+
+void Scene::addBox( const float3& boxmin, const float3& boxmax, int material )
+{
+  Primitive p = Primitive();
+  p.type = PRIMITIVE_BOX;
+  p.material = material;
+  p.boxmin = boxmin;
+  p.boxmax = boxmax;
+  m_primitives.push_back( p );
+}
+
+
+void Scene::addParallelogram( const float3& anchor, const float3& v1, const float3& v2, int material )
+{
+  // Same parameterization as the parallelogram setup in createGeometry()
+  float3 normal = normalize( cross( v1, v2 ) );
+  float d = dot( normal, anchor );
+
+  Primitive p = Primitive();
+  p.type = PRIMITIVE_PARALLELOGRAM;
+  p.material = material;
+  p.plane = make_float4( normal, d );
+  p.v1 = v1 * ( 1.0f / dot( v1, v1 ) );
+  p.v2 = v2 * ( 1.0f / dot( v2, v2 ) );
+  p.anchor = anchor;
+  m_primitives.push_back( p );
+}
+
+
+void Scene::addTriangles( const float3* vertices, const float3* normals, const float2* texcoords,
+                          const unsigned* indices, unsigned num_triangles, int material )
+{
+  for( unsigned i = 0; i < num_triangles; ++i )
+  {
+    Primitive p = Primitive();
+    p.type = PRIMITIVE_TRIANGLE;
+    p.material = material;
+    for( int k = 0; k < 3; ++k )
+    {
+      const unsigned idx = indices[3*i + k];
+      p.vertices[k]  = vertices[idx];
+      p.normals[k]   = normals[idx];
+      p.texcoords[k] = texcoords[idx];
+    }
+    m_primitives.push_back( p );
+  }
+}
+
+
+void Scene::build()
+{
+  const int count = static_cast<int>( m_primitives.size() );
+
+  std::vector<Aabb>   bounds( count );
+  std::vector<float3> centroids( count );
+  m_indices.resize( count );
+  for( int i = 0; i < count; ++i )
+  {
+    bounds[i]    = primitiveBounds( m_primitives[i] );
+    centroids[i] = bounds[i].center();
+    m_indices[i] = i;
+  }
+
+  m_nodes.clear();
+  m_nodes.reserve( 2 * std::max( count, 1 ) );
+  if( count > 0 )
+    buildNode( 0, count, bounds, centroids );
+}
+
+
+int Scene::buildNode( int first, int count, const std::vector<Aabb>& bounds,
+                      const std::vector<float3>& centroids )
+{
+  const int index = static_cast<int>( m_nodes.size() );
+  m_nodes.push_back( Node() );
+
+  Aabb node_bounds;
+  Aabb centroid_bounds;
+  for( int i = first; i < first + count; ++i )
+  {
+    node_bounds.include( bounds[m_indices[i]] );
+    centroid_bounds.include( centroids[m_indices[i]] );
+  }
+
+  Node node;
+  node.bounds = node_bounds;
+  node.left = node.right = -1;
+  node.first = first;
+  node.count = count;
+
+  if( count > LEAF_SIZE )
+  {
+    // Median split along the longest centroid axis
+    const float3 extent = centroid_bounds.m_max - centroid_bounds.m_min;
+    int axis = 0;
+    if( extent.y > extent.x ) axis = 1;
+    if( extent.z > ( axis == 0 ? extent.x : extent.y ) ) axis = 2;
+
+    const int mid = first + count / 2;
+    std::nth_element( m_indices.begin() + first, m_indices.begin() + mid, m_indices.begin() + first + count,
+      [&centroids, axis]( int a, int b ) {
+        const float* ca = &centroids[a].x;
+        const float* cb = &centroids[b].x;
+        return ca[axis] < cb[axis];
+      } );
+
+    node.left  = buildNode( first, mid - first, bounds, centroids );
+    node.right = buildNode( mid, first + count - mid, bounds, centroids );
+    node.count = 0;
+  }
+
+  m_nodes[index] = node;
+  return index;
+}
+
+
+template<typename Visitor>
+void Scene::traverse( const Ray& ray_in, Visitor& visitor ) const
+{
+  if( m_nodes.empty() )
+    return;
+
+  Ray ray = ray_in;
+  const float3 inv_dir = make_float3( 1.0f ) / ray.direction;
+
+  int stack[64];
+  int stack_size = 0;
+  stack[stack_size++] = 0;
+  while( stack_size > 0 )
+  {
+    const Node& node = m_nodes[stack[--stack_size]];
+    if( !intersectAabb( node.bounds, ray, inv_dir ) )
+      continue;
+
+    if( node.left < 0 )
+    {
+      for( int i = node.first; i < node.first + node.count; ++i )
+      {
+        if( !visitor( m_indices[i], ray ) )
+          return;
+      }
+    }
+    else
+    {
+      stack[stack_size++] = node.right;
+      stack[stack_size++] = node.left;
+    }
+  }
+}
+
+
+namespace
+{
+
+struct ClosestHitVisitor
+{
+  const Scene& scene;
+  Hit&         hit;
+  bool         found;
+
+  ClosestHitVisitor( const Scene& s, Hit& h ) : scene( s ), hit( h ), found( false ) {}
+
+  bool operator()( int index, Ray& ray )
+  {
+    Hit candidate = Hit();
+    if( intersectPrimitive( scene.primitive( index ), ray, scene.scene_epsilon, candidate ) )
+    {
+      candidate.primitive = index;
+      hit = candidate;
+      ray.tmax = candidate.t;
+      found = true;
+    }
+    return true;
+  }
+};
+
+struct ShadowVisitor
+{
+  const Scene& scene;
+  float3       attenuation;
+
+  explicit ShadowVisitor( const Scene& s ) : scene( s ), attenuation( make_float3( 1.0f ) ) {}
+
+  bool operator()( int index, Ray& ray )
+  {
+    const Primitive& p = scene.primitive( index );
+    Hit hit = Hit();
+    if( !intersectPrimitive( p, ray, scene.scene_epsilon, hit ) )
+      return true;
+
+    const Material& m = scene.material( p.material );
+    if( m.type != MATERIAL_GLASS )
+    {
+      // phongShadowed(): opaque materials fully attenuate shadow rays
+      attenuation = make_float3( 0.0f );
+      return false;
+    }
+
+    // glass.cu any_hit_shadow
+    float3 world_normal = normalize( hit.shading_normal );
+    float nDi = fabsf( dot( world_normal, ray.direction ) );
+    attenuation *= 1-fresnel_schlick( nDi, 5, 1-m.glass.shadow_attenuation, make_float3( 1 ) );
+    return luminance( attenuation ) >= m.glass.importance_cutoff;
+  }
+};
+
+} // namespace
+
+
+bool Scene::intersect( const Ray& ray, Hit& hit ) const
+{
+  ClosestHitVisitor visitor( *this, hit );
+  traverse( ray, visitor );
+  return visitor.found;
+}
+
+
+float3 Scene::shadowAttenuation( const Ray& ray ) const
+{
+  ShadowVisitor visitor( *this );
+  traverse( ray, visitor );
+  return visitor.attenuation;
+}
+
+
+//------------------------------------------------------------------------------
+//
+// Renderer
+//
+//------------------------------------------------------------------------------
+
+Renderer::Renderer( const Scene& scene, unsigned num_threads )
+  : m_scene( scene ),
+    m_num_threads( num_threads )
+{
+  if( m_num_threads == 0 )
+    m_num_threads = std::max( 1u, std::thread::hardware_concurrency() );
+}
+
+
+void Renderer::launch( const Camera& camera, unsigned frame, unsigned width, unsigned height,
+                       float4* accum_buffer, uchar4* output_buffer ) const
+{
+  const unsigned tiles_x = ( width  + TILE_SIZE - 1 ) / TILE_SIZE;
+  const unsigned tiles_y = ( height + TILE_SIZE - 1 ) / TILE_SIZE;
+  const unsigned num_tiles = tiles_x * tiles_y;
+
+  // Workers pull tiles from a shared counter so that expensive tiles (glass)
+  // do not stall the others.
+  std::atomic<unsigned> next_tile( 0 );
+  auto worker = [&]()
+  {
+    for( unsigned tile = next_tile++; tile < num_tiles; tile = next_tile++ )
+    {
+      const unsigned x0 = ( tile % tiles_x ) * TILE_SIZE;
+      const unsigned y0 = ( tile / tiles_x ) * TILE_SIZE;
+      renderTile( camera, frame, width, height, x0, y0,
+                  std::min( x0 + TILE_SIZE, width ), std::min( y0 + TILE_SIZE, height ),
+                  accum_buffer, output_buffer );
+    }
+  };
+
+  const unsigned num_workers = std::min( m_num_threads, num_tiles );
+  std::vector<std::thread> threads;
+  for( unsigned i = 1; i < num_workers; ++i )
+    threads.push_back( std::thread( worker ) );
+  worker();
+  for( size_t i = 0; i < threads.size(); ++i )
+    threads[i].join();
+}
+
+
+void Renderer::renderTile( const Camera& camera, unsigned frame, unsigned width, unsigned height,
+                           unsigned x0, unsigned y0, unsigned x1, unsigned y1,
+                           float4* accum_buffer, uchar4* output_buffer ) const
+{
+  const float2 screen = make_float2( static_cast<float>( width ), static_cast<float>( height ) );
+  for( unsigned y = y0; y < y1; ++y )
+  {
+    for( unsigned x = x0; x < x1; ++x )
+    {
+      // pinhole_camera from accum_camera.cu
+      unsigned int seed = tea<16>( width*y+x, frame );
+
+      // Draw the jitter in the same order as the device code does.
+      float2 subpixel_jitter = make_float2( 0.0f, 0.0f );
+      if( frame != 0 )
+      {
+        subpixel_jitter.x = rnd( seed ) - 0.5f;
+        subpixel_jitter.y = rnd( seed ) - 0.5f;
+      }
+
+      float2 d = ( make_float2( static_cast<float>( x ), static_cast<float>( y ) ) + subpixel_jitter ) / screen * 2.f - 1.f;
+      Ray ray;
+      ray.origin    = camera.eye;
+      ray.direction = normalize( d.x*camera.U + d.y*camera.V + camera.W );
+      ray.tmin      = m_scene.scene_epsilon;
+      ray.tmax      = RT_DEFAULT_MAX;
+
+      // One pixel step moves d by 2/screen
+      const RayDifferential differential = cameraRayDifferential( d.x*camera.U + d.y*camera.V + camera.W,
+                                                                  camera.U * ( 2.f / screen.x ),
+                                                                  camera.V * ( 2.f / screen.y ) );
+
+      const float3 result = traceRadiance( ray, differential, 1.0f, 0 );
+
+      const size_t idx = static_cast<size_t>( y ) * width + x;
+      float4 acc_val = accum_buffer[idx];
+      if( frame > 0 )
+        acc_val = lerp( acc_val, make_float4( result, 0.f ), 1.0f / static_cast<float>( frame+1 ) );
+      else
+        acc_val = make_float4( result, 0.f );
+      output_buffer[idx] = make_color( make_float3( acc_val ) );
+      accum_buffer[idx] = acc_val;
+    }
+  }
+}
+
+
+float3 Renderer::traceRadiance( const Ray& ray, const RayDifferential& differential,
+                                float importance, int depth ) const
+{
+  Hit hit;
+  if( !m_scene.intersect( ray, hit ) )
+    return miss( ray );
+
+  const Material& m = m_scene.material( m_scene.primitive( hit.primitive ).material );
+  if( m.type == MATERIAL_GLASS )
+    return shadeGlass( ray, hit, m.glass, differential, importance, depth );
+
+  float3 world_shading_normal   = normalize( hit.shading_normal );
+  float3 world_geometric_normal = normalize( hit.geometric_normal );
+  hit.shading_normal = faceforward( world_shading_normal, -ray.direction, world_geometric_normal );
+
+  switch( m.type )
+  {
+  case MATERIAL_PHONG_TEXTURED:
+  {
+    // sampleKd from phong.cu
+    RayDifferential footprint = differential;
+    transferRayDifferential( footprint, ray.direction, hit.t, hit.shading_normal );
+    const float lod = log2f( fmaxf( footprintWidth( footprint ) * m_scene.Kd_map_density, 1.0f ) );
+    const float3 Kd_val = make_float3( m_scene.Kd_map.sampleLod( hit.texcoord.x, hit.texcoord.y, lod ) );
+    return shadePhong( ray, hit, m.phong[0], Kd_val, differential, importance, depth );
+  }
+  case MATERIAL_CHECKER:
+  {
+    float3 t = hit.texcoord * m.inv_checker_size;
+    int which_check = ( static_cast<int>( floorf( t.x ) ) +
+                        static_cast<int>( floorf( t.y ) ) +
+                        static_cast<int>( floorf( t.z ) ) ) & 1;
+    const PhongParams& params = which_check ? m.phong[0] : m.phong[1];
+    return shadePhong( ray, hit, params, params.Kd, differential, importance, depth );
+  }
+  default:
+    return shadePhong( ray, hit, m.phong[0], m.phong[0].Kd, differential, importance, depth );
+  }
+}
+
+
+float3 Renderer::shadePhong( const Ray& ray, const Hit& hit, const PhongParams& params,
+                             const float3& Kd, const RayDifferential& differential,
+                             float importance, int depth ) const
+{
+  // phongShade from phong.h; hit.shading_normal is the face-forwarded normal.
+  const float3 p_normal = hit.shading_normal;
+  float3 hit_point = ray.origin + hit.t * ray.direction;
+
+  // ambient contribution
+  float3 result = params.Ka * m_scene.ambient_light_color;
+
+  // compute direct lighting
+  for( size_t i = 0; i < m_scene.lights.size(); ++i )
+  {
+    const BasicLight& light = m_scene.lights[i];
+    float Ldist = length( light.pos - hit_point );
+    float3 L = normalize( light.pos - hit_point );
+    float nDl = dot( p_normal, L );
+
+    // cast shadow ray
+    float3 light_attenuation = make_float3( static_cast<float>( nDl > 0.0f ) );
+    if( nDl > 0.0f && light.casts_shadow )
+    {
+      Ray shadow_ray;
+      shadow_ray.origin    = hit_point;
+      shadow_ray.direction = L;
+      shadow_ray.tmin      = m_scene.scene_epsilon;
+      shadow_ray.tmax      = Ldist;
+      light_attenuation = m_scene.shadowAttenuation( shadow_ray );
+    }
+
+    // If not completely shadowed, light the hit point
+    if( fmaxf( light_attenuation ) > 0.0f )
+    {
+      float3 Lc = light.color * light_attenuation;
+
+      result += Kd * nDl * Lc;
+
+      float3 H = normalize( L - ray.direction );
+      float nDh = dot( p_normal, H );
+      if( nDh > 0 )
+      {
+        float power = powf( nDh, params.phong_exp );
+        result += params.Ks * power * Lc;
+      }
+    }
+  }
+
+  if( fmaxf( params.Kr ) > 0 )
+  {
+    // ray tree attenuation
+    float new_importance = importance * luminance( params.Kr );
+    int   new_depth = depth + 1;
+
+    // reflection ray
+    if( new_importance >= 0.01f && new_depth <= m_scene.max_depth )
+    {
+      Ray refl_ray;
+      refl_ray.origin    = hit_point;
+      refl_ray.direction = reflect( ray.direction, p_normal );
+      refl_ray.tmin      = m_scene.scene_epsilon;
+      refl_ray.tmax      = RT_DEFAULT_MAX;
+      RayDifferential refl_differential = differential;
+      transferRayDifferential( refl_differential, ray.direction, hit.t, p_normal );
+      reflectRayDifferential( refl_differential, ray.direction, p_normal );
+      result += params.Kr * traceRadiance( refl_ray, refl_differential, new_importance, new_depth );
+    }
+  }
+
+  return result;
+}
+
+
+float3 Renderer::shadeGlass( const Ray& ray, const Hit& hit, const GlassParams& params,
+                             const RayDifferential& ray_differential, float importance, int depth ) const
+{
+  // closest_hit_radiance from glass.cu
+  const float3 n = normalize( hit.shading_normal );
+  const float3 i = ray.direction;
+  float3 t;
+  float3 r;
+
+  float reflection = 1.0f;
+  float3 result = make_float3( 0.0f );
+
+  // Footprint at the hit, shared by the refracted and reflected rays
+  RayDifferential differential = ray_differential;
+  transferRayDifferential( differential, i, hit.t, n );
+
+  float3 beer_attenuation;
+  if( dot( n, ray.direction ) > 0 )
+  {
+    // Beer's law attenuation
+    beer_attenuation = exp( params.extinction_constant * hit.t );
+  }
+  else
+  {
+    beer_attenuation = make_float3( 1 );
+  }
+
+  Ray next;
+  next.tmin = 0.0f;
+  next.tmax = RT_DEFAULT_MAX;
+
+  // refraction
+  if( depth < std::min( params.refraction_maxdepth, m_scene.max_depth ) )
+  {
+    if( refract( t, i, n, params.refraction_index ) )
+    {
+      // check for external or internal reflection
+      float cos_theta = dot( i, n );
+      if( cos_theta < 0.0f )
+        cos_theta = -cos_theta;
+      else
+        cos_theta = dot( t, n );
+
+      reflection = fresnel_schlick( cos_theta, params.fresnel_exponent, params.fresnel_minimum, params.fresnel_maximum );
+
+      float new_importance = importance * ( 1.0f-reflection ) * luminance( params.refraction_color * beer_attenuation );
+      float3 color = params.cutoff_color;
+      if( new_importance > params.importance_cutoff )
+      {
+        next.origin = hit.back_hit_point;
+        next.direction = t;
+        RayDifferential refracted = differential;
+        refractRayDifferential( refracted, i, t, n, params.refraction_index );
+        color = traceRadiance( next, refracted, new_importance, depth+1 );
+      }
+      result += ( 1.0f - reflection ) * params.refraction_color * color;
+    }
+    // else TIR
+  } // else reflection==1 so refraction has 0 weight
+
+  // reflection
+  float3 color = params.cutoff_color;
+  if( depth < std::min( params.reflection_maxdepth, m_scene.max_depth ) )
+  {
+    r = reflect( i, n );
+
+    float new_importance = importance * reflection * luminance( params.reflection_color * beer_attenuation );
+    if( new_importance > params.importance_cutoff )
+    {
+      next.origin = hit.front_hit_point;
+      next.direction = r;
+      RayDifferential reflected = differential;
+      reflectRayDifferential( reflected, i, n );
+      color = traceRadiance( next, reflected, new_importance, depth+1 );
+    }
+  }
+  result += reflection * params.reflection_color * color;
+
+  return result * beer_attenuation;
+}
+
+
+float3 Renderer::miss( const Ray& ray ) const
+{
+  // miss from constantbg.cu
+  float theta = atan2f( ray.direction.x, ray.direction.z );
+  float phi = M_PIf * 0.5f - acosf( ray.direction.y );
+  float u = ( theta + M_PIf ) * ( 0.5f * M_1_PIf );
+  float v = 0.5f * ( 1.0f + sinf( phi ) );
+
+  return make_float3( m_scene.envmap.fetch( u, v ) );
+}
+
+} // namespace cpu
@@ -0,0 +1,315 @@
+/* 
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//-----------------------------------------------------------------------------
+//
+// cpuRenderer: CPU reference backend for optixWhitted.  Reproduces the
+// pinhole_camera ray generation program, the glass, phong and checker
+// materials, the constantbg miss program and the sphere, sphere_texcoord,
+// sphere_shell, box, parallelogram and GeometryTriangles intersectors on the
+// host, so that regression renders can be produced without a GPU.
+//
+//-----------------------------------------------------------------------------
+
+#pragma once
+
+#include <optixu/optixu_math_namespace.h>
+#include <optixu/optixu_aabb_namespace.h>
+
+#include "common.h"
+#include "rayDifferentials.h"
+
+#include <string>
+#include <vector>
+
+namespace cpu
+{
+
+struct Ray
+{
+  optix::float3 origin;
+  optix::float3 direction;
+  float         tmin;
+  float         tmax;
+};
+
+
+// Attributes reported by an intersector.  Mirrors the attribute variables
+// declared by the intersection programs and read by the material programs.
+struct Hit
+{
+  float         t;
+  int           primitive;
+  optix::float3 geometric_normal;
+  optix::float3 shading_normal;
+  optix::float3 texcoord;
+  optix::float3 front_hit_point;  // sphere_shell only
+  optix::float3 back_hit_point;   // sphere_shell only
+};
+
+
+// Host copy of an image bound through SetTexture() in optixWhitted.cpp, sampled
+// the same way: RT_TEXTURE_INDEX_ARRAY_INDEX, RT_FILTER_NEAREST and
+// RT_WRAP_CLAMP_TO_EDGE.
+struct Texture
+{
+  int                        width;
+  int                        height;
+  std::vector<optix::float4> texels;
+
+  Texture() : width( 0 ), height( 0 ) {}
+
+  // Returns false and leaves a single black texel if the file cannot be read.
+  bool load( const std::string& filename );
+
+  // Nearest texel at unnormalized coordinates, clamped to the edge
+  optix::float4 fetch( float u, float v ) const;
+
+  // Bilinear lookup at normalized, repeating coordinates
+  optix::float4 sample( float u, float v ) const;
+
+  // Halves both dimensions with a box filter, clamping at odd edges
+  Texture downsample() const;
+};
+
+
+// Mip chain of the Kd_map built by createMipmappedTexture() in
+// optixWhitted.cpp, sampled like rtTex2DLod with RT_FILTER_LINEAR for all
+// filters: bilinear within a level and linear between levels.
+struct MipTexture
+{
+  std::vector<Texture> levels;  // level 0 first, down to 1x1
+
+  // Builds the chain down from level0
+  void build( const Texture& level0 );
+
+  // Trilinear lookup at normalized, repeating coordinates; lod is clamped
+  // to the chain
+  optix::float4 sampleLod( float u, float v, float lod ) const;
+};
+
+
+enum MaterialType
+{
+  MATERIAL_PHONG,           // phong.cu closest_hit_radiance
+  MATERIAL_PHONG_TEXTURED,  // phong.cu closest_hit_radiance_textured
+  MATERIAL_CHECKER,         // checker.cu closest_hit_radiance
+  MATERIAL_GLASS            // glass.cu closest_hit_radiance
+};
+
+struct PhongParams
+{
+  optix::float3 Ka;
+  optix::float3 Kd;
+  optix::float3 Ks;
+  optix::float3 Kr;
+  float         phong_exp;
+};
+
+struct GlassParams
+{
+  float         importance_cutoff;
+  optix::float3 cutoff_color;
+  float         fresnel_exponent;
+  float         fresnel_minimum;
+  float         fresnel_maximum;
+  float         refraction_index;
+  optix::float3 refraction_color;
+  optix::float3 reflection_color;
+  int           refraction_maxdepth;
+  int           reflection_maxdepth;
+  optix::float3 extinction_constant;
+  optix::float3 shadow_attenuation;
+};
+
+struct Material
+{
+  MaterialType  type;
+  PhongParams   phong[2];          // phong uses [0]; checker uses [0] for Kd1.. and [1] for Kd2..
+  optix::float3 inv_checker_size;  // checker only
+  GlassParams   glass;             // glass only
+};
+
+
+enum PrimitiveType
+{
+  PRIMITIVE_SPHERE,            // sphere.cu robust_intersect
+  PRIMITIVE_SPHERE_TEXCOORD,   // sphere_texcoord.cu robust_intersect
+  PRIMITIVE_SPHERE_SHELL,      // sphere_shell.cu intersect
+  PRIMITIVE_BOX,               // box.cu box_intersect
+  PRIMITIVE_PARALLELOGRAM,     // parallelogram.cu intersect
+  PRIMITIVE_TRIANGLE           // GeometryTriangles + triangle_attributes
+};
+
+struct Primitive
+{
+  PrimitiveType type;
+  int           material;
+
+  // sphere, sphere_texcoord: center and radius
+  optix::float4 sphere;
+  // sphere_texcoord: rotation applied before computing polar texcoords
+  optix::float3 matrix_row[3];
+  // sphere_shell
+  optix::float3 center;
+  float         radius1;
+  float         radius2;
+  // box
+  optix::float3 boxmin;
+  optix::float3 boxmax;
+  // parallelogram, with v1 and v2 pre-scaled as in createGeometry()
+  optix::float4 plane;
+  optix::float3 v1;
+  optix::float3 v2;
+  optix::float3 anchor;
+  // triangle
+  optix::float3 vertices[3];
+  optix::float3 normals[3];
+  optix::float2 texcoords[3];
+};
+
+
+//------------------------------------------------------------------------------
+//
+// Scene: primitives, materials, lights and textures plus a BVH over the
+// primitive bounds.  Call build() after the last add*() call.
+//
+//------------------------------------------------------------------------------
+
+class Scene
+{
+public:
+  Scene();
+
+  int  addMaterial( const Material& material );
+
+  void addSphere( const optix::float4& sphere, int material );
+  void addTexturedSphere( const optix::float4& sphere, const optix::float3& row0,
+                          const optix::float3& row1, const optix::float3& row2, int material );
+  void addSphereShell( const optix::float3& center, float radius1, float radius2, int material );
+  void addBox( const optix::float3& boxmin, const optix::float3& boxmax, int material );
+  void addParallelogram( const optix::float3& anchor, const optix::float3& v1,
+                         const optix::float3& v2, int material );
+  void addTriangles( const optix::float3* vertices, const optix::float3* normals,
+                     const optix::float2* texcoords, const unsigned* indices,
+                     unsigned num_triangles, int material );
+
+  void build();
+
+  // Closest intersection along the ray, or false on a miss.
+  bool intersect( const Ray& ray, Hit& hit ) const;
+
+  // Shadow ray transmission, evaluating the any_hit_shadow programs of every
+  // primitive hit along the ray.
+  optix::float3 shadowAttenuation( const Ray& ray ) const;
+
+  const Material& material( int index ) const { return m_materials[index]; }
+  const Primitive& primitive( int index ) const { return m_primitives[index]; }
+
+  // Context variables used by the programs
+  std::vector<BasicLight> lights;
+  Texture                 envmap;
+  MipTexture              Kd_map;
+  float                   Kd_map_density;  // level 0 texels per world unit
+  optix::float3           ambient_light_color;
+  float                   scene_epsilon;
+  int                     max_depth;
+
+private:
+  struct Node
+  {
+    optix::Aabb bounds;
+    int         left;        // child index for inner nodes, -1 for leaves
+    int         right;
+    int         first;       // first index into m_indices for leaves
+    int         count;
+  };
+
+  int  buildNode( int first, int count, const std::vector<optix::Aabb>& bounds,
+                  const std::vector<optix::float3>& centroids );
+
+  template<typename Visitor>
+  void traverse( const Ray& ray, Visitor& visitor ) const;
+
+  std::vector<Material>  m_materials;
+  std::vector<Primitive> m_primitives;
+  std::vector<Node>      m_nodes;
+  std::vector<int>       m_indices;
+};
+
+
+struct Camera
+{
+  optix::float3 eye;
+  optix::float3 U;
+  optix::float3 V;
+  optix::float3 W;
+};
+
+
+//------------------------------------------------------------------------------
+//
+// Renderer: runs the equivalent of context->launch( 0, width, height ) for the
+// accumulating pinhole camera on a tile-based pool of worker threads.  Every
+// pixel uses the same tea<16> seed as the GPU path.
+//
+//------------------------------------------------------------------------------
+
+class Renderer
+{
+public:
+  // num_threads == 0 selects one thread per hardware thread.
+  explicit Renderer( const Scene& scene, unsigned num_threads = 0 );
+
+  // accum_buffer and output_buffer are width*height, row-major, row 0 at the
+  // bottom of the image as in the OptiX buffers.  output_buffer holds BGRA.
+  void launch( const Camera& camera, unsigned frame, unsigned width, unsigned height,
+               optix::float4* accum_buffer, optix::uchar4* output_buffer ) const;
+
+  unsigned numThreads() const { return m_num_threads; }
+
+private:
+  void renderTile( const Camera& camera, unsigned frame, unsigned width, unsigned height,
+                   unsigned x0, unsigned y0, unsigned x1, unsigned y1,
+                   optix::float4* accum_buffer, optix::uchar4* output_buffer ) const;
+
+  // differential is that of ray, as in the radiance payloads
+  optix::float3 traceRadiance( const Ray& ray, const RayDifferential& differential,
+                               float importance, int depth ) const;
+  optix::float3 shadePhong( const Ray& ray, const Hit& hit, const PhongParams& params,
+                            const optix::float3& Kd, const RayDifferential& differential,
+                            float importance, int depth ) const;
+  optix::float3 shadeGlass( const Ray& ray, const Hit& hit, const GlassParams& params,
+                            const RayDifferential& differential, float importance, int depth ) const;
+  optix::float3 miss( const Ray& ray ) const;
+
+  const Scene& m_scene;
+  unsigned     m_num_threads;
+};
+
+} // namespace cpu
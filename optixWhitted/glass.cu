@@ -30,6 +30,10 @@
 #include <optixu/optixu_math_namespace.h>
 #include <common.h>
 #include "helpers.h"
+#include "iterative.h"
+#include "materials.h"
+#include "random.h"
+#include "rayDifferentials.h"
 
 using namespace optix;
 
@@ -43,23 +47,14 @@ rtDeclareVariable(float3, back_hit_point, attribute back_hit_point, );
 rtDeclareVariable(optix::Ray, ray, rtCurrentRay, );
 rtDeclareVariable(float, t_hit, rtIntersectionDistance, );
 
-rtDeclareVariable(float,        importance_cutoff, , );
-rtDeclareVariable(float3,       cutoff_color, , );
-rtDeclareVariable(float,        fresnel_exponent, , );
-rtDeclareVariable(float,        fresnel_minimum, , );
-rtDeclareVariable(float,        fresnel_maximum, , );
-rtDeclareVariable(float,        refraction_index, , );
-rtDeclareVariable(int,          refraction_maxdepth, , );
-rtDeclareVariable(int,          reflection_maxdepth, , );
-rtDeclareVariable(float3,       refraction_color, , );
-rtDeclareVariable(float3,       reflection_color, , );
-rtDeclareVariable(float3,       extinction_constant, , );
-
 struct PerRayData_radiance
 {
   float3 result;
   float importance;
   int depth;
+  float distance;
+  RayDifferential differential;
+  int cache_index;  // shadow_cache slot of a camera ray's pixel, -1 otherwise
 };
 
 struct PerRayData_shadow
@@ -69,15 +64,19 @@ struct PerRayData_shadow
 
 rtDeclareVariable(PerRayData_radiance, prd_radiance, rtPayload, );
 rtDeclareVariable(PerRayData_shadow,   prd_shadow,   rtPayload, );
+rtDeclareVariable(PerRayData_radiance_iterative, prd_iterative, rtPayload, );
 
 // -----------------------------------------------------------------------------
 
-static __device__ __inline__ float3 TraceRay(float3 origin, float3 direction, int depth, float importance )
+static __device__ __inline__ float3 TraceRay(float3 origin, float3 direction, int depth, float importance,
+                                             const RayDifferential& differential )
 {
   optix::Ray ray = optix::make_Ray( origin, direction, RADIANCE_RAY_TYPE, 0.0f, RT_DEFAULT_MAX );
   PerRayData_radiance prd;
   prd.depth = depth;
   prd.importance = importance;
+  prd.differential = differential;
+  prd.cache_index = -1;
 
   rtTrace( top_object, ray, prd );
   return prd.result;
@@ -88,6 +87,43 @@ static __device__ __inline__ float3 exp( const float3& x )
   return make_float3(exp(x.x), exp(x.y), exp(x.z));
 }
 
+// Glass parameters of the hit primitive's material table entry
+struct GlassParams
+{
+  float  importance_cutoff;
+  float3 cutoff_color;
+  float  fresnel_exponent;
+  float  fresnel_minimum;
+  float  fresnel_maximum;
+  float  refraction_index;
+  int    refraction_maxdepth;
+  int    reflection_maxdepth;
+  float3 refraction_color;
+  float3 reflection_color;
+  float3 extinction_constant;
+};
+
+static __device__ __inline__ GlassParams glassParams( int m )
+{
+  const float4 fresnel = material_fresnel[m];
+  const float4 cutoff  = material_cutoff[m];
+  const int2   depth   = material_max_depth[m];
+
+  GlassParams g;
+  g.importance_cutoff   = cutoff.w;
+  g.cutoff_color        = make_float3( cutoff );
+  g.fresnel_exponent    = fresnel.x;
+  g.fresnel_minimum     = fresnel.y;
+  g.fresnel_maximum     = fresnel.z;
+  g.refraction_index    = fresnel.w;
+  g.refraction_maxdepth = depth.x;
+  g.reflection_maxdepth = depth.y;
+  g.refraction_color    = material_refraction_color[m];
+  g.reflection_color    = material_reflection_color[m];
+  g.extinction_constant = material_extinction[m];
+  return g;
+}
+
 // -----------------------------------------------------------------------------
 
 RT_PROGRAM void closest_hit_radiance()
@@ -104,19 +140,24 @@ RT_PROGRAM void closest_hit_radiance()
   float3 result = make_float3(0.0f);
   
   const int depth = prd_radiance.depth;
+  const GlassParams g = glassParams( materialId() );
+
+  // Footprint at the hit, shared by the refracted and reflected rays
+  RayDifferential differential = prd_radiance.differential;
+  transferRayDifferential( differential, i, t_hit, n );
 
   float3 beer_attenuation;
   if(dot(n, ray.direction) > 0) {
     // Beer's law attenuation
-    beer_attenuation = exp(extinction_constant * t_hit);
+    beer_attenuation = exp(g.extinction_constant * t_hit);
   } else {
     beer_attenuation = make_float3(1);
   }
 
   // refraction
-  if (depth < min(refraction_maxdepth, max_depth))
+  if (depth < min(g.refraction_maxdepth, max_depth))
   {
-    if ( refract(t, i, n, refraction_index) )
+    if ( refract(t, i, n, g.refraction_index) )
     {
       // check for external or internal reflection
       float cos_theta = dot(i, n);
@@ -125,45 +166,118 @@ RT_PROGRAM void closest_hit_radiance()
       else
         cos_theta = dot(t, n);
 
-      reflection = fresnel_schlick(cos_theta, fresnel_exponent, fresnel_minimum, fresnel_maximum);
+      reflection = fresnel_schlick(cos_theta, g.fresnel_exponent, g.fresnel_minimum, g.fresnel_maximum);
 
-      float importance = prd_radiance.importance * (1.0f-reflection) * optix::luminance( refraction_color * beer_attenuation );
-      float3 color = cutoff_color;
-      if ( importance > importance_cutoff ) {
-        color = TraceRay(bhp, t, depth+1, importance);
+      float importance = prd_radiance.importance * (1.0f-reflection) * optix::luminance( g.refraction_color * beer_attenuation );
+      float3 color = g.cutoff_color;
+      if ( importance > g.importance_cutoff ) {
+        RayDifferential refracted = differential;
+        refractRayDifferential( refracted, i, t, n, g.refraction_index );
+        color = TraceRay(bhp, t, depth+1, importance, refracted);
       }
-      result += (1.0f - reflection) * refraction_color * color;
+      result += (1.0f - reflection) * g.refraction_color * color;
     }
     // else TIR
   } // else reflection==1 so refraction has 0 weight
 
   // reflection
-  float3 color = cutoff_color;
-  if (depth < min(reflection_maxdepth, max_depth))
+  float3 color = g.cutoff_color;
+  if (depth < min(g.reflection_maxdepth, max_depth))
   {
     r = reflect(i, n);
   
-    float importance = prd_radiance.importance * reflection * optix::luminance( reflection_color * beer_attenuation );
-    if ( importance > importance_cutoff ) {
-      color = TraceRay( fhp, r, depth+1, importance );
+    float importance = prd_radiance.importance * reflection * optix::luminance( g.reflection_color * beer_attenuation );
+    if ( importance > g.importance_cutoff ) {
+      RayDifferential reflected = differential;
+      reflectRayDifferential( reflected, i, n );
+      color = TraceRay( fhp, r, depth+1, importance, reflected );
     }
   }
-  result += reflection * reflection_color * color;
+  result += reflection * g.reflection_color * color;
 
   result = result * beer_attenuation;
 
   prd_radiance.result = result;
+  prd_radiance.distance = t_hit;
 }
 
 // -----------------------------------------------------------------------------
 
 //
-// Attenuates shadow rays for shadowing transparent objects
+// Iterative shading: follow a single lobe, chosen with probability equal to
+// its Fresnel weight so that the continuation weight is just the lobe color.
 //
-rtDeclareVariable(float3, shadow_attenuation, , );
+RT_PROGRAM void closest_hit_radiance_iterative()
+{
+  const float3 n = normalize(rtTransformNormal(RT_OBJECT_TO_WORLD, shading_normal));
+  const float3 fhp = rtTransformPoint(RT_OBJECT_TO_WORLD, front_hit_point);
+  const float3 bhp = rtTransformPoint(RT_OBJECT_TO_WORLD, back_hit_point);
+  const float3 i = ray.direction;
+        float3 t;
+
+  const int depth = prd_iterative.depth;
+  const GlassParams g = glassParams( materialId() );
+
+  float3 beer_attenuation;
+  if(dot(n, ray.direction) > 0) {
+    // Beer's law attenuation
+    beer_attenuation = exp(g.extinction_constant * t_hit);
+  } else {
+    beer_attenuation = make_float3(1);
+  }
 
+  float reflection = 1.0f;
+  bool  can_refract = false;
+  if (depth < min(g.refraction_maxdepth, max_depth) && refract(t, i, n, g.refraction_index))
+  {
+    float cos_theta = dot(i, n);
+    if (cos_theta < 0.0f)
+      cos_theta = -cos_theta;
+    else
+      cos_theta = dot(t, n);
+
+    reflection = fresnel_schlick(cos_theta, g.fresnel_exponent, g.fresnel_minimum, g.fresnel_maximum);
+    can_refract = true;
+  }
+
+  prd_iterative.result = make_float3(0.0f);
+  prd_iterative.distance = t_hit;
+  transferRayDifferential( prd_iterative.differential, i, t_hit, n );
+
+  if (can_refract && rnd(prd_iterative.seed) >= reflection)
+  {
+    prd_iterative.origin       = bhp;
+    prd_iterative.direction    = t;
+    prd_iterative.weight       = g.refraction_color * beer_attenuation;
+    prd_iterative.continue_ray = 1;
+    refractRayDifferential( prd_iterative.differential, i, t, n, g.refraction_index );
+  }
+  else if (depth < min(g.reflection_maxdepth, max_depth))
+  {
+    prd_iterative.origin       = fhp;
+    prd_iterative.direction    = reflect(i, n);
+    prd_iterative.weight       = g.reflection_color * beer_attenuation;
+    prd_iterative.continue_ray = 1;
+    reflectRayDifferential( prd_iterative.differential, i, n );
+  }
+  else
+  {
+    // Out of depth: the recursive version substitutes cutoff_color here
+    prd_iterative.result = g.reflection_color * g.cutoff_color * beer_attenuation;
+  }
+}
+
+// -----------------------------------------------------------------------------
+
+//
+// Attenuates shadow rays for shadowing transparent objects
+//
 RT_PROGRAM void any_hit_shadow()
 {
+  const int    m                  = materialId();
+  const float3 shadow_attenuation = material_shadow_attenuation[m];
+  const float  importance_cutoff  = material_cutoff[m].w;
+
   float3 world_normal = normalize( rtTransformNormal( RT_OBJECT_TO_WORLD, shading_normal ) );
   float nDi = fabs(dot(world_normal, ray.direction));
 
@@ -0,0 +1,57 @@
+/* 
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <optixu/optixu_vector_types.h>
+
+#include "rayDifferentials.h"
+
+// Payload of the iterative shading mode.  Instead of recursing, a closest hit
+// program returns its local contribution in result and, if the path goes on,
+// a single continuation ray with the throughput weight to apply to it.  The
+// ray generation program loops over the continuation rays.  differential
+// holds the ray's differential on entry and the continuation ray's on exit.
+//
+// The leading fields match PerRayData_radiance, so the constantbg miss program
+// serves both modes; a miss leaves continue_ray at 0.
+struct PerRayData_radiance_iterative
+{
+  optix::float3 result;
+  float         importance;
+  int           depth;
+  float         distance;
+
+  optix::float3 origin;        // continuation ray
+  optix::float3 direction;
+  optix::float3 weight;        // throughput factor of the continuation ray
+  unsigned int  seed;          // for lobe selection
+  int           continue_ray;
+  RayDifferential differential;
+  int           cache_index;   // as in PerRayData_radiance
+};
@@ -0,0 +1,127 @@
+/* 
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "lightTree.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace optix;
+
+namespace
+{
+
+// Recursively fills nodes[node]; nodes may grow, so only indices are held
+// across the recursive calls.
+void buildNode( const std::vector<BasicLight>& lights, std::vector<unsigned>& order,
+                unsigned begin, unsigned end, unsigned node, std::vector<LightTreeNode>& nodes )
+{
+  if( end - begin == 1 ) {
+    const BasicLight& light = lights[order[begin]];
+    nodes[node].bbox_min = light.pos;
+    nodes[node].bbox_max = light.pos;
+    nodes[node].power    = luminance( light.color );
+    nodes[node].child    = -static_cast<int>( order[begin] ) - 1;
+    return;
+  }
+
+  float3 cmin = lights[order[begin]].pos;
+  float3 cmax = cmin;
+  for( unsigned i = begin + 1; i < end; ++i ) {
+    cmin = fminf( cmin, lights[order[i]].pos );
+    cmax = fmaxf( cmax, lights[order[i]].pos );
+  }
+  const float3 extent = cmax - cmin;
+  const int axis = extent.x > extent.y ? ( extent.x > extent.z ? 0 : 2 ) : ( extent.y > extent.z ? 1 : 2 );
+
+  const unsigned mid = begin + ( end - begin ) / 2;
+  std::nth_element( order.begin() + begin, order.begin() + mid, order.begin() + end,
+                    [&]( unsigned a, unsigned b ) {
+                      return getByIndex( lights[a].pos, axis ) < getByIndex( lights[b].pos, axis );
+                    } );
+
+  const unsigned left = static_cast<unsigned>( nodes.size() );
+  nodes.resize( nodes.size() + 2 );
+  nodes[node].child = static_cast<int>( left );
+
+  buildNode( lights, order, begin, mid, left, nodes );
+  buildNode( lights, order, mid, end, left + 1, nodes );
+
+  nodes[node].bbox_min = fminf( nodes[left].bbox_min, nodes[left + 1].bbox_min );
+  nodes[node].bbox_max = fmaxf( nodes[left].bbox_max, nodes[left + 1].bbox_max );
+  nodes[node].power    = nodes[left].power + nodes[left + 1].power;
+}
+
+Buffer createUserBuffer( Context context, size_t element_size, size_t count, const void* data )
+{
+  Buffer buffer = context->createBuffer( RT_BUFFER_INPUT );
+  buffer->setFormat( RT_FORMAT_USER );
+  buffer->setElementSize( element_size );
+  buffer->setSize( count );
+  if( count ) {
+    memcpy( buffer->map(), data, element_size * count );
+    buffer->unmap();
+  }
+  return buffer;
+}
+
+} // namespace
+
+
+std::vector<LightTreeNode> buildLightTree( const std::vector<BasicLight>& lights )
+{
+  std::vector<LightTreeNode> nodes;
+  if( lights.empty() )
+    return nodes;
+
+  std::vector<unsigned> order( lights.size() );
+  for( unsigned i = 0; i < order.size(); ++i )
+    order[i] = i;
+
+  nodes.reserve( 2 * lights.size() - 1 );
+  nodes.resize( 1 );
+  buildNode( lights, order, 0u, static_cast<unsigned>( lights.size() ), 0u, nodes );
+  return nodes;
+}
+
+
+void setLightTree( Context context, const std::vector<BasicLight>& lights,
+                   unsigned light_samples, unsigned exact_lights )
+{
+  context["lights"]->set( createUserBuffer(
+      context, sizeof( BasicLight ), lights.size(), lights.empty() ? 0 : &lights[0] ) );
+
+  std::vector<LightTreeNode> nodes;
+  if( light_samples > 0 )
+    nodes = buildLightTree( lights );
+  context["light_tree"]->set( createUserBuffer(
+      context, sizeof( LightTreeNode ), nodes.size(), nodes.empty() ? 0 : &nodes[0] ) );
+
+  context["light_samples"]->setInt( static_cast<int>( light_samples ) );
+  context["exact_lights"]->setInt( static_cast<int>( exact_lights ) );
+}
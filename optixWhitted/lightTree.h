@@ -0,0 +1,54 @@
+/* 
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//-----------------------------------------------------------------------------
+//
+// lightTree: host side of the many-light sampling in phong.h.  Builds a
+// binary hierarchy over the point lights, storing bounds and total power
+// per node, and uploads it as the light_tree buffer.
+//
+//-----------------------------------------------------------------------------
+
+#pragma once
+
+#include <optixu/optixpp_namespace.h>
+
+#include "common.h"
+
+#include <vector>
+
+// Builds the hierarchy by median split of the light positions along the
+// largest axis.  Node 0 is the root; the result is empty for no lights.
+std::vector<LightTreeNode> buildLightTree( const std::vector<BasicLight>& lights );
+
+// Uploads lights and their hierarchy and sets the sampling variables read
+// by phongDirect.  light_samples == 0 keeps the loop over every light;
+// otherwise each hit evaluates the exact_lights most important lights
+// exactly and draws light_samples stochastic samples from the tree.
+void setLightTree( optix::Context context, const std::vector<BasicLight>& lights,
+                   unsigned light_samples, unsigned exact_lights );
@@ -0,0 +1,151 @@
+/* 
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "materialTable.h"
+#include "common.h"
+
+#include <cstring>
+
+using namespace optix;
+
+
+namespace
+{
+
+template <typename T>
+void uploadColumn( Context context, Buffer& buffer, const char* name, RTformat format, const std::vector<T>& values )
+{
+  if( !buffer ) {
+    buffer = context->createBuffer( RT_BUFFER_INPUT, format, values.size() );
+    context[name]->set( buffer );
+  }
+  else {
+    buffer->setSize( values.size() );
+  }
+
+  if( !values.empty() ) {
+    memcpy( buffer->map( 0, RT_BUFFER_MAP_WRITE_DISCARD ), &values[0], values.size() * sizeof( T ) );
+    buffer->unmap();
+  }
+}
+
+} // namespace
+
+
+MaterialTable::MaterialTable( Context context )
+  : m_context( context )
+{
+}
+
+
+void MaterialTable::setPrograms( cpu::MaterialType type, Program closest_hit, Program any_hit )
+{
+  Material& material = m_materials[type];
+  if( !material )
+    material = m_context->createMaterial();
+  material->setClosestHitProgram( RADIANCE_RAY_TYPE, closest_hit );
+  material->setAnyHitProgram( SHADOW_RAY_TYPE, any_hit );
+}
+
+
+int MaterialTable::add( const cpu::Material& material )
+{
+  const int id = static_cast<int>( m_types.size() );
+  addEntry( material.type, material.phong[0], material );
+  if( material.type == cpu::MATERIAL_CHECKER )
+    addEntry( material.type, material.phong[1], material );
+  return id;
+}
+
+
+void MaterialTable::addEntry( cpu::MaterialType type, const cpu::PhongParams& phong, const cpu::Material& material )
+{
+  const cpu::GlassParams& glass = material.glass;
+
+  m_types.push_back( type );
+  m_Ka.push_back( phong.Ka );
+  m_Kd.push_back( phong.Kd );
+  m_Ks.push_back( phong.Ks );
+  m_Kr.push_back( phong.Kr );
+  m_phong_exp.push_back( phong.phong_exp );
+  m_checker_scale.push_back( material.inv_checker_size );
+  m_fresnel.push_back( make_float4( glass.fresnel_exponent, glass.fresnel_minimum, glass.fresnel_maximum,
+                                    glass.refraction_index ) );
+  m_cutoff.push_back( make_float4( glass.cutoff_color, glass.importance_cutoff ) );
+  m_max_depth.push_back( make_int2( glass.refraction_maxdepth, glass.reflection_maxdepth ) );
+  m_refraction_color.push_back( glass.refraction_color );
+  m_reflection_color.push_back( glass.reflection_color );
+  m_extinction.push_back( glass.extinction_constant );
+  m_shadow_attenuation.push_back( glass.shadow_attenuation );
+}
+
+
+void MaterialTable::assign( GeometryInstance gi, int material_id, unsigned primitive_count )
+{
+  assign( gi, std::vector<int>( primitive_count, material_id ) );
+}
+
+
+void MaterialTable::assign( GeometryInstance gi, const std::vector<int>& primitive_materials )
+{
+  if( primitive_materials.empty() )
+    throw Exception( "MaterialTable::assign: no primitives" );
+
+  const cpu::MaterialType type = m_types.at( primitive_materials[0] );
+  for( size_t i = 1; i < primitive_materials.size(); ++i ) {
+    if( m_types.at( primitive_materials[i] ) != type )
+      throw Exception( "MaterialTable::assign: primitives of one instance must share a material type" );
+  }
+  if( !m_materials[type] )
+    throw Exception( "MaterialTable::assign: no programs set for the material type" );
+
+  gi->setMaterialCount( 1 );
+  gi->setMaterial( 0, m_materials[type] );
+  gi["material_id_offset"]->setInt( static_cast<int>( m_primitive_materials.size() ) );
+  m_primitive_materials.insert( m_primitive_materials.end(), primitive_materials.begin(), primitive_materials.end() );
+}
+
+
+void MaterialTable::upload()
+{
+  unsigned column = 0;
+  uploadColumn( m_context, m_buffers[column++], "material_ids",                RT_FORMAT_INT,    m_primitive_materials );
+  uploadColumn( m_context, m_buffers[column++], "material_Ka",                 RT_FORMAT_FLOAT3, m_Ka );
+  uploadColumn( m_context, m_buffers[column++], "material_Kd",                 RT_FORMAT_FLOAT3, m_Kd );
+  uploadColumn( m_context, m_buffers[column++], "material_Ks",                 RT_FORMAT_FLOAT3, m_Ks );
+  uploadColumn( m_context, m_buffers[column++], "material_Kr",                 RT_FORMAT_FLOAT3, m_Kr );
+  uploadColumn( m_context, m_buffers[column++], "material_phong_exp",          RT_FORMAT_FLOAT,  m_phong_exp );
+  uploadColumn( m_context, m_buffers[column++], "material_checker_scale",      RT_FORMAT_FLOAT3, m_checker_scale );
+  uploadColumn( m_context, m_buffers[column++], "material_fresnel",            RT_FORMAT_FLOAT4, m_fresnel );
+  uploadColumn( m_context, m_buffers[column++], "material_cutoff",             RT_FORMAT_FLOAT4, m_cutoff );
+  uploadColumn( m_context, m_buffers[column++], "material_max_depth",          RT_FORMAT_INT2,   m_max_depth );
+  uploadColumn( m_context, m_buffers[column++], "material_refraction_color",   RT_FORMAT_FLOAT3, m_refraction_color );
+  uploadColumn( m_context, m_buffers[column++], "material_reflection_color",   RT_FORMAT_FLOAT3, m_reflection_color );
+  uploadColumn( m_context, m_buffers[column++], "material_extinction",         RT_FORMAT_FLOAT3, m_extinction );
+  uploadColumn( m_context, m_buffers[column++], "material_shadow_attenuation", RT_FORMAT_FLOAT3, m_shadow_attenuation );
+}
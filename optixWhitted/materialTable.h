@@ -0,0 +1,106 @@
+/* 
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//-----------------------------------------------------------------------------
+//
+// materialTable: host side of materials.h.  Material parameters live in one
+// structure-of-arrays table on the context, one entry per material id, and
+// every GeometryInstance carries an offset into a per-primitive id buffer.
+// Each shading model (phong, textured phong, checker, glass) has a single
+// shared Material, so adding materials only adds table entries and no
+// programs or OptiX material objects.
+//
+// Materials are described with the cpu::Material used by the CPU reference
+// renderer, so both renderers can share one scene description.
+//
+//-----------------------------------------------------------------------------
+
+#pragma once
+
+#include <optixu/optixpp_namespace.h>
+
+#include "cpuRenderer.h"
+
+#include <vector>
+
+class MaterialTable
+{
+public:
+  explicit MaterialTable( optix::Context context );
+
+  // Closest hit (radiance) and any hit (shadow) programs shared by every
+  // material of a type.  Must be set before instances of that type are
+  // assigned.
+  void setPrograms( cpu::MaterialType type, optix::Program closest_hit, optix::Program any_hit );
+
+  // Appends a material and returns its id.  A checker takes two entries,
+  // id for the first check and id+1 for the second.
+  int add( const cpu::Material& material );
+
+  // Binds gi to the shared Material of material_id's type and gives its
+  // first primitive_count primitives that material.
+  void assign( optix::GeometryInstance gi, int material_id, unsigned primitive_count = 1u );
+
+  // Per-primitive material ids.  All of them must have the same type,
+  // since a GeometryInstance is bound to one shared Material.
+  void assign( optix::GeometryInstance gi, const std::vector<int>& primitive_materials );
+
+  // Creates or resizes the table buffers and uploads every entry.  Call
+  // after the last add or assign, and again after changes.
+  void upload();
+
+  size_t size() const { return m_types.size(); }
+
+private:
+  static const unsigned TYPE_COUNT   = cpu::MATERIAL_GLASS + 1;
+  static const unsigned COLUMN_COUNT = 14;  // Buffers written by upload()
+
+  void addEntry( cpu::MaterialType type, const cpu::PhongParams& phong, const cpu::Material& material );
+
+  optix::Context              m_context;
+  optix::Material             m_materials[TYPE_COUNT];
+
+  // One element per entry, uploaded to the material_* buffers of materials.h
+  std::vector<cpu::MaterialType> m_types;
+  std::vector<optix::float3>  m_Ka;
+  std::vector<optix::float3>  m_Kd;
+  std::vector<optix::float3>  m_Ks;
+  std::vector<optix::float3>  m_Kr;
+  std::vector<float>          m_phong_exp;
+  std::vector<optix::float3>  m_checker_scale;
+  std::vector<optix::float4>  m_fresnel;
+  std::vector<optix::float4>  m_cutoff;
+  std::vector<optix::int2>    m_max_depth;
+  std::vector<optix::float3>  m_refraction_color;
+  std::vector<optix::float3>  m_reflection_color;
+  std::vector<optix::float3>  m_extinction;
+  std::vector<optix::float3>  m_shadow_attenuation;
+
+  std::vector<int>            m_primitive_materials;
+  optix::Buffer               m_buffers[COLUMN_COUNT];
+};
@@ -0,0 +1,62 @@
+/* 
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <optix.h>
+#include <optixu/optixu_math_namespace.h>
+
+// Material table written by materialTable.cpp.  Every material parameter is
+// a column indexed by material id; the id of a hit is looked up per
+// primitive through the GeometryInstance's offset into material_ids.  The
+// shared closest hit programs of a shading model read their parameters from
+// here instead of from per-Material variables.
+
+rtBuffer<int>     material_ids;
+rtDeclareVariable(int, material_id_offset, , );
+
+rtBuffer<float3>  material_Ka;
+rtBuffer<float3>  material_Kd;
+rtBuffer<float3>  material_Ks;
+rtBuffer<float3>  material_Kr;
+rtBuffer<float>   material_phong_exp;
+rtBuffer<float3>  material_checker_scale;       // Inverse checker height, width and depth in texture space
+
+// Glass
+rtBuffer<float4>  material_fresnel;             // exponent, minimum, maximum, index of refraction
+rtBuffer<float4>  material_cutoff;              // cutoff color, importance cutoff
+rtBuffer<int2>    material_max_depth;           // refraction, reflection
+rtBuffer<float3>  material_refraction_color;
+rtBuffer<float3>  material_reflection_color;
+rtBuffer<float3>  material_extinction;
+rtBuffer<float3>  material_shadow_attenuation;
+
+static __device__ __inline__ int materialId()
+{
+  return material_ids[material_id_offset + rtGetPrimitiveIndex()];
+}
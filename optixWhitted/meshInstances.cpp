@@ -0,0 +1,117 @@
+/* 
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "meshInstances.h"
+#include "materialTable.h"
+
+using namespace optix;
+
+
+InstancedMesh::InstancedMesh( Context context, GeometryTriangles geometry, MaterialTable& table )
+  : m_context( context )
+  , m_geometry( geometry )
+  , m_table( table )
+{
+  m_acceleration = m_context->createAcceleration( "Trbvh" );
+}
+
+
+GeometryGroup InstancedMesh::group( int material_id )
+{
+  std::map<int, GeometryGroup>::iterator it = m_groups.find( material_id );
+  if( it != m_groups.end() )
+    return it->second;
+
+  // Groups of the same geometry can share one acceleration structure; only
+  // the GeometryInstance, and with it the material, differs.
+  GeometryInstance gi = m_context->createGeometryInstance();
+  gi->setGeometryTriangles( m_geometry );
+  m_table.assign( gi, material_id, m_geometry->getPrimitiveCount() );
+
+  GeometryGroup gg = m_context->createGeometryGroup();
+  gg->addChild( gi );
+  gg->setAcceleration( m_acceleration );
+
+  m_groups[material_id] = gg;
+  return gg;
+}
+
+
+unsigned InstancedMesh::addInstances( Group parent, const Matrix4x4* object_to_world, unsigned count,
+                                      int material_id )
+{
+  const unsigned first = static_cast<unsigned>( m_transforms.size() );
+  if( count == 0 )
+    return first;
+
+  GeometryGroup gg = group( material_id );
+
+  unsigned parent_index = 0;
+  while( parent_index < m_parents.size() && m_parents[parent_index].get() != parent.get() )
+    ++parent_index;
+  if( parent_index == m_parents.size() )
+    m_parents.push_back( parent );
+
+  // Grow the child list once instead of per instance
+  const unsigned child = parent->getChildCount();
+  parent->setChildCount( child + count );
+
+  m_transforms.reserve( first + count );
+  m_parent_of.reserve( first + count );
+  for( unsigned i = 0; i < count; ++i ) {
+    Transform transform = m_context->createTransform();
+    transform->setChild( gg );
+    transform->setMatrix( false, object_to_world[i].getData(), 0 );
+    parent->setChild( child + i, transform );
+
+    m_transforms.push_back( transform );
+    m_parent_of.push_back( parent_index );
+  }
+
+  if( parent->getAcceleration() )
+    parent->getAcceleration()->markDirty();
+  return first;
+}
+
+
+void InstancedMesh::setTransforms( unsigned first, const Matrix4x4* object_to_world, unsigned count )
+{
+  if( first + count > m_transforms.size() )
+    throw Exception( "InstancedMesh::setTransforms: instance index out of range" );
+
+  std::vector<bool> dirty( m_parents.size(), false );
+  for( unsigned i = 0; i < count; ++i ) {
+    m_transforms[first + i]->setMatrix( false, object_to_world[i].getData(), 0 );
+    dirty[m_parent_of[first + i]] = true;
+  }
+
+  for( size_t p = 0; p < m_parents.size(); ++p ) {
+    if( dirty[p] && m_parents[p]->getAcceleration() )
+      m_parents[p]->getAcceleration()->markDirty();
+  }
+}
@@ -0,0 +1,82 @@
+/* 
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//-----------------------------------------------------------------------------
+//
+// meshInstances: placements of one triangle mesh.  The GeometryTriangles
+// and its acceleration structure exist once; every placement is a
+// Transform above a shared GeometryGroup, so memory grows with the number
+// of distinct meshes and materials and only by one Transform per instance.
+//
+//-----------------------------------------------------------------------------
+
+#pragma once
+
+#include <optixu/optixpp_namespace.h>
+#include <optixu/optixu_matrix_namespace.h>
+
+#include <map>
+#include <vector>
+
+class MaterialTable;
+
+class InstancedMesh
+{
+public:
+  // geometry is shared by all instances, in object space.  Materials are
+  // assigned through table, which must outlive the instances.
+  InstancedMesh( optix::Context context, optix::GeometryTriangles geometry, MaterialTable& table );
+
+  // Adds count instances with material_id as children of parent.
+  // object_to_world holds one matrix per instance.  Returns the index of
+  // the first new instance for setTransforms.
+  unsigned addInstances( optix::Group parent, const optix::Matrix4x4* object_to_world, unsigned count,
+                         int material_id );
+
+  // Replaces the matrices of instances [first, first + count) and marks the
+  // acceleration of their parents dirty.
+  void setTransforms( unsigned first, const optix::Matrix4x4* object_to_world, unsigned count );
+
+  size_t instanceCount() const { return m_transforms.size(); }
+
+  // GeometryGroups created so far, one per material
+  size_t groupCount() const { return m_groups.size(); }
+
+private:
+  optix::GeometryGroup group( int material_id );
+
+  optix::Context                      m_context;
+  optix::GeometryTriangles            m_geometry;
+  MaterialTable&                      m_table;
+  optix::Acceleration                 m_acceleration;  // Shared by every group
+  std::map<int, optix::GeometryGroup> m_groups;
+
+  std::vector<optix::Transform>       m_transforms;
+  std::vector<unsigned>               m_parent_of;     // Index into m_parents per instance
+  std::vector<optix::Group>           m_parents;
+};
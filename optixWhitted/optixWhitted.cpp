@@ -48,11 +48,27 @@
 #include <optixu/optixu_math_stream_namespace.h>
 
 #include <sutil.h>
+#include <ChromeTrace.h>
+#include <DynamicResolution.h>
+#include <FrameProfiler.h>
+#include <InteractiveRuntime.h>
+#include "adaptiveSampler.h"
+#include "batchRender.h"
 #include "common.h"
+#include "cpuRenderer.h"
+#include "lightTree.h"
+#include "materialTable.h"
+#include "meshInstances.h"
+#include "random.h"
+#include "shadowCache.h"
+#include "temporalReprojection.h"
 #include <Arcball.h>
 
+#include <algorithm>
+#include <cstdio>
 #include <cstring>
 #include <iostream>
+#include <sstream>
 #include <stdint.h>
 
 #define STB_IMAGE_IMPLEMENTATION
@@ -61,6 +77,7 @@
 using namespace optix;
 
 const char* const SAMPLE_NAME = "optixWhitted";
+const char* const TEXTURE_FILE = "D:/optix6.5/SDK/optixWhitted/star.bmp";
 
 //------------------------------------------------------------------------------
 //
@@ -69,14 +86,53 @@ const char* const SAMPLE_NAME = "optixWhitted";
 //------------------------------------------------------------------------------
 
 Context      context;
-uint32_t     width = 768u;
+uint32_t     width = 768u;   // Launch size
 uint32_t     height = 768u;
+uint32_t     window_width = 768u;
+uint32_t     window_height = 768u;
 bool         use_pbo = true;
+bool         use_cpu = false;
+bool         headless = false;  // No GL context; batch mode
+
+// Launches on a render thread and presents from the GLUT thread
+bool                       threaded = false;
+sutil::InteractiveRuntime* runtime = 0;
+
+// Launch size scaled to a frame time budget while the camera moves,
+// enabled when frame_budget_ms > 0
+float                     frame_budget_ms = 0.0f;
+sutil::DynamicResolution* dynamic_resolution = 0;
+
+// Adaptive sampling, enabled when adaptive_threshold > 0
+float                 adaptive_threshold = 0.0f;
+AdaptiveSampler::Mode adaptive_mode = AdaptiveSampler::MODE_MASK;
+AdaptiveSampler*      adaptive_sampler = 0;
+
+// Temporal reprojection across camera moves
+bool                  use_reprojection = false;
+TemporalReprojection* reprojection = 0;
+bool                  reset_accumulation = false;  // History is invalid, e.g. after a resize
+
+// Reuse primary hit shadow rays across accumulation frames
+bool                  use_shadow_cache = false;
+ShadowCache*          shadow_cache = 0;
+
+// Many-light sampling through the light tree, enabled when light_samples > 0
+unsigned     light_samples = 0;
+unsigned     exact_lights = 0;
+unsigned     extra_lights = 0;  // Random lights added above the floor
+
+// Iterative ray tree evaluation instead of recursive rtTrace in the materials
+bool         iterative_shading = false;
+unsigned     cpu_threads = 0;  // 0 selects one thread per hardware thread
 
 // Camera state
 float3       camera_up;
 float3       camera_lookat;
 float3       camera_eye;
+float3       camera_u;
+float3       camera_v;
+float3       camera_w;
 Matrix4x4    camera_rotate;
 bool         camera_dirty = true;  // Do camera params need to be copied to OptiX context
 sutil::Arcball arcball;
@@ -85,10 +141,13 @@ sutil::Arcball arcball;
 int2       mouse_prev_pos;
 int        mouse_button;
 
-GeometryInstance tri_gi;
-GeometryInstance tri_gi1;
-Material phong_matl;
-Material phong_matl1;
+// Material table of the OptiX scene, filled by setupScene()
+MaterialTable* material_table = 0;
+
+// Tetrahedra share one GeometryTriangles and acceleration structure
+InstancedMesh* tetrahedra = 0;
+int phong_matl;   // Material table ids of the two tetrahedra
+int phong_matl1;
 //------------------------------------------------------------------------------
 //
 // Forward decls
@@ -103,9 +162,15 @@ GeometryGroup createGeometry();
 void setupCamera();
 void setupLights();
 void updateCamera();
+void renderCpu(const std::string& out_file);
+void renderBatch(const std::string& prefix, const std::vector<batch::CameraKey>& camera_path,
+	unsigned first_frame, unsigned last_frame, unsigned samples_per_frame, const std::string& stats_file);
 void glutInitialize(int* argc, char** argv);
 void glutRun();
 
+void renderFrame();
+void resizeBuffers(unsigned w, unsigned h);
+void applyInput(const sutil::InputEvent& event);
 void glutDisplay();
 void glutKeyboardPress(unsigned char k, int x, int y);
 void glutMousePress(int button, int state, int x, int y);
@@ -165,6 +230,60 @@ void SetTexture(optix::TextureSampler& textureSampler, optix::Context& context,
 	textureSampler->setFilteringModes(RT_FILTER_NEAREST, RT_FILTER_NEAREST, RT_FILTER_NONE);
 }
 
+// Same sampler setup as SetTexture() without a GL context: the image is copied
+// into a FLOAT4 buffer with the channel expansion glTexImage2D would apply.
+void SetTextureFromFile(optix::TextureSampler& textureSampler, optix::Context& context, const char* path)
+{
+	cpu::Texture image;
+	image.load(path);
+
+	Buffer buffer = context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_FLOAT4, image.width, image.height);
+	memcpy(buffer->map(), &image.texels[0], image.texels.size() * sizeof(float4));
+	buffer->unmap();
+
+	textureSampler = context->createTextureSampler();
+	textureSampler->setWrapMode(0, RT_WRAP_CLAMP_TO_EDGE);
+	textureSampler->setWrapMode(1, RT_WRAP_CLAMP_TO_EDGE);
+	textureSampler->setIndexingMode(RT_TEXTURE_INDEX_ARRAY_INDEX);
+	textureSampler->setReadMode(RT_TEXTURE_READ_ELEMENT_TYPE);
+	textureSampler->setMaxAnisotropy(1.0f);
+	textureSampler->setFilteringModes(RT_FILTER_NEAREST, RT_FILTER_NEAREST, RT_FILTER_NONE);
+	textureSampler->setBuffer(buffer);
+}
+
+// Texture with a full mip chain and normalized, repeating coordinates for
+// the textured phong material, which picks the level from ray differentials.
+// Built from the file in every mode, since GL interop images come without
+// the mip levels.
+optix::TextureSampler createMipmappedTexture(optix::Context& context, const char* path)
+{
+	// The same chain as the CPU renderer's Kd_map
+	cpu::Texture level0;
+	level0.load(path);
+	cpu::MipTexture mips;
+	mips.build(level0);
+
+	const unsigned level_count = static_cast<unsigned>(mips.levels.size());
+	Buffer buffer = context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_FLOAT4, level0.width, level0.height);
+	buffer->setMipLevelCount(level_count);
+	for (unsigned i = 0; i < level_count; ++i)
+	{
+		const cpu::Texture& level = mips.levels[i];
+		memcpy(buffer->map(i, RT_BUFFER_MAP_WRITE_DISCARD), &level.texels[0], level.texels.size() * sizeof(float4));
+		buffer->unmap(i);
+	}
+
+	optix::TextureSampler textureSampler = context->createTextureSampler();
+	textureSampler->setWrapMode(0, RT_WRAP_REPEAT);
+	textureSampler->setWrapMode(1, RT_WRAP_REPEAT);
+	textureSampler->setIndexingMode(RT_TEXTURE_INDEX_NORMALIZED_COORDINATES);
+	textureSampler->setReadMode(RT_TEXTURE_READ_ELEMENT_TYPE);
+	textureSampler->setMaxAnisotropy(1.0f);
+	textureSampler->setFilteringModes(RT_FILTER_LINEAR, RT_FILTER_LINEAR, RT_FILTER_LINEAR);
+	textureSampler->setBuffer(buffer);
+	return textureSampler;
+}
+
 
 //------------------------------------------------------------------------------
 //
@@ -172,6 +291,13 @@ void SetTexture(optix::TextureSampler& textureSampler, optix::Context& context,
 //
 //------------------------------------------------------------------------------
 
+// Closest hit program for the radiance ray type in the selected shading mode
+std::string radianceProgram(const std::string& name)
+{
+	return iterative_shading ? name + "_iterative" : name;
+}
+
+
 Buffer getOutputBuffer()
 {
 	return context["output_buffer"]->getBuffer();
@@ -180,6 +306,23 @@ Buffer getOutputBuffer()
 
 void destroyContext()
 {
+	// The render thread must be idle before the context goes away
+	delete runtime;
+	runtime = 0;
+
+	delete adaptive_sampler;
+	adaptive_sampler = 0;
+	delete reprojection;
+	reprojection = 0;
+	delete dynamic_resolution;
+	dynamic_resolution = 0;
+	delete shadow_cache;
+	shadow_cache = 0;
+	delete tetrahedra;
+	tetrahedra = 0;
+	delete material_table;
+	material_table = 0;
+
 	if (context)
 	{
 		context->destroy();
@@ -201,12 +344,24 @@ void registerExitHandler()
 
 void createContext()
 {
+	sutil::TraceZone zone("createContext");
 	// Set up context
 	context = Context::create();
 	context->setRayTypeCount(2);
-	context->setEntryPointCount(1);
-	context->setStackSize(2800);
-	context->setMaxTraceDepth(12);
+	context->setEntryPointCount(use_reprojection ? 2 : 1);
+	if (iterative_shading)
+	{
+		// Only shadow rays are traced from closest hit programs
+		context->setStackSize(1024);
+		context->setMaxTraceDepth(2);
+	}
+	else
+	{
+		context->setStackSize(2800);
+		context->setMaxTraceDepth(12);
+	}
+	context["iterative_shading"]->setInt(iterative_shading ? 1 : 0);
+	context["russian_roulette_depth"]->setInt(2);
 
 	// Note: high max depth for reflection and refraction through glass
 	context["max_depth"]->setInt(10);
@@ -223,27 +378,61 @@ void createContext()
 		RT_FORMAT_FLOAT4, width, height);
 	context["accum_buffer"]->set(accum_buffer);
 
+	if (use_shadow_cache)
+		shadow_cache = new ShadowCache(context, width, height);
+	else
+		ShadowCache::disable(context);
+
 	// Ray generation program
 	const char* ptx = sutil::getPtxString(SAMPLE_NAME, "accum_camera.cu");
-	Program ray_gen_program = context->createProgramFromPTXString(ptx, "pinhole_camera");
+	const char* ray_gen_name = "pinhole_camera";
+	if (adaptive_threshold > 0.0f)
+		ray_gen_name = AdaptiveSampler::rayGenProgramName(adaptive_mode);
+	else if (use_reprojection)
+		ray_gen_name = TemporalReprojection::accumulateProgramName();
+	Program ray_gen_program = context->createProgramFromPTXString(ptx, ray_gen_name);
 	context->setRayGenerationProgram(0, ray_gen_program);
 
+	if (adaptive_threshold > 0.0f)
+		adaptive_sampler = new AdaptiveSampler(context, width, height, adaptive_mode, adaptive_threshold);
+
 	// Exception program
 	Program exception_program = context->createProgramFromPTXString(ptx, "exception");
 	context->setExceptionProgram(0, exception_program);
+
+	if (use_reprojection)
+	{
+		context->setRayGenerationProgram(TemporalReprojection::ENTRY_POINT,
+			context->createProgramFromPTXString(ptx, TemporalReprojection::reprojectProgramName()));
+		context->setExceptionProgram(TemporalReprojection::ENTRY_POINT, exception_program);
+		reprojection = new TemporalReprojection(context, width, height);
+	}
 	context["bad_color"]->setFloat(1.0f, 0.0f, 1.0f);
 
 	// Miss program
 	context->setMissProgram(0, context->createProgramFromPTXString(sutil::getPtxString(SAMPLE_NAME, "constantbg.cu"), "miss"));
 	context["bg_color"]->setFloat(0.34f, 0.55f, 0.85f);
 
-	unsigned int pic = loadTexture("D:/optix6.5/SDK/optixWhitted/star.bmp");
-
 	optix::TextureSampler my_pic;
-	SetTexture(my_pic, context, pic);
+	if (headless || threaded)
+	{
+		SetTextureFromFile(my_pic, context, TEXTURE_FILE);
+	}
+	else
+	{
+		unsigned int pic = loadTexture(TEXTURE_FILE);
+		SetTexture(my_pic, context, pic);
+	}
 
 	context["envmap"]->setTextureSampler(my_pic);
-	context["Kd_map"]->setTextureSampler(my_pic);
+
+	// The textured metal sphere has radius 1 and spans the texture width
+	// around its equator and the height from pole to pole.
+	optix::TextureSampler kd_map = createMipmappedTexture(context, TEXTURE_FILE);
+	RTsize kd_width, kd_height;
+	kd_map->getBuffer()->getSize(kd_width, kd_height);
+	context["Kd_map"]->setInt(kd_map->getId());
+	context["Kd_map_density"]->setFloat(std::max(kd_width / (2.0f * M_PIf), kd_height / M_PIf));
 }
 
 struct Tetrahedron
@@ -327,6 +516,89 @@ struct Tetrahedron
 	}
 };
 
+cpu::PhongParams makePhongParams(const float3& Ka, const float3& Kd, const float3& Ks, const float3& Kr, float phong_exp)
+{
+	cpu::PhongParams params;
+	params.Ka = Ka;
+	params.Kd = Kd;
+	params.Ks = Ks;
+	params.Kr = Kr;
+	params.phong_exp = phong_exp;
+	return params;
+}
+
+cpu::Material makeGlassMaterial(float refraction_index, const float3& color)
+{
+	cpu::Material matl = cpu::Material();
+	matl.type = cpu::MATERIAL_GLASS;
+	matl.glass.importance_cutoff = 1e-2f;
+	matl.glass.cutoff_color = make_float3(0.034f, 0.055f, 0.085f);
+	matl.glass.fresnel_exponent = 3.0f;
+	matl.glass.fresnel_minimum = 0.1f;
+	matl.glass.fresnel_maximum = 1.0f;
+	matl.glass.refraction_index = refraction_index;
+	matl.glass.refraction_color = color;
+	matl.glass.reflection_color = color;
+	matl.glass.refraction_maxdepth = 10;
+	matl.glass.reflection_maxdepth = 5;
+	const float3 extinction = make_float3(.83f, .83f, .83f);
+	matl.glass.extinction_constant = make_float3(log(extinction.x), log(extinction.y), log(extinction.z));
+	matl.glass.shadow_attenuation = make_float3(0.6f, 0.6f, 0.6f);
+	return matl;
+}
+
+cpu::Material makePhongMaterial(cpu::MaterialType type, const cpu::PhongParams& params)
+{
+	cpu::Material matl = cpu::Material();
+	matl.type = type;
+	matl.phong[0] = params;
+	return matl;
+}
+
+// Black and white checker of the floor
+cpu::Material makeFloorMaterial()
+{
+	cpu::Material matl = cpu::Material();
+	matl.type = cpu::MATERIAL_CHECKER;
+	matl.phong[0] = makePhongParams(make_float3(0.0f), make_float3(0.0f), make_float3(0.0f), make_float3(0.0f), 0.0f);
+	matl.phong[1] = makePhongParams(make_float3(1.0f), make_float3(1.0f), make_float3(0.0f), make_float3(0.0f), 0.0f);
+	matl.inv_checker_size = make_float3(32.0f, 16.0f, 1.0f);
+	return matl;
+}
+
+// Shading programs of every material type.  Materials themselves are
+// entries of the table, added by createGeometry().
+void createMaterialTable()
+{
+	delete material_table;
+	material_table = new MaterialTable(context);
+
+	const char* ptx = sutil::getPtxString(SAMPLE_NAME, "phong.cu");
+	Program phong_ah = context->createProgramFromPTXString(ptx, "any_hit_shadow");
+	material_table->setPrograms(cpu::MATERIAL_PHONG,
+		context->createProgramFromPTXString(ptx, radianceProgram("closest_hit_radiance")), phong_ah);
+	material_table->setPrograms(cpu::MATERIAL_PHONG_TEXTURED,
+		context->createProgramFromPTXString(ptx, radianceProgram("closest_hit_radiance_textured")), phong_ah);
+
+	ptx = sutil::getPtxString(SAMPLE_NAME, "checker.cu");
+	material_table->setPrograms(cpu::MATERIAL_CHECKER,
+		context->createProgramFromPTXString(ptx, radianceProgram("closest_hit_radiance")),
+		context->createProgramFromPTXString(ptx, "any_hit_shadow"));
+
+	ptx = sutil::getPtxString(SAMPLE_NAME, "glass.cu");
+	material_table->setPrograms(cpu::MATERIAL_GLASS,
+		context->createProgramFromPTXString(ptx, radianceProgram("closest_hit_radiance")),
+		context->createProgramFromPTXString(ptx, "any_hit_shadow"));
+}
+
+GeometryInstance createGeometryInstance(Geometry geometry, int material)
+{
+	GeometryInstance gi = context->createGeometryInstance();
+	gi->setGeometry(geometry);
+	material_table->assign(gi, material, geometry->getPrimitiveCount());
+	return gi;
+}
+
 GeometryGroup createGeometry()
 {
 	// Create glass sphere geometry
@@ -412,135 +684,31 @@ GeometryGroup createGeometry()
 	parallelogram["anchor"]->setFloat(anchor);
 
 
-	// Glass material
-	ptx = sutil::getPtxString(SAMPLE_NAME, "glass.cu");
-	Program glass_ch = context->createProgramFromPTXString(ptx, "closest_hit_radiance");
-	Program glass_ah = context->createProgramFromPTXString(ptx, "any_hit_shadow");
-	Material glass_matl = context->createMaterial();
-	glass_matl->setClosestHitProgram(0, glass_ch);
-	glass_matl->setAnyHitProgram(1, glass_ah);
-
-	glass_matl["importance_cutoff"]->setFloat(1e-2f);
-	glass_matl["cutoff_color"]->setFloat(0.034f, 0.055f, 0.085f);
-	glass_matl["fresnel_exponent"]->setFloat(3.0f);
-	glass_matl["fresnel_minimum"]->setFloat(0.1f);
-	glass_matl["fresnel_maximum"]->setFloat(1.0f);
-	glass_matl["refraction_index"]->setFloat(0.9f);
-	glass_matl["refraction_color"]->setFloat(1.0f, 1.0f, 1.0f);
-	glass_matl["reflection_color"]->setFloat(1.0f, 1.0f, 1.0f);
-	glass_matl["refraction_maxdepth"]->setInt(10);
-	glass_matl["reflection_maxdepth"]->setInt(5);
-	const float3 extinction = make_float3(.83f, .83f, .83f);
-	glass_matl["extinction_constant"]->setFloat(log(extinction.x), log(extinction.y), log(extinction.z));
-	glass_matl["shadow_attenuation"]->setFloat(0.6f, 0.6f, 0.6f);
-
-
-
-	// Glass material
-	ptx = sutil::getPtxString(SAMPLE_NAME, "glass.cu");
-	Program glass_ch2 = context->createProgramFromPTXString(ptx, "closest_hit_radiance");
-	Program glass_ah2 = context->createProgramFromPTXString(ptx, "any_hit_shadow");
-	Material glass_matl2 = context->createMaterial();
-	glass_matl2->setClosestHitProgram(0, glass_ch2);
-	glass_matl2->setAnyHitProgram(1, glass_ah2);
-
-	glass_matl2["importance_cutoff"]->setFloat(1e-2f);
-	glass_matl2["cutoff_color"]->setFloat(0.034f, 0.055f, 0.085f);
-	glass_matl2["fresnel_exponent"]->setFloat(3.0f);
-	glass_matl2["fresnel_minimum"]->setFloat(0.1f);
-	glass_matl2["fresnel_maximum"]->setFloat(1.0f);
-	glass_matl2["refraction_index"]->setFloat(1.4f);
-	glass_matl2["refraction_color"]->setFloat(1.0f, 0.0f, 1.0f);
-	glass_matl2["reflection_color"]->setFloat(1.0f, 0.0f, 1.0f);
-	glass_matl2["refraction_maxdepth"]->setInt(10);
-	glass_matl2["reflection_maxdepth"]->setInt(5);
-	const float3 extinction2 = make_float3(.83f, .83f, .83f);
-	glass_matl2["extinction_constant"]->setFloat(log(extinction2.x), log(extinction2.y), log(extinction2.z));
-	glass_matl2["shadow_attenuation"]->setFloat(0.6f, 0.6f, 0.6f);
-
-
-	// Metal material
-	ptx = sutil::getPtxString(SAMPLE_NAME, "phong.cu");
-	Program phong_ch2 = context->createProgramFromPTXString(ptx, "closest_hit_radiance");
-	Program phong_ah2 = context->createProgramFromPTXString(ptx, "any_hit_shadow");
-	Material metal_matl2 = context->createMaterial();
-	metal_matl2->setClosestHitProgram(0, phong_ch2);
-	metal_matl2->setAnyHitProgram(1, phong_ah2);
-	metal_matl2["Ka"]->setFloat(0.5f, 0.5f, 0.2f);
-	metal_matl2["Kd"]->setFloat(1.0f, 0.0f, 0.0f);
-	metal_matl2["Ks"]->setFloat(0.9f, 0.9f, 0.9f);
-	metal_matl2["phong_exp"]->setFloat(64);
-	metal_matl2["Kr"]->setFloat(0.5f, 0.5f, 0.5f);
-
-	ptx = sutil::getPtxString(SAMPLE_NAME, "phong.cu");
-	Program phong_ch3 = context->createProgramFromPTXString(ptx, "closest_hit_radiance");
-	Program phong_ah3 = context->createProgramFromPTXString(ptx, "any_hit_shadow");
-	Material metal_matl3 = context->createMaterial();
-	metal_matl3->setClosestHitProgram(0, phong_ch2);
-	metal_matl3->setAnyHitProgram(1, phong_ah2);
-	metal_matl3["Ka"]->setFloat(0.5f, 0.2f, 0.2f);
-	metal_matl3["Kd"]->setFloat(0.7f, 0.2f, 0.8f);
-	metal_matl3["Ks"]->setFloat(0.9f, 0.9f, 0.9f);
-	metal_matl3["phong_exp"]->setFloat(64);
-	metal_matl3["Kr"]->setFloat(0.5f, 0.5f, 0.5f);
-
-	//
-	// Metal material
-	ptx = sutil::getPtxString(SAMPLE_NAME, "phong.cu");
-	Program phong_ch = context->createProgramFromPTXString(ptx, "closest_hit_radiance_textured");
-	Program phong_ah = context->createProgramFromPTXString(ptx, "any_hit_shadow");
-	Material metal_matl = context->createMaterial();
-	metal_matl->setClosestHitProgram(0, phong_ch);
-	metal_matl->setAnyHitProgram(1, phong_ah);
-	metal_matl["Ka"]->setFloat(0.2f, 0.5f, 0.5f);
-	metal_matl["Kd"]->setFloat(0.2f, 0.4f, 0.5f);
-	metal_matl["Ks"]->setFloat(0.0f, 0.0f, 0.0f);
-	metal_matl["phong_exp"]->setFloat(64);
-	metal_matl["Kr"]->setFloat(0.0f, 0.0f, 0.0f);
+	// Materials.  Each one is an entry in the material table; the shading
+	// programs are shared per type, see createMaterialTable().
+	const int glass_matl = material_table->add(makeGlassMaterial(0.9f, make_float3(1.0f, 1.0f, 1.0f)));
+	const int glass_matl2 = material_table->add(makeGlassMaterial(1.4f, make_float3(1.0f, 0.0f, 1.0f)));
+	const int metal_matl2 = material_table->add(makePhongMaterial(cpu::MATERIAL_PHONG, makePhongParams(
+		make_float3(0.5f, 0.5f, 0.2f), make_float3(1.0f, 0.0f, 0.0f), make_float3(0.9f, 0.9f, 0.9f), make_float3(0.5f, 0.5f, 0.5f), 64)));
+	const int metal_matl3 = material_table->add(makePhongMaterial(cpu::MATERIAL_PHONG, makePhongParams(
+		make_float3(0.5f, 0.2f, 0.2f), make_float3(0.7f, 0.2f, 0.8f), make_float3(0.9f, 0.9f, 0.9f), make_float3(0.5f, 0.5f, 0.5f), 64)));
+	const int metal_matl = material_table->add(makePhongMaterial(cpu::MATERIAL_PHONG_TEXTURED, makePhongParams(
+		make_float3(0.2f, 0.5f, 0.5f), make_float3(0.2f, 0.4f, 0.5f), make_float3(0.0f, 0.0f, 0.0f), make_float3(0.0f, 0.0f, 0.0f), 64)));
+	const int metal_matl4 = material_table->add(makePhongMaterial(cpu::MATERIAL_PHONG_TEXTURED, makePhongParams(
+		make_float3(0.6f, 0.2f, 0.1f), make_float3(0.6f, 0.2f, 0.1f), make_float3(0.0f, 0.0f, 0.0f), make_float3(0.0f, 0.0f, 0.0f), 64)));
+	const int floor_matl = material_table->add(makeFloorMaterial());
 	phong_matl = metal_matl2;
 	phong_matl1 = metal_matl;
 
-
-	ptx = sutil::getPtxString(SAMPLE_NAME, "phong.cu");
-	Program phong_ch4 = context->createProgramFromPTXString(ptx, "closest_hit_radiance");
-	Program phong_ah4 = context->createProgramFromPTXString(ptx, "any_hit_shadow");
-	Material metal_matl4 = context->createMaterial();
-	metal_matl4->setClosestHitProgram(0, phong_ch);
-	metal_matl4->setAnyHitProgram(1, phong_ah);
-	metal_matl4["Ka"]->setFloat(0.6f, 0.2f, 0.1f);
-	metal_matl4["Kd"]->setFloat(0.6f, 0.2f, 0.1f);
-	metal_matl4["Ks"]->setFloat(0.0f, 0.0f, 0.0f);
-	metal_matl4["phong_exp"]->setFloat(64);
-	metal_matl4["Kr"]->setFloat(0.0f, 0.0f, 0.0f);
-	// Checker material for floor
-	ptx = sutil::getPtxString(SAMPLE_NAME, "checker.cu");
-	Program check_ch = context->createProgramFromPTXString(ptx, "closest_hit_radiance");
-	Program check_ah = context->createProgramFromPTXString(ptx, "any_hit_shadow");
-	Material floor_matl = context->createMaterial();
-	floor_matl->setClosestHitProgram(0, check_ch);
-	floor_matl->setAnyHitProgram(1, check_ah);
-
-	floor_matl["Kd1"]->setFloat(0.0f, 0.0f, 0.0f);
-	floor_matl["Ka1"]->setFloat(0.0f, 0.0f, 0.0f);
-	floor_matl["Ks1"]->setFloat(0.0f, 0.0f, 0.0f);
-	floor_matl["Kd2"]->setFloat(1.0f, 1.0f, 1.0f);
-	floor_matl["Ka2"]->setFloat(1.0f, 1.0f, 1.0f);
-	floor_matl["Ks2"]->setFloat(0.0f, 0.0f, 0.0f);
-	floor_matl["inv_checker_size"]->setFloat(32.0f, 16.0f, 1.0f);
-	floor_matl["phong_exp1"]->setFloat(0.0f);
-	floor_matl["phong_exp2"]->setFloat(0.0f);
-	floor_matl["Kr1"]->setFloat(0.0f, 0.0f, 0.0f);
-	floor_matl["Kr2"]->setFloat(0.0f, 0.0f, 0.0f);
-
 	// Create GIs for each piece of geometry
 	std::vector<GeometryInstance> gis;
-	gis.push_back(context->createGeometryInstance(glass_sphere, &glass_matl, &glass_matl + 1));
-	gis.push_back(context->createGeometryInstance(glass_sphere2, &glass_matl2, &glass_matl2 + 1));
-	gis.push_back(context->createGeometryInstance(metal_sphere, &metal_matl, &metal_matl + 1));
-	gis.push_back(context->createGeometryInstance(metal_sphere2, &metal_matl2, &metal_matl2 + 1));
-	gis.push_back(context->createGeometryInstance(parallelogram, &floor_matl, &floor_matl + 1));
-	gis.push_back(context->createGeometryInstance(box, &metal_matl3, &metal_matl3 + 1));
-	gis.push_back(context->createGeometryInstance(box1, &metal_matl4, &metal_matl4 + 1));
+	gis.push_back(createGeometryInstance(glass_sphere, glass_matl));
+	gis.push_back(createGeometryInstance(glass_sphere2, glass_matl2));
+	gis.push_back(createGeometryInstance(metal_sphere, metal_matl));
+	gis.push_back(createGeometryInstance(metal_sphere2, metal_matl2));
+	gis.push_back(createGeometryInstance(parallelogram, floor_matl));
+	gis.push_back(createGeometryInstance(box, metal_matl3));
+	gis.push_back(createGeometryInstance(box1, metal_matl4));
 
 	// Place all in group
 	GeometryGroup geometrygroup = context->createGeometryGroup();
@@ -559,7 +727,7 @@ GeometryGroup createGeometry()
 	return geometrygroup;
 
 }
-GeometryGroup createGeometryTriangles(Material phong_matl, float3 point, GeometryInstance tri_gi)
+GeometryTriangles createTetrahedronGeometry()
 {
 	// Create a tetrahedron using four triangular faces.  First We will create
 	// vertex and index buffers for the faces, and then create a
@@ -567,8 +735,9 @@ GeometryGroup createGeometryTriangles(Material phong_matl, float3 point, Geometr
 	const unsigned num_faces = 4;
 	const unsigned num_vertices = num_faces * 3;
 
-	// Define a regular tetrahedron of height 2, translated 1.5 units from the origin.
-	Tetrahedron tet(2.3f, point);
+	// Define a regular tetrahedron of height 2.3 at the origin; instances
+	// place it with a Transform.
+	Tetrahedron tet(2.3f, make_float3(0.0f));
 
 	// Create Buffers for the triangle vertices, normals, texture coordinates, and indices.
 	Buffer vertex_buffer = context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_FLOAT3, num_vertices);
@@ -606,42 +775,42 @@ GeometryGroup createGeometryTriangles(Material phong_matl, float3 point, Geometr
 	geom_tri["normal_buffer"]->setBuffer(normal_buffer);
 	geom_tri["texcoord_buffer"]->setBuffer(texcoord_buffer);
 
-	// Bind a Material to the GeometryTriangles.  Materials can be shared
-	// between GeometryTriangles objects and other Geometry types, as long as
-	// all of the attributes needed by the attached hit programs are produced in
-	// the attribute program.
-	tri_gi = context->createGeometryInstance(geom_tri, phong_matl);
-
-	GeometryGroup tri_gg = context->createGeometryGroup();
-	tri_gg->addChild(tri_gi);
-	tri_gg->setAcceleration(context->createAcceleration("Trbvh"));
-
-	return tri_gg;
+	// Materials are bound per instance by InstancedMesh.  Materials can be
+	// shared between GeometryTriangles objects and other Geometry types, as
+	// long as all of the attributes needed by the attached hit programs are
+	// produced in the attribute program.
+	return geom_tri;
 }
 
 void setupScene()
 {
-	// Create a GeometryGroup for the GeometryTriangles instances and a separate
-	// GeometryGroup for all other primitives.
-	GeometryGroup gg = createGeometry();
-	GeometryGroup tri_gg = createGeometryTriangles(phong_matl, make_float3(2.0f, 0.05f, 0.3f), tri_gi);
-	GeometryGroup tri_gg1 = createGeometryTriangles(phong_matl1, make_float3(6.0f, 0.05f, 0.3f), tri_gi1);
-
+	sutil::TraceZone zone("setupScene");
+	createMaterialTable();
 
+	// Create a GeometryGroup for all primitives other than the tetrahedra.
+	GeometryGroup gg = createGeometry();
 
-	// Create a top-level Group to contain the two GeometryGroups.
+	// Create a top-level Group to contain it and the tetrahedron instances.
 	Group top_group = context->createGroup();
 	top_group->setAcceleration(context->createAcceleration("Trbvh"));
 	top_group->addChild(gg);
-	top_group->addChild(tri_gg);
-	top_group->addChild(tri_gg1);
+
+	delete tetrahedra;
+	tetrahedra = new InstancedMesh(context, createTetrahedronGeometry(), *material_table);
+	const Matrix4x4 tet_transform = Matrix4x4::translate(make_float3(2.0f, 0.05f, 0.3f));
+	const Matrix4x4 tet_transform1 = Matrix4x4::translate(make_float3(6.0f, 0.05f, 0.3f));
+	tetrahedra->addInstances(top_group, &tet_transform, 1, phong_matl);
+	tetrahedra->addInstances(top_group, &tet_transform1, 1, phong_matl1);
 
 	context["top_object"]->set(top_group);
 	context["top_shadower"]->set(top_group);
+
+	material_table->upload();
 }
 
 void setupCamera()
 {
+	sutil::TraceZone zone("setupCamera");
 	camera_eye = make_float3(8.0f, 2.0f, -4.0f);
 	camera_lookat = make_float3(4.0f, 2.3f, -4.0f);
 	camera_up = make_float3(0.0f, 1.0f, 0.0f);
@@ -651,21 +820,205 @@ void setupCamera()
 }
 
 
+// Lights shared by the OptiX scene and the CPU reference renderer.
+std::vector<BasicLight> createLights()
+{
+	std::vector<BasicLight> lights;
+	BasicLight sun = { make_float3(60.0f, 40.0f, 0.0f), make_float3(1.0f, 1.0f, 1.0f), 1 };
+	lights.push_back(sun);
+
+	// Scatter extra lights over the floor; their total power matches the
+	// main light so the image stays in range as the count grows.
+	unsigned int seed = 1234u;
+	for (unsigned i = 0; i < extra_lights; ++i)
+	{
+		BasicLight light;
+		light.pos = make_float3(-16.0f + 32.0f * rnd(seed), 0.5f + 4.0f * rnd(seed), -8.0f + 16.0f * rnd(seed));
+		light.color = make_float3(rnd(seed), rnd(seed), rnd(seed)) * (2.0f / extra_lights);
+		light.casts_shadow = 1;
+		light.padding = 0;
+		lights.push_back(light);
+	}
+	return lights;
+}
+
 void setupLights()
 {
+	sutil::TraceZone zone("setupLights");
+	setLightTree(context, createLights(), light_samples, exact_lights);
+}
+
+
+//------------------------------------------------------------------------------
+//
+//  CPU reference renderer
+//
+//------------------------------------------------------------------------------
+
+void addCpuTetrahedron(cpu::Scene& scene, int material, float3 point)
+{
+	Tetrahedron tet(2.3f, point);
+	scene.addTriangles(tet.vertices, tet.normals, tet.texcoords, tet.indices, 4u, material);
+}
+
+// Host mirror of createGeometry(), setupScene() and setupLights().  Keep the
+// values in sync with the OptiX scene so both paths render the same image.
+void createCpuScene(cpu::Scene& scene)
+{
+	scene.max_depth = 10;
+	scene.scene_epsilon = 1.e-4f;
+	scene.ambient_light_color = make_float3(0.4f, 0.4f, 0.4f);
+	scene.envmap.load(TEXTURE_FILE);
+	scene.Kd_map.build(scene.envmap);
+	scene.Kd_map_density = std::max(scene.envmap.width / (2.0f * M_PIf), scene.envmap.height / M_PIf);
+
+	// Materials
+	const int glass_matl = scene.addMaterial(makeGlassMaterial(0.9f, make_float3(1.0f, 1.0f, 1.0f)));
+	const int glass_matl2 = scene.addMaterial(makeGlassMaterial(1.4f, make_float3(1.0f, 0.0f, 1.0f)));
+	const int metal_matl2 = scene.addMaterial(makePhongMaterial(cpu::MATERIAL_PHONG, makePhongParams(
+		make_float3(0.5f, 0.5f, 0.2f), make_float3(1.0f, 0.0f, 0.0f), make_float3(0.9f, 0.9f, 0.9f), make_float3(0.5f, 0.5f, 0.5f), 64)));
+	const int metal_matl3 = scene.addMaterial(makePhongMaterial(cpu::MATERIAL_PHONG, makePhongParams(
+		make_float3(0.5f, 0.2f, 0.2f), make_float3(0.7f, 0.2f, 0.8f), make_float3(0.9f, 0.9f, 0.9f), make_float3(0.5f, 0.5f, 0.5f), 64)));
+	const int metal_matl = scene.addMaterial(makePhongMaterial(cpu::MATERIAL_PHONG_TEXTURED, makePhongParams(
+		make_float3(0.2f, 0.5f, 0.5f), make_float3(0.2f, 0.4f, 0.5f), make_float3(0.0f, 0.0f, 0.0f), make_float3(0.0f, 0.0f, 0.0f), 64)));
+	const int metal_matl4 = scene.addMaterial(makePhongMaterial(cpu::MATERIAL_PHONG_TEXTURED, makePhongParams(
+		make_float3(0.6f, 0.2f, 0.1f), make_float3(0.6f, 0.2f, 0.1f), make_float3(0.0f, 0.0f, 0.0f), make_float3(0.0f, 0.0f, 0.0f), 64)));
+
+	const int floor_material = scene.addMaterial(makeFloorMaterial());
+
+	// Geometry
+	scene.addSphereShell(make_float3(7.0f, 1.5f, -2.5f), 0.9f, 1.0f, glass_matl);
+	scene.addSphereShell(make_float3(9.5f, 1.5f, -2.5f), 0.9f, 1.0f, glass_matl2);
+	scene.addTexturedSphere(make_float4(2.0f, 1.5f, -2.5f, 1.0f),
+		make_float3(1.0f, 0.0f, 0.0f), make_float3(0.0f, 1.0f, 0.0f), make_float3(0.0f, 0.0f, 1.0f), metal_matl);
+	scene.addSphere(make_float4(4.5f, 1.5f, -2.5f, 1.0f), metal_matl2);
+	scene.addParallelogram(make_float3(-16.0f, 0.01f, -8.0f), make_float3(32.0f, 0.0f, 0.0f), make_float3(0.0f, 0.0f, 16.0f), floor_material);
+	scene.addBox(make_float3(1.0f, 0.1f, 2.5f), make_float3(2.0f, 2.5f, 4.0f), metal_matl3);
+	scene.addBox(make_float3(5.0f, 0.1f, 2.5f), make_float3(6.0f, 2.5f, 4.0f), metal_matl4);
+	addCpuTetrahedron(scene, metal_matl2, make_float3(2.0f, 0.05f, 0.3f));
+	addCpuTetrahedron(scene, metal_matl, make_float3(6.0f, 0.05f, 0.3f));
+
+	// Lights
+	scene.lights = createLights();
+
+	scene.build();
+}
+
+void renderCpu(const std::string& out_file)
+{
+	cpu::Scene scene;
+	createCpuScene(scene);
+
+	updateCamera();
+	cpu::Camera camera;
+	camera.eye = camera_eye;
+	camera.U = camera_u;
+	camera.V = camera_v;
+	camera.W = camera_w;
+
+	std::vector<float4> accum_buffer(width * height);
+	std::vector<uchar4> output_buffer(width * height);
+
+	cpu::Renderer renderer(scene, cpu_threads);
+	const double t0 = sutil::currentTime();
+	renderer.launch(camera, 0u, width, height, &accum_buffer[0], &output_buffer[0]);
+	const double t1 = sutil::currentTime();
+	std::cerr << "CPU render: " << (t1 - t0) * 1000.0 << " ms on " << renderer.numThreads() << " threads\n";
+
+	sutil::displayBufferPPM(out_file.c_str(), &output_buffer[0], width, height);
+}
+
+
+// Launch one accumulation frame, through the adaptive sampler if enabled.
+void launchFrame(unsigned accumulation_frame)
+{
+	context["frame"]->setUint(accumulation_frame);
+	if (shadow_cache)
+		shadow_cache->beginFrame(accumulation_frame == 0);
+	if (adaptive_sampler)
+		adaptive_sampler->launch(accumulation_frame);
+	else
+		context->launch(0, width, height);
+}
+
+
+//------------------------------------------------------------------------------
+//
+//  Headless batch rendering
+//
+//------------------------------------------------------------------------------
+
+void renderBatch(const std::string& prefix, const std::vector<batch::CameraKey>& camera_path,
+	unsigned first_frame, unsigned last_frame, unsigned samples_per_frame, const std::string& stats_file)
+{
+	if (!camera_path.empty() && last_frame >= camera_path.size())
+	{
+		std::ostringstream msg;
+		msg << "Frame range ends at " << last_frame << " but the camera path only has " << camera_path.size() << " cameras";
+		throw Exception(msg.str());
+	}
 
-	BasicLight lights[] = {
-		{ make_float3(60.0f, 40.0f, 0.0f), make_float3(1.0f, 1.0f, 1.0f), 1 }
-	};
+	Buffer output_buffer = getOutputBuffer();
+	batch::AsyncImageWriter writer;
+	std::vector<batch::FrameTiming> timings;
 
-	Buffer light_buffer = context->createBuffer(RT_BUFFER_INPUT);
-	light_buffer->setFormat(RT_FORMAT_USER);
-	light_buffer->setElementSize(sizeof(BasicLight));
-	light_buffer->setSize(sizeof(lights) / sizeof(lights[0]));
-	memcpy(light_buffer->map(), lights, sizeof(lights));
-	light_buffer->unmap();
+	const double batch_start = sutil::currentTime();
+	for (unsigned f = first_frame; f <= last_frame; ++f)
+	{
+		if (!camera_path.empty())
+		{
+			camera_eye = camera_path[f].eye;
+			camera_lookat = camera_path[f].lookat;
+			camera_up = camera_path[f].up;
+			camera_rotate = Matrix4x4::identity();
+		}
+		updateCamera();
 
-	context["lights"]->set(light_buffer);
+		batch::FrameTiming timing;
+		timing.frame = f;
+
+		// Same accumulation as glutDisplay(), restarted for every camera
+		const double t0 = sutil::currentTime();
+		launchFrame(0u);
+		const double t1 = sutil::currentTime();
+		double active_sum = 1.0;
+		for (unsigned sample = 1; sample < samples_per_frame; ++sample)
+		{
+			launchFrame(sample);
+			active_sum += adaptive_sampler ? adaptive_sampler->activeFraction() : 1.0;
+		}
+		const double t2 = sutil::currentTime();
+
+		std::vector<uchar4> pixels(width * height);
+		memcpy(&pixels[0], output_buffer->map(), width * height * sizeof(uchar4));
+		output_buffer->unmap();
+		const double t3 = sutil::currentTime();
+
+		char filename[1024];
+		snprintf(filename, sizeof(filename), "%s_%04u.ppm", prefix.c_str(), f);
+		writer.push(filename, pixels, width, height, timings.size());
+
+		timing.launch_ms = (t1 - t0) * 1000.0;
+		timing.accum_ms = (t2 - t1) * 1000.0;
+		timing.readback_ms = (t3 - t2) * 1000.0;
+		timing.write_ms = 0.0;
+		timing.active_fraction = active_sum / samples_per_frame;
+		timings.push_back(timing);
+	}
+	writer.flush();
+	const double batch_end = sutil::currentTime();
+
+	for (size_t i = 0; i < timings.size(); ++i)
+		timings[i].write_ms = writer.writeTimes()[i];
+
+	const double seconds = batch_end - batch_start;
+	const double samples = static_cast<double>(width) * height * samples_per_frame * timings.size();
+	std::cerr << "Rendered " << timings.size() << " frames at " << width << "x" << height
+		<< ", " << samples_per_frame << " spp in " << seconds << " s ("
+		<< samples / seconds / 1.e6 << " Msamples/s)\n";
+
+	if (!stats_file.empty())
+		batch::writeTimings(stats_file, timings, width, height, samples_per_frame);
 }
 
 
@@ -675,7 +1028,6 @@ void updateCamera()
 	const float aspect_ratio = static_cast<float>(width) /
 		static_cast<float>(height);
 
-	float3 camera_u, camera_v, camera_w;
 	sutil::calculateCameraVariables(
 		camera_eye, camera_lookat, camera_up, vfov, aspect_ratio,
 		camera_u, camera_v, camera_w, /*fov_is_vertical*/ true);
@@ -699,10 +1051,14 @@ void updateCamera()
 
 	camera_rotate = Matrix4x4::identity();
 
-	context["eye"]->setFloat(camera_eye);
-	context["U"]->setFloat(camera_u);
-	context["V"]->setFloat(camera_v);
-	context["W"]->setFloat(camera_w);
+	// The CPU renderer reads the camera globals directly
+	if (context)
+	{
+		context["eye"]->setFloat(camera_eye);
+		context["U"]->setFloat(camera_u);
+		context["V"]->setFloat(camera_v);
+		context["W"]->setFloat(camera_w);
+	}
 
 	camera_dirty = false;
 }
@@ -742,6 +1098,18 @@ void glutRun()
 
 	registerExitHandler();
 
+	if (frame_budget_ms > 0.0f)
+	{
+		dynamic_resolution = new sutil::DynamicResolution(frame_budget_ms);
+		dynamic_resolution->setWindowSize(window_width, window_height);
+	}
+
+	if (threaded)
+	{
+		runtime = new sutil::InteractiveRuntime(renderFrame, applyInput, getOutputBuffer);
+		runtime->start();
+	}
+
 	glutMainLoop();
 }
 
@@ -752,50 +1120,118 @@ void glutRun()
 //
 //------------------------------------------------------------------------------
 
-void glutDisplay()
+// Updates the camera and launches the next accumulation frame.  Runs on the
+// render thread in threaded mode.
+void renderFrame()
 {
 	static unsigned int accumulation_frame = 0;
-	if (camera_dirty) {
-		updateCamera();
-		accumulation_frame = 0;
+
+	// The budget covers the whole frame, display upload and buffer swap
+	// included, so feed the controller the time since the previous frame
+	// started rather than the launch alone
+	static double last_frame_start = 0.0;
+	const double frame_start = sutil::currentTime();
+	const double frame_ms = last_frame_start > 0.0 ? (frame_start - last_frame_start) * 1000.0 : 0.0;
+	last_frame_start = frame_start;
+	if (dynamic_resolution && dynamic_resolution->update(frame_ms, camera_dirty))
+		resizeBuffers(dynamic_resolution->width(), dynamic_resolution->height());
+
+	if (camera_dirty || reset_accumulation) {
+		// Reprojection keeps accumulating, but visibility from the new
+		// primary hits has to be traced again
+		if (shadow_cache)
+			shadow_cache->invalidate();
+		if (reprojection && accumulation_frame > 0 && !reset_accumulation) {
+			// Keep accumulating: warp the history rendered with the old camera
+			const float3 prev_eye = camera_eye;
+			const float3 prev_u = camera_u;
+			const float3 prev_v = camera_v;
+			const float3 prev_w = camera_w;
+			updateCamera();
+			reprojection->reproject(prev_eye, prev_u, prev_v, prev_w);
+		}
+		else {
+			updateCamera();
+			accumulation_frame = 0;
+		}
+		reset_accumulation = false;
 	}
 
-	context["frame"]->setUint(accumulation_frame++);
-	context->launch(0, width, height);
+	launchFrame(accumulation_frame++);
+}
 
-	sutil::displayBufferGL(getOutputBuffer());
 
+void glutDisplay()
+{
+	if (runtime)
 	{
+		runtime->present();
+
 		static unsigned frame_count = 0;
-		sutil::displayFps(frame_count++);
+		sutil::displayFrameStats(frame_count++);
+
+		// Render thread throughput, independent of the presentation rate above
+		static double last_time = sutil::currentTime();
+		static unsigned long long last_rendered = 0;
+		static char render_text[64] = "";
+		const double now = sutil::currentTime();
+		if (now - last_time > 0.5)
+		{
+			const unsigned long long rendered = runtime->renderedFrames();
+			sprintf(render_text, "render fps: %7.2f", (rendered - last_rendered) / (now - last_time));
+			last_rendered = rendered;
+			last_time = now;
+		}
+		sutil::displayText(render_text, 10.0f, 30.0f);
+
+		sutil::swapBuffers();
+		return;
 	}
 
-	glutSwapBuffers();
-}
+	{
+		sutil::FrameTimer timer(sutil::FRAME_STAGE_LAUNCH);
+		renderFrame();
+	}
 
+	// Converged pixels no longer change; upload only tiles that were launched
+	if (adaptive_sampler)
+		sutil::setDisplayDirtyTiles(adaptive_sampler->dirtyTiles(), AdaptiveSampler::TILE_SIZE,
+			adaptive_sampler->tilesX(), adaptive_sampler->tilesY());
+	sutil::displayBufferGL(getOutputBuffer());
 
-void glutKeyboardPress(unsigned char k, int x, int y)
-{
-	switch (k)
-	{
-	case('q'):
-	case(27): // ESC
 	{
-		destroyContext();
-		exit(0);
+		static unsigned frame_count = 0;
+		sutil::displayFrameStats(frame_count++);
 	}
-	case('s'):
+
+	if (adaptive_sampler)
 	{
-		const std::string outputImage = std::string(SAMPLE_NAME) + ".ppm";
-		std::cerr << "Saving current frame to '" << outputImage << "'\n";
-		sutil::displayBufferPPM(outputImage.c_str(), getOutputBuffer());
-		break;
+		static char active_text[64];
+		sprintf(active_text, "active: %5.1f%% launched: %5.1f%%",
+			adaptive_sampler->activeFraction() * 100.0f, adaptive_sampler->launchedFraction() * 100.0f);
+		sutil::displayText(active_text, 10.0f, 30.0f);
 	}
+
+	if (dynamic_resolution)
+	{
+		static char scale_text[64];
+		sprintf(scale_text, "launch: %ux%u (%3.0f%%)", width, height, dynamic_resolution->scale() * 100.0f);
+		sutil::displayText(scale_text, 10.0f, 50.0f);
 	}
+
+	sutil::swapBuffers();
 }
 
 
-void glutMousePress(int button, int state, int x, int y)
+void saveImage()
+{
+	const std::string outputImage = std::string(SAMPLE_NAME) + ".ppm";
+	std::cerr << "Saving current frame to '" << outputImage << "'\n";
+	sutil::displayBufferPPM(outputImage.c_str(), getOutputBuffer());
+}
+
+
+void mousePress(int button, int state, int x, int y)
 {
 	if (state == GLUT_DOWN)
 	{
@@ -809,14 +1245,14 @@ void glutMousePress(int button, int state, int x, int y)
 }
 
 
-void glutMouseMotion(int x, int y)
+void mouseMotion(int x, int y)
 {
 	if (mouse_button == GLUT_RIGHT_BUTTON)
 	{
 		const float dx = static_cast<float>(x - mouse_prev_pos.x) /
-			static_cast<float>(width);
+			static_cast<float>(window_width);
 		const float dy = static_cast<float>(y - mouse_prev_pos.y) /
-			static_cast<float>(height);
+			static_cast<float>(window_height);
 		const float dmax = fabsf(dx) > fabs(dy) ? dx : dy;
 		const float scale = fminf(dmax, 0.9f);
 		camera_eye = camera_eye + (camera_lookat - camera_eye) * scale;
@@ -829,8 +1265,8 @@ void glutMouseMotion(int x, int y)
 		const float2 to = { static_cast<float>(x),
 							  static_cast<float>(y) };
 
-		const float2 a = { from.x / width, from.y / height };
-		const float2 b = { to.x / width, to.y / height };
+		const float2 a = { from.x / window_width, from.y / window_height };
+		const float2 b = { to.x / window_width, to.y / window_height };
 
 		camera_rotate = arcball.rotate(b, a);
 		camera_dirty = true;
@@ -840,21 +1276,131 @@ void glutMouseMotion(int x, int y)
 }
 
 
-void glutResize(int w, int h)
+// Resizes the context's buffers to a new launch size and restarts
+// accumulation.
+void resizeBuffers(unsigned w, unsigned h)
 {
 	width = w;
 	height = h;
-	sutil::ensureMinimumSize(width, height);
-
-	camera_dirty = true;
 
 	sutil::resizeBuffer(getOutputBuffer(), width, height);
 	sutil::resizeBuffer(context["accum_buffer"]->getBuffer(), width, height);
+	if (adaptive_sampler)
+		adaptive_sampler->resize(width, height);
+	if (reprojection)
+		reprojection->resize(width, height);
+	if (shadow_cache)
+		shadow_cache->resize(width, height);
+	reset_accumulation = true;
+}
+
+
+// Launches at the window size, or at the dynamic resolution scale of it.
+// The GL viewport is left to glutResize.
+void resizeWindow(int w, int h)
+{
+	window_width = w;
+	window_height = h;
+	sutil::ensureMinimumSize(window_width, window_height);
+
+	camera_dirty = true;
+
+	if (dynamic_resolution)
+	{
+		dynamic_resolution->setWindowSize(window_width, window_height);
+		resizeBuffers(dynamic_resolution->width(), dynamic_resolution->height());
+	}
+	else
+		resizeBuffers(window_width, window_height);
+}
+
+
+// Input posted by the GLUT callbacks in threaded mode, applied on the
+// render thread between launches.
+void applyInput(const sutil::InputEvent& event)
+{
+	switch (event.type)
+	{
+	case sutil::InputEvent::KEY:
+		if (event.code == 's')
+			saveImage();
+		break;
+	case sutil::InputEvent::MOUSE_BUTTON:
+		mousePress(event.code, event.state, event.x, event.y);
+		break;
+	case sutil::InputEvent::MOUSE_MOTION:
+		mouseMotion(event.x, event.y);
+		break;
+	case sutil::InputEvent::RESIZE:
+		resizeWindow(event.x, event.y);
+		break;
+	}
+}
+
+
+void postInput(sutil::InputEvent::Type type, int code, int state, int x, int y)
+{
+	const sutil::InputEvent event = { type, code, state, x, y };
+	if (!runtime->postInput(event))
+		std::cerr << "Input queue full, dropping event\n";
+}
+
+
+void glutKeyboardPress(unsigned char k, int x, int y)
+{
+	switch (k)
+	{
+	case('q'):
+	case(27): // ESC
+	{
+		destroyContext();
+		exit(0);
+	}
+	case('s'):
+	{
+		if (runtime)
+			postInput(sutil::InputEvent::KEY, k, 0, x, y);
+		else
+			saveImage();
+		break;
+	}
+	}
+}
+
+
+void glutMousePress(int button, int state, int x, int y)
+{
+	if (runtime)
+		postInput(sutil::InputEvent::MOUSE_BUTTON, button, state, x, y);
+	else
+		mousePress(button, state, x, y);
+}
+
+
+void glutMouseMotion(int x, int y)
+{
+	if (runtime)
+		postInput(sutil::InputEvent::MOUSE_MOTION, 0, 0, x, y);
+	else
+		mouseMotion(x, y);
+}
+
+
+void glutResize(int w, int h)
+{
+	if (runtime)
+		postInput(sutil::InputEvent::RESIZE, 0, 0, w, h);
+	else
+		resizeWindow(w, h);
+
+	unsigned viewport_width = w;
+	unsigned viewport_height = h;
+	sutil::ensureMinimumSize(viewport_width, viewport_height);
 
 	glMatrixMode(GL_PROJECTION);
 	glLoadIdentity();
 	glOrtho(0, 1, 0, 1, -1, 1);
-	glViewport(0, 0, width, height);
+	glViewport(0, 0, viewport_width, viewport_height);
 	glutPostRedisplay();
 }
 
@@ -870,9 +1416,26 @@ void printUsageAndExit(const std::string& argv0)
 	std::cerr << "\nUsage: " << argv0 << " [options]\n";
 	std::cerr <<
 		"App Options:\n"
-		"  -h | --help         Print this usage message and exit.\n"
-		"  -f | --file         Save single frame to file and exit.\n"
-		"  -n | --nopbo        Disable GL interop for display buffer.\n"
+		"  -h | --help               Print this usage message and exit.\n"
+		"  -f | --file               Save single frame to file and exit.\n"
+		"  -n | --nopbo              Disable GL interop for display buffer.\n"
+		"  -c | --cpu                Render with the CPU reference renderer (requires -f).\n"
+		"  -t | --threads <n>        Number of CPU renderer threads (default: all cores).\n"
+		"  -b | --batch <prefix>     Headless batch render to <prefix>_NNNN.ppm and exit.\n"
+		"  --camera-path <file>      Batch cameras, one 'eye lookat up' line per frame.\n"
+		"  --spp <n>                 Batch samples accumulated per frame (default 1).\n"
+		"  --frames <first>:<last>   Batch frame range, inclusive (default: whole path).\n"
+		"  --stats <file>            Write batch frame timings as CSV, or JSON for *.json.\n"
+		"  -a | --adaptive <err>     Adaptive sampling; stop pixels below relative error <err>.\n"
+		"  --adaptive-tiles          Launch only 16x16 tiles with active pixels.\n"
+		"  -r | --reproject          Reproject accumulation across camera moves.\n"
+		"  -i | --iterative          Iterative ray tree with Russian roulette (small stack).\n"
+		"  --shadow-cache            Reuse primary hit shadow rays while the view is unchanged.\n"
+		"  --threaded                Launch on a render thread, decoupled from display.\n"
+		"  -d | --dynamic-res <ms>   Scale the launch down to fit <ms> per frame while the camera moves.\n"
+		"  --light-tree <n>          Sample <n> lights per hit from a light hierarchy.\n"
+		"  --exact-lights <k>        Also shade the <k> most important lights exactly (max 8).\n"
+		"  --many-lights <n>         Add <n> random lights above the floor.\n"
 		"App Keystrokes:\n"
 		"  q  Quit\n"
 		"  s  Save image to '" << SAMPLE_NAME << ".ppm'\n"
@@ -884,9 +1447,16 @@ void printUsageAndExit(const std::string& argv0)
 int main(int argc, char** argv)
 {
 	std::string out_file;
+	std::string batch_prefix;
+	std::string camera_path_file;
+	std::string stats_file;
+	unsigned samples_per_frame = 1;
+	int first_frame = -1;
+	int last_frame = -1;
 	for (int i = 1; i < argc; ++i)
 	{
 		const std::string arg(argv[i]);
+		const bool has_value = i < argc - 1;
 
 		if (arg == "-h" || arg == "--help")
 		{
@@ -905,6 +1475,106 @@ int main(int argc, char** argv)
 		{
 			use_pbo = false;
 		}
+		else if (arg == "-c" || arg == "--cpu")
+		{
+			use_cpu = true;
+		}
+		else if (arg == "-t" || arg == "--threads")
+		{
+			if (i == argc - 1)
+			{
+				std::cerr << "Option '" << arg << "' requires additional argument.\n";
+				printUsageAndExit(argv[0]);
+			}
+			cpu_threads = atoi(argv[++i]);
+		}
+		else if (arg == "-a" || arg == "--adaptive")
+		{
+			if (!has_value)
+			{
+				std::cerr << "Option '" << arg << "' requires additional argument.\n";
+				printUsageAndExit(argv[0]);
+			}
+			adaptive_threshold = static_cast<float>(atof(argv[++i]));
+		}
+		else if (arg == "--adaptive-tiles")
+		{
+			adaptive_mode = AdaptiveSampler::MODE_TILES;
+		}
+		else if (arg == "-r" || arg == "--reproject")
+		{
+			use_reprojection = true;
+		}
+		else if (arg == "-i" || arg == "--iterative")
+		{
+			iterative_shading = true;
+		}
+		else if (arg == "--shadow-cache")
+		{
+			use_shadow_cache = true;
+		}
+		else if (arg == "--threaded")
+		{
+			// The render thread copies a host output buffer; GL interop
+			// buffers and textures stay on the GLUT thread.
+			threaded = true;
+			use_pbo = false;
+		}
+		else if (arg == "-d" || arg == "--dynamic-res")
+		{
+			if (!has_value)
+			{
+				std::cerr << "Option '" << arg << "' requires additional argument.\n";
+				printUsageAndExit(argv[0]);
+			}
+			frame_budget_ms = static_cast<float>(atof(argv[++i]));
+		}
+		else if (arg == "--light-tree" || arg == "--exact-lights" || arg == "--many-lights")
+		{
+			if (!has_value)
+			{
+				std::cerr << "Option '" << arg << "' requires additional argument.\n";
+				printUsageAndExit(argv[0]);
+			}
+			const unsigned value = static_cast<unsigned>(std::max(0, atoi(argv[++i])));
+			if (arg == "--light-tree")
+				light_samples = value;
+			else if (arg == "--exact-lights")
+			{
+				if (value > MAX_EXACT_LIGHTS)
+				{
+					std::cerr << "Option '" << arg << "' allows at most " << MAX_EXACT_LIGHTS << " lights.\n";
+					printUsageAndExit(argv[0]);
+				}
+				exact_lights = value;
+			}
+			else
+				extra_lights = value;
+		}
+		else if (arg == "-b" || arg == "--batch" || arg == "--camera-path" || arg == "--spp" ||
+			arg == "--frames" || arg == "--stats")
+		{
+			if (!has_value)
+			{
+				std::cerr << "Option '" << arg << "' requires additional argument.\n";
+				printUsageAndExit(argv[0]);
+			}
+			const std::string value(argv[++i]);
+			if (arg == "-b" || arg == "--batch")
+				batch_prefix = value;
+			else if (arg == "--camera-path")
+				camera_path_file = value;
+			else if (arg == "--stats")
+				stats_file = value;
+			else if (arg == "--spp")
+				samples_per_frame = std::max(1, atoi(value.c_str()));
+			else if (sscanf(value.c_str(), "%d:%d", &first_frame, &last_frame) != 2 ||
+				first_frame < 0 || last_frame < first_frame)
+			{
+				std::cerr << "Invalid frame range '" << value << "'\n";
+				printUsageAndExit(argv[0]);
+			}
+		}
 		else
 		{
 			std::cerr << "Unknown option '" << arg << "'\n";
@@ -912,8 +1582,58 @@ int main(int argc, char** argv)
 		}
 	}
 
+	if (use_reprojection && adaptive_threshold > 0.0f)
+	{
+		std::cerr << "Options '--reproject' and '--adaptive' cannot be combined.\n";
+		printUsageAndExit(argv[0]);
+	}
+
+	if (use_cpu && out_file.empty())
+	{
+		std::cerr << "Option '--cpu' requires '--file'.\n";
+		printUsageAndExit(argv[0]);
+	}
+
 	try
 	{
+		if (!batch_prefix.empty())
+		{
+			// No GLUT or GLEW: the output buffer is a plain OptiX buffer and
+			// textures are uploaded without GL interop.
+			headless = true;
+			use_pbo = false;
+
+			std::vector<batch::CameraKey> camera_path;
+			if (!camera_path_file.empty())
+				camera_path = batch::loadCameraPath(camera_path_file);
+			if (first_frame < 0)
+			{
+				first_frame = 0;
+				last_frame = camera_path.empty() ? 0 : static_cast<int>(camera_path.size()) - 1;
+			}
+
+			createContext();
+			setupScene();
+			setupCamera();
+			setupLights();
+			{
+				sutil::TraceZone zone("validate");
+				context->validate();
+			}
+
+			renderBatch(batch_prefix, camera_path, first_frame, last_frame, samples_per_frame, stats_file);
+			destroyContext();
+			return 0;
+		}
+
+		if (use_cpu)
+		{
+			// No GL or OptiX context is needed for the CPU reference renderer
+			setupCamera();
+			renderCpu(out_file);
+			return 0;
+		}
+
 		glutInitialize(&argc, argv);
 
 #ifndef __APPLE__
@@ -926,7 +1646,10 @@ int main(int argc, char** argv)
 		setupCamera();
 		setupLights();
 
-		context->validate();
+		{
+			sutil::TraceZone zone("validate");
+			context->validate();
+		}
 
 		if (out_file.empty())
 		{
@@ -935,7 +1658,7 @@ int main(int argc, char** argv)
 		else
 		{
 			updateCamera();
-			context->launch(0, width, height);
+			launchFrame(0u);
 			sutil::displayBufferPPM(out_file.c_str(), getOutputBuffer());
 			destroyContext();
 		}
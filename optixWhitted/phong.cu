@@ -29,15 +29,10 @@
 #include <optix.h>
 #include <optixu/optixu_math_namespace.h>
 #include "phong.h"
+#include "materials.h"
 
 using namespace optix;
 
-rtDeclareVariable(float3,       Ka, , );
-rtDeclareVariable(float3,       Kd, , );
-rtDeclareVariable(float3,       Ks, , );
-rtDeclareVariable(float3,       Kr, , );
-rtDeclareVariable(float,        phong_exp, , );
-
 rtDeclareVariable(float3, geometric_normal, attribute geometric_normal, ); 
 rtDeclareVariable(float3, shading_normal, attribute shading_normal, ); 
 
@@ -54,13 +49,36 @@ RT_PROGRAM void closest_hit_radiance()
   float3 world_geometric_normal = normalize( rtTransformNormal( RT_OBJECT_TO_WORLD, geometric_normal ) );
 
   float3 ffnormal = faceforward( world_shading_normal, -ray.direction, world_geometric_normal );
-  phongShade( Kd, Ka, Ks, Kr, phong_exp, ffnormal );
+  const int m = materialId();
+  phongShade( material_Kd[m], material_Ka[m], material_Ks[m], material_Kr[m], material_phong_exp[m], ffnormal );
+}
+
+
+RT_PROGRAM void closest_hit_radiance_iterative()
+{
+  float3 world_shading_normal   = normalize( rtTransformNormal( RT_OBJECT_TO_WORLD, shading_normal ) );
+  float3 world_geometric_normal = normalize( rtTransformNormal( RT_OBJECT_TO_WORLD, geometric_normal ) );
+
+  float3 ffnormal = faceforward( world_shading_normal, -ray.direction, world_geometric_normal );
+  const int m = materialId();
+  phongShadeIterative( material_Kd[m], material_Ka[m], material_Ks[m], material_Kr[m], material_phong_exp[m], ffnormal );
 }
 
 
-rtTextureSampler<float4, 2> Kd_map;
+// Kd_map is a mipmapped bindless texture with normalized coordinates.
+// Kd_map_density is the number of level 0 texels per world unit on the
+// surface; it turns the ray footprint into a mip level.
+rtDeclareVariable(int,    Kd_map, , );
+rtDeclareVariable(float,  Kd_map_density, , );
 rtDeclareVariable(float3, texcoord, attribute texcoord, ); 
 
+static __device__ __inline__ float3 sampleKd( RayDifferential differential, float3 normal )
+{
+  transferRayDifferential( differential, ray.direction, t_hit, normal );
+  const float lod = log2f( fmaxf( footprintWidth( differential ) * Kd_map_density, 1.0f ) );
+  return make_float3( rtTex2DLod<float4>( Kd_map, texcoord.x, texcoord.y, lod ) );
+}
+
 RT_PROGRAM void closest_hit_radiance_textured()
 {
   float3 world_shading_normal   = normalize( rtTransformNormal( RT_OBJECT_TO_WORLD, shading_normal ) );
@@ -68,6 +86,19 @@ RT_PROGRAM void closest_hit_radiance_textured()
   
   float3 ffnormal = faceforward( world_shading_normal, -ray.direction, world_geometric_normal );
 
-  const float3 Kd_val = make_float3( tex2D( Kd_map, texcoord.x, texcoord.y ) );
-  phongShade( Kd_val, Ka, Ks, Kr, phong_exp, ffnormal );
+  const float3 Kd_val = sampleKd( prd.differential, ffnormal );
+  const int m = materialId();
+  phongShade( Kd_val, material_Ka[m], material_Ks[m], material_Kr[m], material_phong_exp[m], ffnormal );
+}
+
+RT_PROGRAM void closest_hit_radiance_textured_iterative()
+{
+  float3 world_shading_normal   = normalize( rtTransformNormal( RT_OBJECT_TO_WORLD, shading_normal ) );
+  float3 world_geometric_normal = normalize( rtTransformNormal( RT_OBJECT_TO_WORLD, geometric_normal ) );
+  
+  float3 ffnormal = faceforward( world_shading_normal, -ray.direction, world_geometric_normal );
+
+  const float3 Kd_val = sampleKd( prd_iterative.differential, ffnormal );
+  const int m = materialId();
+  phongShadeIterative( Kd_val, material_Ka[m], material_Ks[m], material_Kr[m], material_phong_exp[m], ffnormal );
 }
@@ -29,12 +29,21 @@
 #include <optix_world.h>
 #include "common.h"
 #include "helpers.h"
+#include "iterative.h"
+#include "random.h"
+#include "rayDifferentials.h"
+
+// The frontier must be able to hold MAX_EXACT_LIGHTS (common.h) leaves
+#define LIGHT_FRONTIER_SIZE 16
 
 struct PerRayData_radiance
 {
   float3 result;
   float importance;
   int depth;
+  float distance;
+  RayDifferential differential;
+  int cache_index;  // shadow_cache slot of a camera ray's pixel, -1 otherwise
 };
 
 struct PerRayData_shadow
@@ -50,10 +59,28 @@ rtDeclareVariable(float,             scene_epsilon, , );
 rtDeclareVariable(rtObject,          top_object, , );
 rtDeclareVariable(rtObject,          top_shadower, , );
 
+// Many-light sampling, see lightTree.h
+rtBuffer<LightTreeNode>              light_tree;
+rtDeclareVariable(int,               light_samples, , );
+rtDeclareVariable(int,               exact_lights, , );
+rtDeclareVariable(unsigned int,      frame, , );
+rtDeclareVariable(uint2,             launch_index, rtLaunchIndex, );
+rtDeclareVariable(uint2,             launch_dim,   rtLaunchDim, );
+
+// Shadow visibility cache, see shadowCache.h.  Per pixel, x flags the lights
+// whose visibility from the primary hit is cached and y holds that
+// visibility, one bit per light for the first SHADOW_CACHE_LIGHTS lights.
+// shadow_cache_frame counts frames since the last invalidation, or is -1
+// when the cache is disabled.
+rtBuffer<uint2>                      shadow_cache;
+rtDeclareVariable(int,               shadow_cache_frame, , );
+rtDeclareVariable(int,               shadow_cache_fill_frames, , );
+
 rtDeclareVariable(optix::Ray, ray, rtCurrentRay, );
 rtDeclareVariable(float, t_hit, rtIntersectionDistance, );
 rtDeclareVariable(PerRayData_radiance, prd, rtPayload, );
 rtDeclareVariable(PerRayData_shadow,   prd_shadow, rtPayload, );
+rtDeclareVariable(PerRayData_radiance_iterative, prd_iterative, rtPayload, );
 
 static __device__ void phongShadowed()
 {
@@ -62,63 +89,255 @@ static __device__ void phongShadowed()
   rtTerminateRay();
 }
 
+// Traces the shadow ray toward light light_index, or answers it from the
+// shadow cache.  During the first shadow_cache_fill_frames frames every ray
+// is traced and a light stays cached only while all of its rays were either
+// unoccluded or fully blocked; lights partly behind glass or on a shadow
+// edge under the subpixel jitter keep being traced.
 static
-__device__ void phongShade( float3 p_Kd,
-                            float3 p_Ka,
-                            float3 p_Ks,
-                            float3 p_Kr,
-                            float  p_phong_exp, 
-                            float3 p_normal )
+__device__ float3 shadowAttenuation( const optix::Ray& shadow_ray, int light_index, int cache_index )
+{
+  const unsigned int bit = light_index < SHADOW_CACHE_LIGHTS ? 1u << light_index : 0u;
+  const bool cached = cache_index >= 0 && bit != 0u && shadow_cache_frame >= 0;
+
+  if( cached && shadow_cache_frame >= shadow_cache_fill_frames ) {
+    const uint2 entry = shadow_cache[cache_index];
+    if( entry.x & bit )
+      return make_float3( ( entry.y & bit ) ? 1.0f : 0.0f );
+  }
+
+  PerRayData_shadow shadow_prd;
+  shadow_prd.attenuation = make_float3(1.0f);
+  rtTrace(top_shadower, shadow_ray, shadow_prd);
+
+  if( cached && shadow_cache_frame < shadow_cache_fill_frames ) {
+    // The ray generation program cleared the entry on frame 0
+    uint2 entry = shadow_cache[cache_index];
+    const bool visible = fminf( shadow_prd.attenuation ) >= 1.0f;
+    const bool binary  = visible || fmaxf( shadow_prd.attenuation ) <= 0.0f;
+    if( shadow_cache_frame == 0 ) {
+      entry.x |= binary ? bit : 0u;
+      entry.y |= visible ? bit : 0u;
+    }
+    else if( !binary || ( ( entry.y & bit ) != 0u ) != visible ) {
+      entry.x &= ~bit;
+    }
+    shadow_cache[cache_index] = entry;
+  }
+  return shadow_prd.attenuation;
+}
+
+// Shadowed Phong contribution of a single light
+static
+__device__ float3 phongLight( const BasicLight& light,
+                              int    light_index,
+                              float3 p_Kd,
+                              float3 p_Ks,
+                              float  p_phong_exp,
+                              float3 p_normal,
+                              float3 hit_point,
+                              int    cache_index )
+{
+  float3 result = make_float3(0.0f);
+  float Ldist = optix::length(light.pos - hit_point);
+  float3 L = optix::normalize(light.pos - hit_point);
+  float nDl = optix::dot( p_normal, L);
+
+  // cast shadow ray
+  float3 light_attenuation = make_float3(static_cast<float>( nDl > 0.0f ));
+  if ( nDl > 0.0f && light.casts_shadow ) {
+    optix::Ray shadow_ray = optix::make_Ray( hit_point, L, SHADOW_RAY_TYPE, scene_epsilon, Ldist );
+    light_attenuation = shadowAttenuation( shadow_ray, light_index, cache_index );
+  }
+
+  // If not completely shadowed, light the hit point
+  if( fmaxf(light_attenuation) > 0.0f ) {
+    float3 Lc = light.color * light_attenuation;
+
+    result += p_Kd * nDl * Lc;
+
+    float3 H = optix::normalize(L - ray.direction);
+    float nDh = optix::dot( p_normal, H );
+    if(nDh > 0) {
+      float power = pow(nDh, p_phong_exp);
+      result += p_Ks * power * Lc;
+    }
+  }
+  return result;
+}
+
+// Estimated contribution of a light tree node: power over squared distance,
+// and zero when the whole node lies below the surface.
+static
+__device__ float lightNodeImportance( const LightTreeNode& node, float3 p, float3 n )
+{
+  const float3 center      = 0.5f * ( node.bbox_min + node.bbox_max );
+  const float3 half_extent = 0.5f * ( node.bbox_max - node.bbox_min );
+  const float3 d           = center - p;
+  if( optix::dot( n, d ) + optix::dot( fabs( n ), half_extent ) <= 0.0f )
+    return 0.0f;
+
+  // Clamp to the node size so that points inside a cluster do not blow up
+  const float dist2 = fmaxf( optix::dot( d, d ), fmaxf( optix::dot( half_extent, half_extent ), 1e-4f ) );
+  return node.power / dist2;
+}
+
+// Walks the light tree choosing children in proportion to their importance.
+// Returns the light index and its selection probability, or -1 if no light
+// can contribute.
+static
+__device__ int sampleLightTree( float3 p, float3 n, unsigned int& seed, float& pdf )
+{
+  pdf = 1.0f;
+  if( light_tree.size() == 0 )
+    return -1;
+
+  int node = 0;
+  while( light_tree[node].child >= 0 ) {
+    const int   left  = light_tree[node].child;
+    const float il    = lightNodeImportance( light_tree[left], p, n );
+    const float ir    = lightNodeImportance( light_tree[left + 1], p, n );
+    if( il + ir <= 0.0f )
+      return -1;
+
+    const float p_left = il / ( il + ir );
+    if( rnd( seed ) < p_left ) {
+      node = left;
+      pdf *= p_left;
+    } else {
+      node = left + 1;
+      pdf *= 1.0f - p_left;
+    }
+  }
+  return -light_tree[node].child - 1;
+}
+
+// Finds up to exact_lights lights with the highest importance by best-first
+// refinement of a cut through the tree.  Returns the number written to exact.
+static
+__device__ int selectExactLights( float3 p, float3 n, int* exact )
+{
+  int   frontier[LIGHT_FRONTIER_SIZE];
+  float importance[LIGHT_FRONTIER_SIZE];
+  int   count = 1;
+  frontier[0]   = 0;
+  importance[0] = lightNodeImportance( light_tree[0], p, n );
+
+  const int k = min( exact_lights, MAX_EXACT_LIGHTS );
+  for( ;; ) {
+    int leaves = 0;
+    int best   = -1;
+    for( int i = 0; i < count; ++i ) {
+      if( light_tree[frontier[i]].child < 0 )
+        ++leaves;
+      else if( best < 0 || importance[i] > importance[best] )
+        best = i;
+    }
+    if( leaves >= k || best < 0 || count == LIGHT_FRONTIER_SIZE )
+      break;
+
+    // Replace the most important inner node by its children
+    const int left = light_tree[frontier[best]].child;
+    frontier[best]    = left;
+    importance[best]  = lightNodeImportance( light_tree[left], p, n );
+    frontier[count]   = left + 1;
+    importance[count] = lightNodeImportance( light_tree[left + 1], p, n );
+    ++count;
+  }
+
+  int num_exact = 0;
+  while( num_exact < k ) {
+    int best = -1;
+    for( int i = 0; i < count; ++i ) {
+      if( light_tree[frontier[i]].child < 0 && importance[i] > 0.0f &&
+          ( best < 0 || importance[i] > importance[best] ) )
+        best = i;
+    }
+    if( best < 0 )
+      break;
+    exact[num_exact++] = -light_tree[frontier[best]].child - 1;
+    importance[best]   = 0.0f;
+  }
+  return num_exact;
+}
+
+// Ambient plus shadowed direct lighting at hit_point.  With light_samples > 0
+// the lights are not looped over: the exact_lights most important ones are
+// evaluated exactly and light_samples more are drawn from the light tree,
+// which bounds the shadow rays per hit regardless of the light count.
+// Samples that land on an exact light are discarded, so the estimate of
+// the remaining lights stays unbiased.
+static
+__device__ float3 phongDirect( float3 p_Kd,
+                               float3 p_Ka,
+                               float3 p_Ks,
+                               float  p_phong_exp, 
+                               float3 p_normal,
+                               float3 hit_point,
+                               int    cache_index )
 {
-  float3 hit_point = ray.origin + t_hit * ray.direction;
-  
   // ambient contribution
 
   float3 result = p_Ka * ambient_light_color;
 
   // compute direct lighting
-  unsigned int num_lights = lights.size();
-  for(int i = 0; i < num_lights; ++i) {
-    BasicLight light = lights[i];
-    float Ldist = optix::length(light.pos - hit_point);
-    float3 L = optix::normalize(light.pos - hit_point);
-    float nDl = optix::dot( p_normal, L);
-
-    // cast shadow ray
-    float3 light_attenuation = make_float3(static_cast<float>( nDl > 0.0f ));
-    if ( nDl > 0.0f && light.casts_shadow ) {
-      PerRayData_shadow shadow_prd;
-      shadow_prd.attenuation = make_float3(1.0f);
-      optix::Ray shadow_ray = optix::make_Ray( hit_point, L, SHADOW_RAY_TYPE, scene_epsilon, Ldist );
-      rtTrace(top_shadower, shadow_ray, shadow_prd);
-      light_attenuation = shadow_prd.attenuation;
-    }
+  if( light_samples <= 0 ) {
+    unsigned int num_lights = lights.size();
+    for(int i = 0; i < num_lights; ++i)
+      result += phongLight( lights[i], i, p_Kd, p_Ks, p_phong_exp, p_normal, hit_point, cache_index );
+    return result;
+  }
 
-    // If not completely shadowed, light the hit point
-    if( fmaxf(light_attenuation) > 0.0f ) {
-      float3 Lc = light.color * light_attenuation;
+  int exact[MAX_EXACT_LIGHTS];
+  const int num_exact = exact_lights > 0 ? selectExactLights( hit_point, p_normal, exact ) : 0;
+  for( int e = 0; e < num_exact; ++e )
+    result += phongLight( lights[exact[e]], exact[e], p_Kd, p_Ks, p_phong_exp, p_normal, hit_point, cache_index );
 
-      result += p_Kd * nDl * Lc;
+  // Decorrelate the bounces of one pixel through the hit distance
+  unsigned int seed = tea<4>( launch_index.y*launch_dim.x + launch_index.x, frame ^ __float_as_uint( t_hit ) );
+  for( int s = 0; s < light_samples; ++s ) {
+    float pdf;
+    const int index = sampleLightTree( hit_point, p_normal, seed, pdf );
+    if( index < 0 )
+      break;
 
-      float3 H = optix::normalize(L - ray.direction);
-      float nDh = optix::dot( p_normal, H );
-      if(nDh > 0) {
-        float power = pow(nDh, p_phong_exp);
-        result += p_Ks * power * Lc;
-      }
-    }
+    bool is_exact = false;
+    for( int e = 0; e < num_exact; ++e )
+      is_exact |= exact[e] == index;
+    if( !is_exact )
+      result += phongLight( lights[index], index, p_Kd, p_Ks, p_phong_exp, p_normal, hit_point, cache_index ) /
+                ( pdf * static_cast<float>( light_samples ) );
   }
 
+  return result;
+}
+
+static
+__device__ void phongShade( float3 p_Kd,
+                            float3 p_Ka,
+                            float3 p_Ks,
+                            float3 p_Kr,
+                            float  p_phong_exp, 
+                            float3 p_normal )
+{
+  float3 hit_point = ray.origin + t_hit * ray.direction;
+  
+  float3 result = phongDirect( p_Kd, p_Ka, p_Ks, p_phong_exp, p_normal, hit_point, prd.cache_index );
+
   if( fmaxf( p_Kr ) > 0 ) {
 
     // ray tree attenuation
     PerRayData_radiance new_prd;             
     new_prd.importance = prd.importance * optix::luminance( p_Kr );
     new_prd.depth = prd.depth + 1;
+    new_prd.cache_index = -1;
 
     // reflection ray
     if( new_prd.importance >= 0.01f && new_prd.depth <= max_depth) {
       float3 R = optix::reflect( ray.direction, p_normal );
+      new_prd.differential = prd.differential;
+      transferRayDifferential( new_prd.differential, ray.direction, t_hit, p_normal );
+      reflectRayDifferential( new_prd.differential, ray.direction, p_normal );
       optix::Ray refl_ray = optix::make_Ray( hit_point, R, RADIANCE_RAY_TYPE, scene_epsilon, RT_DEFAULT_MAX );
       rtTrace(top_object, refl_ray, new_prd);
       result += p_Kr * new_prd.result;
@@ -127,4 +346,31 @@ __device__ void phongShade( float3 p_Kd,
   
   // pass the color back up the tree
   prd.result = result;
+  prd.distance = t_hit;
+}
+
+// Iterative counterpart of phongShade: the reflection is returned as a
+// continuation ray instead of being traced here.  The importance cutoff is
+// left to Russian roulette in the ray generation program.
+static
+__device__ void phongShadeIterative( float3 p_Kd,
+                                     float3 p_Ka,
+                                     float3 p_Ks,
+                                     float3 p_Kr,
+                                     float  p_phong_exp, 
+                                     float3 p_normal )
+{
+  float3 hit_point = ray.origin + t_hit * ray.direction;
+
+  prd_iterative.result = phongDirect( p_Kd, p_Ka, p_Ks, p_phong_exp, p_normal, hit_point, prd_iterative.cache_index );
+  prd_iterative.distance = t_hit;
+
+  if( fmaxf( p_Kr ) > 0 && prd_iterative.depth + 1 <= max_depth ) {
+    prd_iterative.origin       = hit_point;
+    prd_iterative.direction    = optix::reflect( ray.direction, p_normal );
+    prd_iterative.weight       = p_Kr;
+    prd_iterative.continue_ray = 1;
+    transferRayDifferential( prd_iterative.differential, ray.direction, t_hit, p_normal );
+    reflectRayDifferential( prd_iterative.differential, ray.direction, p_normal );
+  }
 }
@@ -0,0 +1,104 @@
+/* 
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <optixu/optixu_math_namespace.h>
+#include "helpers.h"
+
+// Ray differentials (Igehy, "Tracing Ray Differentials"): derivatives of a
+// ray's origin and direction with respect to the pixel coordinates x and y.
+// They start at the pinhole camera, are carried in the radiance payloads
+// through specular reflection and refraction, and give the footprint of a
+// pixel at a hit point for texture LOD selection.  The functions are also
+// compiled for the host, where the CPU reference renderer carries the same
+// differentials.
+//
+// Normal derivatives are not available from the geometry programs, so every
+// surface is treated as locally flat.  This underestimates the spread after
+// reflection off curved surfaces.
+struct RayDifferential
+{
+  optix::float3 dOdx;
+  optix::float3 dOdy;
+  optix::float3 dDdx;
+  optix::float3 dDdy;
+};
+
+// Differential of a camera ray with unnormalized direction d, where one
+// pixel step changes d by dddx and dddy.  The origin is shared by all pixels.
+static __host__ __device__ __inline__ RayDifferential cameraRayDifferential( optix::float3 d, optix::float3 dddx, optix::float3 dddy )
+{
+  RayDifferential rd;
+  rd.dOdx = optix::make_float3( 0.0f );
+  rd.dOdy = optix::make_float3( 0.0f );
+  rd.dDdx = differential_generation_direction( d, dddx );
+  rd.dDdy = differential_generation_direction( d, dddy );
+  return rd;
+}
+
+// Moves the differential of a ray with direction D to its hit at distance t
+// on a surface with normal n.  Afterwards dOdx and dOdy are the position
+// differentials of the hit point, which start the secondary rays.  Grazing
+// hits keep the untransferred differential instead of blowing it up.
+static __host__ __device__ __inline__ void transferRayDifferential( RayDifferential& rd, optix::float3 D, float t, optix::float3 n )
+{
+  if( fabsf( optix::dot( D, n ) ) > 1.e-4f ) {
+    rd.dOdx = differential_transfer_origin( rd.dOdx, rd.dDdx, t, D, n );
+    rd.dOdy = differential_transfer_origin( rd.dOdy, rd.dDdy, t, D, n );
+  } else {
+    rd.dOdx += t * rd.dDdx;
+    rd.dOdy += t * rd.dDdy;
+  }
+}
+
+// Direction differentials of the mirror reflection of D about n.  The
+// helpers.h formulas take the normal's derivative, which is zero here.
+static __host__ __device__ __inline__ void reflectRayDifferential( RayDifferential& rd, optix::float3 D, optix::float3 n )
+{
+  rd.dDdx = differential_reflect_direction( rd.dOdx, rd.dDdx, optix::make_float3( 0.0f ), D, n );
+  rd.dDdy = differential_reflect_direction( rd.dOdy, rd.dDdy, optix::make_float3( 0.0f ), D, n );
+}
+
+// Direction differentials of the refraction of D into T through a surface
+// with normal n and index of refraction ior.  n may face either side.
+static __host__ __device__ __inline__ void refractRayDifferential( RayDifferential& rd, optix::float3 D, optix::float3 T,
+                                                                   optix::float3 n, float ior )
+{
+  if( fabsf( optix::dot( T, n ) ) < 1.e-4f )
+    return;
+
+  rd.dDdx = differential_refract_direction( rd.dOdx, rd.dDdx, optix::make_float3( 0.0f ), D, n, ior, T );
+  rd.dDdy = differential_refract_direction( rd.dOdy, rd.dDdy, optix::make_float3( 0.0f ), D, n, ior, T );
+}
+
+// Width of the pixel footprint at a hit after transferRayDifferential.
+static __host__ __device__ __inline__ float footprintWidth( const RayDifferential& rd )
+{
+  return fmaxf( optix::length( rd.dOdx ), optix::length( rd.dOdy ) );
+}
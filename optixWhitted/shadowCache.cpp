@@ -0,0 +1,81 @@
+/* 
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "shadowCache.h"
+
+using namespace optix;
+
+
+ShadowCache::ShadowCache( Context context, unsigned width, unsigned height, unsigned fill_frames )
+  : m_context( context ),
+    m_fill_frames( fill_frames ),
+    m_frame( 0 )
+{
+  m_buffer = m_context->createBuffer( RT_BUFFER_INPUT_OUTPUT | RT_BUFFER_GPU_LOCAL, RT_FORMAT_UNSIGNED_INT2,
+                                      width * height );
+  m_context["shadow_cache"]->set( m_buffer );
+  m_context["shadow_cache_frame"]->setInt( 0 );
+  m_context["shadow_cache_fill_frames"]->setInt( static_cast<int>( fill_frames ) );
+}
+
+
+void ShadowCache::disable( Context context )
+{
+  context["shadow_cache"]->set( context->createBuffer( RT_BUFFER_INPUT_OUTPUT | RT_BUFFER_GPU_LOCAL,
+                                                       RT_FORMAT_UNSIGNED_INT2, 0 ) );
+  context["shadow_cache_frame"]->setInt( -1 );
+  context["shadow_cache_fill_frames"]->setInt( 0 );
+}
+
+
+void ShadowCache::invalidate()
+{
+  m_frame = 0;
+  m_context["shadow_cache_frame"]->setInt( 0 );
+}
+
+
+void ShadowCache::resize( unsigned width, unsigned height )
+{
+  m_buffer->setSize( width * height );
+  invalidate();
+}
+
+
+void ShadowCache::beginFrame( bool restart )
+{
+  if( restart )
+    invalidate();
+
+  m_context["shadow_cache_frame"]->setInt( static_cast<int>( m_frame ) );
+
+  // Saturate once the cache is in use; the device only compares against
+  // the fill frame count.
+  if( m_frame <= m_fill_frames )
+    ++m_frame;
+}
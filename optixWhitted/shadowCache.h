@@ -0,0 +1,70 @@
+/* 
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//-----------------------------------------------------------------------------
+//
+// shadowCache: host side of the shadow visibility cache in phong.h.  While
+// the camera and scene stay unchanged, the shadow rays from a pixel's
+// primary hit return the same answer every accumulation frame.  The cache
+// records them as two bitmasks per pixel (8 bytes, SHADOW_CACHE_LIGHTS
+// lights) over the first few frames and answers them afterwards.
+//
+//-----------------------------------------------------------------------------
+
+#pragma once
+
+#include <optixu/optixpp_namespace.h>
+
+class ShadowCache
+{
+public:
+  // fill_frames is the number of frames traced in full after an
+  // invalidation; only visibility that agreed across all of them is reused.
+  ShadowCache( optix::Context context, unsigned width, unsigned height, unsigned fill_frames = 4 );
+
+  // Binds an empty cache for contexts that run without one.
+  static void disable( optix::Context context );
+
+  // Resizes the cache; its contents are invalid afterwards.
+  void resize( unsigned width, unsigned height );
+
+  // Refills the cache from the next launch on, including launches such as
+  // reprojection that run before the next beginFrame().  Call on camera
+  // moves and scene edits that change visibility.
+  void invalidate();
+
+  // Sets shadow_cache_frame for the next launch.  restart is true for
+  // accumulation frame 0, which always invalidates.
+  void beginFrame( bool restart );
+
+private:
+  optix::Context m_context;
+  optix::Buffer  m_buffer;
+  unsigned       m_fill_frames;
+  unsigned       m_frame;  // Frames launched since the last invalidation
+};
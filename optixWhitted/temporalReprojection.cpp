@@ -0,0 +1,90 @@
+/* 
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "temporalReprojection.h"
+
+#include <sutil.h>
+
+using namespace optix;
+
+
+TemporalReprojection::TemporalReprojection( Context context, unsigned width, unsigned height,
+                                            float max_history, float tolerance )
+  : m_context( context ),
+    m_width( width ),
+    m_height( height )
+{
+  m_context["history_accum_buffer"]->set( m_context->createBuffer(
+      RT_BUFFER_INPUT_OUTPUT | RT_BUFFER_GPU_LOCAL, RT_FORMAT_FLOAT4, width, height ) );
+  m_context["position_buffer"]->set( m_context->createBuffer(
+      RT_BUFFER_INPUT_OUTPUT | RT_BUFFER_GPU_LOCAL, RT_FORMAT_FLOAT4, width, height ) );
+  m_context["history_position_buffer"]->set( m_context->createBuffer(
+      RT_BUFFER_INPUT_OUTPUT | RT_BUFFER_GPU_LOCAL, RT_FORMAT_FLOAT4, width, height ) );
+
+  m_context["max_history"]->setFloat( max_history );
+  m_context["reprojection_tolerance"]->setFloat( tolerance );
+  m_context["prev_eye"]->setFloat( 0.0f, 0.0f, 0.0f );
+  m_context["prev_U"]->setFloat( 1.0f, 0.0f, 0.0f );
+  m_context["prev_V"]->setFloat( 0.0f, 1.0f, 0.0f );
+  m_context["prev_W"]->setFloat( 0.0f, 0.0f, 1.0f );
+}
+
+
+void TemporalReprojection::resize( unsigned width, unsigned height )
+{
+  m_width = width;
+  m_height = height;
+  sutil::resizeBuffer( m_context["history_accum_buffer"]->getBuffer(), width, height );
+  sutil::resizeBuffer( m_context["position_buffer"]->getBuffer(), width, height );
+  sutil::resizeBuffer( m_context["history_position_buffer"]->getBuffer(), width, height );
+}
+
+
+void TemporalReprojection::reproject( const float3& prev_eye, const float3& prev_U,
+                                      const float3& prev_V, const float3& prev_W )
+{
+  // The current frame becomes the history read by reproject_camera
+  swap( "accum_buffer", "history_accum_buffer" );
+  swap( "position_buffer", "history_position_buffer" );
+
+  m_context["prev_eye"]->setFloat( prev_eye );
+  m_context["prev_U"]->setFloat( prev_U );
+  m_context["prev_V"]->setFloat( prev_V );
+  m_context["prev_W"]->setFloat( prev_W );
+
+  m_context->launch( ENTRY_POINT, m_width, m_height );
+}
+
+
+void TemporalReprojection::swap( const char* a, const char* b )
+{
+  Buffer buffer_a = m_context[a]->getBuffer();
+  Buffer buffer_b = m_context[b]->getBuffer();
+  m_context[a]->set( buffer_b );
+  m_context[b]->set( buffer_a );
+}
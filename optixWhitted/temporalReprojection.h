@@ -0,0 +1,73 @@
+/* 
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//-----------------------------------------------------------------------------
+//
+// temporalReprojection: host side of pinhole_camera_reproject and
+// reproject_camera in accum_camera.cu.  Keeps a second accumulation and
+// first-hit position buffer and, when the camera moves, warps the previous
+// frame's accumulation into the new view instead of restarting it.
+//
+//-----------------------------------------------------------------------------
+
+#pragma once
+
+#include <optixu/optixpp_namespace.h>
+
+class TemporalReprojection
+{
+public:
+  // Entry point of reproject_camera; the caller must reserve it with
+  // setEntryPointCount.
+  static const unsigned ENTRY_POINT = 1;
+
+  // max_history caps the sample count carried across a camera move.
+  // tolerance is the allowed first-hit mismatch relative to hit distance.
+  TemporalReprojection( optix::Context context, unsigned width, unsigned height,
+                        float max_history = 32.0f, float tolerance = 0.02f );
+
+  // Names of the ray generation programs in accum_camera.cu.
+  static const char* accumulateProgramName() { return "pinhole_camera_reproject"; }
+  static const char* reprojectProgramName()  { return "reproject_camera"; }
+
+  // Resizes the history and position buffers.  accum_buffer itself is
+  // resized by the caller; the next launch must use frame 0.
+  void resize( unsigned width, unsigned height );
+
+  // Warps accumulation from the camera that rendered the current
+  // accum_buffer (prev_*) into the camera currently set on the context.
+  void reproject( const optix::float3& prev_eye, const optix::float3& prev_U,
+                  const optix::float3& prev_V, const optix::float3& prev_W );
+
+private:
+  void swap( const char* a, const char* b );
+
+  optix::Context m_context;
+  unsigned       m_width;
+  unsigned       m_height;
+};
@@ -92,6 +92,298 @@ void createTransform(SimpleMatrix4x3& transform, SimpleMatrix4x3& invTransform,
 }
 
 
+//------------------------------------------------------------------------------
+// Half-spaces dot( n, x ) >= w, stored as ( n, w ), that together contain every
+// ray segment of a batch.  Four side planes bound the ray directions around
+// their mean, a near plane lies at the nearest origin and, when every ray has
+// a finite tmax, a far plane at the farthest end point.  Returns no planes if
+// the directions do not fit in a cone of less than a half-space.
+static std::vector<float4> rayBatchPlanes( const Ray* rays, size_t count )
+{
+  using optix::dot;
+
+  std::mutex mutex;
+  float3 mean = make_float3( 0.0f, 0.0f, 0.0f );
+  parallelFor( count, 64*1024, [&]( size_t first, size_t last )
+  {
+    float3 sum = make_float3( 0.0f, 0.0f, 0.0f );
+    for( size_t i = first; i < last; ++i )
+      sum += optix::normalize( rays[i].dir );
+    std::lock_guard<std::mutex> lock( mutex );
+    mean += sum;
+  } );
+  if( count == 0 || dot( mean, mean ) == 0.0f )
+    return std::vector<float4>();
+
+  // View frame around the mean direction; every direction must point along W
+  const float3 W = optix::normalize( mean );
+  const float3 U = optix::normalize( optix::cross( fabsf( W.x ) < 0.9f ? make_float3( 1, 0, 0 ) : make_float3( 0, 1, 0 ), W ) );
+  const float3 V = optix::cross( W, U );
+
+  bool bounded = true;
+  float umin = 1e30f, umax = -1e30f, vmin = 1e30f, vmax = -1e30f;
+  parallelFor( count, 64*1024, [&]( size_t first, size_t last )
+  {
+    bool ok = true;
+    float u0 = 1e30f, u1 = -1e30f, v0 = 1e30f, v1 = -1e30f;
+    for( size_t i = first; i < last; ++i )
+    {
+      const float3 d = rays[i].dir;
+      const float w = dot( d, W );
+      if( !( w > 1e-6f * optix::length( d ) ) )
+      {
+        ok = false;
+        break;
+      }
+      const float u = dot( d, U ) / w;
+      const float v = dot( d, V ) / w;
+      u0 = std::min( u0, u );  u1 = std::max( u1, u );
+      v0 = std::min( v0, v );  v1 = std::max( v1, v );
+    }
+    std::lock_guard<std::mutex> lock( mutex );
+    bounded = bounded && ok;
+    umin = std::min( umin, u0 );  umax = std::max( umax, u1 );
+    vmin = std::min( vmin, v0 );  vmax = std::max( vmax, v1 );
+  } );
+  if( !bounded )
+    return std::vector<float4>();
+
+  // Every direction d has dot( n, d ) >= 0 for these normals, so each plane
+  // only has to be pushed back to the lowest origin
+  std::vector<float4> planes;
+  const float3 normals[] = { umax*W - U, U - umin*W, vmax*W - V, V - vmin*W, W };
+  for( size_t p = 0; p < sizeof(normals)/sizeof(normals[0]); ++p )
+    planes.push_back( make_float4( normals[p].x, normals[p].y, normals[p].z, 1e30f ) );
+  bool finite = true;
+  float farthest = -1e30f;
+  parallelFor( count, 64*1024, [&]( size_t first, size_t last )
+  {
+    float w[5] = { 1e30f, 1e30f, 1e30f, 1e30f, 1e30f };
+    bool ok = true;
+    float f = -1e30f;
+    for( size_t i = first; i < last; ++i )
+    {
+      const float3 o = rays[i].origin;
+      for( int p = 0; p < 5; ++p )
+        w[p] = std::min( w[p], dot( normals[p], o ) );
+      ok = ok && rays[i].tmax < 1e30f;
+      if( ok )
+        f = std::max( f, dot( W, o + rays[i].tmax * rays[i].dir ) );
+    }
+    std::lock_guard<std::mutex> lock( mutex );
+    for( int p = 0; p < 5; ++p )
+      planes[p].w = std::min( planes[p].w, w[p] );
+    finite = finite && ok;
+    farthest = std::max( farthest, f );
+  } );
+  if( finite )
+    planes.push_back( make_float4( -W.x, -W.y, -W.z, -farthest ) );
+  return planes;
+}
+
+
+//------------------------------------------------------------------------------
+//
+// Instances of a scene, culled against each ray batch before the top level
+// model is built.  Only instances whose bounds reach into the batch are
+// compacted into the instance and transform lists handed to Prime, so the
+// cost of building the top level follows the visible instances rather than
+// all of them.  The top level is rebuilt only when the visible set or the
+// transform of a visible instance changed since the last update.
+//
+class InstanceManager
+{
+public:
+  InstanceManager( Context& context, std::vector<Model>& models, std::vector<PrimeMesh>& meshes )
+    : m_models( models.size() ),
+      m_structureChanged( true )
+  {
+    for( size_t i = 0; i < models.size(); ++i )
+    {
+      m_models[i] = models[i]->getRTPmodel();
+      m_modelBoxes.push_back( make_float3( meshes[i].bbox_min ) );
+      m_modelBoxes.push_back( make_float3( meshes[i].bbox_max ) );
+    }
+    m_scene = context->createModel();
+  }
+
+  // Adds an instance of model modelId and returns its index
+  int addInstance( int modelId, const SimpleMatrix4x3& transform, const SimpleMatrix4x3& invTransform )
+  {
+    m_modelIds.push_back( modelId );
+    m_transforms.push_back( transform );
+    m_invTransforms.push_back( invTransform );
+    m_centers.push_back( float3() );
+    m_extents.push_back( float3() );
+    m_visible.push_back( 0 );
+    m_dirty.push_back( 0 );
+    updateBounds( m_modelIds.size() - 1 );
+    m_structureChanged = true;
+    return static_cast<int>( m_modelIds.size() ) - 1;
+  }
+
+  // Moves an instance.  Takes effect on the next update.
+  void setTransform( int instance, const SimpleMatrix4x3& transform, const SimpleMatrix4x3& invTransform )
+  {
+    m_transforms[instance] = transform;
+    m_invTransforms[instance] = invTransform;
+    updateBounds( instance );
+    m_dirty[instance] = 1;
+  }
+
+  // Culls the instances against a ray batch and brings the scene model up to
+  // date for it.  Returns true if the top level model was rebuilt.  With no
+  // instances there is nothing to build and the scene is left as it is.
+  bool update( const Ray* rays, size_t count );
+
+  Model  scene()        const { return m_scene; }
+  size_t numInstances() const { return m_modelIds.size(); }
+  size_t numVisible()   const { return m_visibleInstances.size(); }
+
+  // Hit instance ids index these lists of the visible instances
+  const std::vector<int>&             visibleInstances()     const { return m_visibleInstances; }
+  const std::vector<int>&             visibleModelIds()      const { return m_visibleModelIds; }
+  const std::vector<SimpleMatrix4x3>& visibleInvTransforms() const { return m_visibleInvTransforms; }
+
+private:
+  // World space box of an instance from its model box and transform
+  void updateBounds( size_t instance )
+  {
+    const SimpleMatrix4x3& M = m_transforms[instance];
+    const float3 bmin = m_modelBoxes[2*m_modelIds[instance]];
+    const float3 bmax = m_modelBoxes[2*m_modelIds[instance]+1];
+    const float3 c = 0.5f*(bmin + bmax);
+    const float3 e = 0.5f*(bmax - bmin);
+    m_centers[instance] = make_float3(
+      M.f0*c.x + M.f1*c.y + M.f2*c.z  + M.f3,
+      M.f4*c.x + M.f5*c.y + M.f6*c.z  + M.f7,
+      M.f8*c.x + M.f9*c.y + M.f10*c.z + M.f11 );
+    m_extents[instance] = make_float3(
+      fabsf( M.f0 )*e.x + fabsf( M.f1 )*e.y + fabsf( M.f2 )*e.z,
+      fabsf( M.f4 )*e.x + fabsf( M.f5 )*e.y + fabsf( M.f6 )*e.z,
+      fabsf( M.f8 )*e.x + fabsf( M.f9 )*e.y + fabsf( M.f10 )*e.z );
+  }
+
+  // Instances culled per task; compaction offsets are kept per chunk
+  static const size_t CHUNK_SIZE = 16*1024;
+
+  std::vector<RTPmodel>        m_models;
+  std::vector<float3>          m_modelBoxes;   // min and max per model
+
+  std::vector<int>             m_modelIds;
+  std::vector<SimpleMatrix4x3> m_transforms;
+  std::vector<SimpleMatrix4x3> m_invTransforms;
+  std::vector<float3>          m_centers;
+  std::vector<float3>          m_extents;
+  std::vector<unsigned char>   m_visible;      // as of the last update
+  std::vector<unsigned char>   m_dirty;        // transform set since the last update
+  bool                         m_structureChanged;
+
+  // Compacted lists of the visible instances.  The transforms are written
+  // straight into page-locked memory that Prime reads them from.
+  std::vector<int>             m_visibleInstances;
+  std::vector<int>             m_visibleModelIds;
+  std::vector<SimpleMatrix4x3> m_visibleInvTransforms;
+  std::vector<RTPmodel>        m_visibleModels;
+  Buffer<SimpleMatrix4x3>      m_visibleTransforms;
+
+  Model m_scene;
+};
+
+//------------------------------------------------------------------------------
+bool InstanceManager::update( const Ray* rays, size_t count )
+{
+  // Without instances there is no scene to build; Prime needs at least one
+  const size_t numInstances = m_modelIds.size();
+  if( numInstances == 0 )
+    return false;
+
+  const std::vector<float4> planes = rayBatchPlanes( rays, count );
+  const size_t numChunks = ( numInstances + CHUNK_SIZE - 1 ) / CHUNK_SIZE;
+
+  // Cull, counting the visible instances of every chunk and noting whether
+  // anything the scene was built from changed
+  std::vector<size_t> chunkOffsets( numChunks + 1, 0 );
+  std::vector<unsigned char> chunkChanged( numChunks, 0 );
+  parallelFor( numChunks, 1, [&]( size_t firstChunk, size_t lastChunk )
+  {
+    for( size_t c = firstChunk; c < lastChunk; ++c )
+    {
+      const size_t end = std::min( numInstances, (c+1)*CHUNK_SIZE );
+      size_t visible = 0;
+      bool changed = false;
+      for( size_t i = c*CHUNK_SIZE; i < end; ++i )
+      {
+        const float3 center = m_centers[i];
+        const float3 extent = m_extents[i];
+        bool inside = true;
+        for( size_t p = 0; p < planes.size() && inside; ++p )
+        {
+          const float4& pl = planes[p];
+          inside = pl.x*center.x + pl.y*center.y + pl.z*center.z +
+                   fabsf( pl.x )*extent.x + fabsf( pl.y )*extent.y + fabsf( pl.z )*extent.z >= pl.w;
+        }
+        changed = changed || m_visible[i] != inside || ( inside && m_dirty[i] );
+        m_visible[i] = inside;
+        m_dirty[i] = 0;
+        visible += inside;
+      }
+      chunkOffsets[c+1] = visible;
+      chunkChanged[c] = changed;
+    }
+  } );
+
+  if( !m_structureChanged && std::find( chunkChanged.begin(), chunkChanged.end(), 1 ) == chunkChanged.end() )
+    return false;
+  m_structureChanged = false;
+
+  for( size_t c = 0; c < numChunks; ++c )
+    chunkOffsets[c+1] += chunkOffsets[c];
+  const size_t numVisible = chunkOffsets[numChunks];
+
+  // Prime needs at least one instance, so an empty view keeps instance 0
+  const size_t numListed = std::max<size_t>( numVisible, 1 );
+  m_visibleInstances.resize( numListed );
+  m_visibleModelIds.resize( numListed );
+  m_visibleInvTransforms.resize( numListed );
+  m_visibleModels.resize( numListed );
+  m_visibleTransforms.alloc( numListed, RTP_BUFFER_TYPE_HOST, LOCKED );
+  SimpleMatrix4x3* transforms = m_visibleTransforms.ptr();
+  if( numVisible < numListed )
+  {
+    m_visibleInstances[0]     = 0;
+    m_visibleModelIds[0]      = m_modelIds[0];
+    m_visibleInvTransforms[0] = m_invTransforms[0];
+    m_visibleModels[0]        = m_models[m_modelIds[0]];
+    transforms[0]             = m_transforms[0];
+  }
+  parallelFor( numChunks, 1, [&]( size_t firstChunk, size_t lastChunk )
+  {
+    for( size_t c = firstChunk; c < lastChunk; ++c )
+    {
+      size_t out = chunkOffsets[c];
+      const size_t end = std::min( numInstances, (c+1)*CHUNK_SIZE );
+      for( size_t i = c*CHUNK_SIZE; i < end; ++i )
+      {
+        if( !m_visible[i] )
+          continue;
+        m_visibleInstances[out]     = static_cast<int>( i );
+        m_visibleModelIds[out]      = m_modelIds[i];
+        m_visibleInvTransforms[out] = m_invTransforms[i];
+        m_visibleModels[out]        = m_models[m_modelIds[i]];
+        transforms[out]             = m_transforms[i];
+        ++out;
+      }
+    }
+  } );
+
+  m_scene->setInstances( numListed, RTP_BUFFER_TYPE_HOST, &m_visibleModels[0],
+                         RTP_BUFFER_FORMAT_TRANSFORM_FLOAT4x3, m_visibleTransforms.type(), m_visibleTransforms.ptr() );
+  m_scene->update( 0 );
+  return true;
+}
+
+
 //------------------------------------------------------------------------------
 void printUsageAndExit(const char* argv0)
 {
@@ -103,6 +395,7 @@ void printUsageAndExit(const char* argv0)
     << "  -c  | --context [cpu|(cuda)]               Specify context type. Default is cuda\n"
     << "  -b  | --buffer [(host)|cuda]               Specify buffer type. Default is host\n"
     << "  -i  | --num-instances <num_instances>      Specify the number of instances to be rendered. Must be > 0\n"
+    << "        --cache <dir>                        Save and restore the built mesh acceleration structures in dir\n"
     << std::endl;
 
   exit(1);
@@ -120,6 +413,7 @@ int main(int argc, char** argv)
   int height = 768;
   int numInstances = 10000;
   float sceneSize = 1;
+  std::string cacheDir;
 
   // parse arguments
   for (int i = 1; i < argc; ++i)
@@ -161,6 +455,10 @@ int main(int argc, char** argv)
       else
         printUsageAndExit(argv[0]);
     }
+    else if (arg == "--cache" && i + 1 < argc)
+    {
+      cacheDir = std::string(argv[++i]);
+    }
     else
     {
       std::cerr << "Bad option: '" << arg << "'" << std::endl;
@@ -242,32 +540,23 @@ int main(int argc, char** argv)
       models[i] = context->createModel();
       models[i]->setTriangles(meshes[i].num_triangles, RTP_BUFFER_TYPE_HOST, meshes[i].tri_indices, 
                               meshes[i].num_vertices,  RTP_BUFFER_TYPE_HOST, meshes[i].positions );
-      models[i]->update(0);      
+      updateModelCached( models[i]->getRTPmodel(), contextType, 0, cacheDir,
+                         meshes[i].tri_indices, meshes[i].num_triangles * sizeof(int3),
+                         meshes[i].positions,   meshes[i].num_vertices  * sizeof(float3) );
     }
 
     //
     // Create a list of random instances
     //
-    std::vector<RTPmodel> instances(numInstances);
-    std::vector<int> modelIds(numInstances);
-    std::vector<SimpleMatrix4x3> transforms(numInstances);
-    std::vector<SimpleMatrix4x3> invTransforms(numInstances);
+    InstanceManager instances(context, models, meshes);
     for (int i = 0; i < numInstances; ++i)
     {
+      SimpleMatrix4x3 transform, invTransform;
       int modelId = genRndInt((int)models.size());
-      modelIds[i]  = modelId;
-      instances[i] = models[modelId]->getRTPmodel();
-      createTransform(transforms[i], invTransforms[i], sceneSize, baseScale[modelId]);
+      createTransform(transform, invTransform, sceneSize, baseScale[modelId]);
+      instances.addInstance(modelId, transform, invTransform);
     }
 
-    //
-    // Assemble instances into a single scene
-    //
-    Model scene = context->createModel();
-    scene->setInstances(numInstances, RTP_BUFFER_TYPE_HOST, &instances[0], 
-                        RTP_BUFFER_FORMAT_TRANSFORM_FLOAT4x3, RTP_BUFFER_TYPE_HOST, &transforms[0] );
-    scene->update(0);
-
     //
     // Create buffers for rays and hits
     //
@@ -277,10 +566,16 @@ int main(int argc, char** argv)
     createRaysPersp(rays, width, height, eye, center, 90.0f);
     Buffer<HitInstancing> hits(rays.count(), RTP_BUFFER_TYPE_HOST);
 
+    //
+    // Assemble the instances the rays can reach into a single scene
+    //
+    instances.update(rays.hostPtr(), rays.count());
+    std::cerr << "Visible instances: " << instances.numVisible() << " of " << instances.numInstances() << "\n";
+
     //
     // Execute query
     //
-    Query query = scene->createQuery(RTP_QUERY_TYPE_CLOSEST);
+    Query query = instances.scene()->createQuery(RTP_QUERY_TYPE_CLOSEST);
     query->setRays(rays.count(), Ray::format, rays.type(), rays.ptr());
     query->setHits(hits.count(), HitInstancing::format, hits.type(), hits.ptr());
     query->execute(0);
@@ -288,8 +583,15 @@ int main(int argc, char** argv)
     //
     // Shade the hit results to create image
     //
+    HitShader shader;
+    for (size_t i = 0; i < meshes.size(); ++i)
+      shader.addMesh(meshes[i]);
+    shader.setInstances(instances.visibleModelIds(), instances.visibleInvTransforms());
+
+    HitsSoA hitsSoA;
+    hitsSoA.assign(hits.hostPtr(), hits.count());
     std::vector<float3> image(width * height);
-    shadeHits(image, hits, modelIds, meshes, eye, invTransforms );
+    shader.shade(image, hitsSoA, eye, make_float3(1.0f, 1.0f, 1.0f));
     writePpm("output.ppm", &image[0].x, width, height);
 
     for( int i = 0; i < static_cast<int>( meshes.size() ); ++i )
@@ -50,6 +50,7 @@ void printUsageAndExit( const char* argv0 )
   << "  -c  | --context [cpu|(cuda)]               Specify context type. Default is cuda\n"
   << "  -b  | --buffer [(host)|cuda]               Specify buffer type. Default is host\n"
   << "  -w  | --width <number>                     Specify output image width\n"
+  << "        --cache <dir>                        Save and restore the built acceleration structure in dir\n"
   << std::endl;
   
   exit(1);
@@ -64,6 +65,7 @@ int main( int argc, char** argv )
   std::string objFilename = std::string( sutil::samplesDir() ) + "/data/cow.obj";
   int width = 640;
   int height = 0;
+  std::string cacheDir;
 
   // parse arguments
   for ( int i = 1; i < argc; ++i ) 
@@ -101,6 +103,10 @@ int main( int argc, char** argv )
     {
       width = atoi(argv[++i]);
     } 
+    else if( arg == "--cache" && i+1 < argc )
+    {
+      cacheDir = argv[++i];
+    }
     else 
     {
       std::cerr << "Bad option: '" << arg << "'" << std::endl;
@@ -145,7 +151,9 @@ int main( int argc, char** argv )
     Model model = context->createModel();
     model->setTriangles( indices, vertices );       
     model->setBuilderParameter(RTP_BUILDER_PARAM_USE_CALLER_TRIANGLES, 1); // Masking requires caller triangles
-    model->update( 0 );
+    updateModelCached( model->getRTPmodel(), contextType, 0, cacheDir,
+                       &indicesMasked[0], indicesMasked.size() * sizeof( int4 ),
+                       mesh.getVertexData(), mesh.num_vertices * sizeof( float3 ) );
 
     //
     // Create buffers for rays and hits
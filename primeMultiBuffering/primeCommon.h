@@ -34,11 +34,35 @@
 #include <putil/Buffer.h>
 #include <cuda_runtime.h>
 #include <stdlib.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 #include <Mesh.h>
 
+//------------------------------------------------------------------------------
+// Calls body( first, last ) on contiguous ranges covering [0, count), one per
+// hardware thread, with at least minPerThread items per range.
+template <typename Body>
+void parallelFor( size_t count, size_t minPerThread, Body body )
+{
+  size_t numThreads = std::max( 1u, std::thread::hardware_concurrency() );
+  numThreads = std::min( numThreads, std::max<size_t>( 1, count / std::max<size_t>( 1, minPerThread ) ) );
+
+  std::vector<std::thread> threads;
+  for( size_t t = 1; t < numThreads; ++t )
+    threads.push_back( std::thread( body, count * t / numThreads, count * (t+1) / numThreads ) );
+  body( 0, count / numThreads );
+  for( size_t t = 0; t < threads.size(); ++t )
+    threads[t].join();
+}
+
 //------------------------------------------------------------------------------
 struct SimpleMatrix4x3
 {
@@ -117,7 +141,228 @@ void createRaysPersp( Buffer<Ray>& raysBuffer, int width, int height,
 void translateRays( Buffer<Ray>& raysBuffer, const float3& offset );
 
 //------------------------------------------------------------------------------
-// Perform simple shading via normal visualization.
+// Rays produced on demand in chunks rather than stored in a buffer.  A
+// generator writes the rays with indices first..first+count-1 to rays and may
+// be called concurrently on disjoint ranges.
+typedef std::function<void( Ray* rays, size_t first, size_t count )> RayGenerator;
+
+//------------------------------------------------------------------------------
+// Generators for the rays of createRaysOrtho and createRaysPersp, in the same
+// order; ray i is the one through pixel ( i % width, i / width ), or for an
+// ortho stripe through row yOffset + ( i / width )*yStride.
+RayGenerator rayGeneratorOrtho( int width, int* height,
+  const float3& bbmin, const float3& bbmax, float margin, unsigned rayMask=0, int yOffset=0, int yStride=1 );
+RayGenerator rayGeneratorPersp( int width, int height, 
+  const float3& eye, const float3& lookAt, const float vfov=60.0f );
+
+//------------------------------------------------------------------------------
+// Reorders host rays for coherent traversal before a query.  Each ray gets a
+// key from its direction octant and the Morton code of its origin within the
+// bounds of all origins, and the rays are radix sorted by key in parallel.
+class RaySorter
+{
+public:
+  // Compute the order of the rays and gather them into sortedRays()
+  void sort( const Buffer<Ray>& raysBuffer );
+
+  // The rays of the last sort(); sortedRays().ptr()[i] is the ray at order()[i]
+  const Buffer<Ray>& sortedRays() const { return m_sortedRays; }
+  const std::vector<unsigned>& order() const { return m_order; }
+
+  // Scatter hits of the sorted rays back to the original ray order
+  void unsort( const Buffer<Hit>& sortedHits, Buffer<Hit>& hitsBuffer ) const;
+  void unsort( const Buffer<HitInstancing>& sortedHits, Buffer<HitInstancing>& hitsBuffer ) const;
+
+  // Sort the rays, execute the query on them and return the hits in the
+  // original ray order, or in sorted order when keepSortedOrder is set.  Rays
+  // and hits must be host buffers; otherwise the query executes unsorted.
+  // The query is left bound to buffers of the sorter.
+  void execute( RTPcontext context, RTPquery query, const Buffer<Ray>& raysBuffer,
+    Buffer<Hit>& hitsBuffer, bool keepSortedOrder=false );
+
+private:
+  std::vector<unsigned> m_keys;
+  std::vector<unsigned> m_order;
+  std::vector<unsigned> m_tempKeys;
+  std::vector<unsigned> m_tempOrder;
+  std::vector<size_t>   m_offsets;
+  Buffer<Ray>           m_sortedRays;
+  Buffer<Hit>           m_sortedHits;
+};
+
+//------------------------------------------------------------------------------
+// Size in bytes of count elements of a ray or hit buffer format.
+size_t getBufferSize( RTPbufferformat format, size_t count );
+
+//------------------------------------------------------------------------------
+// Multi-buffered query execution fed by any number of producer threads.  Each
+// of depth stages owns page-locked ray and hit buffers and a query.  A
+// producer acquires a free stage, blocking while all stages are in flight,
+// fills its rays and submits it.  An executor thread issues the queries
+// asynchronously and a completion thread finishes them in submission order,
+// calls the completion callback with the hits and then frees the stage, so
+// ray generation, traversal and hit consumption overlap.
+class QueryPipeline
+{
+public:
+  struct Stage
+  {
+    void*  rays;      // maxCount rays in the pipeline's ray format
+    void*  hits;      // hits of the submitted rays; valid until the stage is freed
+    size_t maxCount;
+    size_t count;     // number of rays submitted
+    void*  userData;  // tag for the submission, passed back with the hits
+  };
+
+  typedef std::function<void( const Stage& stage )> Callback;
+
+  QueryPipeline( RTPmodel model, RTPquerytype queryType, int depth, size_t maxCount,
+    RTPbufferformat rayFormat=Ray::format, RTPbufferformat hitFormat=Hit::format );
+  ~QueryPipeline();
+
+  // Get a free stage. Blocks while all stages are in flight.
+  Stage* acquire();
+
+  // Execute the query on the first count rays of an acquired stage. The
+  // callback runs on the completion thread before the future becomes ready;
+  // hits must be consumed there, since the stage is reused afterwards.
+  // Throws std::invalid_argument and releases the stage if count is larger
+  // than the stage's maxCount.
+  std::future<void> submit( Stage* stage, size_t count, void* userData=0,
+    const Callback& onComplete=Callback() );
+
+  // Wait until all submitted stages have completed
+  void finish();
+
+  size_t maxCount() const { return m_stages[0].maxCount; }
+
+private:
+  struct StageState : Stage
+  {
+    Buffer<char>       raysBuffer;
+    Buffer<char>       hitsBuffer;
+    RTPquery           query;
+    RTPbufferdesc      raysDesc;
+    RTPbufferdesc      hitsDesc;
+    Callback           onComplete;
+    std::promise<void> done;
+  };
+
+  StageState* pop( std::deque<StageState*>& queue, std::condition_variable& cv );
+  void executeLoop();
+  void completeLoop();
+
+  RTPcontext                m_context;
+  std::vector<StageState>   m_stages;
+  std::deque<StageState*>   m_free;
+  std::deque<StageState*>   m_submitted;
+  std::deque<StageState*>   m_executing;
+  size_t                    m_inFlight;
+  bool                      m_stop;
+  std::mutex                m_mutex;
+  std::condition_variable   m_freeCv;
+  std::condition_variable   m_submittedCv;
+  std::condition_variable   m_executingCv;
+  std::condition_variable   m_idleCv;
+  std::thread               m_executor;
+  std::thread               m_completer;
+
+  QueryPipeline( const QueryPipeline& );            // forbidden
+  QueryPipeline& operator=( const QueryPipeline& ); // forbidden
+};
+
+//------------------------------------------------------------------------------
+// Receives the hits, in the hit format of the pipeline, of the rays with
+// indices first..first+count-1.
+typedef std::function<void( const void* hits, size_t first, size_t count )> HitConsumer;
+
+//------------------------------------------------------------------------------
+// Trace count rays from generate through pipeline, in chunks of its maxCount.
+// Each chunk is generated into a free stage and its hits are passed to
+// consume on the completion thread, so memory use depends on the pipeline
+// depth and chunk size but not on count.  Returns when all hits are consumed.
+void executeStreaming( QueryPipeline& pipeline, size_t count,
+  const RayGenerator& generate, const HitConsumer& consume );
+
+//------------------------------------------------------------------------------
+// Visibility queries that return one bit or one byte per ray instead of a
+// Hit.  Rays are generated in chunks straight into the page-locked buffers of
+// a double-buffered QueryPipeline and traced with RTP_QUERY_TYPE_ANY into
+// RTP_BUFFER_FORMAT_HIT_BITMASK results, so neither the whole ray set nor
+// full hit records are ever stored.
+class OcclusionQuery
+{
+public:
+  OcclusionQuery( RTPmodel model, size_t chunkSize=1024*1024 );
+
+  // Trace count rays; bit i%32 of occluded[i/32] is set if ray i is blocked
+  void execute( size_t count, const RayGenerator& generate, std::vector<unsigned>& occluded );
+
+  // Trace count rays; occluded[i] is 1 if ray i is blocked and 0 otherwise
+  void execute( size_t count, const RayGenerator& generate, std::vector<unsigned char>& occluded );
+
+private:
+  QueryPipeline m_pipeline;  // chunks are a multiple of 32 rays, so they start on result words
+};
+
+//------------------------------------------------------------------------------
+// Build the acceleration structure of a model whose triangles are already set,
+// or restore it from a cache file in cacheDir written by an earlier run.  Cache
+// files are named by a hash of the index and vertex data plus the context type
+// and, for CUDA contexts, the device the cache was built on, and are rewritten
+// when they do not load.  An empty cacheDir always builds.  Returns true if
+// the model was restored from the cache.
+bool updateModelCached( RTPmodel model, RTPcontexttype contextType, unsigned device, const std::string& cacheDir,
+  const void* indices, size_t indicesSize, const void* vertices, size_t verticesSize, unsigned hints=0 );
+
+//------------------------------------------------------------------------------
+// The hit fields the shading pass reads, one array per field.  The barycentrics
+// are not kept.  instId is left empty when the hits it was split from carry no
+// instance ids.
+struct HitsSoA
+{
+  std::vector<float> t;
+  std::vector<int>   triId;
+  std::vector<int>   instId;
+
+  size_t count() const { return t.size(); }
+  void assign( const Hit* hits, size_t count );
+  void assign( const HitInstancing* hits, size_t count );
+};
+
+//------------------------------------------------------------------------------
+// Normal visualization shading with the per-scene work hoisted out of the
+// per-hit pass.  Face normals are computed once when a mesh is added and the
+// object space eye of every instance once per shade() call, so shading a hit
+// is a gather plus a few multiplies.  Hits are shaded in parallel in tiles.
+class HitShader
+{
+public:
+  // Adds a mesh and returns the id setInstances() refers to it by
+  int addMesh( PrimeMesh& mesh );
+
+  // Instance i shows mesh modelIds[i] through inverse transform invTransforms[i]
+  void setInstances( const std::vector<int>& modelIds, const std::vector<SimpleMatrix4x3>& invTransforms );
+
+  // Shades hits on mesh 0 without instancing
+  void shade( std::vector<float3>& image, const HitsSoA& hits, const float3& background ) const;
+
+  // Shades instanced hits with normals flipped to face eye
+  void shade( std::vector<float3>& image, const HitsSoA& hits, const float3& eye, const float3& background ) const;
+
+private:
+  // Unit face normals of all meshes and their dot product with the first
+  // vertex of the face, one array per component
+  std::vector<float> m_nx, m_ny, m_nz, m_nd;
+  std::vector<int>   m_meshFirstFace;
+
+  std::vector<int>             m_instFirstFace;
+  std::vector<SimpleMatrix4x3> m_invTransforms;
+};
+
+//------------------------------------------------------------------------------
+// Perform simple shading via normal visualization, straight from the hits.
+// Use a HitShader to shade the same scene over more than one frame.
 void shadeHits( std::vector<float3>& image, Buffer<Hit>& hitsBuffer, PrimeMesh& mesh );
 void shadeHits( std::vector<float3>& image, Buffer<HitInstancing>& hitsBuffer, std::vector<int>& modelIds, std::vector<PrimeMesh>& meshes, float3 eye, std::vector<SimpleMatrix4x3>& invTransforms );
 
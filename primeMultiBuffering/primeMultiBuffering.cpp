@@ -41,158 +41,11 @@
 #include <sutil.h>
 #include <memory.h>
 #include <algorithm>
+#include <atomic>
+#include <thread>
 
 using namespace optix::prime;
 
-//------------------------------------------------------------------------------
-size_t getBufferSize( RTPbufferformat format, size_t count )
-{
-  switch( format )
-  {
-  case RTP_BUFFER_FORMAT_INDICES_INT3:
-    return sizeof(int3)*count;
-  case RTP_BUFFER_FORMAT_VERTEX_FLOAT3:
-    return sizeof(float3)*count;
-  case RTP_BUFFER_FORMAT_RAY_ORIGIN_DIRECTION:        
-    return 2*sizeof(float3)*count;
-  case RTP_BUFFER_FORMAT_RAY_ORIGIN_TMIN_DIRECTION_TMAX:
-    return 2*sizeof(float4)*count;
-  case RTP_BUFFER_FORMAT_HIT_BITMASK:
-    return ((count + 31)/32)*sizeof(int);
-  case RTP_BUFFER_FORMAT_HIT_T:
-    return sizeof(float)*count;
-  case RTP_BUFFER_FORMAT_HIT_T_TRIID:
-    return (sizeof(float) + sizeof(int))*count;
-  case RTP_BUFFER_FORMAT_HIT_T_TRIID_U_V:
-    return (3*sizeof(float) + sizeof(int))*count;
-  default:
-    std::cerr << "Unknown format\n";
-    exit(1);
-  }
-
-  return 0;
-}
-
-//------------------------------------------------------------------------------
-class MultiBufferQueryManager
-{
-public:
-  struct BufferSet
-  {
-    void* rays;
-    void* hits;
-    size_t maxCount;
-    size_t resultCount;
-    void* userData;
-  };
-
-  MultiBufferQueryManager( int numBufferSets, size_t maxCount, 
-     RTPbufferformat rayFormat, RTPbufferformat hitFormat,
-     Model model, RTPquerytype queryType )
-    : m_rayFormat(rayFormat)
-    , m_hitFormat(hitFormat)
-    , m_pendingCount(0)
-    , m_pos(0)
-    , m_lastPos(-1)
-  {
-    m_bufferSets.resize( numBufferSets );
-    m_queries.resize( numBufferSets );
-    m_queryFinished.resize( numBufferSets, true );
-    size_t rayBufferSize = getBufferSize( m_rayFormat, maxCount );
-    size_t hitBufferSize = getBufferSize( m_hitFormat, maxCount );
-    for( int i=0; i < numBufferSets; ++i )
-    {
-      m_queries[i] = model->createQuery( queryType );
-      m_bufferSets[i].rays = new char[rayBufferSize];
-      m_bufferSets[i].hits = new char[hitBufferSize];
-      m_bufferSets[i].maxCount = maxCount;
-      m_bufferSets[i].resultCount = 0;
-      m_bufferSets[i].userData = 0;
-
-      rtpHostBufferLock( m_bufferSets[i].rays, rayBufferSize );
-      rtpHostBufferLock( m_bufferSets[i].hits, hitBufferSize );
-    }
-  }
-
-  ~MultiBufferQueryManager()
-  {
-    for( int i=0; i < (int)m_bufferSets.size(); ++i )
-    {
-      if( !m_queryFinished[i] )
-        m_queries[i]->finish();
-
-      rtpHostBufferUnlock( m_bufferSets[i].rays );
-      rtpHostBufferUnlock( m_bufferSets[i].hits );
-      delete[] (char*)m_bufferSets[i].rays;
-      delete[] (char*)m_bufferSets[i].hits;
-    }
-  }
-
-  // Get a set of ray and hit buffers. If all BufferSets are in use with 
-  // pending queries this function will block until a query is finished. If
-  // bufferSet->resultCount > 0 then  the BufferSet contains results from a 
-  // previous query. bufferSet->userData can be used to tag the results with
-  // information pertaining to a particular query. After processing
-  // previous results, if any, the rays buffer can filled with new data and a
-  // new query issued with executeQueryOnLastBufferSet().
-  //
-  // Returns true if other BufferSets with results are pending.
-  bool getBufferSet( BufferSet* bufferSet )
-  {
-    finishQuery( m_pos );
-    *bufferSet = m_bufferSets[m_pos];
-    m_lastPos = m_pos;
-    if( ++m_pos >= (int)m_bufferSets.size() )
-      m_pos = 0;
-
-    return m_pendingCount > 0;
-  }
-
-
-  // Execute query using ray buffer returned with the last call to getBufferSet().
-  void executeQueryOnLastBufferSet( size_t count, void* userData )
-  {
-    if( m_lastPos < 0 )
-    {
-      std::cerr << "Call getBufferSet() first\n";
-      return;
-    }
-
-    finishQuery( m_lastPos );
-
-    BufferSet& bs = m_bufferSets[m_lastPos];
-    bs.resultCount = count;
-
-    Query& query = m_queries[m_lastPos];
-    query->setRays( count, m_rayFormat, RTP_BUFFER_TYPE_HOST, bs.rays );
-    query->setHits( count, m_hitFormat, RTP_BUFFER_TYPE_HOST, bs.hits );
-    query->execute( RTP_QUERY_HINT_ASYNC );
-
-    m_queryFinished[m_lastPos] = false;
-    m_pendingCount++;
-  }
-
-private:
-  RTPbufferformat m_rayFormat;
-  RTPbufferformat m_hitFormat;
-  std::vector<BufferSet> m_bufferSets;
-  std::vector<Query>    m_queries;
-  std::vector<bool>     m_queryFinished;
-  int m_pendingCount;
-  int m_pos;
-  int m_lastPos;
-
-  void finishQuery( int pos )
-  {
-    if( !m_queryFinished[pos] )
-    {
-      m_queries[pos]->finish();
-      m_queryFinished[pos] = true;
-      m_pendingCount--;
-    }
-  }
-};
-
 //------------------------------------------------------------------------------
 void printUsageAndExit( const char* argv0 )
 {
@@ -203,6 +56,9 @@ void printUsageAndExit( const char* argv0 )
   << "  -o  | --obj <obj_file>      Specify model to be rendered\n"
   << "  -b  | --buffers <number>    Number of buffer sets. Default is 2.\n"
   << "  -c  | --count <number>      Max count for each buffer. Default is 65536.\n"
+  << "  -p  | --producers <number>  Number of threads submitting rays. Default is 1.\n"
+  << "  -s  | --stream              Generate rays chunk by chunk instead of up front\n"
+  << "        --context [cpu|(cuda)] Specify context type. Default is cuda\n"
   << "  -w  | --width <number>      Specify output image width\n"
   << std::endl;
   
@@ -218,6 +74,9 @@ int main( int argc, char** argv )
   int height = 0;
   int numBufferSets = 2;
   size_t maxCount = 64*1024;
+  int numProducers = 1;
+  bool stream = false;
+  RTPcontexttype contextType = RTP_CONTEXT_TYPE_CUDA;
 
   // parse arguments
   for ( int i = 1; i < argc; ++i ) 
@@ -243,6 +102,24 @@ int main( int argc, char** argv )
     {
       maxCount = (size_t)atoi(argv[++i]);
     } 
+    else if( (arg == "-p" || arg == "--producers") && i+1 < argc ) 
+    {
+      numProducers = std::max( 1, atoi(argv[++i]) );
+    } 
+    else if( arg == "-s" || arg == "--stream" ) 
+    {
+      stream = true;
+    } 
+    else if( arg == "--context" && i+1 < argc )
+    {
+      std::string param( argv[++i] );
+      if( param == "cpu" )
+        contextType = RTP_CONTEXT_TYPE_CPU;
+      else if( param == "cuda" )
+        contextType = RTP_CONTEXT_TYPE_CUDA;
+      else
+        printUsageAndExit( argv[0] );
+    } 
     else 
     {
       std::cerr << "Bad option: '" << arg << "'" << std::endl;
@@ -255,9 +132,11 @@ int main( int argc, char** argv )
     //
     // Create Context
     //
-    Context context = Context::create(RTP_CONTEXT_TYPE_CUDA);
-    unsigned int device = 0;
-    context->setCudaDeviceNumbers(1, &device);
+    Context context = Context::create(contextType);
+    if (contextType == RTP_CONTEXT_TYPE_CUDA) {
+      unsigned int device = 0;
+      context->setCudaDeviceNumbers(1, &device);
+    }
 
     //
     // Create the Model object
@@ -271,40 +150,58 @@ int main( int argc, char** argv )
     model->update( 0 );
 
     //
-    // Create buffers for rays and hits
+    // Create buffers for rays and hits. Streamed rays are generated for each
+    // query instead and never stored as a whole.
     //
     Buffer<Ray> rays( 0, RTP_BUFFER_TYPE_HOST );
-    createRaysOrtho( rays, width, &height, mesh.getBBoxMin(), mesh.getBBoxMax(), 0.05f );
-    Buffer<Hit> hits( rays.count(), RTP_BUFFER_TYPE_HOST );
+    RayGenerator generateRays;
+    if( stream )
+      generateRays = rayGeneratorOrtho( width, &height, mesh.getBBoxMin(), mesh.getBBoxMax(), 0.05f );
+    else
+      createRaysOrtho( rays, width, &height, mesh.getBBoxMin(), mesh.getBBoxMax(), 0.05f );
+    Buffer<Hit> hits( size_t(width)*height, RTP_BUFFER_TYPE_HOST );
     
     // 
     // Execute queries with multi-buffering to stage data through page-locked host
-    // memory
+    // memory. Producer threads copy chunks of rays into free buffer sets, and the
+    // hits of each chunk are copied out when its query completes.
     // 
-    MultiBufferQueryManager manager( numBufferSets, maxCount, Ray::format, Hit::format,
-      model, RTP_QUERY_TYPE_CLOSEST );
-    size_t count = 0;
-    size_t finishedCount = 0;
-    while( finishedCount < hits.count() )
+    QueryPipeline pipeline( model->getRTPmodel(), RTP_QUERY_TYPE_CLOSEST, numBufferSets, maxCount );
+    if( stream )
     {
-      MultiBufferQueryManager::BufferSet bufferSet;
-      manager.getBufferSet( &bufferSet );
-      
-      // process results
-      if( bufferSet.resultCount > 0 )
+      executeStreaming( pipeline, hits.count(), generateRays, [&hits]( const void* chunkHits, size_t first, size_t count )
       {
-        memcpy( hits.ptr()+finishedCount, bufferSet.hits, bufferSet.resultCount*sizeof(Hit) );
-        finishedCount += bufferSet.resultCount;
-      }
-
-      // prepare query
-      if( count < rays.count() )
+        memcpy( hits.ptr()+first, chunkHits, count*sizeof(Hit) );
+      } );
+    }
+    else
+    {
+      std::atomic<size_t> nextRay( 0 );
+      auto produce = [&]()
       {
-        size_t queryCount = std::min( bufferSet.maxCount, rays.count()-count );
-        memcpy( bufferSet.rays, rays.ptr()+count, queryCount*sizeof(Ray) );
-        manager.executeQueryOnLastBufferSet( queryCount, 0 );
-        count += queryCount;
-      }
+        for( ;; )
+        {
+          const size_t first = nextRay.fetch_add( maxCount );
+          if( first >= rays.count() )
+            break;
+
+          size_t queryCount = std::min( maxCount, rays.count()-first );
+          QueryPipeline::Stage* stage = pipeline.acquire();
+          memcpy( stage->rays, rays.ptr()+first, queryCount*sizeof(Ray) );
+          pipeline.submit( stage, queryCount, hits.ptr()+first, []( const QueryPipeline::Stage& finished )
+          {
+            memcpy( finished.userData, finished.hits, finished.count*sizeof(Hit) );
+          } );
+        }
+      };
+
+      std::vector<std::thread> producers;
+      for( int i=1; i < numProducers; ++i )
+        producers.push_back( std::thread( produce ) );
+      produce();
+      for( size_t i=0; i < producers.size(); ++i )
+        producers[i].join();
+      pipeline.finish();
     }
 
     //
@@ -29,7 +29,8 @@
 //-----------------------------------------------------------------------------
 //
 //  Minimal demonstration of handling multiple GPUs by allocating an
-//  OptiX Prime context for each.
+//  OptiX Prime context for each, and likewise multiple NUMA nodes of a CPU
+//  with a CPU context for each.
 //
 //-----------------------------------------------------------------------------
 
@@ -38,6 +39,19 @@
 #include <optixu/optixu_math_namespace.h>
 #include <sutil.h>
 #include <memory.h>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#if defined(__linux__)
+#  include <pthread.h>
+#  include <sched.h>
+#  include <cerrno>
+#  include <cstring>
+#endif
 
 using namespace optix::prime;
 
@@ -54,16 +68,8 @@ public:
   MultiGpuManager() 
     : m_width(0)
     , m_height(0)
-    , m_rays_d(0)
-    , m_hits_d(0)    
   {}
 
-  ~MultiGpuManager()
-  {
-    delete[] m_rays_d;
-    delete[] m_hits_d;
-  }
-
   void init()
   {
     int deviceCount = 0;
@@ -75,18 +81,21 @@ public:
       m_models.push_back( m_contexts[i]->createModel() );
       m_queries.push_back( m_models[i]->createQuery( RTP_QUERY_TYPE_CLOSEST ));
     }
-    delete[] m_rays_d;
-    delete[] m_hits_d;
-    m_rays_d = new Buffer<Ray>[deviceCount];
-    m_hits_d = new Buffer<Hit>[deviceCount];
+    m_rays_d.resize( deviceCount );
+    m_hits_d.resize( deviceCount );
   }
 
-  void createModel( int numTriangles, int3* indices, int numVertices, float3* vertices )
+  void createModel( int numTriangles, int3* indices, int numVertices, float3* vertices,
+                    const std::string& cacheDir )
   {
-    // Create the model in the first context
+    // Create the model in the first context, restoring its acceleration
+    // structure from cacheDir when one was saved for this mesh. Saving the
+    // cache after a build waits for the build to complete.
     m_models[0]->setTriangles( numTriangles, RTP_BUFFER_TYPE_HOST,  indices,
                                numVertices,  RTP_BUFFER_TYPE_HOST,  vertices );
-    m_models[0]->update( RTP_MODEL_HINT_ASYNC );
+    updateModelCached( m_models[0]->getRTPmodel(), RTP_CONTEXT_TYPE_CUDA, 0, cacheDir,
+                       indices,  numTriangles * sizeof( int3 ),
+                       vertices, numVertices  * sizeof( float3 ), RTP_MODEL_HINT_ASYNC );
 
     // Copy the models to the other contexts. The copy is performed 
     // asynchronously. Alternatively the context for each device could update
@@ -180,8 +189,8 @@ private:
   int m_height;           // image height
   Buffer<Hit>   m_hits_h; // hits on the host 
   Buffer<Hit>   m_temp_h; // temp host buffer for merging hits from multiple GPUs
-  Buffer<Ray>*  m_rays_d; // array of ray buffers per device
-  Buffer<Hit>*  m_hits_d; // array of hit buffers per device
+  std::vector< Buffer<Ray> > m_rays_d; // ray buffers per device
+  std::vector< Buffer<Hit> > m_hits_d; // hit buffers per device
 
   // Per-device API objects
   std::vector<Context> m_contexts;
@@ -189,6 +198,366 @@ private:
   std::vector<Query>   m_queries;
 };
 
+//------------------------------------------------------------------------------
+// Reads a sysfs list of ranges such as "0-7,16-23"
+static std::vector<int> readRangeList( const std::string& filename )
+{
+  std::vector<int> values;
+  std::ifstream in( filename.c_str() );
+  std::string range;
+  while( std::getline( in, range, ',' ) )
+  {
+    int first = 0, last = -1;
+    char dash = 0;
+    std::istringstream ss( range );
+    if( !( ss >> first ) )
+      continue;
+    last = ( ss >> dash >> last ) ? last : first;
+    for( int value = first; value <= last; ++value )
+      values.push_back( value );
+  }
+  return values;
+}
+
+//------------------------------------------------------------------------------
+// Processors of each online NUMA node with processors, read from sysfs. Node
+// numbers may have gaps. Where sysfs is not available there is a single node
+// with an empty list, meaning no pinning.
+static std::vector< std::vector<int> > getNumaNodes()
+{
+  std::vector< std::vector<int> > nodes;
+#if defined(__linux__)
+  const std::vector<int> online = readRangeList( "/sys/devices/system/node/online" );
+  for( size_t i = 0; i < online.size(); ++i )
+  {
+    std::ostringstream filename;
+    filename << "/sys/devices/system/node/node" << online[i] << "/cpulist";
+    const std::vector<int> cpus = readRangeList( filename.str() );
+    if( !cpus.empty() )  // memory-only nodes have no processors to run on
+      nodes.push_back( cpus );
+  }
+#endif
+  if( nodes.empty() )
+    nodes.push_back( std::vector<int>() );
+  return nodes;
+}
+
+//------------------------------------------------------------------------------
+// Restrict the calling thread to cpus. Threads it creates inherit the mask.
+// Failures are reported and leave the thread unpinned.
+static void pinThread( const std::vector<int>& cpus )
+{
+#if defined(__linux__)
+  if( cpus.empty() )
+    return;
+  cpu_set_t set;
+  CPU_ZERO( &set );
+  int count = 0;
+  for( size_t i=0; i < cpus.size(); ++i )
+  {
+    if( cpus[i] < 0 || cpus[i] >= CPU_SETSIZE )
+    {
+      std::cerr << "Cannot pin to cpu " << cpus[i] << ", out of cpu_set_t range\n";
+      continue;
+    }
+    CPU_SET( cpus[i], &set );
+    ++count;
+  }
+  const int err = count > 0 ? pthread_setaffinity_np( pthread_self(), sizeof(set), &set ) : EINVAL;
+  if( err != 0 )
+    std::cerr << "Could not pin thread to its NUMA node: " << strerror( err ) << "\n";
+#else
+  (void)cpus;
+#endif
+}
+
+//------------------------------------------------------------------------------
+// The CPU counterpart of MultiGpuManager for machines with several NUMA nodes.
+// It allocates a CPU context for each node. Everything that touches a node's
+// context runs on a thread pinned to the node's processors, so the context's
+// worker threads, its copy of the model and its ray and hit buffers are
+// placed in the node's memory. Rays are generated in chunks on the node that
+// traces them rather than read across the interconnect. Each node works
+// through the chunks of its own stripe of rows and then steals half of the
+// largest share left.
+class NumaQueryManager
+{
+public:
+  NumaQueryManager( size_t chunkSize=64*1024 ) 
+    : m_chunkSize( chunkSize )
+    , m_width( 0 )
+    , m_height( 0 )
+  {}
+
+  void init()
+  {
+    std::vector< std::vector<int> > cpus = getNumaNodes();
+    for( size_t i=0; i < cpus.size(); ++i )
+    {
+      m_nodes.push_back( std::unique_ptr<Node>( new Node ) );
+      m_nodes[i]->cpus = cpus[i];
+    }
+
+    runOnNodes( 0, m_nodes.size(), []( Node& node )
+    {
+      node.context = Context::create( RTP_CONTEXT_TYPE_CPU );
+      if( !node.cpus.empty() )
+        node.context->setCpuThreads( unsigned( node.cpus.size() ) );
+      node.model = node.context->createModel();
+    } );
+    std::cerr << "Using " << m_nodes.size() << " cpu context(s)\n";
+  }
+
+  void createModel( int numTriangles, int3* indices, int numVertices, float3* vertices,
+                    const std::string& cacheDir )
+  {
+    // Build the model on the first node and copy it to the others, where the
+    // copy is allocated by the receiving node
+    runOnNodes( 0, 1, [&]( Node& node )
+    {
+      node.model->setTriangles( numTriangles, RTP_BUFFER_TYPE_HOST,  indices,
+                                numVertices,  RTP_BUFFER_TYPE_HOST,  vertices );
+      updateModelCached( node.model->getRTPmodel(), RTP_CONTEXT_TYPE_CPU, 0, cacheDir,
+                         indices,  numTriangles * sizeof( int3 ),
+                         vertices, numVertices  * sizeof( float3 ) );
+    } );
+    Model source = m_nodes[0]->model;
+    runOnNodes( 1, m_nodes.size(), [&]( Node& node )
+    {
+      node.model->copy( source );
+      node.model->finish();
+    } );
+    runOnNodes( 0, m_nodes.size(), []( Node& node )
+    {
+      node.query = node.model->createQuery( RTP_QUERY_TYPE_CLOSEST );
+    } );
+  }
+
+  void createRaysOrtho( int width, int* height,
+     const float3& bbmin, const float3& bbmax, float margin )
+  {
+    // Like the GPU manager, distribute the rows round-robin between the
+    // nodes, so that each node starts with a similar share of the work.
+    // Hits are traced stripe by stripe and merged back into image order.
+    const int numStripes = int( m_nodes.size() );
+    m_width = width;
+    m_stripes.resize( numStripes );
+    size_t offset = 0;
+    for( int i=0; i < numStripes; ++i )
+    {
+      m_stripes[i].generateRays = rayGeneratorOrtho( width, height, bbmin, bbmax, margin, 0, i, numStripes );
+      m_stripes[i].offset = offset;
+      m_stripes[i].count  = size_t(width) * std::max( ( *height - i + numStripes - 1 ) / numStripes, 0 );
+      offset += m_stripes[i].count;
+    }
+    m_height = *height;
+    m_hits_h.alloc( size_t(width) * *height, RTP_BUFFER_TYPE_HOST, UNLOCKED );
+    if( numStripes > 1 )
+      m_temp_h.alloc( size_t(width) * *height, RTP_BUFFER_TYPE_HOST, UNLOCKED );
+  }
+
+  void translateRays( const float3& offset )
+  {
+    for( size_t i=0; i < m_stripes.size(); ++i )
+    {
+      RayGenerator generateRays = m_stripes[i].generateRays;
+      m_stripes[i].generateRays = [generateRays, offset]( Ray* rays, size_t first, size_t count )
+      {
+        generateRays( rays, first, count );
+        for( size_t r=0; r < count; ++r )
+          rays[r].origin = rays[r].origin + offset;
+      };
+    }
+  }
+
+  Buffer<Hit>* queryExecute()
+  {
+    // Each node starts on its own stripe
+    for( size_t i=0; i < m_nodes.size(); ++i )
+    {
+      m_nodes[i]->stripe = i;
+      m_nodes[i]->next   = 0;
+      m_nodes[i]->end    = ( m_stripes[i].count + m_chunkSize - 1 ) / m_chunkSize;
+    }
+
+    // With more than one stripe the hits go to a temp buffer first
+    Hit* stripeHits = m_stripes.size() > 1 ? m_temp_h.ptr() : m_hits_h.ptr();
+
+    runOnNodes( 0, m_nodes.size(), [&]( Node& node )
+    {
+      // First touch from the node allocates the buffers in its memory
+      if( node.rays.empty() )
+      {
+        node.rays.resize( m_chunkSize );
+        node.hits.resize( m_chunkSize );
+      }
+
+      size_t stripe, chunk;
+      while( takeChunk( node, &stripe, &chunk ) )
+      {
+        const Stripe& s = m_stripes[stripe];
+        const size_t first = chunk * m_chunkSize;
+        const size_t chunkCount = std::min( m_chunkSize, s.count - first );
+        s.generateRays( &node.rays[0], first, chunkCount );
+        node.query->setRays( chunkCount, Ray::format, RTP_BUFFER_TYPE_HOST, &node.rays[0] );
+        node.query->setHits( chunkCount, Hit::format, RTP_BUFFER_TYPE_HOST, &node.hits[0] );
+        node.query->execute( 0 );
+        memcpy( stripeHits + s.offset + first, &node.hits[0], chunkCount*sizeof(Hit) );
+      }
+    } );
+
+    // Merge the stripes back into rows
+    if( m_stripes.size() > 1 )
+    {
+      const size_t numStripes = m_stripes.size();
+      parallelFor( m_height, 1, [&]( size_t first, size_t last )
+      {
+        for( size_t y=first; y < last; ++y )
+        {
+          const Hit* row = stripeHits + m_stripes[y % numStripes].offset + ( y / numStripes )*m_width;
+          memcpy( m_hits_h.ptr() + y*m_width, row, m_width*sizeof(Hit) );
+        }
+      } );
+    }
+    return &m_hits_h;
+  }
+
+private:
+  struct Node
+  {
+    std::vector<int> cpus;   // processors of the node; empty if not pinned
+    Context          context;
+    Model            model;
+    Query            query;
+    std::vector<Ray> rays;   // one chunk of rays and hits
+    std::vector<Hit> hits;
+    std::mutex       mutex;  // guards stripe, next and end
+    size_t           stripe; // chunks next..end-1 of stripe are left to this node
+    size_t           next;
+    size_t           end;
+  };
+
+  struct Stripe
+  {
+    RayGenerator generateRays;  // rays of rows i, i + numStripes, ...
+    size_t       offset;        // index of the first hit in m_temp_h
+    size_t       count;
+  };
+
+  // Calls task for nodes first..last-1, each on a thread pinned to the node,
+  // and rethrows the first exception thrown by a task
+  template <typename Task>
+  void runOnNodes( size_t first, size_t last, Task task )
+  {
+    std::vector<std::thread> threads;
+    std::vector<std::exception_ptr> errors( last - first );
+    for( size_t i=first; i < last; ++i )
+    {
+      threads.push_back( std::thread( [&, i]()
+      {
+        pinThread( m_nodes[i]->cpus );
+        try {
+          task( *m_nodes[i] );
+        }
+        catch( ... ) {
+          errors[i - first] = std::current_exception();
+        }
+      } ) );
+    }
+    for( size_t i=0; i < threads.size(); ++i )
+      threads[i].join();
+    for( size_t i=0; i < errors.size(); ++i )
+      if( errors[i] )
+        std::rethrow_exception( errors[i] );
+  }
+
+  // Take the next chunk of node, stealing from other nodes once its own
+  // share is used up. Returns false when no chunks are left.
+  bool takeChunk( Node& node, size_t* stripe, size_t* chunk )
+  {
+    for( ;; )
+    {
+      {
+        std::lock_guard<std::mutex> lock( node.mutex );
+        if( node.next < node.end )
+        {
+          *stripe = node.stripe;
+          *chunk = node.next++;
+          return true;
+        }
+      }
+
+      // Pick the node with the most chunks left and take the back half
+      Node* victim = 0;
+      size_t most = 0;
+      for( size_t i=0; i < m_nodes.size(); ++i )
+      {
+        std::lock_guard<std::mutex> lock( m_nodes[i]->mutex );
+        if( m_nodes[i]->end - m_nodes[i]->next > most )
+        {
+          most = m_nodes[i]->end - m_nodes[i]->next;
+          victim = m_nodes[i].get();
+        }
+      }
+      if( !victim )
+        return false;
+
+      size_t stolenStripe, stolenFirst, stolenEnd;
+      {
+        std::lock_guard<std::mutex> lock( victim->mutex );
+        const size_t left = victim->end - victim->next;
+        if( left == 0 )
+          continue;  // emptied meanwhile; look again
+        stolenStripe = victim->stripe;
+        stolenEnd = victim->end;
+        stolenFirst = stolenEnd - ( left + 1 ) / 2;
+        victim->end = stolenFirst;
+      }
+
+      std::lock_guard<std::mutex> lock( node.mutex );
+      node.stripe = stolenStripe;
+      node.next = stolenFirst;
+      node.end  = stolenEnd;
+    }
+  }
+
+  size_t                               m_chunkSize;
+  std::vector< std::unique_ptr<Node> > m_nodes;
+  std::vector<Stripe>                  m_stripes;  // one per node
+  int                                  m_width;    // image width
+  int                                  m_height;   // image height
+  Buffer<Hit>                          m_hits_h;   // hits on the host
+  Buffer<Hit>                          m_temp_h;   // hits by stripe before merging
+};
+
+//------------------------------------------------------------------------------
+template <typename Manager>
+void render( Manager& manager, PrimeMesh& mesh, int width, const std::string& cacheDir )
+{
+  int height = 0;
+  manager.init();
+  manager.createModel( mesh.num_triangles, mesh.getVertexIndices(),  
+                       mesh.num_vertices,  mesh.getVertexData(), cacheDir );
+  manager.createRaysOrtho( width, &height, mesh.getBBoxMin(), mesh.getBBoxMax(), 0.05f );
+  Buffer<Hit>* hits = manager.queryExecute();
+
+  //
+  // Shade the hit results to create image.
+  //
+  std::vector<float3> image( width * height );
+  shadeHits( image, *hits, mesh );
+  writePpm( "output.ppm", &image[0].x, width, height );
+
+  //
+  // Re-execute query with different rays.
+  //
+  float3 extents = mesh.getBBoxMax() - mesh.getBBoxMin();
+  manager.translateRays( extents * make_float3(0.2f, 0, 0) );
+  hits = manager.queryExecute();
+  shadeHits( image, *hits, mesh );
+  writePpm( "outputTranslated.ppm", &image[0].x, width, height );
+}
+
 //------------------------------------------------------------------------------
 void printUsageAndExit( const char* argv0 )
 {
@@ -198,6 +567,8 @@ void printUsageAndExit( const char* argv0 )
   << "  -h  | --help                               Print this usage message\n"
   << "  -o  | --obj <obj_file>                     Specify model to be rendered\n"
   << "  -w  | --width <number>                     Specify output image width\n"
+  << "        --cache <dir>                        Save and restore the built acceleration structure in dir\n"
+  << "        --numa                               Use a CPU context per NUMA node instead of a CUDA context per device\n"
   << std::endl;
   
   exit(1);
@@ -209,7 +580,8 @@ int main( int argc, char** argv )
   // set defaults
   std::string objFilename = std::string( sutil::samplesDir() ) + "/data/cow.obj";
   int width = 640;
-  int height = 0;
+  std::string cacheDir;
+  bool numa = false;
 
   // parse arguments
   for ( int i = 1; i < argc; ++i ) 
@@ -227,6 +599,14 @@ int main( int argc, char** argv )
     {
       width = atoi(argv[++i]);
     } 
+    else if( arg == "--cache" && i+1 < argc )
+    {
+      cacheDir = argv[++i];
+    }
+    else if( arg == "--numa" )
+    {
+      numa = true;
+    }
     else 
     {
       std::cerr << "Bad option: '" << arg << "'" << std::endl;
@@ -239,29 +619,17 @@ int main( int argc, char** argv )
     PrimeMesh mesh;
     loadMesh( objFilename, mesh );
 
-    MultiGpuManager manager;
-    manager.init();
-    manager.createModel( mesh.num_triangles, mesh.getVertexIndices(),  
-                         mesh.num_vertices,  mesh.getVertexData() );
-    manager.createRaysOrtho( width, &height, mesh.getBBoxMin(), mesh.getBBoxMax(), 0.05f );
-    Buffer<Hit>* hits = manager.queryExecute();
-
-    //
-    // Shade the hit results to create image.
-    //
-    std::vector<float3> image( width * height );
-    shadeHits( image, *hits, mesh );
-    writePpm( "output.ppm", &image[0].x, width, height );
-
-    //
-    // Re-execute query with different rays.
-    //
-    float3 extents = mesh.getBBoxMax() - mesh.getBBoxMin();
-    manager.translateRays( extents * make_float3(0.2f, 0, 0) );
-    hits = manager.queryExecute();
-    shadeHits( image, *hits, mesh );
+    if( numa )
+    {
+      NumaQueryManager manager;
+      render( manager, mesh, width, cacheDir );
+    }
+    else
+    {
+      MultiGpuManager manager;
+      render( manager, mesh, width, cacheDir );
+    }
     freeMesh( mesh );
-    writePpm( "outputTranslated.ppm", &image[0].x, width, height );
   }
   catch (const std::exception& e)
   {
@@ -48,6 +48,8 @@ void printUsageAndExit( const char* argv0 )
   << "  -c  | --context [cpu|(cuda)]               Specify context type. Default is cuda\n"
   << "  -b  | --buffer [(host)|cuda]               Specify buffer type. Default is host\n"
   << "  -w  | --width <number>                     Specify output image width\n"
+  << "        --cache <dir>                        Save and restore the built acceleration structure in dir\n"
+  << "        --sort-rays                          Sort rays for coherence before executing queries\n"
   << std::endl;
   
   exit(1);
@@ -62,6 +64,8 @@ int main( int argc, char** argv )
   std::string objFilename = std::string( sutil::samplesDir() ) + "/data/cow.obj";
   int width = 640;
   int height = 0;
+  std::string cacheDir;
+  bool sortRays = false;
 
   // parse arguments
   for ( int i = 1; i < argc; ++i ) 
@@ -99,6 +103,14 @@ int main( int argc, char** argv )
     {
       width = atoi(argv[++i]);
     } 
+    else if( arg == "--cache" && i+1 < argc )
+    {
+      cacheDir = argv[++i];
+    }
+    else if( arg == "--sort-rays" )
+    {
+      sortRays = true;
+    }
     else 
     {
       std::cerr << "Bad option: '" << arg << "'" << std::endl;
@@ -155,7 +167,10 @@ int main( int argc, char** argv )
   RTPmodel model;
   CHK_PRIME( rtpModelCreate( context, &model ) );
   CHK_PRIME( rtpModelSetTriangles( model, indicesDesc, verticesDesc ) );
-  CHK_PRIME( rtpModelUpdate( model, 0 ) );
+  if( updateModelCached( model, contextType, 0, cacheDir,
+        mesh.getVertexIndices(), mesh.num_triangles * sizeof( int3 ),
+        mesh.getVertexData(), mesh.num_vertices * sizeof( float3 ) ) )
+    std::cerr << "Loaded acceleration structure from " << cacheDir << "\n";
 
   //
   // Create buffer for ray input 
@@ -193,7 +208,11 @@ int main( int argc, char** argv )
   CHK_PRIME( rtpQueryCreate( model, RTP_QUERY_TYPE_CLOSEST, &query ) );
   CHK_PRIME( rtpQuerySetRays( query, raysDesc ) );
   CHK_PRIME( rtpQuerySetHits( query, hitsDesc ) );
-  CHK_PRIME( rtpQueryExecute( query, 0 /* hints */ ) );
+  RaySorter sorter;
+  if( sortRays )
+    sorter.execute( context, query, raysBuffer, hitsBuffer );
+  else
+    CHK_PRIME( rtpQueryExecute( query, 0 /* hints */ ) );
 
   //
   // Shade the hit results to create image
@@ -207,7 +226,10 @@ int main( int argc, char** argv )
   //
   float3 extents = mesh.getBBoxMax() - mesh.getBBoxMin();
   translateRays( raysBuffer, extents * make_float3(0.2f, 0, 0) );
-  CHK_PRIME( rtpQueryExecute( query, 0 /* hints */ ) );
+  if( sortRays )
+    sorter.execute( context, query, raysBuffer, hitsBuffer );
+  else
+    CHK_PRIME( rtpQueryExecute( query, 0 /* hints */ ) );
   shadeHits( image, hitsBuffer, mesh );
   freeMesh( mesh );
   writePpm( "outputTranslated.ppm", &image[0].x, width, height );
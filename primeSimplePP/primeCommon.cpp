@@ -27,10 +27,27 @@
  */
 
 #include "primeCommon.h"
+#include <cassert>
 #include <math.h>
+#include <stdio.h>
+#include <string.h>
 #include <fstream>
 #include <iostream>
 #include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+// Host ray generation writes four rays per step with SSE where available.
+// Only IEEE add, mul, div and sqrt are used, in the same order as the scalar
+// code, so both paths produce bit-identical rays.
+#if defined(__SSE2__) || defined(_M_X64) || ( defined(_M_IX86_FP) && _M_IX86_FP >= 2 )
+#  define PRIME_COMMON_SSE 1
+#  include <emmintrin.h>
+#else
+#  define PRIME_COMMON_SSE 0
+#endif
 
 #include <optixu/optixu_math_namespace.h>
 #include <optixu/optixu_aabb_namespace.h>
@@ -67,49 +84,208 @@ inline float __int_as_float  (int val)
 }
 
 //------------------------------------------------------------------------------
-void createRaysOrtho( Buffer<Ray>& raysBuffer, int width, int* height,
-  const float3& bbmin, const float3& bbmax, float margin, unsigned rayMask, int yOffset, int yStride )
+// Rays handed to a thread at least; a row of a small image is not worth one.
+static const size_t MIN_RAYS_PER_THREAD = 16*1024;
+
+//------------------------------------------------------------------------------
+// One row of orthographic rays.  xs holds the x coordinate of every column.
+static void fillRaysOrtho( Ray* rays, const float* xs, int width, float y, float z, float tminOrMask )
+{
+  int ix = 0;
+#if PRIME_COMMON_SSE
+  const __m128 dirTmax = _mm_setr_ps( 0.0f, 0.0f, 1.0f, 1e34f );
+  const __m128 y4 = _mm_set1_ps( y );
+  const __m128 z4 = _mm_set1_ps( z );
+  const __m128 tminOrMask4 = _mm_set1_ps( tminOrMask );
+  for( ; ix + 4 <= width; ix += 4 )
+  {
+    // Transpose the x, y, z and tmin lanes to one origin vector per ray
+    __m128 o0 = _mm_loadu_ps( xs + ix ), o1 = y4, o2 = z4, o3 = tminOrMask4;
+    _MM_TRANSPOSE4_PS( o0, o1, o2, o3 );
+    float* r = reinterpret_cast<float*>( rays + ix );
+    _mm_storeu_ps( r,      o0 );
+    _mm_storeu_ps( r + 4,  dirTmax );
+    _mm_storeu_ps( r + 8,  o1 );
+    _mm_storeu_ps( r + 12, dirTmax );
+    _mm_storeu_ps( r + 16, o2 );
+    _mm_storeu_ps( r + 20, dirTmax );
+    _mm_storeu_ps( r + 24, o3 );
+    _mm_storeu_ps( r + 28, dirTmax );
+  }
+#endif
+  for( ; ix < width; ix++ )
+  {
+    Ray r = { make_float3(xs[ix],y,z), tminOrMask, make_float3(0,0,1), 1e34f };
+    rays[ix] = r;
+  }
+}
+
+//------------------------------------------------------------------------------
+// One row of perspective rays through the image plane at height v.  us holds
+// the horizontal image plane coordinate of every column.
+static void fillRaysPersp( Ray* rays, const float* us, int width, float v,
+                           const float3& eye, const float3& U, const float3& V, const float3& W )
+{
+  const float3 vV = v*V;
+  int w = 0;
+#if PRIME_COMMON_SSE
+  const __m128 Ux = _mm_set1_ps( U.x ), Uy = _mm_set1_ps( U.y ), Uz = _mm_set1_ps( U.z );
+  const __m128 vVx = _mm_set1_ps( vV.x ), vVy = _mm_set1_ps( vV.y ), vVz = _mm_set1_ps( vV.z );
+  const __m128 Wx = _mm_set1_ps( W.x ), Wy = _mm_set1_ps( W.y ), Wz = _mm_set1_ps( W.z );
+  const __m128 one = _mm_set1_ps( 1.0f );
+  const __m128 origin = _mm_setr_ps( eye.x, eye.y, eye.z, 0.0f );
+  for( ; w + 4 <= width; w += 4 )
+  {
+    // dir = normalize( u*U + v*V + W ), evaluated as optix::normalize does
+    const __m128 u = _mm_loadu_ps( us + w );
+    __m128 dx = _mm_add_ps( _mm_add_ps( _mm_mul_ps( u, Ux ), vVx ), Wx );
+    __m128 dy = _mm_add_ps( _mm_add_ps( _mm_mul_ps( u, Uy ), vVy ), Wy );
+    __m128 dz = _mm_add_ps( _mm_add_ps( _mm_mul_ps( u, Uz ), vVz ), Wz );
+    const __m128 len2 = _mm_add_ps( _mm_add_ps( _mm_mul_ps( dx, dx ), _mm_mul_ps( dy, dy ) ), _mm_mul_ps( dz, dz ) );
+    const __m128 invLen = _mm_div_ps( one, _mm_sqrt_ps( len2 ) );
+    dx = _mm_mul_ps( dx, invLen );
+    dy = _mm_mul_ps( dy, invLen );
+    dz = _mm_mul_ps( dz, invLen );
+
+    // Transpose to one ( dir, tmax ) vector per ray
+    __m128 tmax = _mm_set1_ps( 1e34f );
+    _MM_TRANSPOSE4_PS( dx, dy, dz, tmax );
+    float* r = reinterpret_cast<float*>( rays + w );
+    _mm_storeu_ps( r,      origin );
+    _mm_storeu_ps( r + 4,  dx );
+    _mm_storeu_ps( r + 8,  origin );
+    _mm_storeu_ps( r + 12, dy );
+    _mm_storeu_ps( r + 16, origin );
+    _mm_storeu_ps( r + 20, dz );
+    _mm_storeu_ps( r + 24, origin );
+    _mm_storeu_ps( r + 28, tmax );
+  }
+#endif
+  for( ; w < width; w++ )
+  {
+    float3 dir = optix::normalize(us[w]*U + vV + W);
+    Ray r = { eye, 0.0f, dir, 1e34f };
+    rays[w] = r;
+  }
+}
+
+//------------------------------------------------------------------------------
+// Calls fill( row, column, n, offset ) for the row segments covering the rays
+// first..first+count-1 of an image of the given width.  offset is the index
+// of the segment's first ray relative to first.
+template <typename Fill>
+static void forEachRowSegment( int width, size_t first, size_t count, Fill fill )
+{
+  for( size_t offset = 0; offset < count; )
+  {
+    const size_t row = ( first + offset ) / width;
+    const int column = int( ( first + offset ) % width );
+    const int n = int( std::min<size_t>( width - column, count - offset ) );
+    fill( row, column, n, offset );
+    offset += n;
+  }
+}
+
+//------------------------------------------------------------------------------
+// View of createRaysOrtho: pixel spacing, first pixel center and ray origin z
+struct OrthoView
+{
+  float dx, dy;
+  float x0, y0;
+  float z;
+};
+
+//------------------------------------------------------------------------------
+static OrthoView orthoView( int width, int* height, const float3& bbmin, const float3& bbmax, float margin )
 {
   float3 bbspan = bbmax - bbmin;
   
   // set height according to aspect ratio of bounding box    
   *height = (int)(width * bbspan.y / bbspan.x);
 
-  float dx = bbspan.x * (1 + 2*margin) / width;
-  float dy = bbspan.y * (1 + 2*margin) / *height;
-  float x0 = bbmin.x - bbspan.x*margin + dx/2;
-  float y0 = bbmin.y - bbspan.y*margin + dy/2;
-  float z = bbmin.z - std::max(bbspan.z,1.0f)*.001f;
+  OrthoView view;
+  view.dx = bbspan.x * (1 + 2*margin) / width;
+  view.dy = bbspan.y * (1 + 2*margin) / *height;
+  view.x0 = bbmin.x - bbspan.x*margin + view.dx/2;
+  view.y0 = bbmin.y - bbspan.y*margin + view.dy/2;
+  view.z  = bbmin.z - std::max(bbspan.z,1.0f)*.001f;
+  return view;
+}
+
+//------------------------------------------------------------------------------
+// Column and row coordinates are accumulated serially, as one ray at a time
+// used to, so that rays can be filled in parallel without changing a bit.
+static std::vector<float> orthoColumns( const OrthoView& view, int width )
+{
+  std::vector<float> xs( std::max( width, 0 ) );
+  float x = view.x0;
+  for( size_t ix = 0; ix < xs.size(); ix++ )
+  {
+    xs[ix] = x;
+    x += view.dx;
+  }
+  return xs;
+}
+
+static std::vector<float> orthoRows( const OrthoView& view, int rows, int yOffset, int yStride )
+{
+  std::vector<float> ys( std::max( rows, 0 ) );
+  float y = view.y0 + view.dy*yOffset;
+  for( size_t row = 0; row < ys.size(); row++ )
+  {
+    ys[row] = y;
+    y += view.dy*yStride;
+  }
+  return ys;
+}
+
+//------------------------------------------------------------------------------
+void createRaysOrtho( Buffer<Ray>& raysBuffer, int width, int* height,
+  const float3& bbmin, const float3& bbmax, float margin, unsigned rayMask, int yOffset, int yStride )
+{
+  const OrthoView view = orthoView( width, height, bbmin, bbmax, margin );
   int rows = idivCeil( (*height - yOffset), yStride );
   raysBuffer.alloc( width * rows );
 
   if( raysBuffer.type() == RTP_BUFFER_TYPE_HOST )
   {
     Ray* rays = raysBuffer.ptr();
-    float y = y0 + dy*yOffset;
-    size_t idx = 0;
-    for( int iy = yOffset; iy < *height; iy += yStride )
+    const std::vector<float> xs = orthoColumns( view, width );
+    const std::vector<float> ys = orthoRows( view, rows, yOffset, yStride );
+
+    float tminOrMask = 0.0f;
+    if( rayMask ) 
+      tminOrMask = __int_as_float( rayMask );
+
+    parallelFor( ys.size(), MIN_RAYS_PER_THREAD / std::max( width, 1 ), [&]( size_t first, size_t last )
     {
-      float x = x0;
-      for( int ix = 0; ix < width; ix++ )
-      {
-        float tminOrMask = 0.0f;
-        if( rayMask ) 
-          tminOrMask = __int_as_float( rayMask );
-        
-        Ray r = { make_float3(x,y,z), tminOrMask, make_float3(0,0,1), 1e34f };
-        rays[idx++] = r;
-        x += dx;
-      }
-      y += dy*yStride;
-    }  
+      for( size_t row = first; row < last; row++ )
+        fillRaysOrtho( rays + row*width, xs.data(), width, ys[row], view.z, tminOrMask );
+    } );
   }
   else if( raysBuffer.type() == RTP_BUFFER_TYPE_CUDA_LINEAR )
   {    
-    createRaysOrthoOnDevice( (float4*)raysBuffer.ptr(), width, *height, x0, y0, z, dx, dy, yOffset, yStride, rayMask );
+    createRaysOrthoOnDevice( (float4*)raysBuffer.ptr(), width, *height, view.x0, view.y0, view.z, view.dx, view.dy, yOffset, yStride, rayMask );
   }
 }
 
+//------------------------------------------------------------------------------
+RayGenerator rayGeneratorOrtho( int width, int* height,
+  const float3& bbmin, const float3& bbmax, float margin, unsigned rayMask, int yOffset, int yStride )
+{
+  const OrthoView view = orthoView( width, height, bbmin, bbmax, margin );
+  const std::vector<float> xs = orthoColumns( view, width );
+  const std::vector<float> ys = orthoRows( view, idivCeil( (*height - yOffset), yStride ), yOffset, yStride );
+  const float tminOrMask = rayMask ? __int_as_float( rayMask ) : 0.0f;
+  return [=]( Ray* rays, size_t first, size_t count )
+  {
+    forEachRowSegment( width, first, count, [&]( size_t row, int column, int n, size_t offset )
+    {
+      fillRaysOrtho( rays + offset, xs.data() + column, n, ys[row], view.z, tminOrMask );
+    } );
+  };
+}
+
 //------------------------------------------------------------------------------
 // Compute a left-handed coordinate frame for the camera
 void computeUVW( float3 eye, float3 lookat, float3 up, float3& U, float3& V, float3& W )
@@ -120,34 +296,49 @@ void computeUVW( float3 eye, float3 lookat, float3 up, float3& U, float3& V, flo
 }
 
 //------------------------------------------------------------------------------
-void createRaysPersp( Buffer<Ray>& raysBuffer, int width, int height, const float3& eye, const float3& lookAt, const float vfov /* = 60.0f */ )
+// Scaled camera frame of createRaysPersp
+static void perspView( int width, int height, const float3& eye, const float3& lookAt, const float vfov,
+                       float3& U, float3& V, float3& W )
 {
   float aspectRatio  = float(width)/height;
   float vScale = float( tan( vfov/2 * M_PI/180 ) );
   float uScale = vScale * aspectRatio;
 
-  float3 U, V, W;
   computeUVW( eye, lookAt, make_float3( 0.0f, 1.0f, 0.0f ), U, V, W );
   U *= uScale;
   V *= vScale;
+}
+
+//------------------------------------------------------------------------------
+// Horizontal image plane coordinate of every column
+static std::vector<float> perspColumns( int width )
+{
+  std::vector<float> us( std::max( width, 0 ) );
+  for( int w=0; w < width; w++ ) 
+    us[w] = float(w)/width * 2.0f - 1.0f;
+  return us;
+}
+
+//------------------------------------------------------------------------------
+void createRaysPersp( Buffer<Ray>& raysBuffer, int width, int height, const float3& eye, const float3& lookAt, const float vfov /* = 60.0f */ )
+{
+  float3 U, V, W;
+  perspView( width, height, eye, lookAt, vfov, U, V, W );
 
   raysBuffer.alloc( width * height );
   if( raysBuffer.type() == RTP_BUFFER_TYPE_HOST )
   {
     Ray* rays = raysBuffer.ptr();
+    const std::vector<float> us = perspColumns( width );
 
-    int idx=0;
-    for( int h=0; h < height; h++ ) 
+    parallelFor( height, MIN_RAYS_PER_THREAD / std::max( width, 1 ), [&]( size_t first, size_t last )
     {
-      float v = float(h)/height * 2.0f - 1.0f;
-      for( int w=0; w < width; w++ ) 
+      for( size_t h = first; h < last; h++ )
       {
-        float u = float(w)/width * 2.0f - 1.0f;
-        float3 dir = optix::normalize(u*U + v*V + W);
-        Ray r = { eye, 0.0f, dir, 1e34f };
-        rays[idx++] = r;
+        float v = float(h)/height * 2.0f - 1.0f;
+        fillRaysPersp( rays + h*width, us.data(), width, v, eye, U, V, W );
       }
-    }
+    } );
   }
   else if( raysBuffer.type() == RTP_BUFFER_TYPE_CUDA_LINEAR )
   {
@@ -155,14 +346,46 @@ void createRaysPersp( Buffer<Ray>& raysBuffer, int width, int height, const floa
   }
 }
 
+//------------------------------------------------------------------------------
+RayGenerator rayGeneratorPersp( int width, int height, const float3& eye, const float3& lookAt, const float vfov )
+{
+  float3 U, V, W;
+  perspView( width, height, eye, lookAt, vfov, U, V, W );
+  const std::vector<float> us = perspColumns( width );
+  return [=]( Ray* rays, size_t first, size_t count )
+  {
+    forEachRowSegment( width, first, count, [&]( size_t row, int column, int n, size_t offset )
+    {
+      float v = float(row)/height * 2.0f - 1.0f;
+      fillRaysPersp( rays + offset, us.data() + column, n, v, eye, U, V, W );
+    } );
+  };
+}
+
 //------------------------------------------------------------------------------
 void translateRays( Buffer<Ray>& raysBuffer, const float3& offset )
 {
   if( raysBuffer.type() == RTP_BUFFER_TYPE_HOST )
   {
     Ray* rays = raysBuffer.ptr();
-    for( size_t r=0; r < raysBuffer.count(); r++ )
-      rays[r].origin = rays[r].origin + offset;
+    parallelFor( raysBuffer.count(), MIN_RAYS_PER_THREAD, [&]( size_t first, size_t last )
+    {
+      size_t r = first;
+#if PRIME_COMMON_SSE
+      // Add to origin.xyz and keep tmin, which may hold a ray mask
+      const __m128 off  = _mm_setr_ps( offset.x, offset.y, offset.z, 0.0f );
+      const __m128 tmin = _mm_castsi128_ps( _mm_setr_epi32( 0, 0, 0, -1 ) );
+      for( ; r < last; r++ )
+      {
+        float* p = reinterpret_cast<float*>( rays + r );
+        const __m128 o = _mm_loadu_ps( p );
+        const __m128 t = _mm_add_ps( o, off );
+        _mm_storeu_ps( p, _mm_or_ps( _mm_andnot_ps( tmin, t ), _mm_and_ps( tmin, o ) ) );
+      }
+#endif
+      for( ; r < last; r++ )
+        rays[r].origin = rays[r].origin + offset;
+    } );
   }
   else if( raysBuffer.type() == RTP_BUFFER_TYPE_CUDA_LINEAR )
   {
@@ -171,32 +394,615 @@ void translateRays( Buffer<Ray>& raysBuffer, const float3& offset )
 }
 
 //------------------------------------------------------------------------------
-void shadeHits( std::vector<float3>& image, Buffer<Hit>& hitsBuffer, PrimeMesh& mesh )
+// Radix sort of 30-bit ray keys: three octant bits above a 27-bit Morton code
+static const int      RAY_KEY_MORTON_BITS = 9;  // per axis
+static const int      RAY_KEY_RADIX_BITS  = 10;
+static const int      RAY_KEY_PASSES      = 3;
+static const unsigned RAY_KEY_BUCKETS     = 1u << RAY_KEY_RADIX_BITS;
+
+//------------------------------------------------------------------------------
+// Spreads the low 9 bits of v two bits apart
+static unsigned expandBits( unsigned v )
 {
-  float3 backgroundColor = { 0.2f, 0.2f, 0.2f };
+  v = ( v * 0x00010001u ) & 0xFF0000FFu;
+  v = ( v * 0x00000101u ) & 0x0F00F00Fu;
+  v = ( v * 0x00000011u ) & 0xC30C30C3u;
+  v = ( v * 0x00000005u ) & 0x49249249u;
+  return v;
+}
 
-  int3* indices = mesh.getVertexIndices();
-  float3* vertices = mesh.getVertexData();
-  const Hit* hits = hitsBuffer.hostPtr();
-  for( size_t i=0; i < hitsBuffer.count(); i++ )
+//------------------------------------------------------------------------------
+static unsigned quantize( float v, float lo, float scale )
+{
+  const float q = ( v - lo ) * scale;
+  return q > 0.0f ? std::min( unsigned( q ), ( 1u << RAY_KEY_MORTON_BITS ) - 1 ) : 0u;
+}
+
+//------------------------------------------------------------------------------
+void RaySorter::sort( const Buffer<Ray>& raysBuffer )
+{
+  const Ray* rays = raysBuffer.hostView();
+  const size_t count = rays ? raysBuffer.count() : 0;
+  m_keys.resize( count );
+  m_order.resize( count );
+  m_tempKeys.resize( count );
+  m_tempOrder.resize( count );
+  m_sortedRays.alloc( count, RTP_BUFFER_TYPE_HOST );
+  if( count == 0 )
+    return;
+
+  // Chunks are fixed across the passes so that each sorts stably into the
+  // ranges reserved for it
+  const size_t numChunks = std::max<size_t>( 1, std::min<size_t>( std::thread::hardware_concurrency(), count / MIN_RAYS_PER_THREAD ) );
+  std::vector<optix::Aabb> chunkBounds( numChunks );
+  m_offsets.resize( numChunks * RAY_KEY_BUCKETS );
+
+  parallelFor( numChunks, 1, [&]( size_t firstChunk, size_t lastChunk )
+  {
+    for( size_t c = firstChunk; c < lastChunk; c++ )
+      for( size_t r = count * c / numChunks; r < count * (c+1) / numChunks; r++ )
+        chunkBounds[c].include( rays[r].origin );
+  } );
+  optix::Aabb bounds;
+  for( size_t c = 0; c < numChunks; c++ )
+    bounds.include( chunkBounds[c] );
+  const float3 extent = bounds.extent();
+  const float  cells  = float( 1u << RAY_KEY_MORTON_BITS );
+  const float3 scale  = make_float3(
+      extent.x > 0.0f ? cells / extent.x : 0.0f,
+      extent.y > 0.0f ? cells / extent.y : 0.0f,
+      extent.z > 0.0f ? cells / extent.z : 0.0f );
+
+  parallelFor( count, MIN_RAYS_PER_THREAD, [&]( size_t first, size_t last )
   {
-    if( hits[i].t < 0.0f )
+    for( size_t r = first; r < last; r++ )
     {
-      image[i] = backgroundColor;
+      const Ray& ray = rays[r];
+      const unsigned octant = ( ray.dir.x < 0.0f ? 1u : 0u ) | ( ray.dir.y < 0.0f ? 2u : 0u ) | ( ray.dir.z < 0.0f ? 4u : 0u );
+      const unsigned morton =
+          expandBits( quantize( ray.origin.x, bounds.m_min.x, scale.x ) ) |
+        ( expandBits( quantize( ray.origin.y, bounds.m_min.y, scale.y ) ) << 1 ) |
+        ( expandBits( quantize( ray.origin.z, bounds.m_min.z, scale.z ) ) << 2 );
+      m_keys[r]  = ( octant << ( 3 * RAY_KEY_MORTON_BITS ) ) | morton;
+      m_order[r] = unsigned( r );
     }
-    else
+  } );
+
+  for( int pass = 0; pass < RAY_KEY_PASSES; pass++ )
+  {
+    const int shift = pass * RAY_KEY_RADIX_BITS;
+
+    parallelFor( numChunks, 1, [&]( size_t firstChunk, size_t lastChunk )
     {
-      int3 tri  = indices[hits[i].triId];
-      float3 v0 = vertices[tri.x];
-      float3 v1 = vertices[tri.y];
-      float3 v2 = vertices[tri.z];
-      float3 e0 = v1-v0;
-      float3 e1 = v2-v0;
-      float3 n = optix::normalize( optix::cross( e0, e1 ) );
+      for( size_t c = firstChunk; c < lastChunk; c++ )
+      {
+        size_t* histogram = &m_offsets[c * RAY_KEY_BUCKETS];
+        std::fill( histogram, histogram + RAY_KEY_BUCKETS, size_t( 0 ) );
+        for( size_t r = count * c / numChunks; r < count * (c+1) / numChunks; r++ )
+          histogram[( m_keys[r] >> shift ) & ( RAY_KEY_BUCKETS - 1 )]++;
+      }
+    } );
+
+    // Bucket-major prefix sum: chunk c writes bucket b after chunks 0..c-1
+    size_t offset = 0;
+    for( unsigned b = 0; b < RAY_KEY_BUCKETS; b++ )
+      for( size_t c = 0; c < numChunks; c++ )
+      {
+        const size_t n = m_offsets[c * RAY_KEY_BUCKETS + b];
+        m_offsets[c * RAY_KEY_BUCKETS + b] = offset;
+        offset += n;
+      }
+
+    parallelFor( numChunks, 1, [&]( size_t firstChunk, size_t lastChunk )
+    {
+      for( size_t c = firstChunk; c < lastChunk; c++ )
+      {
+        size_t* offsets = &m_offsets[c * RAY_KEY_BUCKETS];
+        for( size_t r = count * c / numChunks; r < count * (c+1) / numChunks; r++ )
+        {
+          const size_t dst = offsets[( m_keys[r] >> shift ) & ( RAY_KEY_BUCKETS - 1 )]++;
+          m_tempKeys[dst]  = m_keys[r];
+          m_tempOrder[dst] = m_order[r];
+        }
+      }
+    } );
+    m_keys.swap( m_tempKeys );
+    m_order.swap( m_tempOrder );
+  }
+
+  Ray* sortedRays = m_sortedRays.ptr();
+  parallelFor( count, MIN_RAYS_PER_THREAD, [&]( size_t first, size_t last )
+  {
+    for( size_t r = first; r < last; r++ )
+      sortedRays[r] = rays[m_order[r]];
+  } );
+}
+
+//------------------------------------------------------------------------------
+template <typename HitT>
+static void unsortHits( const std::vector<unsigned>& order, const Buffer<HitT>& sortedHits, Buffer<HitT>& hitsBuffer )
+{
+  const HitT* src = sortedHits.hostView();
+  HitT* dst = hitsBuffer.ptr();
+  parallelFor( std::min( order.size(), sortedHits.count() ), MIN_RAYS_PER_THREAD, [&]( size_t first, size_t last )
+  {
+    for( size_t r = first; r < last; r++ )
+      dst[order[r]] = src[r];
+  } );
+}
+
+//------------------------------------------------------------------------------
+void RaySorter::unsort( const Buffer<Hit>& sortedHits, Buffer<Hit>& hitsBuffer ) const
+{
+  unsortHits( m_order, sortedHits, hitsBuffer );
+}
+
+//------------------------------------------------------------------------------
+void RaySorter::unsort( const Buffer<HitInstancing>& sortedHits, Buffer<HitInstancing>& hitsBuffer ) const
+{
+  unsortHits( m_order, sortedHits, hitsBuffer );
+}
+
+//------------------------------------------------------------------------------
+void RaySorter::execute( RTPcontext context, RTPquery query, const Buffer<Ray>& raysBuffer,
+  Buffer<Hit>& hitsBuffer, bool keepSortedOrder )
+{
+  const bool sorted = raysBuffer.type() == RTP_BUFFER_TYPE_HOST && hitsBuffer.type() == RTP_BUFFER_TYPE_HOST;
+  const Buffer<Ray>* rays = &raysBuffer;
+  Buffer<Hit>* hits = &hitsBuffer;
+  if( sorted )
+  {
+    sort( raysBuffer );
+    rays = &m_sortedRays;
+    if( !keepSortedOrder )
+    {
+      m_sortedHits.alloc( raysBuffer.count(), RTP_BUFFER_TYPE_HOST );
+      hits = &m_sortedHits;
+    }
+  }
+
+  RTPbufferdesc raysDesc;
+  CHK_PRIME( rtpBufferDescCreate( context, Ray::format, rays->type(), const_cast<Ray*>( rays->ptr() ), &raysDesc ) );
+  CHK_PRIME( rtpBufferDescSetRange( raysDesc, 0, rays->count() ) );
+  RTPbufferdesc hitsDesc;
+  CHK_PRIME( rtpBufferDescCreate( context, Hit::format, hits->type(), hits->ptr(), &hitsDesc ) );
+  CHK_PRIME( rtpBufferDescSetRange( hitsDesc, 0, rays->count() ) );
+
+  CHK_PRIME( rtpQuerySetRays( query, raysDesc ) );
+  CHK_PRIME( rtpQuerySetHits( query, hitsDesc ) );
+  CHK_PRIME( rtpQueryExecute( query, 0 /* hints */ ) );
+  CHK_PRIME( rtpBufferDescDestroy( raysDesc ) );
+  CHK_PRIME( rtpBufferDescDestroy( hitsDesc ) );
+
+  if( sorted && !keepSortedOrder )
+    unsort( m_sortedHits, hitsBuffer );
+}
+
+//------------------------------------------------------------------------------
+size_t getBufferSize( RTPbufferformat format, size_t count )
+{
+  switch( format )
+  {
+  case RTP_BUFFER_FORMAT_INDICES_INT3:
+    return sizeof(int3)*count;
+  case RTP_BUFFER_FORMAT_VERTEX_FLOAT3:
+    return sizeof(float3)*count;
+  case RTP_BUFFER_FORMAT_RAY_ORIGIN_DIRECTION:        
+    return 2*sizeof(float3)*count;
+  case RTP_BUFFER_FORMAT_RAY_ORIGIN_TMIN_DIRECTION_TMAX:
+    return 2*sizeof(float4)*count;
+  case RTP_BUFFER_FORMAT_HIT_BITMASK:
+    return ((count + 31)/32)*sizeof(int);
+  case RTP_BUFFER_FORMAT_HIT_T:
+    return sizeof(float)*count;
+  case RTP_BUFFER_FORMAT_HIT_T_TRIID:
+    return (sizeof(float) + sizeof(int))*count;
+  case RTP_BUFFER_FORMAT_HIT_T_TRIID_U_V:
+    return (3*sizeof(float) + sizeof(int))*count;
+  case RTP_BUFFER_FORMAT_HIT_T_TRIID_INSTID_U_V:
+    return (3*sizeof(float) + 2*sizeof(int))*count;
+  default:
+    std::cerr << "Unknown format\n";
+    exit(1);
+  }
+
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+QueryPipeline::QueryPipeline( RTPmodel model, RTPquerytype queryType, int depth, size_t maxCount,
+  RTPbufferformat rayFormat, RTPbufferformat hitFormat )
+  : m_stages( std::max( depth, 1 ) )
+  , m_inFlight( 0 )
+  , m_stop( false )
+{
+  RTPcontext context;  // for CHK_PRIME
+  CHK_PRIME( rtpModelGetContext( model, &context ) );
+  m_context = context;
+
+  for( size_t i = 0; i < m_stages.size(); ++i )
+  {
+    StageState& s = m_stages[i];
+    s.raysBuffer.alloc( getBufferSize( rayFormat, maxCount ), RTP_BUFFER_TYPE_HOST, LOCKED );
+    s.hitsBuffer.alloc( getBufferSize( hitFormat, maxCount ), RTP_BUFFER_TYPE_HOST, LOCKED );
+    s.rays     = s.raysBuffer.ptr();
+    s.hits     = s.hitsBuffer.ptr();
+    s.maxCount = maxCount;
+    s.count    = 0;
+    s.userData = 0;
+    CHK_PRIME( rtpQueryCreate( model, queryType, &s.query ) );
+    CHK_PRIME( rtpBufferDescCreate( context, rayFormat, RTP_BUFFER_TYPE_HOST, s.rays, &s.raysDesc ) );
+    CHK_PRIME( rtpBufferDescCreate( context, hitFormat, RTP_BUFFER_TYPE_HOST, s.hits, &s.hitsDesc ) );
+    m_free.push_back( &s );
+  }
+
+  m_executor  = std::thread( &QueryPipeline::executeLoop, this );
+  m_completer = std::thread( &QueryPipeline::completeLoop, this );
+}
+
+//------------------------------------------------------------------------------
+QueryPipeline::~QueryPipeline()
+{
+  finish();
+  {
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_stop = true;
+  }
+  m_submittedCv.notify_all();
+  m_executingCv.notify_all();
+  m_executor.join();
+  m_completer.join();
+
+  RTPcontext context = m_context;  // for CHK_PRIME
+  for( size_t i = 0; i < m_stages.size(); ++i )
+  {
+    CHK_PRIME( rtpBufferDescDestroy( m_stages[i].raysDesc ) );
+    CHK_PRIME( rtpBufferDescDestroy( m_stages[i].hitsDesc ) );
+    CHK_PRIME( rtpQueryDestroy( m_stages[i].query ) );
+  }
+}
+
+//------------------------------------------------------------------------------
+QueryPipeline::Stage* QueryPipeline::acquire()
+{
+  std::unique_lock<std::mutex> lock( m_mutex );
+  m_freeCv.wait( lock, [this] { return !m_free.empty(); } );
+  StageState* s = m_free.front();
+  m_free.pop_front();
+  return s;
+}
 
-      image[i] = 0.5f*n + make_float3( 0.5f, 0.5f, 0.5f ); 
+//------------------------------------------------------------------------------
+std::future<void> QueryPipeline::submit( Stage* stage, size_t count, void* userData, const Callback& onComplete )
+{
+  StageState* s = static_cast<StageState*>( stage );
+  if( count > s->maxCount )
+  {
+    {
+      std::lock_guard<std::mutex> lock( m_mutex );
+      m_free.push_back( s );
     }
+    m_freeCv.notify_one();
+
+    std::ostringstream msg;
+    msg << "QueryPipeline::submit: " << count << " rays do not fit in a stage of " << s->maxCount;
+    throw std::invalid_argument( msg.str() );
+  }
+  s->count      = count;
+  s->userData   = userData;
+  s->onComplete = onComplete;
+  s->done       = std::promise<void>();
+  std::future<void> done = s->done.get_future();
+  {
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_submitted.push_back( s );
+    m_inFlight++;
   }
+  m_submittedCv.notify_one();
+  return done;
+}
+
+//------------------------------------------------------------------------------
+void QueryPipeline::finish()
+{
+  std::unique_lock<std::mutex> lock( m_mutex );
+  m_idleCv.wait( lock, [this] { return m_inFlight == 0; } );
+}
+
+//------------------------------------------------------------------------------
+// Next stage from queue, or 0 once the pipeline stops and the queue is empty
+QueryPipeline::StageState* QueryPipeline::pop( std::deque<StageState*>& queue, std::condition_variable& cv )
+{
+  std::unique_lock<std::mutex> lock( m_mutex );
+  cv.wait( lock, [&] { return !queue.empty() || m_stop; } );
+  if( queue.empty() )
+    return 0;
+  StageState* s = queue.front();
+  queue.pop_front();
+  return s;
+}
+
+//------------------------------------------------------------------------------
+void QueryPipeline::executeLoop()
+{
+  RTPcontext context = m_context;  // for CHK_PRIME
+  while( StageState* s = pop( m_submitted, m_submittedCv ) )
+  {
+    // CPU contexts traverse here; CUDA contexts return right away
+    if( s->count > 0 )
+    {
+      CHK_PRIME( rtpBufferDescSetRange( s->raysDesc, 0, s->count ) );
+      CHK_PRIME( rtpBufferDescSetRange( s->hitsDesc, 0, s->count ) );
+      CHK_PRIME( rtpQuerySetRays( s->query, s->raysDesc ) );
+      CHK_PRIME( rtpQuerySetHits( s->query, s->hitsDesc ) );
+      CHK_PRIME( rtpQueryExecute( s->query, RTP_QUERY_HINT_ASYNC ) );
+    }
+    {
+      std::lock_guard<std::mutex> lock( m_mutex );
+      m_executing.push_back( s );
+    }
+    m_executingCv.notify_one();
+  }
+}
+
+//------------------------------------------------------------------------------
+void QueryPipeline::completeLoop()
+{
+  RTPcontext context = m_context;  // for CHK_PRIME
+  while( StageState* s = pop( m_executing, m_executingCv ) )
+  {
+    if( s->count > 0 )
+      CHK_PRIME( rtpQueryFinish( s->query ) );
+    if( s->onComplete )
+      s->onComplete( *s );
+    s->onComplete = Callback();
+    s->done.set_value();
+    {
+      std::lock_guard<std::mutex> lock( m_mutex );
+      m_free.push_back( s );
+      m_inFlight--;
+    }
+    m_freeCv.notify_one();
+    m_idleCv.notify_all();
+  }
+}
+
+//------------------------------------------------------------------------------
+void executeStreaming( QueryPipeline& pipeline, size_t count,
+  const RayGenerator& generate, const HitConsumer& consume )
+{
+  const QueryPipeline::Callback onComplete = [&consume]( const QueryPipeline::Stage& stage )
+  {
+    consume( stage.hits, reinterpret_cast<size_t>( stage.userData ), stage.count );
+  };
+
+  // The next chunk is generated while earlier ones are traced
+  const size_t chunkSize = pipeline.maxCount();
+  for( size_t first = 0; first < count; first += chunkSize )
+  {
+    const size_t chunkCount = std::min( chunkSize, count - first );
+    QueryPipeline::Stage* stage = pipeline.acquire();
+    Ray* rays = static_cast<Ray*>( stage->rays );
+    parallelFor( chunkCount, MIN_RAYS_PER_THREAD, [&]( size_t begin, size_t end )
+    {
+      generate( rays + begin, first + begin, end - begin );
+    } );
+    pipeline.submit( stage, chunkCount, reinterpret_cast<void*>( first ), onComplete );
+  }
+  pipeline.finish();
+}
+
+//------------------------------------------------------------------------------
+OcclusionQuery::OcclusionQuery( RTPmodel model, size_t chunkSize )
+  : m_pipeline( model, RTP_QUERY_TYPE_ANY, 2, std::max<size_t>( 32, chunkSize / 32 * 32 ),
+                Ray::format, RTP_BUFFER_FORMAT_HIT_BITMASK )
+{
+}
+
+//------------------------------------------------------------------------------
+void OcclusionQuery::execute( size_t count, const RayGenerator& generate, std::vector<unsigned>& occluded )
+{
+  occluded.resize( ( count + 31 ) / 32 );
+  unsigned* result = occluded.empty() ? 0 : &occluded[0];
+  executeStreaming( m_pipeline, count, generate, [result]( const void* hits, size_t first, size_t hitCount )
+  {
+    const size_t words = ( hitCount + 31 ) / 32;
+    memcpy( result + first / 32, hits, words * sizeof(unsigned) );
+
+    // Clear the bits past the last ray
+    if( hitCount % 32 )
+      result[first / 32 + words - 1] &= ( 1u << ( hitCount % 32 ) ) - 1;
+  } );
+}
+
+//------------------------------------------------------------------------------
+void OcclusionQuery::execute( size_t count, const RayGenerator& generate, std::vector<unsigned char>& occluded )
+{
+  occluded.resize( count );
+  unsigned char* result = occluded.empty() ? 0 : &occluded[0];
+  executeStreaming( m_pipeline, count, generate, [result]( const void* hits, size_t first, size_t hitCount )
+  {
+    const unsigned* bits = static_cast<const unsigned*>( hits );
+    parallelFor( ( hitCount + 31 ) / 32, MIN_RAYS_PER_THREAD / 32, [&]( size_t firstWord, size_t lastWord )
+    {
+      for( size_t w = firstWord; w < lastWord; w++ )
+      {
+        const unsigned word = bits[w];
+        const size_t n = std::min<size_t>( 32, hitCount - w * 32 );
+        unsigned char* bytes = result + first + w * 32;
+        for( size_t b = 0; b < n; b++ )
+          bytes[b] = ( word >> b ) & 1;
+      }
+    } );
+  } );
+}
+
+//------------------------------------------------------------------------------
+// 64-bit FNV-1a style hash, consuming eight bytes per step
+static unsigned long long hashBytes( unsigned long long h, const void* data, size_t size )
+{
+  const unsigned long long prime = 0x100000001b3ULL;
+  const unsigned char* bytes = static_cast<const unsigned char*>( data );
+  size_t i = 0;
+  for( ; i + 8 <= size; i += 8 )
+  {
+    unsigned long long word;
+    memcpy( &word, bytes + i, 8 );
+    h = ( h ^ word ) * prime;
+    h ^= h >> 32;
+  }
+  for( ; i < size; i++ )
+    h = ( h ^ bytes[i] ) * prime;
+  return ( h ^ size ) * prime;
+}
+
+//------------------------------------------------------------------------------
+// Header of an acceleration cache file, followed by cacheSize bytes from
+// rtpModelGetCache
+struct AccelCacheHeader
+{
+  char               magic[4];
+  unsigned           version;
+  unsigned long long hash;
+  unsigned long long indicesSize;
+  unsigned long long verticesSize;
+  unsigned long long cacheSize;
+};
+
+static const char     ACCEL_CACHE_MAGIC[4] = { 'P', 'R', 'M', 'C' };
+static const unsigned ACCEL_CACHE_VERSION  = 1;
+
+//------------------------------------------------------------------------------
+// Reads the cache stored for header's hash and sizes; empty if there is none.
+static std::vector<char> readAccelCache( const std::string& filename, const AccelCacheHeader& expected )
+{
+  std::vector<char> cache;
+  std::ifstream in( filename.c_str(), std::ios::in | std::ios::binary );
+  if( !in )
+    return cache;
+
+  AccelCacheHeader header;
+  if( !in.read( reinterpret_cast<char*>( &header ), sizeof( header ) ) ||
+      memcmp( header.magic, expected.magic, sizeof( header.magic ) ) != 0 ||
+      header.version != expected.version || header.hash != expected.hash ||
+      header.indicesSize != expected.indicesSize || header.verticesSize != expected.verticesSize ||
+      header.cacheSize == 0 )
+    return cache;
+
+  cache.resize( size_t( header.cacheSize ) );
+  if( !in.read( &cache[0], cache.size() ) )
+    cache.clear();
+  return cache;
+}
+
+//------------------------------------------------------------------------------
+static void writeAccelCache( const std::string& filename, AccelCacheHeader header, const std::vector<char>& cache )
+{
+  // Write under a temporary name so that a reader never sees a partial file
+  const std::string tmpFilename = filename + ".tmp";
+  {
+    std::ofstream out( tmpFilename.c_str(), std::ios::out | std::ios::binary );
+    header.cacheSize = cache.size();
+    out.write( reinterpret_cast<const char*>( &header ), sizeof( header ) );
+    out.write( &cache[0], cache.size() );
+    if( !out )
+    {
+      std::cerr << "Cannot write acceleration cache " << tmpFilename << std::endl;
+      return;
+    }
+  }
+  remove( filename.c_str() );
+  if( rename( tmpFilename.c_str(), filename.c_str() ) != 0 )
+    std::cerr << "Cannot write acceleration cache " << filename << std::endl;
+}
+
+//------------------------------------------------------------------------------
+bool updateModelCached( RTPmodel model, RTPcontexttype contextType, unsigned device, const std::string& cacheDir,
+  const void* indices, size_t indicesSize, const void* vertices, size_t verticesSize, unsigned hints )
+{
+  RTPcontext context;  // for CHK_PRIME
+  CHK_PRIME( rtpModelGetContext( model, &context ) );
+
+  if( cacheDir.empty() )
+  {
+    CHK_PRIME( rtpModelUpdate( model, hints ) );
+    return false;
+  }
+
+  AccelCacheHeader header;
+  memcpy( header.magic, ACCEL_CACHE_MAGIC, sizeof( header.magic ) );
+  header.version      = ACCEL_CACHE_VERSION;
+  header.hash         = hashBytes( hashBytes( 0xcbf29ce484222325ULL, indices, indicesSize ), vertices, verticesSize );
+  header.indicesSize  = indicesSize;
+  header.verticesSize = verticesSize;
+  header.cacheSize    = 0;
+
+  std::ostringstream filename;
+  filename << cacheDir << "/" << std::hex << std::setw( 16 ) << std::setfill( '0' ) << header.hash << std::dec;
+  if( contextType == RTP_CONTEXT_TYPE_CPU )
+    filename << "-cpu.primeaccel";
+  else
+    filename << "-cuda" << device << ".primeaccel";
+
+  // A cache from an incompatible device or driver does not load; fall back to
+  // a build and replace it.
+  std::vector<char> cache = readAccelCache( filename.str(), header );
+  if( !cache.empty() && rtpModelSetCache( model, &cache[0] ) == RTP_SUCCESS )
+    return true;
+
+  CHK_PRIME( rtpModelUpdate( model, hints ) );
+  CHK_PRIME( rtpModelFinish( model ) );
+
+  RTPsize cacheSize = 0;
+  CHK_PRIME( rtpModelGetCacheSize( model, &cacheSize ) );
+  cache.resize( cacheSize );
+  if( cacheSize > 0 )
+  {
+    CHK_PRIME( rtpModelGetCache( model, &cache[0] ) );
+    writeAccelCache( filename.str(), header, cache );
+  }
+  return false;
+}
+
+//------------------------------------------------------------------------------
+// Hits handed to a shading thread at least, and hits shaded per tile.  A tile
+// of gathered normals stays in L1 while its colors are computed.
+static const size_t MIN_HITS_PER_THREAD = 16*1024;
+static const size_t SHADE_TILE = 256;
+
+//------------------------------------------------------------------------------
+template <typename HitT>
+static void splitHits( HitsSoA& soa, const HitT* hits, size_t count )
+{
+  soa.t.resize( count );
+  soa.triId.resize( count );
+  parallelFor( count, MIN_HITS_PER_THREAD, [&]( size_t first, size_t last )
+  {
+    for( size_t i = first; i < last; ++i )
+    {
+      soa.t[i]     = hits[i].t;
+      soa.triId[i] = hits[i].triId;
+    }
+  } );
+}
+
+//------------------------------------------------------------------------------
+void HitsSoA::assign( const Hit* hits, size_t count )
+{
+  splitHits( *this, hits, count );
+  instId.clear();
+}
+
+//------------------------------------------------------------------------------
+void HitsSoA::assign( const HitInstancing* hits, size_t count )
+{
+  splitHits( *this, hits, count );
+  instId.resize( count );
+  parallelFor( count, MIN_HITS_PER_THREAD, [&]( size_t first, size_t last )
+  {
+    for( size_t i = first; i < last; ++i )
+      instId[i] = hits[i].instId;
+  } );
 }
 
 //------------------------------------------------------------------------------
@@ -219,48 +1025,220 @@ float3 transformNormal( const SimpleMatrix4x3& Minv, const float3& n)
 }
 
 //------------------------------------------------------------------------------
-void shadeHits( std::vector<float3>& image, Buffer<HitInstancing>& hitsBuffer, std::vector<int>& modelIds, std::vector<PrimeMesh>& models, float3 eye, std::vector<SimpleMatrix4x3>& invTransforms )
+int HitShader::addMesh( PrimeMesh& mesh )
 {
-  float3 backgroundColor = { 1.0f, 1.0f, 1.0f };
+  const int3* indices = mesh.getVertexIndices();
+  const float3* vertices = mesh.getVertexData();
+  const size_t first = m_nx.size();
+  m_meshFirstFace.push_back( static_cast<int>( first ) );
 
-  const HitInstancing* hits = hitsBuffer.hostPtr();
-  for( size_t i=0; i < hitsBuffer.count(); ++i )
+  m_nx.resize( first + mesh.num_triangles );
+  m_ny.resize( first + mesh.num_triangles );
+  m_nz.resize( first + mesh.num_triangles );
+  m_nd.resize( first + mesh.num_triangles );
+  parallelFor( mesh.num_triangles, MIN_HITS_PER_THREAD, [&]( size_t begin, size_t end )
   {
-    if( hits[i].t < 0.0f )
+    for( size_t i = begin; i < end; ++i )
     {
-      image[i] = backgroundColor;
-    }
-    else
-    {
-      int modelId = modelIds[hits[i].instId];
-      PrimeMesh& mesh = models[modelId];
-      int3* indices = mesh.getVertexIndices();
-      float3* vertices = mesh.getVertexData();
-      SimpleMatrix4x3& Minv = invTransforms[hits[i].instId];
-
-      // Compute normal in object space
-      int3 tri  = indices[hits[i].triId];
+      int3 tri  = indices[i];
       float3 v0 = vertices[tri.x];
       float3 v1 = vertices[tri.y];
       float3 v2 = vertices[tri.z];
-      float3 e0 = v1-v0;
-      float3 e1 = v2-v0;
-      float3  n = optix::cross( e0, e1 ); // save normalization for later
-
-      // Flip normal if facing away from eye
-      float3 eyeO = transformPoint( Minv, eye );
-      float3 dir = v0 - eyeO;
-      if( optix::dot(n, dir) > 0 )
-        n = -n;
-
-      // Transform to world space
-      n = optix::normalize( transformNormal( Minv, n ) );     
-      
-      // Compute color
-      image[i] = 0.5f*n + make_float3( 0.5f, 0.5f, 0.5f ); 
+      float3 n  = optix::normalize( optix::cross( v1-v0, v2-v0 ) );
+      m_nx[first+i] = n.x;
+      m_ny[first+i] = n.y;
+      m_nz[first+i] = n.z;
+      m_nd[first+i] = optix::dot( n, v0 );
     }
-  }
+  } );
+  return static_cast<int>( m_meshFirstFace.size() ) - 1;
+}
+
+//------------------------------------------------------------------------------
+void HitShader::setInstances( const std::vector<int>& modelIds, const std::vector<SimpleMatrix4x3>& invTransforms )
+{
+  m_instFirstFace.resize( modelIds.size() );
+  for( size_t i = 0; i < modelIds.size(); ++i )
+    m_instFirstFace[i] = m_meshFirstFace[modelIds[i]];
+  m_invTransforms = invTransforms;
+}
+
+//------------------------------------------------------------------------------
+void HitShader::shade( std::vector<float3>& image, const HitsSoA& hits, const float3& background ) const
+{
+  const size_t firstFace = m_meshFirstFace.empty() ? 0 : m_meshFirstFace[0];
+  parallelFor( hits.count(), MIN_HITS_PER_THREAD, [&]( size_t first, size_t last )
+  {
+    float nx[SHADE_TILE], ny[SHADE_TILE], nz[SHADE_TILE];
+    for( size_t base = first; base < last; base += SHADE_TILE )
+    {
+      const size_t n = std::min( SHADE_TILE, last - base );
+      const float* t = &hits.t[base];
+      const int* triId = &hits.triId[base];
+
+      // Gather the normals of the hit faces.  Misses have no face.
+      for( size_t k = 0; k < n; ++k )
+      {
+        const size_t face = firstFace + triId[k];
+        nx[k] = t[k] < 0.0f ? 0.0f : m_nx[face];
+        ny[k] = t[k] < 0.0f ? 0.0f : m_ny[face];
+        nz[k] = t[k] < 0.0f ? 0.0f : m_nz[face];
+      }
+
+      float3* out = &image[base];
+      for( size_t k = 0; k < n; ++k )
+      {
+        const bool hit = t[k] >= 0.0f;
+        out[k].x = hit ? 0.5f*nx[k] + 0.5f : background.x;
+        out[k].y = hit ? 0.5f*ny[k] + 0.5f : background.y;
+        out[k].z = hit ? 0.5f*nz[k] + 0.5f : background.z;
+      }
+    }
+  } );
 }
+
+//------------------------------------------------------------------------------
+void HitShader::shade( std::vector<float3>& image, const HitsSoA& hits, const float3& eye, const float3& background ) const
+{
+  assert( hits.instId.size() == hits.count() );
+
+  // The eye in the object space of every instance
+  const size_t numInstances = m_invTransforms.size();
+  std::vector<float3> eyeO( numInstances );
+  parallelFor( numInstances, MIN_HITS_PER_THREAD, [&]( size_t first, size_t last )
+  {
+    for( size_t i = first; i < last; ++i )
+      eyeO[i] = transformPoint( m_invTransforms[i], eye );
+  } );
+
+  parallelFor( hits.count(), MIN_HITS_PER_THREAD, [&]( size_t first, size_t last )
+  {
+    float nx[SHADE_TILE], ny[SHADE_TILE], nz[SHADE_TILE];
+    for( size_t base = first; base < last; base += SHADE_TILE )
+    {
+      const size_t n = std::min( SHADE_TILE, last - base );
+      const float* t = &hits.t[base];
+      const int* triId = &hits.triId[base];
+      const int* instId = &hits.instId[base];
+
+      // Gather the face normal, flip it to face the eye and take it to world
+      // space.  Misses have no face.
+      for( size_t k = 0; k < n; ++k )
+      {
+        if( t[k] < 0.0f )
+        {
+          nx[k] = ny[k] = 0.0f;
+          nz[k] = 1.0f;
+          continue;
+        }
+        const int inst = instId[k];
+        const size_t face = m_instFirstFace[inst] + triId[k];
+        float3 nO = make_float3( m_nx[face], m_ny[face], m_nz[face] );
+        if( m_nd[face] - optix::dot( nO, eyeO[inst] ) > 0.0f )
+          nO = -nO;
+        const float3 nW = transformNormal( m_invTransforms[inst], nO );
+        nx[k] = nW.x;
+        ny[k] = nW.y;
+        nz[k] = nW.z;
+      }
+
+      // Normalize and color
+      float3* out = &image[base];
+      for( size_t k = 0; k < n; ++k )
+      {
+        const bool hit = t[k] >= 0.0f;
+        const float s = 0.5f / sqrtf( nx[k]*nx[k] + ny[k]*ny[k] + nz[k]*nz[k] );
+        out[k].x = hit ? s*nx[k] + 0.5f : background.x;
+        out[k].y = hit ? s*ny[k] + 0.5f : background.y;
+        out[k].z = hit ? s*nz[k] + 0.5f : background.z;
+      }
+    }
+  } );
+}
+
+//------------------------------------------------------------------------------
+void shadeHits( std::vector<float3>& image, Buffer<Hit>& hitsBuffer, PrimeMesh& mesh )
+{
+  float3 backgroundColor = { 0.2f, 0.2f, 0.2f };
+
+  int3* indices = mesh.getVertexIndices();
+  float3* vertices = mesh.getVertexData();
+  const Hit* hits = hitsBuffer.hostPtr();
+  parallelFor( hitsBuffer.count(), MIN_HITS_PER_THREAD, [&]( size_t first, size_t last )
+  {
+    for( size_t i=first; i < last; i++ )
+    {
+      if( hits[i].t < 0.0f )
+      {
+        image[i] = backgroundColor;
+      }
+      else
+      {
+        int3 tri  = indices[hits[i].triId];
+        float3 v0 = vertices[tri.x];
+        float3 v1 = vertices[tri.y];
+        float3 v2 = vertices[tri.z];
+        float3 e0 = v1-v0;
+        float3 e1 = v2-v0;
+        float3 n = optix::normalize( optix::cross( e0, e1 ) );
+
+        image[i] = 0.5f*n + make_float3( 0.5f, 0.5f, 0.5f );
+      }
+    }
+  } );
+}
+
+//------------------------------------------------------------------------------
+void shadeHits( std::vector<float3>& image, Buffer<HitInstancing>& hitsBuffer, std::vector<int>& modelIds, std::vector<PrimeMesh>& models, float3 eye, std::vector<SimpleMatrix4x3>& invTransforms )
+{
+  float3 backgroundColor = { 1.0f, 1.0f, 1.0f };
+
+  // The eye in the object space of every instance
+  std::vector<float3> eyeO( invTransforms.size() );
+  for( size_t i=0; i < invTransforms.size(); ++i )
+    eyeO[i] = transformPoint( invTransforms[i], eye );
+
+  const HitInstancing* hits = hitsBuffer.hostPtr();
+  parallelFor( hitsBuffer.count(), MIN_HITS_PER_THREAD, [&]( size_t first, size_t last )
+  {
+    for( size_t i=first; i < last; ++i )
+    {
+      if( hits[i].t < 0.0f )
+      {
+        image[i] = backgroundColor;
+      }
+      else
+      {
+        int modelId = modelIds[hits[i].instId];
+        PrimeMesh& mesh = models[modelId];
+        int3* indices = mesh.getVertexIndices();
+        float3* vertices = mesh.getVertexData();
+        SimpleMatrix4x3& Minv = invTransforms[hits[i].instId];
+
+        // Compute normal in object space
+        int3 tri  = indices[hits[i].triId];
+        float3 v0 = vertices[tri.x];
+        float3 v1 = vertices[tri.y];
+        float3 v2 = vertices[tri.z];
+        float3 e0 = v1-v0;
+        float3 e1 = v2-v0;
+        float3  n = optix::cross( e0, e1 ); // save normalization for later
+
+        // Flip normal if facing away from eye
+        float3 dir = v0 - eyeO[hits[i].instId];
+        if( optix::dot(n, dir) > 0 )
+          n = -n;
+
+        // Transform to world space
+        n = optix::normalize( transformNormal( Minv, n ) );
+
+        // Compute color
+        image[i] = 0.5f*n + make_float3( 0.5f, 0.5f, 0.5f );
+      }
+    }
+  } );
+}
+
 //------------------------------------------------------------------------------
 void writePpm( const char* filename, const float* image, int width, int height )
 {
@@ -288,6 +1266,9 @@ void writePpm( const char* filename, const float* image, int width, int height )
 //------------------------------------------------------------------------------
 void resetAllDevices()
 {
+  // Pooled device blocks do not survive the reset
+  BufferPool::instance().trim();
+
   int deviceCount;
   CHK_CUDA( cudaGetDeviceCount( &deviceCount ) );
   for( int i=0; i < deviceCount; ++i )
@@ -52,6 +52,7 @@ void printUsageAndExit( const char* argv0 )
   << "  -c  | --context [cpu|(cuda)]               Specify context type. Default is cuda\n"
   << "  -b  | --buffer [(host)|cuda]               Specify buffer type. Default is host\n"
   << "  -w  | --width <number>                     Specify output image width\n"
+  << "  -s  | --shadows                            Also write outputShadows.ppm, shadowed by an occlusion query\n"
   << std::endl;
   
   exit(1);
@@ -66,6 +67,7 @@ int main( int argc, char** argv )
   std::string objFilename = std::string( sutil::samplesDir() ) + "/data/cow.obj";
   int width = 640;
   int height = 0;
+  bool shadows = false;
 
   // parse arguments
   for ( int i = 1; i < argc; ++i ) 
@@ -103,6 +105,10 @@ int main( int argc, char** argv )
     {
       width = atoi(argv[++i]);
     } 
+    else if( arg == "-s" || arg == "--shadows" )
+    {
+      shadows = true;
+    }
     else 
     {
       std::cerr << "Bad option: '" << arg << "'" << std::endl;
@@ -156,6 +162,40 @@ int main( int argc, char** argv )
     shadeHits( image, hits, mesh );
     writePpm( "output.ppm", &image[0].x, width, height );
 
+    //
+    // Darken the hit points that cannot see a directional light.  The shadow
+    // rays are made from the primary hits chunk by chunk and only one bit per
+    // ray comes back.
+    //
+    if( shadows )
+    {
+      const Ray* primaryRays = rays.hostPtr();
+      const Hit* primaryHits = hits.hostPtr();
+      const float3 lightDir = optix::normalize( make_float3( 0.5f, 1.0f, -0.5f ) );
+      const float epsilon = 1.e-4f * optix::length( mesh.getBBoxMax() - mesh.getBBoxMin() );
+      RayGenerator shadowRays = [=]( Ray* out, size_t first, size_t count )
+      {
+        for( size_t i = 0; i < count; ++i )
+        {
+          // Misses get an empty ray; their pixels keep the background
+          const Ray& r = primaryRays[first+i];
+          const float t = primaryHits[first+i].t;
+          const Ray shadow = { r.origin + t*r.dir + epsilon*lightDir, 0.0f, lightDir, t < 0.0f ? 0.0f : 1.e34f };
+          out[i] = shadow;
+        }
+      };
+
+      std::vector<unsigned> occluded;
+      OcclusionQuery occlusion( model->getRTPmodel() );
+      occlusion.execute( rays.count(), shadowRays, occluded );
+
+      std::vector<float3> shadowImage( image );
+      for( size_t i = 0; i < shadowImage.size(); ++i )
+        if( primaryHits[i].t >= 0.0f && ( occluded[i/32] >> (i%32) & 1 ) )
+          shadowImage[i] *= 0.5f;
+      writePpm( "outputShadows.ppm", &shadowImage[0].x, width, height );
+    }
+
     //
     // Re-execute query with different rays
     //
@@ -29,6 +29,11 @@
 #pragma once
 
 #include <putil/Preprocessor.h>
+#include <cstring>
+#include <list>
+#include <map>
+#include <mutex>
+#include <tuple>
 #include <vector>
 
 //------------------------------------------------------------------------------
@@ -44,68 +49,301 @@ enum PageLockedState
 
 //------------------------------------------------------------------------------
 //
-// A simple abstraction for memory to be passed into Prime via BufferDescs
+// Size-class pool for the memory behind Buffer. Released blocks are kept per
+// kind (host, page-locked host, or memory on one CUDA device) and size class
+// and are handed out again instead of going back through new or cudaMalloc
+// and rtpHostBufferLock. At most 256 MB, or the limit set with
+// setMaxCachedBytes, are kept; releasing beyond that frees the blocks released
+// longest ago. trim() frees all cached blocks; it must be called before
+// cudaDeviceReset.
+//
+class BufferPool
+{
+public:
+  enum Kind
+  {
+    HOST,
+    HOST_LOCKED,
+    DEVICE
+  };
+
+  static BufferPool& instance()
+  {
+    static BufferPool pool;
+    return pool;
+  }
+
+  // Returns a block of at least bytes bytes on the current CUDA device for
+  // DEVICE blocks. blockSize receives the usable size of the block.
+  void* acquire( Kind kind, size_t bytes, int* device, size_t* blockSize )
+  {
+    *device = 0;
+    if( kind == DEVICE )
+      CHK_CUDA( cudaGetDevice( device ) );
+    *blockSize = sizeClass( bytes );
+
+    {
+      std::lock_guard<std::mutex> lock( m_mutex );
+      BlockMap::iterator it = m_blocks.find( Key( kind, *device, *blockSize ) );
+      if( it != m_blocks.end() && !it->second.empty() )
+      {
+        LruList::iterator block = it->second.back();
+        it->second.pop_back();
+        void* ptr = block->ptr;
+        m_lru.erase( block );
+        m_cachedBytes -= *blockSize;
+        return ptr;
+      }
+    }
+
+    void* ptr = 0;
+    if( kind == DEVICE )
+    {
+      CHK_CUDA( cudaMalloc( &ptr, *blockSize ) );
+    }
+    else
+    {
+      ptr = ::operator new( *blockSize );
+      if( kind == HOST_LOCKED )
+      {
+        RTPcontext context = 0;  // for CHK_PRIME; the lock belongs to no context
+        CHK_PRIME( rtpHostBufferLock( ptr, *blockSize ) ); // for improved transfer performance
+      }
+    }
+    return ptr;
+  }
+
+  void release( Kind kind, int device, size_t blockSize, void* ptr )
+  {
+    std::vector<Block> evicted;
+    {
+      std::lock_guard<std::mutex> lock( m_mutex );
+      const Key key( kind, device, blockSize );
+      m_lru.push_back( Block( key, ptr ) );
+      m_blocks[key].push_back( --m_lru.end() );
+      m_cachedBytes += blockSize;
+
+      // Evict the least recently released blocks. They are the oldest of
+      // their size class too, so they come first in its list.
+      while( m_cachedBytes > m_maxCachedBytes )
+      {
+        const Block oldest = m_lru.front();
+        std::vector<LruList::iterator>& blocks = m_blocks[oldest.key];
+        blocks.erase( blocks.begin() );
+        m_lru.pop_front();
+        m_cachedBytes -= std::get<2>( oldest.key );
+        evicted.push_back( oldest );
+      }
+    }
+
+    for( size_t i = 0; i < evicted.size(); ++i )
+      deallocate( evicted[i] );
+  }
+
+  // Limit on the bytes of released blocks kept for reuse. Lowering it takes
+  // effect on the next release.
+  void setMaxCachedBytes( size_t bytes )
+  {
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_maxCachedBytes = bytes;
+  }
+
+  void trim()
+  {
+    LruList blocks;
+    {
+      std::lock_guard<std::mutex> lock( m_mutex );
+      blocks.swap( m_lru );
+      m_blocks.clear();
+      m_cachedBytes = 0;
+    }
+    for( LruList::iterator it = blocks.begin(); it != blocks.end(); ++it )
+      deallocate( *it );
+  }
+
+private:
+  typedef std::tuple<int, int, size_t> Key; // kind, device, block size
+
+  struct Block
+  {
+    Block( const Key& k, void* p ) : key( k ), ptr( p ) {}
+    Key   key;
+    void* ptr;
+  };
+
+  typedef std::list<Block> LruList; // least recently released first
+  typedef std::map<Key, std::vector<LruList::iterator> > BlockMap;
+
+  BufferPool()
+    : m_cachedBytes( 0 ),
+      m_maxCachedBytes( size_t(256) << 20 )
+  {}
+
+  // Runs at exit. The CUDA runtime may already be shutting down, so device
+  // frees are not checked.
+  ~BufferPool()
+  {
+    for( LruList::iterator it = m_lru.begin(); it != m_lru.end(); ++it )
+      deallocate( *it, false );
+  }
+
+  // Powers of two split into four classes, so at most a quarter of a block is
+  // unused
+  static size_t sizeClass( size_t bytes )
+  {
+    const size_t minSize = 256;
+    if( bytes <= minSize )
+      return minSize;
+    size_t size = minSize;
+    while( size < bytes )
+      size <<= 1;
+    const size_t step = size / 8;
+    size_t blockSize = size / 2 + step;
+    while( blockSize < bytes )
+      blockSize += step;
+    return blockSize;
+  }
+
+  static void deallocate( const Block& block, bool checked=true )
+  {
+    const Kind kind = Kind( std::get<0>( block.key ) );
+    if( kind == DEVICE && !checked )
+    {
+      cudaSetDevice( std::get<1>( block.key ) );
+      cudaFree( block.ptr );
+    }
+    else if( kind == DEVICE )
+    {
+      int oldDevice;
+      CHK_CUDA( cudaGetDevice( &oldDevice ) );
+      CHK_CUDA( cudaSetDevice( std::get<1>( block.key ) ) );
+      CHK_CUDA( cudaFree( block.ptr ) );
+      CHK_CUDA( cudaSetDevice( oldDevice ) );
+    }
+    else
+    {
+      if( kind == HOST_LOCKED )
+        rtpHostBufferUnlock( block.ptr );
+      ::operator delete( block.ptr );
+    }
+  }
+
+  std::mutex m_mutex;
+  LruList    m_lru;
+  BlockMap   m_blocks;
+  size_t     m_cachedBytes;
+  size_t     m_maxCachedBytes;
+
+  BufferPool( const BufferPool& );            // forbidden
+  BufferPool& operator=( const BufferPool& ); // forbidden
+};
+
+
+//------------------------------------------------------------------------------
+//
+// A simple abstraction for memory to be passed into Prime via BufferDescs.
+// Memory comes from BufferPool and is kept while the buffer shrinks, so
+// reallocating to the same or a smaller size does not allocate. Elements are
+// not constructed; T must be a plain data type.
 //
 template<typename T>
 class Buffer
 {
 public:
   Buffer( size_t count=0, RTPbuffertype type=RTP_BUFFER_TYPE_HOST, PageLockedState pageLockedState=UNLOCKED ) 
-    : m_ptr( 0 ),
+    : m_type( type ),
+      m_ptr( 0 ),
+      m_device( 0 ),
+      m_count( 0 ),
+      m_blockSize( 0 ),
       m_pageLockedState( pageLockedState )
   {
     alloc( count, type, pageLockedState );
   }
 
+  Buffer( Buffer<T>&& other ) noexcept
+    : m_type( other.m_type ),
+      m_ptr( other.m_ptr ),
+      m_device( other.m_device ),
+      m_count( other.m_count ),
+      m_blockSize( other.m_blockSize ),
+      m_pageLockedState( other.m_pageLockedState ),
+      m_tempHost( std::move( other.m_tempHost ) )
+  {
+    other.m_ptr = 0;
+    other.m_count = 0;
+    other.m_blockSize = 0;
+  }
+
+  Buffer<T>& operator=( Buffer<T>&& other ) noexcept
+  {
+    if( this != &other )
+    {
+      free();
+      m_type = other.m_type;
+      m_ptr = other.m_ptr;
+      m_device = other.m_device;
+      m_count = other.m_count;
+      m_blockSize = other.m_blockSize;
+      m_pageLockedState = other.m_pageLockedState;
+      m_tempHost = std::move( other.m_tempHost );
+      other.m_ptr = 0;
+      other.m_count = 0;
+      other.m_blockSize = 0;
+    }
+    return *this;
+  }
+
   // Allocate without changing type
   void alloc( size_t count )
   {
     alloc( count, m_type, m_pageLockedState );
   }
 
+  // Set the element count. The contents are undefined afterwards.
   void alloc( size_t count, RTPbuffertype type, PageLockedState pageLockedState=UNLOCKED )
   {
-    if( m_ptr )
+    if( m_ptr && !blockFits( count, type, pageLockedState ) )
       free();
 
     m_type = type;
+    if( m_type == RTP_BUFFER_TYPE_HOST )
+      m_pageLockedState = pageLockedState;
     m_count = count;
-    if( m_count > 0 ) 
+    if( m_count > capacity() )
+      acquireBlock( m_count );
+  }
+
+  // Set the element count, keeping the first min(count, count()) elements
+  void resize( size_t count )
+  {
+    if( count > capacity() )
     {
-      if( m_type == RTP_BUFFER_TYPE_HOST )
-      {
-        m_ptr = new T[m_count];
-        if( pageLockedState )
-          rtpHostBufferLock( m_ptr, sizeInBytes() ); // for improved transfer performance
-        m_pageLockedState = pageLockedState;
-      }
-      else
+      T* oldPtr = m_ptr;
+      const int oldDevice = m_device;
+      const size_t oldBlockSize = m_blockSize;
+
+      acquireBlock( count );
+      if( oldPtr )
       {
-        CHK_CUDA( cudaGetDevice( &m_device ) );
-        CHK_CUDA( cudaMalloc( &m_ptr, sizeInBytes() ) );
+        if( m_type == RTP_BUFFER_TYPE_HOST )
+          memcpy( m_ptr, oldPtr, sizeInBytes() );
+        else
+          CHK_CUDA( cudaMemcpy( m_ptr, oldPtr, sizeInBytes(), cudaMemcpyDeviceToDevice ) );
+        BufferPool::instance().release( kind(), oldDevice, oldBlockSize, oldPtr );
       }
     }
+    m_count = count;
   }
 
   void free()
   {
-    if( m_ptr && m_type == RTP_BUFFER_TYPE_HOST )
-    {
-      if( m_pageLockedState )
-        rtpHostBufferUnlock( m_ptr );
-      delete[] m_ptr;
-    }
-    else 
-    {
-      int oldDevice;
-      CHK_CUDA( cudaGetDevice( &oldDevice ) );
-      CHK_CUDA( cudaSetDevice( m_device ) );
-      CHK_CUDA( cudaFree( m_ptr ) );
-      CHK_CUDA( cudaSetDevice( oldDevice ) );
-    }
+    if( m_ptr )
+      BufferPool::instance().release( kind(), m_device, m_blockSize, m_ptr );
 
     m_ptr = 0;
     m_count = 0;
+    m_blockSize = 0;
   }
 
   ~Buffer()
@@ -114,11 +352,13 @@ public:
   }
 
   size_t count()       const { return m_count; }
+  size_t capacity()    const { return m_blockSize / sizeof(T); }
   size_t sizeInBytes() const { return m_count * sizeof(T); }
   const T* ptr()       const { return m_ptr; }
   T* ptr()                   { return m_ptr; }
   RTPbuffertype type() const { return m_type; }
 
+  // Host copy of the contents, made on each call for device buffers
   const T* hostPtr() 
   {
     if( m_type == RTP_BUFFER_TYPE_HOST )
@@ -129,11 +369,44 @@ public:
     return &m_tempHost[0];
   }
 
+  // The contents of a host buffer without a copy; 0 for device buffers
+  const T* hostView() const
+  {
+    return m_type == RTP_BUFFER_TYPE_HOST ? m_ptr : 0;
+  }
+
 protected:
+  BufferPool::Kind kind() const
+  {
+    if( m_type != RTP_BUFFER_TYPE_HOST )
+      return BufferPool::DEVICE;
+    return m_pageLockedState ? BufferPool::HOST_LOCKED : BufferPool::HOST;
+  }
+
+  // Whether the current block can hold count elements of the given type
+  bool blockFits( size_t count, RTPbuffertype type, PageLockedState pageLockedState ) const
+  {
+    if( type != m_type || count > capacity() )
+      return false;
+    if( type == RTP_BUFFER_TYPE_HOST )
+      return pageLockedState == m_pageLockedState;
+
+    int device;
+    CHK_CUDA( cudaGetDevice( &device ) );
+    return device == m_device;
+  }
+
+  // Replace the block by one that holds count elements; the old block is not released
+  void acquireBlock( size_t count )
+  {
+    m_ptr = static_cast<T*>( BufferPool::instance().acquire( kind(), count * sizeof(T), &m_device, &m_blockSize ) );
+  }
+
   RTPbuffertype m_type;
   T* m_ptr;
   int m_device;
   size_t m_count;
+  size_t m_blockSize;
   PageLockedState m_pageLockedState;
   std::vector<T> m_tempHost;
   
@@ -141,4 +414,3 @@ private:
   Buffer<T>( const Buffer<T>& );            // forbidden
   Buffer<T>& operator=( const Buffer<T>& ); // forbidden
 };
-
@@ -0,0 +1,289 @@
+/* 
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ChromeTrace.h"
+
+#include <sutil.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+using namespace optix;
+
+namespace sutil
+{
+
+namespace
+{
+
+struct TraceEvent
+{
+    const char* name;
+    std::string detail;
+    double      begin;   // Seconds since the trace started
+    double      end;
+};
+
+
+// Zones of one thread.  Only the owning thread appends; chunks are never
+// moved once allocated and each chunk publishes its event count with
+// release semantics, so a writer on another thread sees complete events.
+class ThreadTrace
+{
+public:
+    static const unsigned CHUNK_SIZE = 1024;
+
+    struct Chunk
+    {
+        TraceEvent            events[CHUNK_SIZE];
+        std::atomic<unsigned> count;
+        std::atomic<Chunk*>   next;
+
+        Chunk() : count( 0 ), next( 0 ) {}
+    };
+
+    explicit ThreadTrace( unsigned id ) : m_id( id ), m_tail( &m_first ) {}
+
+    ~ThreadTrace()
+    {
+        Chunk* chunk = m_first.next.load();
+        while( chunk )
+        {
+            Chunk* next = chunk->next.load();
+            delete chunk;
+            chunk = next;
+        }
+    }
+
+    void append( const char* name, const std::string& detail, double begin, double end )
+    {
+        unsigned count = m_tail->count.load( std::memory_order_relaxed );
+        if( count == CHUNK_SIZE )
+        {
+            Chunk* chunk = new Chunk();
+            m_tail->next.store( chunk, std::memory_order_release );
+            m_tail = chunk;
+            count  = 0;
+        }
+        TraceEvent& event = m_tail->events[count];
+        event.name   = name;
+        event.detail = detail;
+        event.begin  = begin;
+        event.end    = end;
+        m_tail->count.store( count + 1, std::memory_order_release );
+    }
+
+    unsigned     id() const    { return m_id; }
+    const Chunk* first() const { return &m_first; }
+
+private:
+    unsigned m_id;
+    Chunk    m_first;
+    Chunk*   m_tail;
+};
+
+
+class TraceRecorder
+{
+public:
+    TraceRecorder()
+        : m_enabled( false ),
+          m_start( currentTime() )
+    {
+        const char* filename = getenv( "SUTIL_TRACE" );
+        if( filename && *filename )
+            begin( filename );
+    }
+
+    ~TraceRecorder()
+    {
+        if( m_enabled )
+            write();
+        for( size_t i = 0; i < m_threads.size(); ++i )
+            delete m_threads[i];
+    }
+
+    void begin( const std::string& filename )
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        m_filename = filename;
+        m_enabled.store( true );
+    }
+
+    bool enabled() const { return m_enabled.load( std::memory_order_relaxed ); }
+
+    double now() const { return currentTime() - m_start; }
+
+    // The calling thread's buffer; the registry lock is only taken the
+    // first time a thread records a zone.
+    ThreadTrace& threadTrace()
+    {
+        static thread_local ThreadTrace* trace = 0;
+        if( !trace )
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            trace = new ThreadTrace( static_cast<unsigned>( m_threads.size() ) );
+            m_threads.push_back( trace );
+        }
+        return *trace;
+    }
+
+    void write();
+
+private:
+    std::atomic<bool>         m_enabled;
+    double                    m_start;
+    std::string               m_filename;
+    std::mutex                m_mutex;
+    std::vector<ThreadTrace*> m_threads;
+};
+
+
+TraceRecorder& recorder()
+{
+    static TraceRecorder recorder;
+    return recorder;
+}
+
+
+void writeJsonString( std::ostream& out, const std::string& s )
+{
+    out << '"';
+    for( std::string::const_iterator it = s.begin(); it != s.end(); ++it )
+    {
+        const unsigned char c = static_cast<unsigned char>( *it );
+        if( c == '"' || c == '\\' )
+            out << '\\' << *it;
+        else if( c < 0x20 )
+        {
+            char escaped[8];
+            sprintf( escaped, "\\u%04x", c );
+            out << escaped;
+        }
+        else
+            out << *it;
+    }
+    out << '"';
+}
+
+
+void TraceRecorder::write()
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_enabled.store( false );
+
+    std::ofstream out( m_filename.c_str() );
+    if( !out )
+    {
+        std::cerr << "Could not open trace file '" << m_filename << "'" << std::endl;
+        return;
+    }
+
+    // Complete ("X") events with microsecond timestamps
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first_event = true;
+    for( size_t t = 0; t < m_threads.size(); ++t )
+    {
+        for( const ThreadTrace::Chunk* chunk = m_threads[t]->first(); chunk;
+             chunk = chunk->next.load( std::memory_order_acquire ) )
+        {
+            const unsigned count = chunk->count.load( std::memory_order_acquire );
+            for( unsigned i = 0; i < count; ++i )
+            {
+                const TraceEvent& event = chunk->events[i];
+                out << ( first_event ? "\n" : ",\n" );
+                out << "{\"name\":";
+                writeJsonString( out, event.name );
+                out << ",\"cat\":\"sutil\",\"ph\":\"X\",\"pid\":0,\"tid\":" << m_threads[t]->id()
+                    << ",\"ts\":" << static_cast<long long>( event.begin * 1.0e6 )
+                    << ",\"dur\":" << static_cast<long long>( ( event.end - event.begin ) * 1.0e6 );
+                if( !event.detail.empty() )
+                {
+                    out << ",\"args\":{\"detail\":";
+                    writeJsonString( out, event.detail );
+                    out << "}";
+                }
+                out << "}";
+                first_event = false;
+            }
+        }
+    }
+    out << "\n]}\n";
+}
+
+} // namespace
+
+
+void beginTrace( const std::string& filename )
+{
+    recorder().begin( filename );
+}
+
+
+void endTrace()
+{
+    if( recorder().enabled() )
+        recorder().write();
+}
+
+
+bool traceEnabled()
+{
+    return recorder().enabled();
+}
+
+
+TraceZone::TraceZone( const char* name )
+    : m_name( name ),
+      m_begin( recorder().enabled() ? recorder().now() : -1.0 )
+{
+}
+
+
+TraceZone::TraceZone( const char* name, const std::string& detail )
+    : m_name( name ),
+      m_begin( recorder().enabled() ? recorder().now() : -1.0 )
+{
+    if( m_begin >= 0.0 )
+        m_detail = detail;
+}
+
+
+TraceZone::~TraceZone()
+{
+    TraceRecorder& r = recorder();
+    if( m_begin >= 0.0 && r.enabled() )
+        r.threadTrace().append( m_name, m_detail, m_begin, r.now() );
+}
+
+} // namespace sutil
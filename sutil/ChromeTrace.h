@@ -0,0 +1,80 @@
+/* 
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <sutilapi.h>
+
+#include <string>
+
+//-----------------------------------------------------------------------------
+//
+// Chrome trace recorder for host-side phases such as PTX compilation, mesh
+// and image loading and scene setup.  Zones are recorded per thread without
+// locking and written as trace_event JSON, viewable in chrome://tracing or
+// Perfetto.
+//
+// Recording is off unless beginTrace is called or the SUTIL_TRACE
+// environment variable names an output file.  The file is written by
+// endTrace, or at exit if endTrace was not called.
+//
+//-----------------------------------------------------------------------------
+
+namespace sutil
+{
+
+// Starts recording zones; they are written to filename.
+SUTILAPI void beginTrace( const std::string& filename );
+
+// Writes every zone recorded so far and stops recording.  Zones still open
+// on other threads are not included.
+SUTILAPI void endTrace();
+
+SUTILAPI bool traceEnabled();
+
+
+// Records the lifetime of the scope as a zone on the calling thread.  Zones
+// nest by time.  name is not copied and should be a string literal; detail
+// is shown as an argument of the zone, e.g. the file being loaded.
+class TraceZone
+{
+public:
+    SUTILAPI explicit TraceZone( const char* name );
+    SUTILAPI TraceZone( const char* name, const std::string& detail );
+    SUTILAPI ~TraceZone();
+
+private:
+    TraceZone( const TraceZone& );
+    TraceZone& operator=( const TraceZone& );
+
+    const char* m_name;
+    std::string m_detail;
+    double      m_begin;    // Negative if recording was off at construction
+};
+
+} // namespace sutil
@@ -0,0 +1,153 @@
+/* 
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "DynamicResolution.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+namespace sutil
+{
+
+namespace
+{
+
+const float SCALE_STEP = 1.0f / 16.0f;
+
+// Consecutive frames outside the hysteresis band before the scale changes
+const int TREND_FRAMES = 3;
+
+// Weight of the newest frame in the smoothed frame time
+const double AVERAGE_WEIGHT = 0.25;
+
+} // namespace
+
+
+DynamicResolution::DynamicResolution( float budget_ms, float min_scale, float hysteresis, unsigned settle_frames )
+    : m_budget_ms( budget_ms ),
+      m_min_scale( std::min( std::max( min_scale, SCALE_STEP ), 1.0f ) ),
+      m_hysteresis( hysteresis ),
+      m_settle_frames( std::max( settle_frames, 1u ) ),
+      m_window_width( 1u ),
+      m_window_height( 1u ),
+      m_width( 1u ),
+      m_height( 1u ),
+      m_scale( 1.0f ),
+      m_motion_scale( 1.0f ),
+      m_average_ms( 0.0 ),
+      m_trend( 0 ),
+      m_still_frames( 0u ),
+      m_discard_next( false )
+{
+}
+
+
+void DynamicResolution::setWindowSize( unsigned width, unsigned height )
+{
+    m_window_width  = width;
+    m_window_height = height;
+    updateSize();
+}
+
+
+bool DynamicResolution::update( double frame_ms, bool camera_moving )
+{
+    if( !camera_moving )
+    {
+        m_trend = 0;
+        if( m_still_frames < m_settle_frames )
+            ++m_still_frames;
+        if( m_still_frames < m_settle_frames )
+            return false;
+        return setScale( 1.0f );
+    }
+
+    // Resume at the scale that fit the budget during the previous move
+    // instead of measuring a full resolution frame again.
+    const bool was_settled = m_still_frames >= m_settle_frames;
+    m_still_frames = 0;
+    if( was_settled && m_motion_scale < m_scale )
+        return setScale( m_motion_scale );
+
+    if( m_discard_next )
+    {
+        m_discard_next = false;
+        return false;
+    }
+
+    m_average_ms = m_average_ms > 0.0 ? m_average_ms + AVERAGE_WEIGHT * ( frame_ms - m_average_ms ) : frame_ms;
+
+    if( m_average_ms > m_budget_ms * ( 1.0f + m_hysteresis ) )
+        m_trend = std::max( m_trend, 0 ) + 1;
+    else if( m_average_ms < m_budget_ms * ( 1.0f - m_hysteresis ) )
+        m_trend = std::min( m_trend, 0 ) - 1;
+    else
+        m_trend = 0;
+
+    if( std::abs( m_trend ) < TREND_FRAMES )
+        return false;
+
+    // Pixel count, and so frame time, goes with the square of the scale
+    const float ideal = m_scale * static_cast<float>( std::sqrt( m_budget_ms / std::max( m_average_ms, 1.e-3 ) ) );
+    float next = std::floor( ideal / SCALE_STEP + 1.e-3f ) * SCALE_STEP;
+    if( m_trend > 0 )
+        next = std::min( next, m_scale - SCALE_STEP );
+    else
+        next = std::max( next, m_scale + SCALE_STEP );
+    next = std::min( std::max( next, m_min_scale ), 1.0f );
+
+    m_motion_scale = next;
+    return setScale( next );
+}
+
+
+bool DynamicResolution::setScale( float scale )
+{
+    m_trend = 0;
+    if( scale == m_scale )
+        return false;
+
+    m_scale        = scale;
+    m_average_ms   = 0.0;
+    m_discard_next = true;
+
+    const unsigned old_width  = m_width;
+    const unsigned old_height = m_height;
+    updateSize();
+    return m_width != old_width || m_height != old_height;
+}
+
+
+void DynamicResolution::updateSize()
+{
+    m_width  = std::max( 1u, static_cast<unsigned>( m_window_width * m_scale + 0.5f ) );
+    m_height = std::max( 1u, static_cast<unsigned>( m_window_height * m_scale + 0.5f ) );
+}
+
+} // namespace sutil
@@ -0,0 +1,99 @@
+/* 
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <sutilapi.h>
+
+//-----------------------------------------------------------------------------
+//
+// Dynamic resolution: picks the launch size of an interactive sample from a
+// frame time budget.  While the camera moves, the launch is scaled down
+// until frames fit the budget and upsampled for display (displayBufferGL
+// filters linearly when the buffer is smaller than the viewport).  Once the
+// camera has been still for a few frames the controller returns to full
+// resolution so accumulation converges to the reference image.
+//
+// Render time is assumed to be proportional to the pixel count, so a scale
+// s costs about s^2 of the full resolution frame.  Changes are quantized to
+// steps of 1/16 and only made after several frames outside the hysteresis
+// band, which keeps buffers from being resized every frame.
+//
+//-----------------------------------------------------------------------------
+
+namespace sutil
+{
+
+class DynamicResolution
+{
+public:
+    // budget_ms: target frame time while the camera moves.
+    // hysteresis: relative band around the budget that does not trigger a
+    //   change, e.g. 0.15 for [0.85, 1.15] * budget.
+    // settle_frames: still frames before returning to full resolution.
+    SUTILAPI DynamicResolution( float    budget_ms,
+                                float    min_scale     = 0.25f,
+                                float    hysteresis    = 0.15f,
+                                unsigned settle_frames = 8u );
+
+    // Sets the full resolution, normally the window size.
+    SUTILAPI void setWindowSize( unsigned width, unsigned height );
+
+    // Feeds the time of the last frame and whether the camera moved since.
+    // Returns true if the launch size changed; the caller then resizes its
+    // buffers to width() x height().
+    SUTILAPI bool update( double frame_ms, bool camera_moving );
+
+    // Scale applied to both window dimensions
+    SUTILAPI float    scale()  const { return m_scale; }
+    SUTILAPI unsigned width()  const { return m_width; }
+    SUTILAPI unsigned height() const { return m_height; }
+
+private:
+    bool setScale( float scale );
+    void updateSize();
+
+    float    m_budget_ms;
+    float    m_min_scale;
+    float    m_hysteresis;
+    unsigned m_settle_frames;
+
+    unsigned m_window_width;
+    unsigned m_window_height;
+    unsigned m_width;
+    unsigned m_height;
+
+    float    m_scale;
+    float    m_motion_scale;   // Last scale used while moving, restored on the next move
+    double   m_average_ms;     // Smoothed frame time at the current scale, 0 if unknown
+    int      m_trend;          // Consecutive frames over (> 0) or under (< 0) budget
+    unsigned m_still_frames;
+    bool     m_discard_next;   // The first frame after a resize includes reallocation
+};
+
+} // namespace sutil
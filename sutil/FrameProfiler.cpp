@@ -0,0 +1,204 @@
+/* 
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "FrameProfiler.h"
+
+#include <sutil.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+
+namespace sutil
+{
+
+namespace
+{
+
+bool hasSuffix( const std::string& s, const std::string& suffix )
+{
+    return s.size() >= suffix.size() && s.compare( s.size() - suffix.size(), suffix.size(), suffix ) == 0;
+}
+
+} // namespace
+
+
+FrameProfiler::FrameProfiler()
+    : m_frame_count( 0 ),
+      m_last_frame_time( currentTime() ),
+      m_export_json( false )
+{
+    std::fill( m_current.stage_ms, m_current.stage_ms + FRAME_STAGE_COUNT, 0.0f );
+    m_current.frame_ms = 0.0f;
+    m_history.reserve( HISTORY_SIZE );
+
+    const char* export_file = getenv( "SUTIL_FRAME_STATS" );
+    if( !export_file || !*export_file )
+        return;
+
+    m_export.open( export_file );
+    if( !m_export )
+    {
+        std::cerr << "FrameProfiler: could not open '" << export_file << "' for writing" << std::endl;
+        return;
+    }
+    m_export_json = hasSuffix( export_file, ".json" );
+    if( m_export_json )
+    {
+        m_export << "{\n  \"frames\": [";
+    }
+    else
+    {
+        m_export << "frame,frame_ms";
+        for( int s = 0; s < FRAME_STAGE_COUNT; ++s )
+            m_export << "," << stageName( static_cast<FrameStage>( s ) ) << "_ms";
+        m_export << "\n";
+    }
+}
+
+
+FrameProfiler::~FrameProfiler()
+{
+    if( !m_export.is_open() || !m_export_json )
+        return;
+
+    // Percentiles of the frames still in the ring buffer
+    m_export << "\n  ],\n  \"percentiles_ms\": {\n";
+    for( int s = 0; s <= FRAME_STAGE_COUNT; ++s )
+    {
+        const FrameStage stage = static_cast<FrameStage>( s );
+        m_export << "    \"" << ( s == FRAME_STAGE_COUNT ? "frame" : stageName( stage ) ) << "\": { "
+                 << "\"p50\": " << percentile( stage, 50.0 ) << ", "
+                 << "\"p95\": " << percentile( stage, 95.0 ) << ", "
+                 << "\"p99\": " << percentile( stage, 99.0 ) << " }"
+                 << ( s < FRAME_STAGE_COUNT ? ",\n" : "\n" );
+    }
+    m_export << "  }\n}\n";
+}
+
+
+FrameProfiler& FrameProfiler::instance()
+{
+    static FrameProfiler profiler;
+    return profiler;
+}
+
+
+void FrameProfiler::addTime( FrameStage stage, double seconds )
+{
+    m_current.stage_ms[stage] += static_cast<float>( seconds * 1000.0 );
+}
+
+
+void FrameProfiler::endFrame()
+{
+    const double now = currentTime();
+    m_current.frame_ms = static_cast<float>( ( now - m_last_frame_time ) * 1000.0 );
+    m_last_frame_time = now;
+
+    // The first frame's interval starts at construction, not at a frame
+    if( m_frame_count > 0 )
+    {
+        if( m_history.size() < HISTORY_SIZE )
+            m_history.push_back( m_current );
+        else
+            m_history[( m_frame_count - 1 ) % HISTORY_SIZE] = m_current;  // frame 0 is not recorded
+        if( m_export.is_open() )
+            writeFrame( m_current );
+    }
+    ++m_frame_count;
+
+    std::fill( m_current.stage_ms, m_current.stage_ms + FRAME_STAGE_COUNT, 0.0f );
+}
+
+
+double FrameProfiler::percentile( FrameStage stage, double p ) const
+{
+    if( m_history.empty() )
+        return 0.0;
+
+    std::vector<float> values( m_history.size() );
+    for( size_t i = 0; i < m_history.size(); ++i )
+        values[i] = stage == FRAME_STAGE_COUNT ? m_history[i].frame_ms : m_history[i].stage_ms[stage];
+
+    const double clamped = std::min( std::max( p, 0.0 ), 100.0 );
+    const size_t rank = static_cast<size_t>( clamped / 100.0 * ( values.size() - 1 ) + 0.5 );
+    std::nth_element( values.begin(), values.begin() + rank, values.end() );
+    return values[rank];
+}
+
+
+void FrameProfiler::writeFrame( const Frame& frame )
+{
+    if( m_export_json )
+    {
+        m_export << ( m_frame_count > 1 ? ",\n" : "\n" )
+                 << "    { \"frame\": " << m_frame_count << ", \"frame_ms\": " << frame.frame_ms;
+        for( int s = 0; s < FRAME_STAGE_COUNT; ++s )
+            m_export << ", \"" << stageName( static_cast<FrameStage>( s ) ) << "_ms\": " << frame.stage_ms[s];
+        m_export << " }";
+    }
+    else
+    {
+        m_export << m_frame_count << "," << frame.frame_ms;
+        for( int s = 0; s < FRAME_STAGE_COUNT; ++s )
+            m_export << "," << frame.stage_ms[s];
+        m_export << "\n";
+    }
+}
+
+
+const char* FrameProfiler::stageName( FrameStage stage )
+{
+    switch( stage )
+    {
+        case FRAME_STAGE_LAUNCH:      return "launch";
+        case FRAME_STAGE_POSTPROCESS: return "postprocess";
+        case FRAME_STAGE_MAP:         return "map";
+        case FRAME_STAGE_UPLOAD:      return "upload";
+        case FRAME_STAGE_DISPLAY:     return "display";
+        case FRAME_STAGE_SWAP:        return "swap";
+        default:                      return "frame";
+    }
+}
+
+
+FrameTimer::FrameTimer( FrameStage stage )
+    : m_stage( stage ),
+      m_start( currentTime() )
+{
+}
+
+
+FrameTimer::~FrameTimer()
+{
+    FrameProfiler::instance().addTime( m_stage, currentTime() - m_start );
+}
+
+} // namespace sutil
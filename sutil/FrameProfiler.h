@@ -0,0 +1,127 @@
+/* 
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <sutilapi.h>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+//-----------------------------------------------------------------------------
+//
+// Frame profiler: per-stage host timings of the interactive samples, kept
+// in a ring buffer of recent frames for percentile statistics.
+//
+// Samples feed it through sutil::displayFrameStats, which closes the frame
+// and draws the breakdown, and through FrameTimer scopes around launches
+// and postprocessing.  displayBufferGL times its own map/unmap, GL upload
+// and draw, and sutil::swapBuffers the buffer swap.  If SUTIL_FRAME_STATS
+// names a file, every frame is streamed there as it ends, as JSON if the
+// name ends in .json and CSV otherwise.
+//
+// OptiX launches block until the kernel has finished, so host timers around
+// context->launch measure GPU time as well.
+//
+//-----------------------------------------------------------------------------
+
+namespace sutil
+{
+
+enum FrameStage
+{
+    FRAME_STAGE_LAUNCH = 0,
+    FRAME_STAGE_POSTPROCESS,
+    FRAME_STAGE_MAP,          // Buffer map and unmap of the output buffer
+    FRAME_STAGE_UPLOAD,       // glTexImage2D from the PBO or mapped pointer
+    FRAME_STAGE_DISPLAY,      // Drawing the textured quad
+    FRAME_STAGE_SWAP,         // glutSwapBuffers, which follows displayFrameStats
+                              // and so counts toward the next frame
+    FRAME_STAGE_COUNT
+};
+
+
+class FrameProfiler
+{
+public:
+    // Number of frames kept for the percentiles
+    static const unsigned HISTORY_SIZE = 512;
+
+    SUTILAPI static FrameProfiler& instance();
+
+    // Adds time to a stage of the current frame.  A stage may be timed
+    // several times per frame; the durations add up.
+    SUTILAPI void addTime( FrameStage stage, double seconds );
+
+    // Closes the current frame.  Its total time is the interval since the
+    // previous call.
+    SUTILAPI void endFrame();
+
+    // Percentile p in [0,100] of a stage over the ring buffer, in
+    // milliseconds.  Pass FRAME_STAGE_COUNT for the whole frame.
+    SUTILAPI double percentile( FrameStage stage, double p ) const;
+
+    SUTILAPI unsigned frameCount() const { return m_frame_count; }
+
+    SUTILAPI static const char* stageName( FrameStage stage );
+
+private:
+    FrameProfiler();
+    ~FrameProfiler();   // Finishes SUTIL_FRAME_STATS
+
+    struct Frame
+    {
+        float stage_ms[FRAME_STAGE_COUNT];
+        float frame_ms;
+    };
+
+    void writeFrame( const Frame& frame );
+
+    Frame               m_current;
+    std::vector<Frame>  m_history;      // Ring buffer of the last HISTORY_SIZE frames
+    unsigned            m_frame_count;
+    double              m_last_frame_time;
+    std::ofstream       m_export;       // SUTIL_FRAME_STATS, if open
+    bool                m_export_json;
+};
+
+
+// Adds the lifetime of the scope to a stage of the current frame.
+class FrameTimer
+{
+public:
+    SUTILAPI explicit FrameTimer( FrameStage stage );
+    SUTILAPI ~FrameTimer();
+
+private:
+    FrameStage m_stage;
+    double     m_start;
+};
+
+} // namespace sutil
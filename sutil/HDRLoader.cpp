@@ -27,6 +27,7 @@
  */
 
 #include "HDRLoader.h"
+#include "ChromeTrace.h"
 
 #include <math.h>
 #include <fstream>
@@ -135,6 +136,7 @@ namespace {
 HDRLoader::HDRLoader( const std::string& filename )
 : m_nx( 0u ), m_ny( 0u ), m_raster( 0 )
 {
+  sutil::TraceZone zone( "HDRLoader", filename );
   if ( filename.empty() ) return;
 
   // Open file
@@ -234,6 +236,8 @@ optix::TextureSampler loadHDRTexture( optix::Context context,
                                       const std::string& filename,
                                       const optix::float3& default_color )
 {
+  sutil::TraceZone zone( "loadHDRTexture", filename );
+
   // Create tex sampler and populate with default values
   optix::TextureSampler sampler = context->createTextureSampler();
   sampler->setWrapMode( 0, RT_WRAP_REPEAT );
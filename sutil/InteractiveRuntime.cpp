@@ -0,0 +1,147 @@
+/* 
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "InteractiveRuntime.h"
+
+#include <cstring>
+
+using namespace optix;
+
+namespace sutil
+{
+
+InteractiveRuntime::InteractiveRuntime( RenderFunction render, InputHandler input, OutputFunction output )
+    : m_render( render ),
+      m_input( input ),
+      m_output( output ),
+      m_back( 0 ),
+      m_front( 1 ),
+      m_ready( 2 ),
+      m_running( false ),
+      m_rendered_frames( 0 )
+{
+}
+
+
+InteractiveRuntime::~InteractiveRuntime()
+{
+    stop();
+}
+
+
+void InteractiveRuntime::start()
+{
+    if( m_running )
+        return;
+    m_running = true;
+    m_thread = std::thread( &InteractiveRuntime::run, this );
+}
+
+
+void InteractiveRuntime::stop()
+{
+    m_running = false;
+    if( m_thread.joinable() )
+        m_thread.join();
+}
+
+
+bool InteractiveRuntime::postInput( const InputEvent& event )
+{
+    return m_input_queue.push( event );
+}
+
+
+bool InteractiveRuntime::present( bufferPixelFormat format, bool disable_srgb_conversion )
+{
+    {
+        std::lock_guard<std::mutex> lock( m_error_mutex );
+        if( !m_error.empty() )
+            throw Exception( m_error );
+    }
+
+    // Swap the presented frame with the last completed one if that is new
+    bool is_new = false;
+    if( m_ready.load( std::memory_order_relaxed ) & READY_NEW )
+    {
+        m_front = m_ready.exchange( m_front, std::memory_order_acq_rel ) & ~READY_NEW;
+        is_new  = true;
+    }
+
+    const Frame& frame = m_frames[m_front];
+    if( frame.width == 0 || frame.height == 0 )
+        return false;
+    displayImageGL( &frame.pixels[0], frame.width, frame.height, frame.format, format, disable_srgb_conversion );
+    return is_new;
+}
+
+
+void InteractiveRuntime::copyOutput( Frame& frame )
+{
+    Buffer buffer = m_output();
+
+    RTsize width, height;
+    buffer->getSize( width, height );
+    const size_t size = width * height * buffer->getElementSize();
+
+    frame.width  = static_cast<unsigned>( width );
+    frame.height = static_cast<unsigned>( height );
+    frame.format = buffer->getFormat();
+    frame.pixels.resize( size );
+    memcpy( &frame.pixels[0], buffer->map( 0, RT_BUFFER_MAP_READ ), size );
+    buffer->unmap();
+}
+
+
+void InteractiveRuntime::run()
+{
+    try
+    {
+        while( m_running )
+        {
+            InputEvent event;
+            while( m_input_queue.pop( event ) )
+                m_input( event );
+
+            m_render();
+            copyOutput( m_frames[m_back] );
+
+            // Publish the frame and take over the one it replaces
+            m_back = m_ready.exchange( m_back | READY_NEW, std::memory_order_acq_rel ) & ~READY_NEW;
+            ++m_rendered_frames;
+        }
+    }
+    catch( const std::exception& e )
+    {
+        std::lock_guard<std::mutex> lock( m_error_mutex );
+        m_error   = e.what();
+        m_running = false;
+    }
+}
+
+} // namespace sutil
@@ -0,0 +1,186 @@
+/* 
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <optixu/optixpp_namespace.h>
+#include <sutil.h>
+#include <sutilapi.h>
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//-----------------------------------------------------------------------------
+//
+// Interactive runtime: decouples rendering from presentation for the GLUT
+// samples.  A render thread owns the OptiX context and launches continuously.
+// After each launch it copies the output buffer into one of three host
+// frames.  The GLUT thread presents whichever frame completed last and never
+// waits for a launch.  Input events travel from the GLUT callbacks to the
+// render thread through a lock-free queue and are applied between launches.
+//
+// Once start() has been called, only the render thread may use the context.
+// The output buffer should therefore not be a GL interop (PBO) buffer.
+//
+//-----------------------------------------------------------------------------
+
+namespace sutil
+{
+
+struct InputEvent
+{
+    enum Type
+    {
+        KEY,
+        MOUSE_BUTTON,
+        MOUSE_MOTION,
+        RESIZE,
+    };
+
+    Type type;
+    int  code;      // Key for KEY, GLUT button for MOUSE_BUTTON
+    int  state;     // GLUT_DOWN or GLUT_UP for MOUSE_BUTTON
+    int  x;         // Mouse position, or the new window size for RESIZE
+    int  y;
+};
+
+
+// Bounded queue for exactly one producer thread and one consumer thread.
+template <typename T, unsigned N>
+class SpscQueue
+{
+public:
+    SpscQueue() : m_head( 0 ), m_tail( 0 ) {}
+
+    // Producer side.  Returns false if the queue is full.
+    bool push( const T& item )
+    {
+        const unsigned tail = m_tail.load( std::memory_order_relaxed );
+        const unsigned next = ( tail + 1 ) % N;
+        if( next == m_head.load( std::memory_order_acquire ) )
+            return false;
+        m_items[tail] = item;
+        m_tail.store( next, std::memory_order_release );
+        return true;
+    }
+
+    // Consumer side.  Returns false if the queue is empty.
+    bool pop( T& item )
+    {
+        const unsigned head = m_head.load( std::memory_order_relaxed );
+        if( head == m_tail.load( std::memory_order_acquire ) )
+            return false;
+        item = m_items[head];
+        m_head.store( ( head + 1 ) % N, std::memory_order_release );
+        return true;
+    }
+
+private:
+    T                     m_items[N];
+    std::atomic<unsigned> m_head;
+    std::atomic<unsigned> m_tail;
+};
+
+
+class InteractiveRuntime
+{
+public:
+    // Launches one frame.  Runs on the render thread.
+    typedef std::function<void()> RenderFunction;
+
+    // Applies one input event.  Runs on the render thread between launches.
+    typedef std::function<void( const InputEvent& )> InputHandler;
+
+    // Returns the buffer to present after a launch.  Runs on the render thread.
+    typedef std::function<optix::Buffer()> OutputFunction;
+
+    SUTILAPI InteractiveRuntime( RenderFunction render, InputHandler input, OutputFunction output );
+
+    // Stops the render thread.
+    SUTILAPI ~InteractiveRuntime();
+
+    SUTILAPI void start();
+
+    // Waits for the frame in flight to finish.  The context may be used by
+    // the calling thread afterwards.
+    SUTILAPI void stop();
+
+    // GLUT thread.  Returns false if the queue is full and the event was
+    // dropped.
+    SUTILAPI bool postInput( const InputEvent& event );
+
+    // GLUT thread.  Draws the most recently completed frame with
+    // displayImageGL and returns true if it had not been presented before.
+    // Rethrows an error raised on the render thread.
+    SUTILAPI bool present( bufferPixelFormat format = BUFFER_PIXEL_FORMAT_DEFAULT,
+                           bool disable_srgb_conversion = false );
+
+    // Number of frames completed by the render thread.
+    SUTILAPI unsigned long long renderedFrames() const { return m_rendered_frames.load(); }
+
+private:
+    struct Frame
+    {
+        std::vector<unsigned char> pixels;
+        unsigned                   width;
+        unsigned                   height;
+        RTformat                   format;
+
+        Frame() : width( 0 ), height( 0 ), format( RT_FORMAT_UNSIGNED_BYTE4 ) {}
+    };
+
+    // m_ready holds the index of the last completed frame, plus READY_NEW
+    // until the GLUT thread picks it up.
+    static const unsigned READY_NEW = 4u;
+
+    void run();
+    void copyOutput( Frame& frame );
+
+    RenderFunction                  m_render;
+    InputHandler                    m_input;
+    OutputFunction                  m_output;
+
+    Frame                           m_frames[3];
+    unsigned                        m_back;      // Written by the render thread
+    unsigned                        m_front;     // Presented by the GLUT thread
+    std::atomic<unsigned>           m_ready;
+
+    SpscQueue<InputEvent, 256>      m_input_queue;
+    std::thread                     m_thread;
+    std::atomic<bool>               m_running;
+    std::atomic<unsigned long long> m_rendered_frames;
+
+    std::mutex                      m_error_mutex;
+    std::string                     m_error;
+};
+
+} // namespace sutil
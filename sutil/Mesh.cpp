@@ -31,6 +31,7 @@
 #include <optixu/optixu_math_stream_namespace.h>
 
 #include "Mesh.h" 
+#include "ChromeTrace.h"
 #include "rply-1.01/rply.h"
 #include "tinyobjloader/tiny_obj_loader.h"
 #include <algorithm>
@@ -332,6 +333,7 @@ MeshLoader::Impl::Impl( const std::string& filename )
 
 void MeshLoader::Impl::scanMesh( Mesh& mesh )
 {
+  sutil::TraceZone zone( "MeshLoader::scanMesh", m_filename );
   clearMesh( mesh );
 
   if( m_filetype == OBJ )
@@ -345,6 +347,7 @@ void MeshLoader::Impl::scanMesh( Mesh& mesh )
 
 void MeshLoader::Impl::loadMesh( Mesh& mesh, const float* load_xform )
 {
+  sutil::TraceZone zone( "MeshLoader::loadMesh", m_filename );
   if( !checkValid( mesh ) )
   {
     std::cerr << "MeshLoader - ERROR: Attempted to load mesh '" << m_filename
@@ -28,6 +28,7 @@
 
 #include <optixu/optixu_math_namespace.h>
 
+#include "ChromeTrace.h"
 #include "Mesh.h"
 #include "OptiXMesh.h"
 #include "sutil.h"
@@ -295,6 +296,8 @@ void loadMesh(
     const optix::Matrix4x4&     load_xform
     )
 {
+  sutil::TraceZone zone( "OptiXMesh::loadMesh", filename );
+
   if( !optix_mesh.context )
   {
     throw std::runtime_error( "OptiXMesh: loadMesh() requires valid OptiX context" );
@@ -27,6 +27,7 @@
  */
 
 #include <PPMLoader.h>
+#include <ChromeTrace.h>
 #include <optixu/optixu_math_namespace.h>
 #include <fstream>
 #include <iostream>
@@ -48,6 +49,7 @@ unsigned char PPMLoader::s_srgb2linear[256];
 PPMLoader::PPMLoader( const std::string& filename, const bool vflip )
   : m_nx( 0u ), m_ny( 0u ), m_max_val( 0u ), m_raster( 0 ), m_is_ascii(false)
 {
+  sutil::TraceZone zone( "PPMLoader", filename );
   if ( filename.empty() ) return;
   
   size_t pos;
@@ -320,6 +322,7 @@ optix::TextureSampler loadPPMTexture( optix::Context context,
                                       const std::string& filename,
                                       const optix::float3& default_color )
 {
+  sutil::TraceZone zone( "loadPPMTexture", filename );
   PPMLoader ppm( filename );
   return ppm.loadTexture(context, default_color );
 }
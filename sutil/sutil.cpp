@@ -39,6 +39,8 @@
 #endif
 
 #include <sutil/sutil.h>
+#include <sutil/ChromeTrace.h>
+#include <sutil/FrameProfiler.h>
 #include <sutil/HDRLoader.h>
 #include <sutil/PPMLoader.h>
 #include <sampleConfig.h>
@@ -47,6 +49,7 @@
 
 #include <nvrtc.h>
 
+#include <algorithm>
 #include <cmath>
 #include <cstring>
 #include <iostream>
@@ -164,73 +167,295 @@ void checkBuffer( RTbuffer buffer )
 }
 
 
-void displayBuffer()
+// Host images go through pixel unpack buffers with fences where the GL
+// supports them; see uploadHostImage.
+#if defined(__APPLE__)
+#    define SUTIL_ASYNC_UPLOAD 0
+#else
+#    define SUTIL_ASYNC_UPLOAD 1
+#endif
+
+
+// The texture every image is drawn from.  It is reallocated only when the
+// image size or format changes; otherwise frames are uploaded into it with
+// glTexSubImage2D, which also lets unchanged tiles keep their texels.
+struct DisplayTexture
 {
-    optix::Buffer buffer = Buffer::take( g_image_buffer );
+    GLuint   id;
+    unsigned width;
+    unsigned height;
+    GLint    internal_format;
+    RTbuffer source;            // Buffer of the last upload, 0 for host images
+};
+DisplayTexture g_display_texture = { 0, 0, 0, 0, 0 };
 
-    // Query buffer information
-    RTsize buffer_width_rts, buffer_height_rts;
-    buffer->getSize( buffer_width_rts, buffer_height_rts );
-    uint32_t width  = static_cast<int>(buffer_width_rts);
-    uint32_t height = static_cast<int>(buffer_height_rts);
-    RTformat buffer_format = buffer->getFormat();
 
+// Tiles that changed since the last frame, set by setDisplayDirtyTiles for
+// the next upload only.
+std::vector<unsigned char> g_dirty_tiles;
+unsigned g_dirty_tile_size = 0;
+unsigned g_dirty_tiles_x   = 0;
+unsigned g_dirty_tiles_y   = 0;
+
+
+struct UploadRect
+{
+    unsigned x;
+    unsigned y;
+    unsigned width;
+    unsigned height;
+};
+
+
+// Regions of a width x height image to upload.  The whole image, unless
+// dirty tiles were set for the buffer whose previous frame the texture
+// still holds; then one rectangle per horizontal run of dirty tiles.
+void collectUploadRects( unsigned width, unsigned height, bool texture_current, std::vector<UploadRect>& rects )
+{
+    rects.clear();
+    const bool use_tiles = texture_current && !g_dirty_tiles.empty() &&
+                           g_dirty_tiles_x * g_dirty_tile_size >= width &&
+                           g_dirty_tiles_y * g_dirty_tile_size >= height;
+    if( !use_tiles )
+    {
+        const UploadRect all = { 0, 0, width, height };
+        rects.push_back( all );
+        return;
+    }
+
+    for( unsigned ty = 0; ty < g_dirty_tiles_y; ++ty )
+    {
+        const unsigned char* row = &g_dirty_tiles[ty * g_dirty_tiles_x];
+        for( unsigned tx = 0; tx < g_dirty_tiles_x; )
+        {
+            if( !row[tx] )
+            {
+                ++tx;
+                continue;
+            }
+            const unsigned first = tx;
+            while( tx < g_dirty_tiles_x && row[tx] )
+                ++tx;
+
+            UploadRect rect;
+            rect.x = first * g_dirty_tile_size;
+            rect.y = ty * g_dirty_tile_size;
+            if( rect.x >= width || rect.y >= height )
+                continue;
+            rect.width  = std::min( tx * g_dirty_tile_size, width ) - rect.x;
+            rect.height = std::min( rect.y + g_dirty_tile_size, height ) - rect.y;
+            rects.push_back( rect );
+        }
+    }
+}
+
+
+// Uploads rects of a width-wide image into the bound texture.  data is a
+// host pointer, or an offset into the bound pixel unpack buffer.
+void uploadRects( const std::vector<UploadRect>& rects, unsigned width, RTsize elmt_size,
+                  GLenum pixel_format, GLenum pixel_type, const GLvoid* data )
+{
+    glPixelStorei( GL_UNPACK_ROW_LENGTH, width );
+    for( size_t i = 0; i < rects.size(); ++i )
+    {
+        const UploadRect& r = rects[i];
+        const size_t offset = ( static_cast<size_t>( r.y ) * width + r.x ) * elmt_size;
+        glTexSubImage2D( GL_TEXTURE_2D, 0, r.x, r.y, r.width, r.height, pixel_format, pixel_type,
+                         static_cast<const char*>( data ) + offset );
+    }
+    glPixelStorei( GL_UNPACK_ROW_LENGTH, 0 );
+}
+
+
+#if SUTIL_ASYNC_UPLOAD
+
+// Pixel unpack buffers cycled for host image uploads.  glTexSubImage2D from
+// a PBO returns before the transfer is done, so the upload of frame N
+// overlaps the launch of frame N+1.  Each PBO is fenced after its upload,
+// and the host waits on the fence before it writes that PBO again.
+const unsigned UPLOAD_PBO_COUNT = 2;
+
+struct UploadRing
+{
+    GLuint   pbo[UPLOAD_PBO_COUNT];
+    GLsync   fence[UPLOAD_PBO_COUNT];
+    size_t   size[UPLOAD_PBO_COUNT];
+    unsigned next;
+};
+UploadRing g_upload_ring = { { 0, 0 }, { 0, 0 }, { 0, 0 }, 0 };
+
+
+// Copies the rects of a host image into the next PBO and uploads them from
+// there.  Returns false if the GL lacks sync objects or the PBO could not
+// be mapped; nothing has been uploaded then.
+bool uploadHostImage( const std::vector<UploadRect>& rects, unsigned width, unsigned height,
+                      RTsize elmt_size, GLenum pixel_format, GLenum pixel_type, const GLvoid* image_data )
+{
+    if( !GLEW_ARB_sync || !GLEW_ARB_map_buffer_range || !GLEW_ARB_pixel_buffer_object )
+        return false;
+
+    UploadRing& ring = g_upload_ring;
+    const unsigned i = ring.next;
+    ring.next = ( ring.next + 1 ) % UPLOAD_PBO_COUNT;
+
+    if( ring.fence[i] )
+    {
+        while( glClientWaitSync( ring.fence[i], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000 ) == GL_TIMEOUT_EXPIRED )
+            ;
+        glDeleteSync( ring.fence[i] );
+        ring.fence[i] = 0;
+    }
+
+    if( !ring.pbo[i] )
+        glGenBuffers( 1, &ring.pbo[i] );
+    glBindBuffer( GL_PIXEL_UNPACK_BUFFER, ring.pbo[i] );
+
+    const size_t image_size = static_cast<size_t>( width ) * height * elmt_size;
+    if( ring.size[i] != image_size )
+    {
+        glBufferData( GL_PIXEL_UNPACK_BUFFER, image_size, 0, GL_STREAM_DRAW );
+        ring.size[i] = image_size;
+    }
+
+    // The fence wait above makes an unsynchronized map safe
+    char* dst = static_cast<char*>( glMapBufferRange( GL_PIXEL_UNPACK_BUFFER, 0, image_size,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT ) );
+    if( !dst )
+    {
+        glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+        return false;
+    }
+
+    // Only the rects are written; the rest of the PBO is never read.
+    const char* src = static_cast<const char*>( image_data );
+    const size_t row_size = width * elmt_size;
+    for( size_t r = 0; r < rects.size(); ++r )
+    {
+        const UploadRect& rect = rects[r];
+        const size_t rect_row_size = rect.width * elmt_size;
+        size_t offset = ( static_cast<size_t>( rect.y ) * width + rect.x ) * elmt_size;
+        if( rect_row_size == row_size )
+        {
+            memcpy( dst + offset, src + offset, row_size * rect.height );
+            continue;
+        }
+        for( unsigned y = 0; y < rect.height; ++y, offset += row_size )
+            memcpy( dst + offset, src + offset, rect_row_size );
+    }
+    glUnmapBuffer( GL_PIXEL_UNPACK_BUFFER );
+
+    uploadRects( rects, width, elmt_size, pixel_format, pixel_type, 0 );
+    ring.fence[i] = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+
+    glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+    return true;
+}
+
+#endif // SUTIL_ASYNC_UPLOAD
+
+
+// Draws a width x height image as a full-window quad.  The pixels come from
+// the bound PBO if pboId is nonzero, otherwise from image_data.  source is
+// the buffer the pixels belong to, or 0 for a host image; dirty tiles are
+// only applied to consecutive frames of the same buffer.
+void displayImage(
+        unsigned width, unsigned height, RTformat buffer_format, RTsize elmt_size,
+        unsigned pboId, const GLvoid* image_data,
+        bufferPixelFormat image_pixel_format, bool disable_srgb_conversion,
+        RTbuffer source = 0 )
+{
     GLboolean use_SRGB = GL_FALSE;
-    if( !g_disable_srgb_conversion && (buffer_format == RT_FORMAT_FLOAT4 || buffer_format == RT_FORMAT_FLOAT3) )
+    if( !disable_srgb_conversion && (buffer_format == RT_FORMAT_FLOAT4 || buffer_format == RT_FORMAT_FLOAT3) )
     {
         glGetBooleanv( GL_FRAMEBUFFER_SRGB_CAPABLE_EXT, &use_SRGB );
         if( use_SRGB )
             glEnable(GL_FRAMEBUFFER_SRGB_EXT);
     }
 
-    static unsigned int gl_tex_id = 0;
-    if( !gl_tex_id )
+    DisplayTexture& texture = g_display_texture;
+    if( !texture.id )
     {
-        glGenTextures( 1, &gl_tex_id );
-        glBindTexture( GL_TEXTURE_2D, gl_tex_id );
-
-        // Change these to GL_LINEAR for super- or sub-sampling
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glGenTextures( 1, &texture.id );
+        glBindTexture( GL_TEXTURE_2D, texture.id );
 
         // GL_CLAMP_TO_EDGE for linear filtering, not relevant for nearest.
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     }
 
-    glBindTexture( GL_TEXTURE_2D, gl_tex_id );
+    glBindTexture( GL_TEXTURE_2D, texture.id );
 
-    // send PBO or host-mapped image data to texture
-    const unsigned pboId = buffer->getGLBOId();
-    GLvoid* imageData = 0;
-    if( pboId )
-        glBindBuffer( GL_PIXEL_UNPACK_BUFFER, pboId );
-    else
-        imageData = buffer->map( 0, RT_BUFFER_MAP_READ );
+    // Nearest for a 1:1 mapping, linear when the image is scaled to the
+    // viewport, e.g. by a dynamic resolution launch.
+    GLint viewport[4];
+    glGetIntegerv( GL_VIEWPORT, viewport );
+    const GLint filter = ( viewport[2] == static_cast<GLint>( width ) && viewport[3] == static_cast<GLint>( height ) ) ?
+                         GL_NEAREST : GL_LINEAR;
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
 
-    RTsize elmt_size = buffer->getElementSize();
     if      ( elmt_size % 8 == 0) glPixelStorei(GL_UNPACK_ALIGNMENT, 8);
     else if ( elmt_size % 4 == 0) glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
     else if ( elmt_size % 2 == 0) glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
     else                          glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
-    GLenum pixel_format = glFormatFromBufferFormat(g_image_buffer_format, buffer_format);
+    GLenum pixel_format = glFormatFromBufferFormat(image_pixel_format, buffer_format);
 
+    GLint  internal_format;
+    GLenum pixel_type = GL_FLOAT;
     if( buffer_format == RT_FORMAT_UNSIGNED_BYTE4)
-        glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, pixel_format, GL_UNSIGNED_BYTE, imageData);
+    {
+        internal_format = GL_RGBA8;
+        pixel_type      = GL_UNSIGNED_BYTE;
+    }
     else if(buffer_format == RT_FORMAT_FLOAT4)
-        glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA32F_ARB, width, height, 0, pixel_format, GL_FLOAT, imageData );
+        internal_format = GL_RGBA32F_ARB;
     else if(buffer_format == RT_FORMAT_FLOAT3)
-        glTexImage2D( GL_TEXTURE_2D, 0, GL_RGB32F_ARB, width, height, 0, pixel_format, GL_FLOAT, imageData );
+        internal_format = GL_RGB32F_ARB;
     else if(buffer_format == RT_FORMAT_FLOAT)
-        glTexImage2D( GL_TEXTURE_2D, 0, GL_LUMINANCE32F_ARB, width, height, 0, pixel_format, GL_FLOAT, imageData );
+        internal_format = GL_LUMINANCE32F_ARB;
     else
         throw Exception( "Unknown buffer format" );
 
-    if( pboId )
-        glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
-    else
-        buffer->unmap();
+    {
+        // Host side only: uploads from a PBO may complete later
+        sutil::FrameTimer upload_timer( sutil::FRAME_STAGE_UPLOAD );
+
+        bool texture_current = texture.width == width && texture.height == height &&
+                               texture.internal_format == internal_format;
+        if( !texture_current )
+        {
+            glTexImage2D( GL_TEXTURE_2D, 0, internal_format, width, height, 0, pixel_format, pixel_type, 0 );
+            texture.width           = width;
+            texture.height          = height;
+            texture.internal_format = internal_format;
+        }
+        texture_current = texture_current && source && source == texture.source;
+        texture.source  = source;
+
+        std::vector<UploadRect> rects;
+        collectUploadRects( width, height, texture_current, rects );
+        g_dirty_tiles.clear();
+
+        if( pboId )
+        {
+            // send PBO to texture
+            glBindBuffer( GL_PIXEL_UNPACK_BUFFER, pboId );
+            uploadRects( rects, width, elmt_size, pixel_format, pixel_type, 0 );
+            glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+        }
+        else
+        {
+            bool uploaded = false;
+#if SUTIL_ASYNC_UPLOAD
+            uploaded = uploadHostImage( rects, width, height, elmt_size, pixel_format, pixel_type, image_data );
+#endif
+            if( !uploaded )
+                uploadRects( rects, width, elmt_size, pixel_format, pixel_type, image_data );
+        }
+    }
+
+    sutil::FrameTimer display_timer( sutil::FRAME_STAGE_DISPLAY );
 
     // 1:1 texel to pixel mapping with glOrtho(0, 1, 0, 1, -1, 1) setup:
     // The quad coordinates go from lower left corner of the lower left pixel
@@ -260,6 +485,39 @@ void displayBuffer()
 }
 
 
+void displayBuffer()
+{
+    optix::Buffer buffer = Buffer::take( g_image_buffer );
+
+    // Query buffer information
+    RTsize buffer_width_rts, buffer_height_rts;
+    buffer->getSize( buffer_width_rts, buffer_height_rts );
+    uint32_t width  = static_cast<int>(buffer_width_rts);
+    uint32_t height = static_cast<int>(buffer_height_rts);
+    RTformat buffer_format = buffer->getFormat();
+
+    const unsigned pboId = buffer->getGLBOId();
+    if( pboId )
+    {
+        displayImage( width, height, buffer_format, buffer->getElementSize(), pboId, 0,
+                      g_image_buffer_format, g_disable_srgb_conversion, g_image_buffer );
+        return;
+    }
+
+    GLvoid* imageData = 0;
+    {
+        sutil::FrameTimer timer( sutil::FRAME_STAGE_MAP );
+        imageData = buffer->map( 0, RT_BUFFER_MAP_READ );
+    }
+    displayImage( width, height, buffer_format, buffer->getElementSize(), 0, imageData,
+                  g_image_buffer_format, g_disable_srgb_conversion, g_image_buffer );
+    {
+        sutil::FrameTimer timer( sutil::FRAME_STAGE_MAP );
+        buffer->unmap();
+    }
+}
+
+
 void displayBufferSwap()
 {
     displayBuffer();
@@ -629,6 +887,26 @@ void sutil::displayBufferPPM( const char* filename, RTbuffer buffer, bool disabl
 }
 
 
+void sutil::displayBufferPPM( const char* filename, const optix::uchar4* pixels, unsigned width, unsigned height )
+{
+    std::vector<unsigned char> pix(width * height * 3);
+
+    // Data is BGRA and upside down, so we need to swizzle to RGB
+    for(int j = height-1; j >= 0; --j) {
+        unsigned char *dst = &pix[0] + (3*width*(height-1-j));
+        const unsigned char *src = reinterpret_cast<const unsigned char*>(pixels) + (4*width*j);
+        for(unsigned i = 0; i < width; i++) {
+            *dst++ = *(src + 2);
+            *dst++ = *(src + 1);
+            *dst++ = *(src + 0);
+            src += 4;
+        }
+    }
+
+    SavePPM(&pix[0], filename, width, height, 3);
+}
+
+
 void sutil::displayBufferGL( optix::Buffer buffer, bufferPixelFormat format, bool disable_srgb_conversion )
 {
     g_image_buffer = buffer->get();
@@ -638,6 +916,37 @@ void sutil::displayBufferGL( optix::Buffer buffer, bufferPixelFormat format, boo
 }
 
 
+void sutil::setDisplayDirtyTiles( const unsigned char* tile_mask, unsigned tile_size,
+                                  unsigned tiles_x, unsigned tiles_y )
+{
+    if( !tile_mask || tile_size == 0 )
+    {
+        g_dirty_tiles.clear();
+        return;
+    }
+    g_dirty_tiles.assign( tile_mask, tile_mask + tiles_x * tiles_y );
+    g_dirty_tile_size = tile_size;
+    g_dirty_tiles_x   = tiles_x;
+    g_dirty_tiles_y   = tiles_y;
+}
+
+
+void sutil::displayImageGL( const void* pixels, unsigned width, unsigned height, RTformat format,
+                            bufferPixelFormat pixel_format, bool disable_srgb_conversion )
+{
+    RTsize elmt_size = 0;
+    switch( format )
+    {
+        case RT_FORMAT_UNSIGNED_BYTE4: elmt_size = 4;  break;
+        case RT_FORMAT_FLOAT:          elmt_size = 4;  break;
+        case RT_FORMAT_FLOAT3:         elmt_size = 12; break;
+        case RT_FORMAT_FLOAT4:         elmt_size = 16; break;
+        default: throw Exception( "Attempting to display image with format not float, float3, float4, or uchar4" );
+    }
+    displayImage( width, height, format, elmt_size, 0, pixels, pixel_format, disable_srgb_conversion );
+}
+
+
 namespace
 {
 
@@ -692,6 +1001,41 @@ void sutil::displayFps( unsigned int frame_count )
 }
 
 
+void sutil::displayFrameStats( unsigned int frame_count )
+{
+    FrameProfiler& profiler = FrameProfiler::instance();
+    profiler.endFrame();
+    displayFps( frame_count );
+
+    if( profiler.frameCount() < 2 )
+        return;
+
+    // Breakdown from the top of the window down, leaving the bottom lines
+    // to the samples' own text
+    char text[128];
+    float y = static_cast<float>( glutGet( GLUT_WINDOW_HEIGHT ) ) - 20.0f;
+    for( int s = 0; s <= FRAME_STAGE_COUNT; ++s )
+    {
+        const FrameStage stage = static_cast<FrameStage>( s );
+        const double p99 = profiler.percentile( stage, 99.0 );
+        if( p99 <= 0.0 )
+            continue;
+        sprintf( text, "%-12s p50 %7.2f  p95 %7.2f  p99 %7.2f ms",
+                 FrameProfiler::stageName( stage ),
+                 profiler.percentile( stage, 50.0 ), profiler.percentile( stage, 95.0 ), p99 );
+        drawText( text, 10.0f, y, GLUT_BITMAP_8_BY_13 );
+        y -= 14.0f;
+    }
+}
+
+
+void sutil::swapBuffers()
+{
+    FrameTimer timer( FRAME_STAGE_SWAP );
+    glutSwapBuffers();
+}
+
+
 void sutil::displayText(const char* text, float x, float y)
 {
   drawText(text, x, y, GLUT_BITMAP_8_BY_13);
@@ -942,7 +1286,11 @@ static void getPtxFromCuString( std::string &ptx, const char* sample_name, const
         options.push_back( compiler_options[i] );
 
     // JIT compile CU to PTX
-    const nvrtcResult compileRes = nvrtcCompileProgram( prog, (int) options.size(), options.data() );
+    nvrtcResult compileRes;
+    {
+        sutil::TraceZone zone( "nvrtcCompileProgram", name );
+        compileRes = nvrtcCompileProgram( prog, (int) options.size(), options.data() );
+    }
 
     // Retrieve log output
     size_t log_size = 0;
@@ -1009,6 +1357,7 @@ const char* sutil::getPtxString(
 
     if( elem == g_ptxSourceCache.map.end() )
     {
+        sutil::TraceZone zone( "getPtxString", filename );
         ptx = new std::string();
 #if CUDA_NVRTC_ENABLED
         std::string location;
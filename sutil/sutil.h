@@ -146,16 +146,55 @@ void SUTILAPI displayBufferPPM(
         RTbuffer buffer,                      // Buffer to be displayed
         bool disable_srgb_conversion = true); // Enables/disables srgb conversion before the image is saved. Disabled by default.            
 
+// Write host BGRA pixels, stored bottom row first like an RT_FORMAT_UNSIGNED_BYTE4
+// output buffer, to a PPM image file.
+void SUTILAPI displayBufferPPM(
+        const char* filename,               // Image file to be created
+        const optix::uchar4* pixels,        // width*height pixels
+        unsigned width,                     // Image width
+        unsigned height );                  // Image height
+
 // Display contents of buffer, where the OpenGL/GLUT context is managed by caller.
 void SUTILAPI displayBufferGL(
         optix::Buffer buffer,       // Buffer to be displayed
         bufferPixelFormat format = BUFFER_PIXEL_FORMAT_DEFAULT, // The pixel format of the buffer or 0 to use the default for the pixel type
         bool disable_srgb_conversion = false);
 
+// Restrict the next displayBufferGL upload to the tiles that changed since
+// the previous frame of the same buffer, e.g. those an adaptive sampler
+// still launched.  The mask holds tiles_x*tiles_y bytes, row-major from
+// buffer row 0; nonzero marks a changed tile_size square.  The rest of the
+// texture keeps the previous frame.  The whole image is uploaded anyway if
+// the size, format or buffer changed.  Pass a null mask to clear it.
+void SUTILAPI setDisplayDirtyTiles(
+        const unsigned char* tile_mask,
+        unsigned tile_size,
+        unsigned tiles_x,
+        unsigned tiles_y );
+
+// Display a host image laid out like an output buffer of the given format,
+// where the OpenGL/GLUT context is managed by caller.
+void SUTILAPI displayImageGL(
+        const void* pixels,         // width*height elements of format
+        unsigned width,             // Image width
+        unsigned height,            // Image height
+        RTformat format,            // RT_FORMAT_UNSIGNED_BYTE4, FLOAT, FLOAT3 or FLOAT4
+        bufferPixelFormat pixel_format = BUFFER_PIXEL_FORMAT_DEFAULT,
+        bool disable_srgb_conversion = false);
+
 // Display frames per second, where the OpenGL/GLUT context
 // is managed by the caller.
 void SUTILAPI displayFps( unsigned total_frame_count );
 
+// Display frames per second plus p50/p95/p99 times of each frame stage
+// recorded by sutil::FrameProfiler (see FrameProfiler.h).  Closes the
+// profiler's current frame, so call it once per frame in place of
+// displayFps.
+void SUTILAPI displayFrameStats( unsigned total_frame_count );
+
+// glutSwapBuffers, timed as the swap stage of sutil::FrameProfiler.
+void SUTILAPI swapBuffers();
+
 // Display a short string starting at x,y.
 void SUTILAPI displayText(const char* text, float x, float y);
 